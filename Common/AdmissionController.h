@@ -0,0 +1,182 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <memory>
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <boost/asio/ip/address.hpp>
+
+#include "TokenBucket.h"
+
+#ifdef WIN32
+#include <windows.h>
+#include <psapi.h>
+#elif defined(__linux__)
+#include <unistd.h>
+#endif
+
+/// <summary>
+/// Limits of a listener, zero means no limit
+/// </summary>
+struct AdmissionLimits
+{
+	//sessions open at once
+	std::size_t maxSessions{ 0 };
+	//sessions open at once from one address
+	std::size_t maxSessionsPerAddress{ 0 };
+	//accepted connections per second and how many of them may come at once
+	std::size_t acceptsPerSecond{ 0 };
+	std::size_t acceptBurst{ 0 };
+	//resident memory of the process in bytes, accepting is paused above it
+	std::size_t memoryBudget{ 0 };
+};
+
+/// <summary>
+/// Decides whether a connection is accepted before anything is allocated for its session.
+/// A session holds a ticket, the place is given back when the session is destroyed,
+/// so the counters are right whichever thread destroys it.
+/// </summary>
+class AdmissionController
+{
+	struct State {
+		std::mutex m_mutex;
+		AdmissionLimits limits;
+		std::size_t active{ 0 };
+		std::map<boost::asio::ip::address, std::size_t> perAddress;
+		TokenBucket acceptRate;
+		std::size_t residentMemory{ 0 };
+		std::chrono::steady_clock::time_point lastMemorySample;
+	};
+
+public:
+	//how long accepting waits when the process is over its memory budget
+	constexpr static std::chrono::milliseconds MemoryPause = std::chrono::milliseconds(200);
+	//resident memory is sampled at most this often
+	constexpr static std::chrono::milliseconds MemorySampleInterval = std::chrono::milliseconds(100);
+
+	/// <summary>
+	/// Place of an admitted session, move-only
+	/// </summary>
+	class Ticket
+	{
+	public:
+		Ticket() = default;
+		Ticket(Ticket&& other) noexcept : state(std::move(other.state)), address(other.address) {}
+		Ticket& operator=(Ticket&& other) noexcept {
+			if (this != &other) {
+				release();
+				state = std::move(other.state);
+				address = other.address;
+			}
+			return *this;
+		}
+		Ticket(const Ticket&) = delete;
+		Ticket& operator=(const Ticket&) = delete;
+		~Ticket() { release(); }
+
+		explicit operator bool() const noexcept { return static_cast<bool>(state); }
+
+	private:
+		friend class AdmissionController;
+		Ticket(std::shared_ptr<State> _state, const boost::asio::ip::address& _address) : state(std::move(_state)), address(_address) {}
+
+		void release() noexcept {
+			if (!state) {
+				return;
+			}
+			{
+				std::lock_guard<std::mutex> lg{ state->m_mutex };
+				state->active--;
+				auto it = state->perAddress.find(address);
+				if (it != state->perAddress.end() && --it->second == 0) {
+					state->perAddress.erase(it);
+				}
+			}
+			//the last ticket of a destroyed server destroys the mutex along with the state, so it is unlocked first
+			state.reset();
+		}
+
+		std::shared_ptr<State> state;
+		boost::asio::ip::address address;
+	};
+
+	explicit AdmissionController(const AdmissionLimits& limits = {}) : state(std::make_shared<State>()) {
+		state->limits = limits;
+		state->acceptRate = TokenBucket(static_cast<double>(limits.acceptsPerSecond), static_cast<double>(limits.acceptBurst));
+	}
+
+	/// <summary>
+	/// Check whether the next connection may be accepted now, takes a token of the accept rate if it may
+	/// </summary>
+	/// <returns>Zero if accepting may go on, otherwise how long to wait before checking again</returns>
+	std::chrono::steady_clock::duration acceptDelay() {
+		auto now = std::chrono::steady_clock::now();
+		std::lock_guard<std::mutex> lg{ state->m_mutex };
+		const auto& limits = state->limits;
+		if (limits.memoryBudget) {
+			if (now - state->lastMemorySample >= MemorySampleInterval) {
+				state->residentMemory = residentMemory();
+				state->lastMemorySample = now;
+			}
+			if (state->residentMemory > limits.memoryBudget) {
+				return MemoryPause;
+			}
+		}
+		return state->acceptRate.take(1, now);
+	}
+
+	/// <summary>
+	/// Take a place for a session of an accepted connection
+	/// </summary>
+	/// <param name="address">Address of the peer</param>
+	/// <returns>Empty ticket if the connection is over a limit</returns>
+	Ticket admit(const boost::asio::ip::address& address) {
+		std::lock_guard<std::mutex> lg{ state->m_mutex };
+		const auto& limits = state->limits;
+		if (limits.maxSessions && state->active >= limits.maxSessions) {
+			return {};
+		}
+		auto& count = state->perAddress[address];
+		if (limits.maxSessionsPerAddress && count >= limits.maxSessionsPerAddress) {
+			if (count == 0) {
+				state->perAddress.erase(address);
+			}
+			return {};
+		}
+		count++;
+		state->active++;
+		return Ticket(state, address);
+	}
+
+	std::size_t activeSessions() const {
+		std::lock_guard<std::mutex> lg{ state->m_mutex };
+		return state->active;
+	}
+
+	/// <summary>
+	/// Resident memory of the process in bytes, zero if it is unknown on this platform
+	/// </summary>
+	static std::size_t residentMemory() {
+#ifdef WIN32
+		PROCESS_MEMORY_COUNTERS counters;
+		if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+			return counters.WorkingSetSize;
+		}
+		return 0;
+#elif defined(__linux__)
+		std::ifstream statm("/proc/self/statm");
+		std::size_t size = 0, resident = 0;
+		if (statm >> size >> resident) {
+			return resident * static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+		}
+		return 0;
+#else
+		return 0;
+#endif
+	}
+
+private:
+	std::shared_ptr<State> state;
+};
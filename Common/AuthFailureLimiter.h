@@ -0,0 +1,137 @@
+#pragma once
+
+#include <array>
+#include <mutex>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <string_view>
+#include <functional>
+#include <algorithm>
+#include <boost/asio/ip/address.hpp>
+
+/// <summary>
+/// Failed logons by consumer name from a client address and by client address in fixed memory.
+/// Failures are counted in count-min sketches: a key adds to one counter in each row and its estimate
+/// is the smallest of them, so collisions may only raise it. Counters leak at a constant rate.
+/// Once the estimate of the name from the address or of the whole address is over its allowance,
+/// logons are refused for a time doubling with every further failure. Failures from other addresses
+/// never lock a consumer out, an address behind NAT has a larger allowance than a single consumer.
+/// An IPv6 client is one /64 prefix, it cannot escape the limits by rotating its interface identifier.
+/// </summary>
+class AuthFailureLimiter
+{
+public:
+	constexpr static std::size_t Depth = 4;
+	constexpr static std::size_t Width = 4096;
+	//failures allowed before any backoff, and how fast they are forgotten
+	constexpr static double FreeFailures = 5;
+	constexpr static double FreeAddressFailures = 20;
+	constexpr static double ForgottenPerSecond = 1.0 / 60;
+	constexpr static std::chrono::milliseconds BaseBackoff = std::chrono::milliseconds(500);
+	constexpr static std::chrono::milliseconds MaxBackoff = std::chrono::milliseconds(60000);
+
+	/// <summary>
+	/// Limiter of the process
+	/// </summary>
+	static AuthFailureLimiter& Shared() {
+		static AuthFailureLimiter limiter;
+		return limiter;
+	}
+
+	/// <summary>
+	/// How long logons of a consumer from an address are refused
+	/// </summary>
+	/// <returns>Zero if a logon may be tried now</returns>
+	std::chrono::milliseconds backoff(std::string_view name, const boost::asio::ip::address& address) {
+		auto now = seconds();
+		auto addressHash = hashOf(address);
+		//the excess over the allowance decides the backoff
+		auto excess = std::max(namesFromAddresses.estimate(hashOf(name, addressHash), now) - FreeFailures,
+			addresses.estimate(addressHash, now) - FreeAddressFailures);
+		if (excess <= 0) {
+			return std::chrono::milliseconds::zero();
+		}
+		auto factor = std::exp2(std::min(excess - 1, 16.0));
+		auto delay = std::chrono::milliseconds(static_cast<std::chrono::milliseconds::rep>(BaseBackoff.count() * factor));
+		return std::min(delay, MaxBackoff);
+	}
+
+	void failure(std::string_view name, const boost::asio::ip::address& address) {
+		auto now = seconds();
+		auto addressHash = hashOf(address);
+		namesFromAddresses.add(hashOf(name, addressHash), now);
+		addresses.add(addressHash, now);
+	}
+
+private:
+	//a counter with the time of its last update, leaked when it is touched
+	struct Counter {
+		float value{ 0 };
+		float updated{ 0 };
+
+		double at(float now) const {
+			return std::max(0.0, static_cast<double>(value) - (now - updated) * ForgottenPerSecond);
+		}
+	};
+
+	class Sketch {
+	public:
+		double estimate(std::uint64_t hash, float now) {
+			double result = HUGE_VAL;
+			forEachCell(hash, [&result, now](Counter& counter) { result = std::min(result, counter.at(now)); });
+			return result;
+		}
+
+		void add(std::uint64_t hash, float now) {
+			forEachCell(hash, [now](Counter& counter) {
+				counter.value = static_cast<float>(counter.at(now) + 1);
+				counter.updated = now;
+			});
+		}
+
+	private:
+		//rows are indexed by h1 + i * h2, a cell is locked by its stripe only while it is touched
+		template<typename Func>
+		void forEachCell(std::uint64_t hash, Func func) {
+			auto h1 = static_cast<std::uint32_t>(hash);
+			auto h2 = static_cast<std::uint32_t>(hash >> 32) | 1;
+			for (std::size_t row = 0; row < Depth; row++) {
+				auto cell = row * Width + (h1 + row * h2) % Width;
+				std::lock_guard<std::mutex> lg{ stripes[cell % stripes.size()] };
+				func(cells[cell]);
+			}
+		}
+
+		std::array<Counter, Depth * Width> cells;
+		std::array<std::mutex, 64> stripes;
+	};
+
+	static std::uint64_t hashOf(std::string_view name) {
+		return static_cast<std::uint64_t>(std::hash<std::string_view>{}(name));
+	}
+
+	//a name is counted together with the address it is tried from
+	static std::uint64_t hashOf(std::string_view name, std::uint64_t addressHash) {
+		return hashOf(name) ^ (addressHash * 0x9E3779B97F4A7C15ull);
+	}
+
+	//IPv4-mapped addresses are IPv4 clients reaching a dual-stack listener
+	static std::uint64_t hashOf(const boost::asio::ip::address& address) {
+		if (address.is_v4() || address.to_v6().is_v4_mapped()) {
+			auto bytes = address.is_v4() ? address.to_v4().to_bytes() : address.to_v6().to_v4().to_bytes();
+			return hashOf(std::string_view(reinterpret_cast<const char*>(bytes.data()), bytes.size()));
+		}
+		auto bytes = address.to_v6().to_bytes();
+		return hashOf(std::string_view(reinterpret_cast<const char*>(bytes.data()), 8));
+	}
+
+	//seconds since the limiter was created, precise enough for leaking by the minute
+	float seconds() const {
+		return std::chrono::duration<float>(std::chrono::steady_clock::now() - created).count();
+	}
+
+	const std::chrono::steady_clock::time_point created{ std::chrono::steady_clock::now() };
+	Sketch namesFromAddresses;
+	Sketch addresses;
+};
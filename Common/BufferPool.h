@@ -0,0 +1,70 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cstddef>
+
+/// <summary>
+/// Blocks of one size shared by all sessions. A session takes a block only while it is sending
+/// a large response and gives it back right after, so idle sessions hold no large buffers.
+/// At most maxRetained blocks are kept for reuse, the rest are freed.
+/// </summary>
+class BufferPool
+{
+public:
+	struct Returner {
+		BufferPool* pool;
+		void operator()(char* block) const { pool->release(block); }
+	};
+	using Buffer = std::unique_ptr<char[], Returner>;
+
+	BufferPool(std::size_t _blockSize, std::size_t _maxRetained) : blockSize(_blockSize), maxRetained(_maxRetained) {}
+
+	~BufferPool() {
+		for (auto block : available) {
+			delete[] block;
+		}
+	}
+
+	//noncopyable
+	BufferPool(const BufferPool&) = delete;
+	BufferPool operator=(const BufferPool&) = delete;
+
+	Buffer acquire() {
+		{
+			std::lock_guard<std::mutex> lg{ m_mutex };
+			if (!available.empty()) {
+				auto block = available.back();
+				available.pop_back();
+				return Buffer(block, Returner{ this });
+			}
+		}
+		return Buffer(new char[blockSize], Returner{ this });
+	}
+
+	std::size_t getBlockSize() const { return blockSize; }
+
+	//blocks kept for reuse
+	std::size_t retained() const {
+		std::lock_guard<std::mutex> lg{ m_mutex };
+		return available.size();
+	}
+
+private:
+	void release(char* block) {
+		{
+			std::lock_guard<std::mutex> lg{ m_mutex };
+			if (available.size() < maxRetained) {
+				available.push_back(block);
+				return;
+			}
+		}
+		delete[] block;
+	}
+
+	const std::size_t blockSize;
+	const std::size_t maxRetained;
+	mutable std::mutex m_mutex;
+	std::vector<char*> available;
+};
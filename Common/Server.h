@@ -1,20 +1,46 @@
 #pragma once
 
 #include <memory>
+#include <vector>
+#include <functional>
 #include <boost/asio.hpp>
 #include <boost/asio/steady_timer.hpp>
+#include <boost/algorithm/string.hpp>
+
+#include "AdmissionController.h"
+#include "SessionExecutor.h"
 
 template<typename SessionType>
 class Server {
 	using ServerImpl = Server<SessionType>;
 public:
 	Server(boost::asio::io_context& context, boost::asio::ip::tcp::acceptor acceptor) : 
-		io_context(context), acceptor(std::move(acceptor))
+		io_context(context), acceptor(std::move(acceptor)), admission(limits), acceptStrand(boost::asio::make_strand(context)), pause(acceptStrand)
 	{
 	}
 
+	/// <summary>
+	/// Limits of servers built after the call
+	/// </summary>
+	static void SetAdmissionLimits(const AdmissionLimits& value) {
+		limits = value;
+	}
+
 	void serve() {
-		acceptor.async_accept([this](boost::system::error_code ec, boost::asio::ip::tcp::socket socket) {
+		//over the accept rate or the memory budget connections wait in the backlog
+		auto delay = admission.acceptDelay();
+		if (delay != std::chrono::steady_clock::duration::zero()) {
+			pause.expires_after(delay);
+			pause.async_wait([this](boost::system::error_code ec) {
+				if (!ec) {
+					serve();
+				}
+			});
+			return;
+		}
+		//every connection gets its own strand, so handlers of a session never run concurrently
+		//while the io_context is run by many threads
+		acceptor.async_accept(boost::asio::make_strand(io_context), boost::asio::bind_executor(acceptStrand, [this](boost::system::error_code ec, session_socket socket) {
 				if (ec && ec.value() == boost::asio::error::operation_aborted) {
 					//aborted
 					return;
@@ -23,21 +49,55 @@ public:
 				if (ec) {
 					return;
 				}
-				boost::asio::steady_timer timer(io_context, SessionType::Timeout);
-				auto session = SessionType::CreateSession(std::move(socket), std::move(timer));
-				session->read();
-				session->startTimer();
-			});
+				boost::system::error_code endpointError;
+				auto peer = socket.remote_endpoint(endpointError);
+				auto ticket = endpointError ? AdmissionController::Ticket() : admission.admit(peer.address());
+				if (!ticket) {
+					reject(std::move(socket));
+					return;
+				}
+				//each response is written whole, a response to a pipelined command must not wait for the ack of the previous one
+				boost::system::error_code ignored;
+				socket.set_option(boost::asio::ip::tcp::no_delay(true), ignored);
+				auto strand = socket.get_executor();
+				session_timer timer(strand, SessionType::Timeout);
+				auto session = SessionType::CreateSession(std::move(socket), std::move(timer), std::move(ticket));
+				//started on the strand, so no handler of the session runs before both operations are initiated
+				boost::asio::post(strand, [session]() {
+					session->read();
+					session->startTimer();
+				});
+			}));
 	}
 
 	void cancel() {
 		SessionType::cancelAll();
-		acceptor.cancel();
+		boost::asio::post(acceptStrand, [this]() {
+			acceptor.cancel();
+			pause.cancel();
+		});
 	}
 
 private:
+	//tell the client to come later and close, nothing of a session is created
+	static void reject(session_socket socket) {
+		auto rejected = std::make_shared<session_socket>(std::move(socket));
+		boost::asio::async_write(*rejected, boost::asio::buffer(SessionType::BusyResponse.data(), SessionType::BusyResponse.size()),
+			[rejected](boost::system::error_code, std::size_t) {
+				boost::system::error_code ignored;
+				rejected->shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored);
+			});
+	}
+
+	static inline AdmissionLimits limits;
+
 	boost::asio::io_context& io_context;
 	boost::asio::ip::tcp::acceptor acceptor;
+	AdmissionController admission;
+	//accepting and its pauses run here, so cancel does not race with them
+	boost::asio::strand<boost::asio::io_context::executor_type> acceptStrand;
+	//waits out the accept rate and the memory budget
+	boost::asio::steady_timer pause;
 };
 
 template<typename ServerType>
@@ -65,6 +125,20 @@ template<typename ServerType>
 class ConsoleServerController
 {
 public:
+	/// <summary>
+	/// Run one more server on the same io_context, it is started and stopped along with the main one.
+	/// Must be called before Run.
+	/// </summary>
+	template<typename AttachedServerType>
+	static void Attach(std::string_view addr, unsigned short portNumber) {
+		attached.push_back([addr = std::string(addr), portNumber](boost::asio::io_context& context) -> std::function<void()> {
+			ServerBuilder<AttachedServerType> builder(addr, portNumber);
+			auto server = std::make_shared<AttachedServerType>(builder.build(context));
+			server->serve();
+			return [server] { server->cancel(); };
+		});
+	}
+
 	static void Run(std::string_view addr = "127.0.0.1", unsigned short portNumber = 110, unsigned int thread_pool_size = 0) {
 		using namespace boost::asio;
 
@@ -83,6 +157,10 @@ public:
 			ServerBuilder<ServerType> builder(addr, portNumber);
 			auto server = builder.build(io_context);
 			server.serve();
+			std::vector<std::function<void()>> cancelAttached;
+			std::transform(attached.cbegin(), attached.cend(), std::back_inserter(cancelAttached), [&io_context](const auto& start) {
+				return start(io_context);
+			});
 
 			std::vector<std::future<void>> futures;
 			std::generate_n(std::back_inserter(futures), thread_pool_size, [&io_context]() {
@@ -96,6 +174,7 @@ public:
 					boost::algorithm::to_lower(command);
 					if (command == "quit") {
 						server.cancel();
+						std::for_each(cancelAttached.cbegin(), cancelAttached.cend(), [](const auto& cancel) { cancel(); });
 						break;
 					}
 				}
@@ -117,6 +196,9 @@ public:
 		}
 	}
 private:
+	//start attached servers and return functions cancelling them
+	static inline std::vector<std::function<std::function<void()>(boost::asio::io_context&)>> attached;
+
 	static bool verifyAddress(std::string_view addr) {
 		try {
 			boost::asio::ip::make_address(addr);
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <chrono>
+#include <utility>
+#include <boost/asio.hpp>
+
+//handlers of a connection run on its own strand (see Server)
+using session_executor = boost::asio::strand<boost::asio::io_context::executor_type>;
+
+//sockets and timers of sessions keep the strand by its type, any_io_executor would copy it to the heap
+//whenever one of their operations completes
+using session_socket = boost::asio::basic_stream_socket<boost::asio::ip::tcp, session_executor>;
+using session_timer = boost::asio::basic_waitable_timer<std::chrono::steady_clock, boost::asio::wait_traits<std::chrono::steady_clock>, session_executor>;
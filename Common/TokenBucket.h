@@ -0,0 +1,71 @@
+#pragma once
+
+#include <chrono>
+#include <algorithm>
+
+/// <summary>
+/// Rate limiter. Tokens come at a constant rate up to the burst. A charge may run into debt,
+/// which is paid off before the next take succeeds, so a charge may be larger than the burst.
+/// Not synchronized, the owner serializes calls.
+/// </summary>
+class TokenBucket
+{
+public:
+	using clock = std::chrono::steady_clock;
+
+	//a zero rate does not limit anything
+	TokenBucket(double _rate = 0, double _burst = 1) : rate(_rate), burst(std::max(_burst, 1.0)), tokens(burst), lastRefill(clock::now()) {}
+
+	/// <summary>
+	/// Take tokens if there is no debt
+	/// </summary>
+	/// <returns>Zero if the tokens are taken, otherwise how long to wait before trying again</returns>
+	clock::duration take(double count, clock::time_point now = clock::now()) {
+		if (rate <= 0) {
+			return clock::duration::zero();
+		}
+		refill(now);
+		if (tokens < 0) {
+			return debtDuration();
+		}
+		tokens -= count;
+		return clock::duration::zero();
+	}
+
+	/// <summary>
+	/// Take tokens for what has already been used, even if it runs into debt
+	/// </summary>
+	/// <returns>How long to wait until the debt is paid off, zero if there is none</returns>
+	clock::duration charge(double count, clock::time_point now = clock::now()) {
+		if (rate <= 0) {
+			return clock::duration::zero();
+		}
+		refill(now);
+		tokens -= count;
+		return tokens < 0 ? debtDuration() : clock::duration::zero();
+	}
+
+	bool limited() const { return rate > 0; }
+
+private:
+	void refill(clock::time_point now) {
+		//callers read the clock before they are serialized, an earlier time must not take tokens away
+		if (now <= lastRefill) {
+			return;
+		}
+		std::chrono::duration<double> elapsed = now - lastRefill;
+		lastRefill = now;
+		tokens = std::min(tokens + elapsed.count() * rate, burst);
+	}
+
+	clock::duration debtDuration() const {
+		std::chrono::duration<double> wait(-tokens / rate);
+		//rounded up, so the debt is paid off when the wait is over
+		return std::chrono::duration_cast<clock::duration>(wait) + std::chrono::milliseconds(1);
+	}
+
+	double rate;
+	double burst;
+	double tokens;
+	clock::time_point lastRefill;
+};
@@ -0,0 +1,62 @@
+
+#include "MessageIngest.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <variant>
+
+namespace {
+	void printUsage() {
+		std::cerr << "Usage: MailIngest <mailbox directory> [message file...]\n"
+			"Delivers messages in the wire form, a single message is read from standard input if no files are given\n";
+	}
+
+	bool deliver(const std::filesystem::path& mailbox, std::istream& stream, const std::string& source) {
+		std::ostringstream content;
+		content << stream.rdbuf();
+		if (stream.bad()) {
+			std::cerr << source << ": failed to read the message\n";
+			return false;
+		}
+		auto result = MessageIngest::Deliver(mailbox, content.str());
+		if (std::holds_alternative<MailboxOperationError>(result)) {
+			std::cerr << source << ": failed to deliver the message\n";
+			return false;
+		}
+		std::cout << std::get<std::filesystem::path>(result).string() << "\n";
+		return true;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2) {
+		printUsage();
+		return 2;
+	}
+	std::filesystem::path mailbox = argv[1];
+	if (!std::filesystem::is_directory(mailbox)) {
+		std::cerr << mailbox.string() << ": no such mailbox directory\n";
+		return 1;
+	}
+
+	if (argc == 2) {
+		return deliver(mailbox, std::cin, "stdin") ? 0 : 1;
+	}
+
+	int failed = 0;
+	for (int i = 2; i < argc; i++) {
+		std::ifstream stream{ argv[i], std::ios_base::in | std::ios_base::binary };
+		if (!stream.is_open()) {
+			std::cerr << argv[i] << ": failed to open the message\n";
+			failed++;
+			continue;
+		}
+		if (!deliver(mailbox, stream, argv[i])) {
+			failed++;
+		}
+	}
+	return failed == 0 ? 0 : 1;
+}
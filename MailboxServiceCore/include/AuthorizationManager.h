@@ -1,26 +1,80 @@
 #pragma once
 
 #include "ConsumerInfo.h"
+#include "PasswordVerifier.h"
 #include <variant>
+#include <memory>
+#include <optional>
 
 class AuthorizationManager
 {
 public:
+	virtual ~AuthorizationManager() = default;
+
 	virtual bool verifyName(std::string_view name) const = 0;
 	
 	std::variant<AuthError, std::vector<MailStorageInfo>> logon(std::string_view name, std::string_view password) {
+		if (auto err = authenticate(name, password)) {
+			return *err;
+		}
+		return getMailStoragesAssociatedWithConsumer(name);
+	}
+
+	/// <summary>
+	/// Check a consumer and its password, may take as long as the password verifier does
+	/// </summary>
+	/// <returns>Nothing if the consumer may log on</returns>
+	std::optional<AuthError> authenticate(std::string_view name, std::string_view password) const {
 		if (!verifyName(name)) {
 			return AuthError::NoSuchConsumer;
 		}
 		if (!verifyCredentials(name, password)) {
 			return AuthError::InvalidPassword;
 		}
+		return std::nullopt;
+	}
+
+	/// <summary>
+	/// Verifier of credentials kept as strings, must be set before logons start
+	/// </summary>
+	void setPasswordVerifier(std::shared_ptr<const PasswordVerifier> _verifier) { verifier = std::move(_verifier); }
+
+	/// <summary>
+	/// How long a successful verification is remembered, zero verifies every logon
+	/// </summary>
+	void setVerificationCacheTtl(std::chrono::seconds ttl) { verified.setTtl(ttl); }
+
+	/// <summary>
+	/// Get storages of a consumer without checking the password, used for delivery
+	/// </summary>
+	std::vector<MailStorageInfo> storagesOf(std::string_view name) const {
+		if (!verifyName(name)) {
+			return std::vector<MailStorageInfo>();
+		}
 		return getMailStoragesAssociatedWithConsumer(name);
 	}
 
 protected:
 	virtual std::vector<MailStorageInfo> getMailStoragesAssociatedWithConsumer(std::string_view name) const = 0;
 	virtual bool verifyCredentials(std::string_view name, std::string_view password) const = 0;
+
+	/// <summary>
+	/// Check a password against a credential kept as a string, through the cache and the verifier
+	/// </summary>
+	bool checkPassword(std::string_view name, std::string_view password, std::string_view credential) const {
+		if (verified.contains(name, password, credential)) {
+			return true;
+		}
+		if (!verifier->verify(password, credential)) {
+			return false;
+		}
+		verified.insert(name, password, credential);
+		return true;
+	}
+
+private:
+	std::shared_ptr<const PasswordVerifier> verifier{ std::make_shared<PlainPasswordVerifier>() };
+	mutable VerificationCache verified;
 };
 
 /// <summary>
@@ -81,8 +135,7 @@ private:
 				return settings && settings->password == passConv(password);
 			}
 			else {
-				constexpr static auto passConv = compact_string::compact_string_converter<ConsumerInfoType::_PasswordType::const_size>>();
-				return settings && settings->password == passConv(password);
+				return settings && checkPassword(name, password, settings->password.c_str());
 			}
 		}
 		else {
@@ -93,8 +146,7 @@ private:
 				return settings && settings->password == passConv(password);
 			}
 			else {
-				constexpr static auto passConv = compact_string::compact_string_converter<ConsumerInfoType::_PasswordType::const_size >> ();
-				return settings && settings->password == passConv(password);
+				return settings && checkPassword(name, password, settings->password.c_str());
 			}
 		}
 	}
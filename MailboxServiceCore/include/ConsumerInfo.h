@@ -28,7 +28,10 @@ inline int constexpr length(const char* str) {
 
 inline constexpr static std::size_t getMaximumOptionName() {
 	constexpr const char* options[] = {
-		"path" //for FileSystemMailStorage
+		"path", //for FileSystemMailStorage and PackedMailStorage
+		"compaction", //for PackedMailStorage
+		"compression", //for PackedMailStorage
+		"blobs" //for DeduplicatedMailStorage
 	};
 	std::size_t maximum = 0;
 	for (int i = 0; i < sizeof(options) / sizeof(char*); i++) {
@@ -51,7 +54,7 @@ struct Option {
 	Option(std::string_view name, T value) : name(name), value(value) {}
 };
 
-#define MAX_OPTIONS_COUNT 2
+#define MAX_OPTIONS_COUNT 3
 
 struct MailStorageInfo 
 {
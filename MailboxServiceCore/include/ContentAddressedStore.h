@@ -0,0 +1,59 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <variant>
+#include <optional>
+
+#include "Enums.h"
+
+/// <summary>
+/// Keeps every distinct message body once under a name derived from its content (SHA-256 where OpenSSL is available).
+/// Mailboxes refer to a body by hard links, so identical messages delivered to many
+/// mailboxes share one inode: disk space and page cache are paid once.
+/// A body is garbage when the store's own link is the only one left.
+/// </summary>
+class ContentAddressedStore
+{
+public:
+	explicit ContentAddressedStore(std::filesystem::path _root) : root(std::move(_root)) {}
+
+	/// <summary>
+	/// Store the message once and link it into every mailbox
+	/// </summary>
+	/// <param name="message">Content of the message</param>
+	/// <param name="mailboxes">Directories of the recipients' mailboxes</param>
+	/// <returns>Path of the message or error for every mailbox, in the same order</returns>
+	std::vector<std::variant<std::filesystem::path, MailboxOperationError>> deliver(std::string_view message,
+		const std::vector<std::filesystem::path>& mailboxes) const;
+
+	/// <summary>
+	/// Remove bodies of the given mailbox files if they are not referenced anymore
+	/// </summary>
+	/// <param name="removed">Files already removed from mailboxes</param>
+	/// <returns>Number of removed bodies</returns>
+	std::size_t collect(const std::vector<std::filesystem::path>& removed) const;
+
+	/// <summary>
+	/// Remove all bodies which are not referenced by any mailbox
+	/// </summary>
+	/// <returns>Number of removed bodies</returns>
+	std::size_t collectGarbage() const;
+
+	inline const std::filesystem::path& getRoot() const { return root; }
+
+	/// <summary>
+	/// Default location of the store for a mailbox directory
+	/// </summary>
+	static std::filesystem::path DefaultRoot(const std::filesystem::path& mailboxDirectory);
+
+private:
+	std::filesystem::path blobPath(std::string_view blobName) const;
+	std::optional<std::string> storeBlob(std::string_view message) const;
+	static std::optional<std::string> blobNameOf(const std::filesystem::path& mailboxFile);
+	static bool removeIfUnreferenced(const std::filesystem::path& blob);
+
+	std::filesystem::path root;
+};
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <string_view>
+
+/// <summary>
+/// Helpers for files which must survive a crash once the server has acknowledged them
+/// </summary>
+class DurableFile
+{
+public:
+	DurableFile() = delete;
+
+	/// <summary>
+	/// Flush the file's data to the disk
+	/// </summary>
+	/// <param name="handle">Descriptor of the file</param>
+	static bool Sync(int handle);
+
+	/// <summary>
+	/// Flush the stream and the file's data to the disk
+	/// </summary>
+	static bool Flush(std::FILE* file);
+
+	/// <summary>
+	/// Create or replace the file with the content and flush it to the disk. The caller renames it into place
+	/// and syncs the directory.
+	/// </summary>
+	static bool Write(const std::filesystem::path& path, std::string_view content);
+
+	/// <summary>
+	/// Make renames, links and removals in the directory durable.
+	/// Does nothing where directories cannot be synced (Windows journals them itself).
+	/// </summary>
+	static bool SyncDirectory(const std::filesystem::path& directory);
+
+	/// <summary>
+	/// Name which no other file written by this or another process on the host gets (time, process id and a counter)
+	/// </summary>
+	static std::string UniqueName();
+};
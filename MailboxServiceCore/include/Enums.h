@@ -1,15 +1,22 @@
 #pragma once
 
 #include <iostream>
+#include <string_view>
 
 enum class StorageType
 {
 	Undefined,
-	FileSystemMailStorage
+	FileSystemMailStorage,
+	PackedMailStorage,
+	//FileSystemMailStorage whose messages are hard links to a ContentAddressedStore
+	DeduplicatedMailStorage,
+	//Maildir (new/cur/tmp) shared with other MDAs and tools
+	MaildirMailStorage
 };
 
 inline bool checkIfStorageTypeValid(StorageType value) {
-	return value == StorageType::FileSystemMailStorage;
+	return value == StorageType::FileSystemMailStorage || value == StorageType::PackedMailStorage ||
+		value == StorageType::DeduplicatedMailStorage || value == StorageType::MaildirMailStorage;
 }
 
 enum class AuthError
@@ -19,24 +26,25 @@ enum class AuthError
 	ConsumerHasNoAssociatedMailStorage
 };
 
-inline std::ostream& operator<<(std::ostream& out, const AuthError& err) {
-	std::string message;
+/// <summary>
+/// Text of the error sent to the client
+/// </summary>
+inline std::string_view errorMessage(AuthError err) {
 	switch (err)
 	{
 	case AuthError::NoSuchConsumer:
-		message = "sorry, no mailbox for such user here";
-		break;
+		return "sorry, no mailbox for such user here";
 	case AuthError::InvalidPassword:
-		message = "invalid password";
-		break;
+		return "invalid password";
 	case AuthError::ConsumerHasNoAssociatedMailStorage:
-		message = "login and password are corrent, however default mail storage is not set for this user";
-		break;
+		return "login and password are corrent, however default mail storage is not set for this user";
 	default:
-		message = "";
-		break;
+		return "";
 	}
-	out << message;
+}
+
+inline std::ostream& operator<<(std::ostream& out, const AuthError& err) {
+	out << errorMessage(err);
 	return out;
 }
 
@@ -50,5 +58,7 @@ enum class MailboxOperationError {
 	UserStoragesInstantinationFailure,
 	EmailAlreadyDeleted,
 	MailIsMarkedAsDeleted,
+	//the previous logon was too recent (see LoginThrottle)
+	LoginDelayed,
 	InternalError
 };
@@ -2,6 +2,8 @@
 
 #include "MailStorage.h"
 #include "ConsumerInfo.h"
+#include "StorageIOEngine.h"
+#include "ContentAddressedStore.h"
 
 
 #include <filesystem>
@@ -10,14 +12,20 @@
 #include <array>
 #include <map>
 #include <variant>
+#include <optional>
+#include <cassert>
 
 
 
 class FileSystemMailStorage : public MailStorage
 {
 public:
-	FileSystemMailStorage(std::vector<std::filesystem::path> _emails) : MailStorage(), emails(std::move(_emails))
+	FileSystemMailStorage(std::filesystem::path _directory, std::vector<std::filesystem::path> _emails, std::vector<FileAttributes> _attributes,
+		std::vector<std::size_t> _wireSizes, io_engine_ptr engine, std::optional<ContentAddressedStore> _blobStore = std::nullopt) : 
+		MailStorage(), directory(std::move(_directory)), emails(std::move(_emails)), attributes(std::move(_attributes)), wireSizes(std::move(_wireSizes)),
+		ioEngine(std::move(engine)), blobStore(std::move(_blobStore))
 	{
+		assert(emails.size() == attributes.size() && emails.size() == wireSizes.size());
 	}
 
 	std::size_t getEmailsCount() const override {
@@ -31,10 +39,10 @@ public:
 	/// Get lengths of all emails in the mailbox
 	/// </summary>
 	/// <returns></returns>
-	std::map<std::size_t, std::size_t> getEmailsLengths(std::size_t mailNumberOffset = 0) const override;
+	email_lengths getEmailsLengths(std::size_t mailNumberOffset = 0, std::pmr::memory_resource* resource = std::pmr::get_default_resource()) const override;
 
 	/// <summary>
-	/// Get the length of a particular email in the mailbox
+	/// Get the length of a particular email in the mailbox as it is sent by RETR
 	/// </summary>
 	/// <param name="emailNumber">Number of the email</param>
 	/// <returns></returns>
@@ -47,14 +55,33 @@ public:
 	/// <returns></returns>
 	std::variant<std::string, MailboxOperationError> getEmail(std::size_t emailNumber) const override;
 
+	/// <summary>
+	/// Get a reader of a particular email. Small emails are taken from and put to the shared MessageCache,
+	/// large ones are read from the file by chunks. When emails are retrieved in order, the following files
+	/// are read ahead in background.
+	/// </summary>
+	/// <param name="emailNumber">Number of the email</param>
+	/// <returns></returns>
+	std::variant<message_reader_ptr, MailboxOperationError> openEmail(std::size_t emailNumber) const override;
+
 	///
-	/// Destructor
+	/// Destructor, hands messages deleted in UPDATE state over to MailboxExpunger
 	/// 
 	~FileSystemMailStorage() override;
 
 private:
 	static auto read_file(std::ifstream& stream, std::size_t len = 0)->std::string;
+	const std::filesystem::path directory;
 	const std::vector<std::filesystem::path> emails;
+	//attributes are obtained by a single batch when the storage is created
+	const std::vector<FileAttributes> attributes;
+	//sizes of the emails in the wire form, taken from MailboxIndex
+	const std::vector<std::size_t> wireSizes;
+	io_engine_ptr ioEngine;
+	//set for deduplicated storages, bodies of expunged messages are collected from there
+	std::optional<ContentAddressedStore> blobStore;
+	//a storage belongs to one session, so the pattern of its RETR commands is seen here
+	mutable ReadAheadWindow readAhead;
 };
 
 class FileSystemStorageFactory 
@@ -74,9 +101,24 @@ public:
 		}*/
 	}
 
+	struct Settings {
+		std::filesystem::path path;
+		//set for deduplicated storages only
+		std::filesystem::path blobs;
+	};
+
+	/// <summary>
+	/// Get location of a mailbox from its description ("path", "blobs" options)
+	/// </summary>
+	static Settings resolve(const MailStorageInfo& info, std::string_view name);
+
 	static std::shared_ptr<FileSystemMailStorage> create(const MailStorageInfo& info, [[maybe_unused]] std::string_view name);
 	static inline void setDefaultPath(std::filesystem::path p) { defaultPath = p; }
+	static inline const std::filesystem::path& getDefaultPath() { return defaultPath; }
+	static inline io_engine_ptr getIOEngine() { return ioEngine; }
+	static inline void setIOEngine(io_engine_ptr engine) { ioEngine = std::move(engine); }
 private:
 	static std::filesystem::path defaultPath;
+	static io_engine_ptr ioEngine;
 };
 
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <array>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+
+/// <summary>
+/// Times of the last logons of consumers, enforces the minimum delay between logons (RFC 2449 LOGIN-DELAY).
+/// Names are spread over shards with their own locks, so logons of different consumers rarely contend.
+/// An entry is a hash of the name and a time in seconds, entries older than the delay are swept out.
+/// </summary>
+class LoginThrottle
+{
+public:
+	constexpr static std::size_t Shards = 64;
+	//a shard is swept when it grows over this size, and then when it doubles what is left
+	constexpr static std::size_t SweepSize = 1024;
+
+	explicit LoginThrottle(std::chrono::seconds delay = std::chrono::seconds::zero()) : delaySeconds(delay.count()) {}
+
+	//zero lets consumers log on at any time
+	void setDelay(std::chrono::seconds delay) { delaySeconds = delay.count(); }
+	std::chrono::seconds getDelay() const { return std::chrono::seconds(delaySeconds.load()); }
+
+	/// <summary>
+	/// Check whether the delay since the last logon of a consumer has passed
+	/// </summary>
+	bool allowed(std::string_view name) const;
+
+	/// <summary>
+	/// Remember a successful logon
+	/// </summary>
+	void record(std::string_view name);
+
+private:
+	struct Shard {
+		mutable std::mutex m_mutex;
+		std::unordered_map<std::uint64_t, std::uint32_t> lastLogons;
+		std::size_t sweepAt{ SweepSize };
+	};
+
+	static std::uint32_t now();
+	const Shard& shardOf(std::uint64_t key) const { return shards[key % Shards]; }
+	Shard& shardOf(std::uint64_t key) { return shards[key % Shards]; }
+
+	std::atomic<std::chrono::seconds::rep> delaySeconds;
+	std::array<Shard, Shards> shards;
+};
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Enums.h"
+
+/// <summary>
+/// Delivers a message to local recipients. A recipient gets the message into the first of its storages.
+/// The body is stored once for all recipients with mailboxes of the same kind: plain mailboxes share
+/// one wire form file by hard links, deduplicated ones share one blob, packed mailboxes and maildirs get their own copy.
+/// </summary>
+class MailDelivery
+{
+public:
+	MailDelivery() = delete;
+
+	/// <summary>
+	/// Deliver a message
+	/// </summary>
+	/// <param name="message">Message as it was received</param>
+	/// <param name="recipients">Names of the recipients' mailboxes</param>
+	/// <returns>Result for every recipient in the same order</returns>
+	static std::vector<MailboxOperationError> Deliver(std::string_view message, const std::vector<std::string>& recipients);
+
+	/// <summary>
+	/// Check whether there is a mailbox which can receive messages
+	/// </summary>
+	static bool CanDeliver(std::string_view recipient);
+};
@@ -4,9 +4,142 @@
 #include <vector>
 #include <memory>
 #include <map>
+#include <memory_resource>
 #include <variant>
+#include <algorithm>
+#include <optional>
+#include <utility>
+#include <cstdint>
 #include <Enums.h>
 
+/// <summary>
+/// Immutable content of an email which can be shared between sessions
+/// </summary>
+using message_buffer = std::shared_ptr<const std::string>;
+
+/// <summary>
+/// Lengths of emails by their numbers, allocated by the caller's resource
+/// </summary>
+using email_lengths = std::pmr::map<std::size_t, std::size_t>;
+
+/// <summary>
+/// Sequential reader of an email's content, allows sending a message without loading it as a whole
+/// </summary>
+class MessageReader
+{
+public:
+	/// <summary>
+	/// Part of an open file holding the email in the wire form
+	/// </summary>
+	struct WireFile {
+		int handle;
+		std::uint64_t offset;
+		std::uint64_t length;
+	};
+
+	/// <summary>
+	/// Read the next part of the email
+	/// </summary>
+	/// <param name="buffer">Destination</param>
+	/// <param name="size">Capacity of destination</param>
+	/// <returns>Number of octets read, 0 when the email is over</returns>
+	virtual std::variant<std::size_t, MailboxOperationError> read(char* buffer, std::size_t size) = 0;
+
+	/// <summary>
+	/// Whole email if it is already in memory, so it can be sent without copying
+	/// </summary>
+	/// <returns>Buffer or nullptr</returns>
+	virtual message_buffer contiguous() const { return nullptr; }
+
+	/// <summary>
+	/// File holding the email already dot-stuffed and CRLF-normalized, so it can be sent by sendfile.
+	/// read() of such reader returns the wire form as well.
+	/// </summary>
+	/// <returns>File region or empty value</returns>
+	virtual std::optional<WireFile> wireFile() const { return std::nullopt; }
+
+	virtual ~MessageReader() {}
+};
+
+using message_reader_ptr = std::unique_ptr<MessageReader>;
+
+/// <summary>
+/// Reader over an email which is already in memory
+/// </summary>
+class StringMessageReader : public MessageReader
+{
+public:
+	explicit StringMessageReader(std::string _content) : content(std::move(_content)) {}
+
+	std::variant<std::size_t, MailboxOperationError> read(char* buffer, std::size_t size) override {
+		auto count = content.copy(buffer, size, position);
+		position += count;
+		return count;
+	}
+
+private:
+	std::string content;
+	std::size_t position{ 0 };
+};
+
+/// <summary>
+/// Reader over a shared email buffer
+/// </summary>
+class BufferMessageReader : public MessageReader
+{
+public:
+	explicit BufferMessageReader(message_buffer _buffer) : buffer(std::move(_buffer)) {}
+
+	std::variant<std::size_t, MailboxOperationError> read(char* dest, std::size_t size) override {
+		auto count = buffer->copy(dest, size, position);
+		position += count;
+		return count;
+	}
+
+	message_buffer contiguous() const override { return buffer; }
+
+private:
+	message_buffer buffer;
+	std::size_t position{ 0 };
+};
+
+/// <summary>
+/// Detects retrieval of consecutive emails (RETR 1..N after LIST) and tells which of the following emails
+/// should be read ahead while the current one is sent. Every email is requested once.
+/// </summary>
+class ReadAheadWindow
+{
+public:
+	//number of emails read ahead of the one being retrieved
+	constexpr static std::size_t Depth = 4;
+
+	/// <summary>
+	/// Register retrieval of an email
+	/// </summary>
+	/// <param name="emailNumber">Number of the email</param>
+	/// <param name="emailsCount">Number of emails in the storage</param>
+	/// <returns>Range [first, last) of emails to read ahead, empty if access is not sequential</returns>
+	std::pair<std::size_t, std::size_t> access(std::size_t emailNumber, std::size_t emailsCount) {
+		bool sequential = previous && *previous + 1 == emailNumber;
+		previous = emailNumber;
+		if (!sequential) {
+			return { 0, 0 };
+		}
+		auto first = std::max(emailNumber + 1, requested);
+		auto last = std::min(emailNumber + 1 + Depth, emailsCount);
+		if (first >= last) {
+			return { 0, 0 };
+		}
+		requested = last;
+		return { first, last };
+	}
+
+private:
+	std::optional<std::size_t> previous;
+	//emails below this number have already been requested
+	std::size_t requested{ 0 };
+};
+
 class MailStorage
 {
 public:
@@ -20,7 +153,7 @@ public:
 	/// Getting the lengths of all emails contained in the storage
 	/// </summary>
 	/// <returns></returns>
-	virtual std::map<std::size_t, std::size_t> getEmailsLengths(std::size_t mailNumberOffset = 0) const = 0;
+	virtual email_lengths getEmailsLengths(std::size_t mailNumberOffset = 0, std::pmr::memory_resource* resource = std::pmr::get_default_resource()) const = 0;
 
 	/// <summary>
 	/// Get the length of a particular email in the mailbox
@@ -36,6 +169,19 @@ public:
 	/// <returns></returns>
 	virtual std::variant<std::string, MailboxOperationError> getEmail(std::size_t emailNumber) const = 0;
 
+	/// <summary>
+	/// Get a reader of a particular email. The reader must not outlive the storage.
+	/// </summary>
+	/// <param name="emailNumber">Number of the email</param>
+	/// <returns></returns>
+	virtual std::variant<message_reader_ptr, MailboxOperationError> openEmail(std::size_t emailNumber) const {
+		auto result = getEmail(emailNumber);
+		if (std::holds_alternative<MailboxOperationError>(result)) {
+			return std::get<MailboxOperationError>(result);
+		}
+		return message_reader_ptr(new StringMessageReader(std::move(std::get<std::string>(result))));
+	}
+
 	/// <summary>
 	/// Mark mail as deleted
 	/// </summary>
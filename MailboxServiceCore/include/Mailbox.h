@@ -16,7 +16,7 @@ class Mailbox
 {
 public:
 	Mailbox(std::string_view mailboxName, std::vector<storage_ptr> storages, MailboxLock _lock) :
-		name(mailboxName), storages(std::move(storages)), lock(std::move(_lock))
+		lock(std::move(_lock)), name(mailboxName), storages(std::move(storages))
 	{
 		//nothing
 	}
@@ -36,14 +36,15 @@ public:
 	/// <summary>
 	/// Get lengths of all emails in the mailbox
 	/// </summary>
+	/// <param name="resource">Resource the result and temporary maps are allocated from</param>
 	/// <returns></returns>
-	std::map<std::size_t, std::size_t> getEmailsLengths() const;
+	email_lengths getEmailsLengths(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) const;
 
 	/// <summary>
 	/// Get size of all mails
 	/// </summary>
 	/// <returns></returns>
-	std::size_t getWholeMailboxSize() const;
+	std::size_t getWholeMailboxSize(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) const;
 
 	/// <summary>
 	/// Get the length of a particular email in the mailbox
@@ -59,6 +60,13 @@ public:
 	/// <returns></returns>
 	std::variant<std::string, MailboxOperationError> getEmail(std::size_t emailNumber) const;
 
+	/// <summary>
+	/// Get a reader of a particular email, the reader must not outlive the mailbox
+	/// </summary>
+	/// <param name="emailNumber">Number of the email</param>
+	/// <returns></returns>
+	std::variant<message_reader_ptr, MailboxOperationError> openEmail(std::size_t emailNumber) const;
+
 	/// <summary>
 	/// Mark a particular email as deleted
 	/// </summary>
@@ -90,9 +98,10 @@ public:
 
 private:
 	std::vector<storage_ptr>::const_iterator findStorage(std::size_t& emailNumber) const;
+	//declared first to be released last, storages finish UPDATE state while mailbox is still locked
+	MailboxLock lock;
 	std::string name;
 	std::vector<storage_ptr> storages;
-	MailboxLock lock;
 };
 
 typedef std::unique_ptr<Mailbox> mailbox_ptr;
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <filesystem>
+#include <vector>
+#include <set>
+#include <map>
+#include <mutex>
+#include <functional>
+
+#include "StorageIOEngine.h"
+
+/// <summary>
+/// Removes messages deleted during UPDATE state in background.
+/// Before anything is removed, names of the files are written to a journal inside the mailbox's
+/// metadata directory, so removal interrupted by a crash is finished by the next process.
+/// </summary>
+class MailboxExpunger
+{
+public:
+	MailboxExpunger() = delete;
+
+	/// <summary>
+	/// Name of the directory inside a mailbox which keeps server's metadata
+	/// </summary>
+	constexpr static const char* MetadataDirectory = ".pop3";
+
+	using RemovedCallback = std::function<void(const std::vector<std::filesystem::path>&)>;
+
+	/// <summary>
+	/// Durably write a journal for the files and schedule their removal
+	/// </summary>
+	/// <param name="mailboxDirectory">Directory of the mailbox</param>
+	/// <param name="files">Files to be removed</param>
+	/// <param name="engine">Engine used to remove the files</param>
+	/// <param name="onRemoved">Called with the files after they are removed</param>
+	/// <returns>false if journal could not be written, files are removed synchronously in this case</returns>
+	static bool Schedule(const std::filesystem::path& mailboxDirectory, const std::vector<std::filesystem::path>& files, io_engine_ptr engine,
+		RemovedCallback onRemoved = {});
+
+	/// <summary>
+	/// Schedule journals left in the mailbox directory by a previous run
+	/// and get files which are still waiting for removal. The directory is examined once per process,
+	/// later journals are written by this process and known without reading them.
+	/// </summary>
+	/// <param name="mailboxDirectory">Directory of the mailbox</param>
+	/// <param name="engine">Engine used to remove the files</param>
+	/// <param name="onRemoved">Called with the files after they are removed</param>
+	/// <returns>Files which must not be treated as messages anymore</returns>
+	static std::set<std::filesystem::path> Recover(const std::filesystem::path& mailboxDirectory, io_engine_ptr engine,
+		RemovedCallback onRemoved = {});
+
+	/// <summary>
+	/// Replay journals of all mailboxes in the root directory, intended to be called at startup
+	/// </summary>
+	/// <param name="root">Directory containing mailboxes' directories</param>
+	/// <param name="engine">Engine used to remove the files</param>
+	/// <returns>Number of mailboxes which had files waiting for removal</returns>
+	static std::size_t ReplayJournals(const std::filesystem::path& root, io_engine_ptr engine);
+
+private:
+	struct Job {
+		std::filesystem::path journal;
+		std::vector<std::filesystem::path> files;
+		io_engine_ptr engine;
+		RemovedCallback onRemoved;
+	};
+
+	static std::filesystem::path writeJournal(const std::filesystem::path& mailboxDirectory, const std::vector<std::filesystem::path>& files);
+	static std::vector<std::filesystem::path> readJournal(const std::filesystem::path& journal);
+	static void enqueue(Job job);
+	static void drain();
+
+	static std::mutex m_mutex;
+	static std::vector<Job> queue;
+	//journals which are queued or being processed with their files
+	static std::map<std::filesystem::path, std::vector<std::filesystem::path>> inProgress;
+	//mailboxes whose metadata directory has been examined by Recover
+	static std::set<std::filesystem::path> recovered;
+	static bool draining;
+};
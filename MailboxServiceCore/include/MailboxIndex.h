@@ -0,0 +1,107 @@
+#pragma once
+
+#include <filesystem>
+#include <vector>
+#include <set>
+#include <map>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include <memory>
+#include <functional>
+#include <cstdint>
+
+#include "StorageIOEngine.h"
+
+/// <summary>
+/// Persistent index of a FileSystemMailStorage mailbox: message files with their attributes and sizes in the wire form
+/// (see WireEncoder). The index remembers modification time of the mailbox directory, while it is unchanged the messages
+/// are taken from the index without listing the directory. Deliveries made through Publish and removals reported by Remove
+/// keep the index current, anything else touching the directory makes the next Load list it again.
+/// A modification time is trusted only if the directory was listed later than the timestamp granularity
+/// of the file system after it, a change in the same tick leaves the time as it was. Until then Load compares
+/// the names in the directory with the index, which needs no stat of the messages.
+/// The last loaded content of recently used mailboxes is also kept in memory, so a login to an unchanged mailbox
+/// costs one stat of its directory.
+/// </summary>
+class MailboxIndex
+{
+public:
+	MailboxIndex() = delete;
+
+	/// <summary>
+	/// Name of the index file inside the metadata directory of the mailbox
+	/// </summary>
+	constexpr static const char* FileName = "index";
+
+	/// <summary>
+	/// Number of mailboxes whose content is kept in memory
+	/// </summary>
+	constexpr static std::size_t MaxSnapshots = 16384;
+
+	struct Entry {
+		std::filesystem::path file;
+		FileAttributes attributes;
+		std::size_t wireSize;
+	};
+
+	/// <summary>
+	/// Get messages of the mailbox. If the directory has changed since the index was written, it is listed,
+	/// attributes are obtained by one batch, new messages are scanned for their wire size and the index is rewritten.
+	/// </summary>
+	/// <param name="mailboxDirectory">Directory of the mailbox</param>
+	/// <param name="excluded">Files which are not messages anymore (waiting for removal)</param>
+	/// <param name="engine">Engine used for stat calls</param>
+	/// <returns>Messages, empty if the directory did not exist and has been created</returns>
+	static std::vector<Entry> Load(const std::filesystem::path& mailboxDirectory, const std::set<std::filesystem::path>& excluded,
+		io_engine_ptr engine);
+
+	/// <summary>
+	/// Make a new message visible and add it to the index in the same step. The directory is not listed,
+	/// the next Load compares its names with the index once instead, however many messages have been published.
+	/// </summary>
+	/// <param name="mailboxDirectory">Directory of the mailbox</param>
+	/// <param name="file">Path the message appears at</param>
+	/// <param name="wireSize">Size of the message in the wire form</param>
+	/// <param name="place">Atomically creates the file (rename or link)</param>
+	/// <returns>Result of place</returns>
+	static bool Publish(const std::filesystem::path& mailboxDirectory, const std::filesystem::path& file, std::size_t wireSize,
+		const std::function<bool()>& place);
+
+	/// <summary>
+	/// Take removed messages out of the index, so the next Load does not measure the remaining ones again
+	/// </summary>
+	/// <param name="mailboxDirectory">Directory of the mailbox</param>
+	/// <param name="removed">Files already removed from the mailbox</param>
+	static void Remove(const std::filesystem::path& mailboxDirectory, const std::vector<std::filesystem::path>& removed);
+
+	/// <summary>
+	/// Compute the wire size of a message file by reading it by chunks
+	/// </summary>
+	/// <returns>false if the file could not be read</returns>
+	static bool Measure(const std::filesystem::path& file, std::size_t& wireSize);
+
+private:
+	struct Snapshot {
+		std::int64_t directoryMtime;
+		//clock of the file system before the directory was examined
+		std::int64_t listedAt;
+		std::vector<Entry> entries;
+	};
+	using snapshot_ptr = std::shared_ptr<const Snapshot>;
+	using snapshot_list = std::list<std::pair<std::string, snapshot_ptr>>;
+
+	//serializes updates of the same index inside the process
+	static std::shared_ptr<std::mutex> getDirectoryMutex(const std::filesystem::path& directory);
+
+	//snapshots are replaced as a whole under the directory's mutex, nullptr drops the snapshot,
+	//the least recently used one is evicted over MaxSnapshots
+	static snapshot_ptr findSnapshot(const std::filesystem::path& directory);
+	static void storeSnapshot(const std::filesystem::path& directory, snapshot_ptr snapshot);
+
+	static std::mutex m_mutex;
+	static std::map<std::string, std::weak_ptr<std::mutex>> directoryMutexes;
+	static snapshot_list snapshotOrder;
+	static std::unordered_map<std::string, snapshot_list::iterator> snapshots;
+};
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <set>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+
+#include "ConsumerInfo.h"
+
+/// <summary>
+/// Speculative warm-up of a mailbox between USER and PASS. While the client sends its password,
+/// the mailbox index is loaded (and rewritten if it is stale) and the first messages are read ahead
+/// into the page cache, so the storages are instantiated from warm caches after the logon.
+/// Nothing is kept in the process, so there is nothing to discard if the logon fails.
+/// </summary>
+class MailboxPrefetcher
+{
+public:
+	MailboxPrefetcher() = delete;
+
+	//read ahead is limited by the number of messages and by their total size
+	constexpr static std::size_t MaxPrefetchedMessages = 32;
+	constexpr static std::uint64_t MaxPrefetchedBytes = 8 * 1024 * 1024;
+
+	/// <summary>
+	/// Start warming the storages of a mailbox on the shared worker pool.
+	/// Does nothing if prefetching is disabled or the mailbox is already being warmed.
+	/// </summary>
+	/// <param name="mailboxName">Name of the mailbox</param>
+	/// <param name="storages">Storages of the mailbox</param>
+	static void Schedule(std::string_view mailboxName, std::vector<MailStorageInfo> storages);
+
+	static inline void Enable(bool value) { enabled = value; }
+	static inline bool IsEnabled() { return enabled; }
+
+private:
+	static void warm(const std::string& mailboxName, const MailStorageInfo& storage);
+
+	static std::atomic<bool> enabled;
+	static std::mutex m_mutex;
+	//mailboxes being warmed now, repeated USER commands do not queue more work
+	static std::set<std::string> inFlight;
+};
@@ -2,13 +2,22 @@
 
 #include "Mailbox.h"
 #include "AuthorizationManager.h"
+#include "MailboxPrefetcher.h"
+#include "LoginThrottle.h"
+#include "WorkerPool.h"
 
 #include <set>
+#include <map>
 #include <mutex>
+#include <chrono>
+#include <atomic>
+#include <functional>
 
 class MailboxServiceManager
 {
 public:
+	using LogonResult = std::variant<mailbox_ptr, MailboxOperationError, AuthError>;
+
 	MailboxServiceManager() = delete;
 	/// <summary>
 	/// Check user
@@ -23,10 +32,55 @@ public:
 	/// <param name="mailboxName"></param>
 	/// <param name="password"></param>
 	/// <returns></returns>
-	static std::variant<mailbox_ptr, MailboxOperationError, AuthError> VerifyCredentialsAndConnect(std::string_view mailboxName, std::string_view password);
+	static LogonResult VerifyCredentialsAndConnect(std::string_view mailboxName, std::string_view password);
+
+	/// <summary>
+	/// VerifyCredentialsAndConnect without blocking the caller: the password is verified on AuthPool,
+	/// the storages are instantiated on the shared worker pool. A slow verifier does not hold up storage work.
+	/// </summary>
+	/// <param name="handler">Called once with the result, on one of the pools or right away if the logon is delayed</param>
+	static void VerifyCredentialsAndConnectAsync(std::string mailboxName, std::string password, std::function<void(LogonResult)> handler);
+
+	/// <summary>
+	/// Threads verifying passwords, sized apart from the storage pool. Takes effect if called before the first logon.
+	/// </summary>
+	static void SetAuthThreads(unsigned int threadsCount) { authThreads = threadsCount; }
+	static WorkerPool& AuthPool();
 	
+	/// <summary>
+	/// Get storages of a mailbox to deliver messages to
+	/// </summary>
+	/// <param name="mailboxName">Name of mailbox</param>
+	/// <returns>Empty if there is no such mailbox</returns>
+	static std::vector<MailStorageInfo> GetMailStorages(std::string_view mailboxName) { return AuthorizationManager->storagesOf(mailboxName); }
+
+	/// <summary>
+	/// Start warming storages of a mailbox while its password is awaited (see MailboxPrefetcher)
+	/// </summary>
+	/// <param name="mailboxName">Name of mailbox</param>
+	static void PrefetchMailbox(std::string_view mailboxName) {
+		//a logon which is going to be refused needs no warm caches
+		if (MailboxPrefetcher::IsEnabled() && loginThrottle.allowed(mailboxName)) {
+			MailboxPrefetcher::Schedule(mailboxName, GetMailStorages(mailboxName));
+		}
+	}
+
+	/// <summary>
+	/// Minimum time between logons of a consumer (RFC 2449 LOGIN-DELAY), zero disables it.
+	/// Earlier logons are refused once the password is verified and before the mailbox is locked,
+	/// so the refusal does not tell others whether the consumer logged in recently (RFC 2449 8.1.1).
+	/// </summary>
+	static void SetLoginDelay(std::chrono::seconds delay) { loginThrottle.setDelay(delay); }
+	static std::chrono::seconds GetLoginDelay() { return loginThrottle.getDelay(); }
+
 	static void UnlockMailbox(std::string_view name);
 	static bool LockMailbox(std::string_view name);
+
+	/// <summary>
+	/// Post a task to the shared worker pool once the mailbox is not locked: right away if it is free,
+	/// otherwise when it is unlocked. The task still has to lock the mailbox, a session may take it first.
+	/// </summary>
+	static void PostWhenUnlocked(std::string_view name, std::function<void()> task);
 	static void SetAuthorizationManager(std::unique_ptr<AuthorizationManager> ptr) { 
 		AuthorizationManager = std::move(ptr); 
 	}
@@ -34,6 +88,15 @@ private:
 	static std::unique_ptr<AuthorizationManager> AuthorizationManager;
 	static std::mutex m_mutex;
 	static std::set<std::string> activeMailboxes;
+	//tasks waiting for a locked mailbox
+	static std::multimap<std::string, std::function<void()>, std::less<>> unlockTasks;
+	static LoginThrottle loginThrottle;
+	static std::atomic<unsigned int> authThreads;
+
+	//check the credentials, the outcome is counted by the callers
+	static std::optional<AuthError> Authenticate(std::string_view mailboxName, std::string_view password);
+	//lock the mailbox of a consumer whose password has been verified and instantiate its storages
+	static LogonResult Connect(std::string_view mailboxName);
 };
 
 
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "FileSystemMailStorage.h"
+
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <optional>
+#include <variant>
+
+/// <summary>
+/// Maildir mailboxes: messages are delivered to tmp/, moved to new/ when complete and to cur/ when they are seen
+/// by the POP3 server. Sizes are taken from ",S=" and ",W=" fields of the file names, so a mailbox is listed by
+/// reading its directories without stat calls. Maildirs written by other MDAs without these fields are supported,
+/// such messages are measured once and their sizes are kept in the metadata directory.
+/// </summary>
+class MaildirStorageFactory
+{
+public:
+	MaildirStorageFactory() = delete;
+
+	/// <summary>
+	/// Separator of the unique name and the flags (":2,..."), ':' is not allowed in file names on Windows
+	/// </summary>
+#ifdef WIN32
+	constexpr static char InfoSeparator = '!';
+#else
+	constexpr static char InfoSeparator = ':';
+#endif
+
+	/// <summary>
+	/// File in the metadata directory with the sizes of messages whose names do not carry them
+	/// </summary>
+	constexpr static const char* SizesFileName = "maildir-sizes";
+
+	struct NameSizes {
+		std::optional<std::size_t> size;
+		std::optional<std::size_t> wireSize;
+	};
+
+	/// <summary>
+	/// Get ",S=" and ",W=" fields of a Maildir file name
+	/// </summary>
+	static NameSizes ParseName(std::string_view filename);
+
+	static std::shared_ptr<FileSystemMailStorage> create(const MailStorageInfo& info, std::string_view name);
+
+	/// <summary>
+	/// Deliver a message: it is written and synced in tmp/ and moved to new/ under a unique name carrying its sizes
+	/// </summary>
+	/// <param name="directory">Root directory of the Maildir</param>
+	/// <param name="message">Content of the message</param>
+	/// <returns>Path of the message in new/</returns>
+	static std::variant<std::filesystem::path, MailboxOperationError> deliver(const std::filesystem::path& directory, std::string_view message);
+
+private:
+	static bool prepare(const std::filesystem::path& directory);
+	static std::string uniqueName();
+};
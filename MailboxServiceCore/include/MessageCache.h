@@ -0,0 +1,119 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <list>
+#include <unordered_map>
+#include <array>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+
+#include "MailStorage.h"
+
+/// <summary>
+/// Process-wide cache of immutable message buffers shared by all sessions.
+/// Buffers are handed out by reference counted pointers, so a message fetched by many sessions
+/// at once is read from disk once and written to every socket without copying.
+/// The cache is split into shards with their own LRU lists to keep lock contention low.
+/// </summary>
+class MessageCache
+{
+public:
+	struct Key {
+		std::string path;
+		std::uint64_t uid;
+		std::int64_t mtime;
+
+		bool operator==(const Key& right) const {
+			return uid == right.uid && mtime == right.mtime && path == right.path;
+		}
+	};
+
+	struct Statistics {
+		std::uint64_t hits;
+		std::uint64_t misses;
+		std::uint64_t insertions;
+		std::uint64_t evictions;
+		//messages which were not cached because of their size
+		std::uint64_t bypassed;
+		std::size_t size;
+	};
+
+	constexpr static std::size_t ShardsCount = 16;
+	constexpr static std::size_t DefaultCapacity = 256 * 1024 * 1024;
+	constexpr static std::size_t DefaultMaxMessageSize = 256 * 1024;
+
+	MessageCache(std::size_t capacity, std::size_t maxMessageSize);
+
+	//noncopyable
+	MessageCache(const MessageCache&) = delete;
+	MessageCache operator=(const MessageCache&) = delete;
+
+	/// <summary>
+	/// Find a message in the cache
+	/// </summary>
+	/// <returns>Buffer or nullptr if the message is not cached</returns>
+	message_buffer find(const Key& key);
+
+	/// <summary>
+	/// Check whether a message of this size is allowed into the cache, large messages bypass it
+	/// </summary>
+	inline bool admits(std::size_t messageSize) const {
+		return messageSize <= maxMessageSize && messageSize <= shardCapacity;
+	}
+
+	/// <summary>
+	/// Put a message into the cache, least recently used messages of the shard are evicted if necessary
+	/// </summary>
+	/// <returns>false if the message is not admitted</returns>
+	bool insert(const Key& key, message_buffer buffer);
+
+	Statistics statistics() const;
+
+	/// <summary>
+	/// Cache shared by all storages
+	/// </summary>
+	static MessageCache& Shared();
+
+	/// <summary>
+	/// Set limits of the shared cache, must be called before the first use of it
+	/// </summary>
+	static void Configure(std::size_t capacity, std::size_t maxMessageSize);
+
+private:
+	struct KeyHash {
+		std::size_t operator()(const Key& key) const noexcept {
+			auto h = std::hash<std::string>{}(key.path);
+			h ^= std::hash<std::uint64_t>{}(key.uid) + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+			h ^= std::hash<std::int64_t>{}(key.mtime) + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+			return h;
+		}
+	};
+
+	struct Shard {
+		using lru_list = std::list<std::pair<Key, message_buffer>>;
+		std::mutex m_mutex;
+		lru_list entries;
+		std::unordered_map<Key, lru_list::iterator, KeyHash> index;
+		std::size_t size{ 0 };
+	};
+
+	inline Shard& shardFor(const Key& key) {
+		return shards[KeyHash{}(key) % ShardsCount];
+	}
+
+	const std::size_t shardCapacity;
+	const std::size_t maxMessageSize;
+	std::array<Shard, ShardsCount> shards;
+
+	std::atomic<std::uint64_t> hits{ 0 };
+	std::atomic<std::uint64_t> misses{ 0 };
+	std::atomic<std::uint64_t> insertions{ 0 };
+	std::atomic<std::uint64_t> evictions{ 0 };
+	std::atomic<std::uint64_t> bypassed{ 0 };
+	std::atomic<std::size_t> size{ 0 };
+
+	static std::size_t sharedCapacity;
+	static std::size_t sharedMaxMessageSize;
+};
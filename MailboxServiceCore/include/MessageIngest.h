@@ -0,0 +1,54 @@
+#pragma once
+
+#include <filesystem>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+#include "Enums.h"
+#include "ConsumerInfo.h"
+
+/// <summary>
+/// Delivers messages to FileSystemMailStorage mailboxes already in the wire form (see WireEncoder).
+/// Such files are marked by the name suffix, RETR sends them as they are and their size on disk is the size
+/// reported to the client, so they are neither scanned nor reformatted by the server.
+/// </summary>
+class MessageIngest
+{
+public:
+	MessageIngest() = delete;
+
+	/// <summary>
+	/// Suffix of files holding messages in the wire form
+	/// </summary>
+	constexpr static const char* WireSuffix = ".wire";
+
+	/// <summary>
+	/// Check whether a message file is in the wire form
+	/// </summary>
+	static bool IsWireForm(const std::filesystem::path& file);
+
+	/// <summary>
+	/// Normalize a message and durably put it into the mailbox. The file becomes visible by rename,
+	/// so a session never sees it partially written.
+	/// </summary>
+	/// <param name="mailboxDirectory">Directory of the mailbox</param>
+	/// <param name="message">Message as it was received</param>
+	/// <returns>Path to the created file</returns>
+	static std::variant<std::filesystem::path, MailboxOperationError> Deliver(const std::filesystem::path& mailboxDirectory, std::string_view message);
+
+	/// <summary>
+	/// Deliver one message to many mailboxes. The wire form is written once, other mailboxes get hard links to it
+	/// (a copy if a mailbox is on another file system).
+	/// </summary>
+	/// <param name="mailboxDirectories">Directories of the recipients' mailboxes</param>
+	/// <param name="message">Message as it was received</param>
+	/// <returns>Path to the created file or error for every mailbox, in the same order</returns>
+	static std::vector<std::variant<std::filesystem::path, MailboxOperationError>> Deliver(const std::vector<std::filesystem::path>& mailboxDirectories,
+		std::string_view message);
+
+	/// <summary>
+	/// Deliver a message to the mailbox described by storage info ("path" option or default path and mailbox name)
+	/// </summary>
+	static std::variant<std::filesystem::path, MailboxOperationError> Deliver(const MailStorageInfo& info, std::string_view name, std::string_view message);
+};
@@ -0,0 +1,207 @@
+#pragma once
+
+#include <list>
+#include <array>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <string_view>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+using MetricLabels = std::vector<std::pair<std::string, std::string>>;
+
+enum class MetricType {
+	Counter,
+	Gauge,
+	Histogram
+};
+
+struct MetricDescriptor {
+	std::string name;
+	std::string help;
+	MetricType type;
+	MetricLabels labels;
+	//first slot of the metric, a histogram takes HistogramSlots of them
+	std::size_t slot;
+};
+
+/// <summary>
+/// Counters, gauges and latency histograms of the process.
+/// Every thread writes to its own block of slots with relaxed stores, so the hot path takes no lock
+/// and shares no cache line. A snapshot merges the blocks of all threads, blocks of finished threads are folded into a total.
+/// Metrics are registered once, at start, and then updated through handles which are indexes of slots.
+/// </summary>
+class MetricsRegistry
+{
+public:
+	constexpr static std::size_t MaxSlots = 8192;
+	//histograms keep microseconds in buckets of 2 significant bits (HDR style): 4 buckets per power of two, up to 2^32 us
+	constexpr static unsigned int SubBucketBits = 2;
+	constexpr static std::size_t SubBuckets = std::size_t{ 1 } << SubBucketBits;
+	constexpr static unsigned int MaxMagnitude = 32;
+	constexpr static std::size_t HistogramBuckets = SubBuckets * (MaxMagnitude - SubBucketBits + 1);
+	//buckets, then the count and the sum of the values
+	constexpr static std::size_t HistogramSlots = HistogramBuckets + 2;
+
+	class Counter
+	{
+	public:
+		Counter() = default;
+		void add(std::uint64_t count = 1) const { MetricsRegistry::local()[slot] += static_cast<std::int64_t>(count); }
+	private:
+		friend class MetricsRegistry;
+		explicit Counter(std::size_t _slot) : slot(_slot) {}
+		std::size_t slot{ 0 };
+	};
+
+	class Gauge
+	{
+	public:
+		Gauge() = default;
+		void add(std::int64_t delta) const { MetricsRegistry::local()[slot] += delta; }
+	private:
+		friend class MetricsRegistry;
+		explicit Gauge(std::size_t _slot) : slot(_slot) {}
+		std::size_t slot{ 0 };
+	};
+
+	class Histogram
+	{
+	public:
+		Histogram() = default;
+		void record(std::uint64_t micros) const {
+			auto& block = MetricsRegistry::local();
+			block[slot + BucketIndex(micros)] += 1;
+			block[slot + HistogramBuckets] += 1;
+			block[slot + HistogramBuckets + 1] += static_cast<std::int64_t>(micros);
+		}
+		void record(std::chrono::steady_clock::duration elapsed) const {
+			record(static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count()));
+		}
+	private:
+		friend class MetricsRegistry;
+		explicit Histogram(std::size_t _slot) : slot(_slot) {}
+		std::size_t slot{ 0 };
+	};
+
+	/// <summary>
+	/// Records the time of a scope into a histogram
+	/// </summary>
+	class Stopwatch
+	{
+	public:
+		explicit Stopwatch(const Histogram& _histogram) : histogram(_histogram), started(std::chrono::steady_clock::now()) {}
+		~Stopwatch() { histogram.record(std::chrono::steady_clock::now() - started); }
+		Stopwatch(const Stopwatch&) = delete;
+		Stopwatch& operator=(const Stopwatch&) = delete;
+	private:
+		const Histogram& histogram;
+		std::chrono::steady_clock::time_point started;
+	};
+
+	/// <summary>
+	/// Merged values of all slots and the metrics they belong to
+	/// </summary>
+	struct Snapshot {
+		std::vector<MetricDescriptor> metrics;
+		std::vector<std::int64_t> values;
+	};
+
+	static MetricsRegistry& Shared();
+
+	/// <summary>
+	/// Register a metric, or get the one registered with the same name and labels.
+	/// Metrics over MaxSlots share a slot which is never reported.
+	/// </summary>
+	Counter counter(std::string_view name, std::string_view help, MetricLabels labels = {});
+	Gauge gauge(std::string_view name, std::string_view help, MetricLabels labels = {});
+	Histogram histogram(std::string_view name, std::string_view help, MetricLabels labels = {});
+
+	Snapshot snapshot() const;
+
+	static std::size_t BucketIndex(std::uint64_t value) {
+		if (value < SubBuckets) {
+			return static_cast<std::size_t>(value);
+		}
+		auto magnitude = magnitudeOf(value);
+		if (magnitude >= MaxMagnitude) {
+			return HistogramBuckets - 1;
+		}
+		auto sub = (value >> (magnitude - SubBucketBits)) & (SubBuckets - 1);
+		return (magnitude - SubBucketBits + 1) * SubBuckets + static_cast<std::size_t>(sub);
+	}
+
+	//the largest value counted in a bucket, the last one also counts everything larger
+	static std::uint64_t BucketUpperBound(std::size_t index) {
+		if (index < SubBuckets) {
+			return index;
+		}
+		auto magnitude = static_cast<unsigned int>(index / SubBuckets) + SubBucketBits - 1;
+		auto width = std::uint64_t{ 1 } << (magnitude - SubBucketBits);
+		return (std::uint64_t{ 1 } << magnitude) + (index % SubBuckets) * width + width - 1;
+	}
+
+private:
+	//written by its thread only, so increments need no read-modify-write instruction
+	class Block
+	{
+	public:
+		class Slot
+		{
+		public:
+			void operator+=(std::int64_t delta) {
+				value.store(value.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+			}
+			std::int64_t load() const { return value.load(std::memory_order_relaxed); }
+		private:
+			std::atomic<std::int64_t> value{ 0 };
+		};
+
+		Slot& operator[](std::size_t slot) { return slots[slot]; }
+		const Slot& operator[](std::size_t slot) const { return slots[slot]; }
+
+	private:
+		std::array<Slot, MaxSlots> slots;
+	};
+
+	//attaches the block of a thread to the registry and folds it into the total when the thread finishes
+	struct LocalBlock {
+		LocalBlock() : block(Shared().attach()) {}
+		~LocalBlock() { Shared().detach(block); }
+		Block* block;
+	};
+
+	static Block& local() {
+		thread_local LocalBlock block;
+		return *block.block;
+	}
+
+	static unsigned int magnitudeOf(std::uint64_t value) {
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanReverse64(&index, value);
+		return static_cast<unsigned int>(index);
+#else
+		return 63 - static_cast<unsigned int>(__builtin_clzll(value));
+#endif
+	}
+
+	std::size_t add(std::string_view name, std::string_view help, MetricType type, MetricLabels labels);
+	Block* attach();
+	void detach(Block* block);
+
+	mutable std::mutex m_mutex;
+	std::vector<MetricDescriptor> metrics;
+	//slots below are shared by metrics registered over the limit
+	std::size_t nextSlot{ HistogramSlots };
+	std::list<std::unique_ptr<Block>> blocks;
+	std::vector<std::int64_t> finished = std::vector<std::int64_t>(MaxSlots);
+};
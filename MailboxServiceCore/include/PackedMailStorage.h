@@ -0,0 +1,231 @@
+#pragma once
+
+#include "MailStorage.h"
+#include "ConsumerInfo.h"
+
+#include <filesystem>
+#include <vector>
+#include <memory>
+#include <map>
+#include <mutex>
+#include <variant>
+#include <string_view>
+#include <cstdint>
+
+/// <summary>
+/// Header of a packed mailbox index file
+/// </summary>
+struct PackedIndexHeader {
+	constexpr static std::uint32_t Magic = 0x58424D50; //"PMBX"
+	constexpr static std::uint32_t CurrentVersion = 1;
+
+	std::uint32_t magic{ Magic };
+	std::uint32_t version{ CurrentVersion };
+	//segment file currently referenced by the index, changes with every compaction
+	std::uint64_t generation{ 0 };
+	std::uint64_t nextUid{ 1 };
+};
+
+enum PackedRecordFlags : std::uint32_t {
+	Tombstone = 1,
+	//stored as a deflate stream, length keeps the uncompressed size
+	Compressed = 2,
+	//wireExtra is known, records appended by older versions do not have it
+	WireSized = 4
+};
+
+enum class PackedCompression : unsigned int {
+	None,
+	Deflate
+};
+
+/// <summary>
+/// Index entry describing a single message inside the segment file
+/// </summary>
+struct PackedIndexRecord {
+	std::uint64_t offset{ 0 };
+	//octets occupied in the segment
+	std::uint64_t storedLength{ 0 };
+	//octets of the message as it was delivered
+	std::uint64_t length{ 0 };
+	std::uint64_t uid{ 0 };
+	std::uint32_t flags{ 0 };
+	//octets added by dot-stuffing and CRLF normalization when the message is sent by RETR
+	std::uint32_t wireExtra{ 0 };
+
+	inline bool isTombstone() const { return (flags & PackedRecordFlags::Tombstone) != 0; }
+	inline bool isCompressed() const { return (flags & PackedRecordFlags::Compressed) != 0; }
+	inline bool isWireSized() const { return (flags & PackedRecordFlags::WireSized) != 0; }
+	inline std::uint64_t wireLength() const { return length + wireExtra; }
+
+	/// <summary>
+	/// Compute wireExtra for the content of the message
+	/// </summary>
+	void setWireSize(std::string_view message);
+};
+
+static_assert(sizeof(PackedIndexHeader) == 24, "index header layout must not depend on compiler");
+static_assert(sizeof(PackedIndexRecord) == 40, "index record layout must not depend on compiler");
+
+/// <summary>
+/// Minimal positional file I/O: pread/pwrite on POSIX
+/// </summary>
+class PackedFile
+{
+public:
+	PackedFile() {}
+	PackedFile(const std::filesystem::path& path, bool writable) { open(path, writable); }
+
+	//noncopyable
+	PackedFile(const PackedFile&) = delete;
+	PackedFile operator=(const PackedFile&) = delete;
+	PackedFile(PackedFile&& moved) noexcept : handle(moved.handle) { moved.handle = -1; }
+
+	bool open(const std::filesystem::path& path, bool writable);
+	bool readAt(void* data, std::size_t size, std::uint64_t offset) const;
+	bool writeAt(const void* data, std::size_t size, std::uint64_t offset);
+	std::uint64_t size() const;
+	bool sync();
+	void close();
+
+	/// <summary>
+	/// Ask the kernel to read a region into the page cache in background, only a hint
+	/// </summary>
+	void prefetch(std::uint64_t offset, std::uint64_t length) const;
+
+	inline bool isOpen() const { return handle >= 0; }
+	inline int nativeHandle() const { return handle; }
+
+	~PackedFile() { close(); }
+private:
+	int handle{ -1 };
+};
+
+/// <summary>
+/// Mailbox kept as one append-only segment file plus an index of (offset, length, uid, flags).
+/// LIST and STAT are served from the index, RETR reads the message at its offset.
+/// Messages deleted in UPDATE state are marked as tombstones, their space is reclaimed by compaction.
+/// </summary>
+class PackedMailStorage : public MailStorage
+{
+public:
+	PackedMailStorage(std::filesystem::path _directory, std::string_view _mailboxName, PackedFile _segment,
+		std::vector<PackedIndexRecord> _records, std::vector<std::uint64_t> _positions, std::uint64_t _deadBytes, unsigned int _compactionThreshold) :
+		MailStorage(), directory(std::move(_directory)), mailboxName(_mailboxName), segment(std::move(_segment)),
+		records(std::move(_records)), positions(std::move(_positions)), deadBytes(_deadBytes), compactionThreshold(_compactionThreshold)
+	{
+	}
+
+	std::size_t getEmailsCount() const override {
+		if (deleteAll) {
+			return static_cast<std::size_t>(0);
+		}
+		return records.size() - emailsToBeDeleted.size();
+	}
+
+	/// <summary>
+	/// Get lengths of all emails in the mailbox
+	/// </summary>
+	/// <returns></returns>
+	email_lengths getEmailsLengths(std::size_t mailNumberOffset = 0, std::pmr::memory_resource* resource = std::pmr::get_default_resource()) const override;
+
+	/// <summary>
+	/// Get the length of a particular email in the mailbox
+	/// </summary>
+	/// <param name="emailNumber">Number of the email</param>
+	/// <returns></returns>
+	std::size_t getEmailLength(std::size_t emailNumber) const override;
+
+	/// <summary>
+	/// Get a pointer to an object representing a particular email
+	/// </summary>
+	/// <param name="emailNumber">Number of the email</param>
+	/// <returns></returns>
+	std::variant<std::string, MailboxOperationError> getEmail(std::size_t emailNumber) const override;
+
+	/// <summary>
+	/// Get a reader of a particular email, compressed emails are inflated chunk by chunk.
+	/// When emails are retrieved in order, the following records are read ahead.
+	/// </summary>
+	/// <param name="emailNumber">Number of the email</param>
+	/// <returns></returns>
+	std::variant<message_reader_ptr, MailboxOperationError> openEmail(std::size_t emailNumber) const override;
+
+	///
+	/// Destructor, marks messages deleted in UPDATE state as tombstones
+	///
+	~PackedMailStorage() override;
+
+	constexpr static const char* IndexFileName = "mailbox.idx";
+
+	static std::filesystem::path SegmentPath(const std::filesystem::path& directory, std::uint64_t generation);
+
+private:
+	const std::filesystem::path directory;
+	const std::string mailboxName;
+	PackedFile segment;
+	const std::vector<PackedIndexRecord> records;
+	//numbers of the records in the index file
+	const std::vector<std::uint64_t> positions;
+	//octets of the segment already occupied by tombstones
+	const std::uint64_t deadBytes;
+	//percent of dead octets which triggers compaction, 0 disables it
+	const unsigned int compactionThreshold;
+	mutable ReadAheadWindow readAhead;
+};
+
+class PackedStorageFactory
+{
+public:
+	PackedStorageFactory() = delete;
+
+	constexpr static unsigned int DefaultCompactionThreshold = 30;
+
+	struct Settings {
+		std::filesystem::path path;
+		unsigned int compactionThreshold{ DefaultCompactionThreshold };
+		PackedCompression compression{ PackedCompression::None };
+	};
+
+	/// <summary>
+	/// Get settings of a packed mailbox from its description ("path", "compaction", "compression" options)
+	/// </summary>
+	static Settings resolve(const MailStorageInfo& info, std::string_view name);
+
+	static std::shared_ptr<PackedMailStorage> create(const MailStorageInfo& info, std::string_view name);
+
+	/// <summary>
+	/// Append a message to a packed mailbox
+	/// </summary>
+	/// <param name="directory">Directory of the mailbox</param>
+	/// <param name="message">Content of the message</param>
+	/// <param name="compression">How to store the message, it is stored as is if compression is not available</param>
+	/// <returns>UID assigned to the message</returns>
+	static std::variant<std::uint64_t, MailboxOperationError> append(const std::filesystem::path& directory, std::string_view message,
+		PackedCompression compression = PackedCompression::None);
+
+	/// <summary>
+	/// Append a message to a packed mailbox described by storage info
+	/// </summary>
+	static std::variant<std::uint64_t, MailboxOperationError> append(const MailStorageInfo& info, std::string_view name, std::string_view message);
+
+	/// <summary>
+	/// Rewrite the segment without tombstones. The new segment gets the next generation
+	/// and becomes visible by atomic replacement of the index.
+	/// </summary>
+	/// <param name="directory">Directory of the mailbox</param>
+	/// <returns></returns>
+	static bool compact(const std::filesystem::path& directory);
+
+	/// <summary>
+	/// Compact the mailbox in background once it is not used by any session
+	/// </summary>
+	static void scheduleCompaction(const std::filesystem::path& directory, std::string_view mailboxName);
+
+private:
+	//serializes appends and compactions of the same mailbox inside the process
+	static std::shared_ptr<std::mutex> getDirectoryMutex(const std::filesystem::path& directory);
+
+	static std::mutex m_mutex;
+	static std::map<std::string, std::weak_ptr<std::mutex>> directoryMutexes;
+};
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <array>
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+
+/// <summary>
+/// Checks a password against the credential kept for a consumer.
+/// A check may be slow on purpose (key derivation), so it is never run on the io threads.
+/// </summary>
+class PasswordVerifier
+{
+public:
+	virtual ~PasswordVerifier() = default;
+
+	virtual bool verify(std::string_view password, std::string_view credential) const = 0;
+};
+
+/// <summary>
+/// Credentials are the passwords themselves
+/// </summary>
+class PlainPasswordVerifier : public PasswordVerifier
+{
+public:
+	bool verify(std::string_view password, std::string_view credential) const override {
+		return password == credential;
+	}
+};
+
+/// <summary>
+/// Credentials of the form pbkdf2-sha256$iterations$salt$key with hex salt and key (RFC 8018).
+/// Credentials without the prefix are compared as plain passwords, so a consumer store is migrated one consumer at a time.
+/// </summary>
+class Pbkdf2PasswordVerifier : public PasswordVerifier
+{
+public:
+	constexpr static std::string_view Prefix = "pbkdf2-sha256$";
+	constexpr static unsigned int DefaultIterations = 100000;
+	constexpr static std::size_t SaltLength = 16;
+	constexpr static std::size_t KeyLength = 32;
+
+	bool verify(std::string_view password, std::string_view credential) const override;
+
+	/// <summary>
+	/// Make a credential for a password with a random salt
+	/// </summary>
+	/// <returns>Empty if the build has no PBKDF2</returns>
+	static std::string MakeCredential(std::string_view password, unsigned int iterations = DefaultIterations);
+
+	/// <summary>
+	/// Whether the build has PBKDF2 (OpenSSL), otherwise only plain credentials are accepted
+	/// </summary>
+	static bool IsSupported();
+};
+
+/// <summary>
+/// Recent successful verifications, so a consumer polling every minute does not pay for the key derivation each time.
+/// An entry is an HMAC-SHA256 of the consumer, the password and the credential keyed by a random per-process key,
+/// so a changed password or credential misses and the table tells nothing about the passwords.
+/// </summary>
+class VerificationCache
+{
+public:
+	//the cache is swept when it grows over this size, and then when it doubles what is left
+	constexpr static std::size_t SweepSize = 1024;
+	constexpr static std::size_t DigestLength = 32;
+
+	explicit VerificationCache(std::chrono::seconds _ttl = std::chrono::seconds(60));
+
+	//zero disables the cache
+	void setTtl(std::chrono::seconds _ttl);
+
+	bool contains(std::string_view name, std::string_view password, std::string_view credential) const;
+	void insert(std::string_view name, std::string_view password, std::string_view credential);
+
+private:
+	using clock = std::chrono::steady_clock;
+	using Digest = std::array<unsigned char, DigestLength>;
+
+	struct Entry {
+		Digest digest;
+		clock::time_point expires;
+	};
+
+	std::uint64_t keyOf(std::string_view name) const;
+	//false if the digest could not be computed, nothing is cached or found then
+	bool digestOf(std::string_view name, std::string_view password, std::string_view credential, Digest& digest) const;
+	//in constant time, a guess learns nothing from how long the comparison takes
+	static bool equal(const Digest& first, const Digest& second);
+
+	mutable std::mutex m_mutex;
+	clock::duration ttl;
+	//key of the HMAC, random per process, digests cannot be computed ahead
+	std::string salt;
+	std::unordered_map<std::uint64_t, Entry> entries;
+	std::size_t sweepAt{ SweepSize };
+};
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <filesystem>
+#include <vector>
+#include <memory>
+#include <optional>
+#include <string>
+#include <variant>
+#include <cstdint>
+
+#include "Enums.h"
+
+enum class StorageIOEngineType
+{
+	Synchronous,
+	ThreadPool,
+	IoUring
+};
+
+/// <summary>
+/// Attributes of a message file obtained by one stat call
+/// </summary>
+struct FileAttributes {
+	std::size_t size{ 0 };
+	//modification time in nanoseconds since epoch
+	std::int64_t mtime{ 0 };
+	//inode number, 0 where it is not available
+	std::uint64_t inode{ 0 };
+};
+
+/// <summary>
+/// Performs file system requests of mail storages. Requests which concern many messages
+/// (sizes for LIST, removing for UPDATE) are passed as a single batch, so an engine is free
+/// to submit them together instead of issuing one blocking syscall per message.
+/// </summary>
+class StorageIOEngine
+{
+public:
+	/// <summary>
+	/// Get attributes of a batch of files
+	/// </summary>
+	/// <param name="files">Paths to files</param>
+	/// <returns>Attributes in the same order as files, empty value for a file which could not be examined</returns>
+	virtual std::vector<std::optional<FileAttributes>> statFiles(const std::vector<std::filesystem::path>& files) = 0;
+
+	/// <summary>
+	/// Read the whole content of a file
+	/// </summary>
+	/// <param name="file">Path to file</param>
+	/// <param name="sizeHint">Expected size of the file, 0 if unknown</param>
+	/// <returns></returns>
+	virtual std::variant<std::string, MailboxOperationError> readFile(const std::filesystem::path& file, std::size_t sizeHint = 0) = 0;
+
+	/// <summary>
+	/// Remove a batch of files
+	/// </summary>
+	/// <param name="files">Paths to files</param>
+	/// <returns>Number of removed files</returns>
+	virtual std::size_t unlinkFiles(const std::vector<std::filesystem::path>& files) = 0;
+
+	/// <summary>
+	/// Ask the kernel to read a batch of files into the page cache in background.
+	/// Only a hint, does nothing where it is not supported.
+	/// </summary>
+	/// <param name="files">Paths to files</param>
+	/// <param name="length">Number of leading octets of each file to read, 0 for whole files</param>
+	virtual void prefetchFiles(const std::vector<std::filesystem::path>& files, std::uint64_t length = 0);
+
+	virtual StorageIOEngineType type() const = 0;
+
+	virtual ~StorageIOEngine() {}
+
+	/// <summary>
+	/// Create an engine of the requested type. If io_uring is not compiled in or is not supported
+	/// by the running kernel, a thread pool based engine is returned instead.
+	/// </summary>
+	/// <param name="type">Preferred type of the engine</param>
+	/// <param name="threadsCount">Number of threads for the thread pool engine, 0 means hardware concurrency</param>
+	/// <returns></returns>
+	static std::shared_ptr<StorageIOEngine> Create(StorageIOEngineType type, unsigned int threadsCount = 0);
+};
+
+using io_engine_ptr = std::shared_ptr<StorageIOEngine>;
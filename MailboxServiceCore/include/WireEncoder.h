@@ -0,0 +1,78 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <cstddef>
+
+#include "MailStorage.h"
+
+/// <summary>
+/// Converts a message into the form it is sent by RETR (RFC 1939): bare LF becomes CRLF,
+/// a line beginning with '.' gets one more '.' and the message ends with CRLF.
+/// The message may be passed by arbitrary chunks, the state between them is kept by the encoder.
+/// Line feeds are searched by SSE2/AVX2 when the compiler targets them, other octets are copied in bulk.
+/// </summary>
+class WireEncoder
+{
+public:
+	/// <summary>
+	/// Append the wire form of the next part of the message
+	/// </summary>
+	/// <param name="data">Part of the message</param>
+	/// <param name="size">Size of the part</param>
+	/// <param name="out">Destination</param>
+	void encode(const char* data, std::size_t size, std::string& out);
+
+	/// <summary>
+	/// Count octets the next part of the message takes in the wire form
+	/// </summary>
+	/// <param name="data">Part of the message</param>
+	/// <param name="size">Size of the part</param>
+	/// <returns></returns>
+	std::size_t measure(const char* data, std::size_t size);
+
+	/// <summary>
+	/// Complete the message, CRLF is appended if it does not end with a line break
+	/// </summary>
+	/// <param name="out">Destination</param>
+	void finish(std::string& out);
+
+	/// <summary>
+	/// Octets appended by finish
+	/// </summary>
+	inline std::size_t finishSize() const { return lineStart ? 0 : 2; }
+
+	/// <summary>
+	/// Exact size of the message in the wire form without the terminating ".CRLF"
+	/// </summary>
+	static std::size_t WireSize(std::string_view message);
+
+private:
+	template<typename Sink>
+	void process(const char* data, std::size_t size, Sink& sink);
+
+	//nothing but complete lines has been consumed so far
+	bool lineStart{ true };
+	//last consumed octet is CR, so LF at the beginning of the next part is not bare
+	bool afterCR{ false };
+};
+
+/// <summary>
+/// Reader returning the wire form of a message provided by another reader
+/// </summary>
+class WireMessageReader : public MessageReader
+{
+public:
+	explicit WireMessageReader(message_reader_ptr _source) : source(std::move(_source)) {}
+
+	std::variant<std::size_t, MailboxOperationError> read(char* buffer, std::size_t size) override;
+
+private:
+	message_reader_ptr source;
+	WireEncoder encoder;
+	//encoded octets which did not fit to the caller's buffer
+	std::string pending;
+	std::size_t pendingPosition{ 0 };
+	std::string chunk;
+	bool finished{ false };
+};
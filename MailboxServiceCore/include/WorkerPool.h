@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <type_traits>
+
+/// <summary>
+/// Fixed-size pool of threads executing posted tasks in FIFO order.
+/// Used for storage work which must not run on the io threads.
+/// </summary>
+class WorkerPool
+{
+public:
+	explicit WorkerPool(unsigned int threadsCount);
+
+	//noncopyable
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool operator=(const WorkerPool&) = delete;
+
+	/// <summary>
+	/// Enqueue a task, it will be executed by one of the pool's threads
+	/// </summary>
+	/// <param name="task"></param>
+	void post(std::function<void()> task);
+
+	/// <summary>
+	/// Enqueue a task and get a future for its result
+	/// </summary>
+	template<typename Func>
+	auto submit(Func func) -> std::future<std::invoke_result_t<Func>> {
+		using result_type = std::invoke_result_t<Func>;
+		auto task = std::make_shared<std::packaged_task<result_type()>>(std::move(func));
+		auto future = task->get_future();
+		post([task]() { (*task)(); });
+		return future;
+	}
+
+	inline std::size_t size() const { return threads.size(); }
+
+	/// <summary>
+	/// Pool shared by background storage activities (prefetching, expunging, compaction)
+	/// </summary>
+	/// <returns></returns>
+	static WorkerPool& Shared();
+
+	/// <summary>
+	/// Destructor finishes already enqueued tasks and joins the threads
+	/// </summary>
+	~WorkerPool();
+
+private:
+	void run();
+
+	std::vector<std::thread> threads;
+	std::deque<std::function<void()>> tasks;
+	std::mutex m_mutex;
+	std::condition_variable cv;
+	bool stopped{ false };
+};
@@ -0,0 +1,200 @@
+
+#include "ContentAddressedStore.h"
+#include "MailboxIndex.h"
+#include "WireEncoder.h"
+#include "DurableFile.h"
+
+#include <fstream>
+#include <array>
+#include <cstdint>
+
+#ifdef MAILBOX_HAS_OPENSSL
+#include <openssl/sha.h>
+#endif
+
+namespace {
+	std::string toHex(const unsigned char* data, std::size_t size) {
+		constexpr const char* digits = "0123456789abcdef";
+		std::string hex;
+		hex.reserve(size * 2);
+		for (std::size_t i = 0; i < size; i++) {
+			hex.push_back(digits[data[i] >> 4]);
+			hex.push_back(digits[data[i] & 0xF]);
+		}
+		return hex;
+	}
+
+#ifdef MAILBOX_HAS_OPENSSL
+	//nobody can make two messages with one SHA-256 address, a body found under the address is the message
+	constexpr bool TrustedAddress = true;
+	constexpr int MaxCollisions = 1;
+
+	std::string contentAddress(std::string_view message) {
+		std::array<unsigned char, SHA256_DIGEST_LENGTH> digest;
+		SHA256(reinterpret_cast<const unsigned char*>(message.data()), message.size(), digest.data());
+		return toHex(digest.data(), digest.size());
+	}
+#else
+	//FNV-1a is easy to collide on purpose, so a body is compared with the message before it is shared
+	constexpr bool TrustedAddress = false;
+	constexpr int MaxCollisions = 16;
+
+	std::string contentAddress(std::string_view message) {
+		std::uint64_t hash = 14695981039346656037ULL;
+		for (auto c : message) {
+			hash ^= static_cast<unsigned char>(c);
+			hash *= 1099511628211ULL;
+		}
+		std::array<unsigned char, sizeof(hash)> octets;
+		for (auto i = octets.size(); i-- > 0; hash >>= 8) {
+			octets[i] = static_cast<unsigned char>(hash & 0xFF);
+		}
+		return toHex(octets.data(), octets.size());
+	}
+#endif
+
+	bool sameContent(const std::filesystem::path& file, std::string_view message) {
+		std::error_code ec;
+		if (std::filesystem::file_size(file, ec) != message.size() || ec) {
+			return false;
+		}
+		std::ifstream stream{ file, std::ios_base::in | std::ios_base::binary };
+		std::array<char, 65536> buffer;
+		std::size_t position = 0;
+		while (stream && position < message.size()) {
+			stream.read(buffer.data(), buffer.size());
+			auto count = static_cast<std::size_t>(stream.gcount());
+			if (message.compare(position, count, std::string_view(buffer.data(), count)) != 0) {
+				return false;
+			}
+			position += count;
+		}
+		return position == message.size();
+	}
+}
+
+std::filesystem::path ContentAddressedStore::DefaultRoot(const std::filesystem::path& mailboxDirectory) {
+	return mailboxDirectory.parent_path() / ".blobs";
+}
+
+std::filesystem::path ContentAddressedStore::blobPath(std::string_view blobName) const {
+	//first octet of the hash spreads bodies over subdirectories
+	return root / std::string(blobName.substr(0, 2)) / std::string(blobName);
+}
+
+std::optional<std::string> ContentAddressedStore::blobNameOf(const std::filesystem::path& mailboxFile) {
+	auto filename = mailboxFile.filename().string();
+	auto pos = filename.rfind('.');
+	if (pos == std::string::npos || filename.find('-', pos) == std::string::npos) {
+		return std::nullopt;
+	}
+	return filename.substr(pos + 1);
+}
+
+bool ContentAddressedStore::removeIfUnreferenced(const std::filesystem::path& blob) {
+	std::error_code ec;
+	auto links = std::filesystem::hard_link_count(blob, ec);
+	if (ec || links != 1) {
+		return false;
+	}
+	return std::filesystem::remove(blob, ec);
+}
+
+std::optional<std::string> ContentAddressedStore::storeBlob(std::string_view message) const {
+	auto base = contentAddress(message) + "-" + std::to_string(message.size());
+	for (int attempt = 0; attempt < MaxCollisions; attempt++) {
+		auto name = attempt == 0 ? base : base + "-" + std::to_string(attempt);
+		auto path = blobPath(name);
+		std::error_code ec;
+		if (std::filesystem::exists(path, ec)) {
+			if (TrustedAddress ? std::filesystem::file_size(path, ec) == message.size() && !ec : sameContent(path, message)) {
+				return name;
+			}
+			if (!TrustedAddress) {
+				//hash collision, try the next name
+				continue;
+			}
+			//a body cut short by a crash of a version which did not sync it, replaced below
+		}
+
+		bool created = std::filesystem::create_directories(path.parent_path(), ec);
+		auto tmp = root / ("tmp-" + DurableFile::UniqueName());
+		//the body is on the disk before it gets its name, and the name before the message is acknowledged
+		if (ec || !DurableFile::Write(tmp, message)) {
+			std::filesystem::remove(tmp, ec);
+			return std::nullopt;
+		}
+		std::filesystem::rename(tmp, path, ec);
+		if (ec || !DurableFile::SyncDirectory(path.parent_path()) || (created && !DurableFile::SyncDirectory(root))) {
+			std::filesystem::remove(tmp, ec);
+			return std::nullopt;
+		}
+		return name;
+	}
+	return std::nullopt;
+}
+
+std::vector<std::variant<std::filesystem::path, MailboxOperationError>> ContentAddressedStore::deliver(std::string_view message,
+	const std::vector<std::filesystem::path>& mailboxes) const
+{
+	std::vector<std::variant<std::filesystem::path, MailboxOperationError>> delivered(mailboxes.size(), MailboxOperationError::InternalError);
+	auto name = storeBlob(message);
+	if (!name) {
+		return delivered;
+	}
+	auto blob = blobPath(*name);
+	auto wireSize = WireEncoder::WireSize(message);
+
+	//every mailbox gets its own result, so the ones already linked are not delivered again by a retry
+	for (std::size_t i = 0; i < mailboxes.size(); i++) {
+		const auto& mailbox = mailboxes[i];
+		auto target = mailbox / (DurableFile::UniqueName() + "." + *name);
+		//the link is made under the lock of the mailbox index, so the index stays current
+		bool placed = MailboxIndex::Publish(mailbox, target, wireSize, [&]() {
+			std::error_code ec;
+			std::filesystem::create_hard_link(blob, target, ec);
+			if (ec == std::errc::no_such_file_or_directory && std::filesystem::exists(mailbox)) {
+				//body has just been collected as garbage, store it again under the name the link refers to
+				auto stored = storeBlob(message);
+				if (!stored || *stored != *name) {
+					return false;
+				}
+				ec.clear();
+				std::filesystem::create_hard_link(blob, target, ec);
+			}
+			if (ec) {
+				//mailbox is on another file system, the message is copied there
+				ec.clear();
+				std::filesystem::copy_file(blob, target, ec);
+			}
+			return !ec;
+		});
+		if (placed && DurableFile::SyncDirectory(mailbox)) {
+			delivered[i] = std::move(target);
+		}
+	}
+	return delivered;
+}
+
+std::size_t ContentAddressedStore::collect(const std::vector<std::filesystem::path>& removed) const {
+	std::size_t collected = 0;
+	for (const auto& file : removed) {
+		auto name = blobNameOf(file);
+		if (name && removeIfUnreferenced(blobPath(*name))) {
+			collected++;
+		}
+	}
+	return collected;
+}
+
+std::size_t ContentAddressedStore::collectGarbage() const {
+	std::size_t collected = 0;
+	std::error_code ec;
+	std::filesystem::recursive_directory_iterator it(root, ec), end;
+	for (; !ec && it != end; it.increment(ec)) {
+		if (it->is_regular_file() && it.depth() > 0 && removeIfUnreferenced(it->path())) {
+			collected++;
+		}
+	}
+	return collected;
+}
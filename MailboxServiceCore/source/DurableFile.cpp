@@ -0,0 +1,66 @@
+#include "DurableFile.h"
+
+#include <atomic>
+#include <chrono>
+
+#ifdef WIN32
+#include <io.h>
+#include <process.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+bool DurableFile::Sync(int handle) {
+#ifdef WIN32
+	return _commit(handle) == 0;
+#else
+	return ::fsync(handle) == 0;
+#endif
+}
+
+bool DurableFile::Flush(std::FILE* file) {
+	if (std::fflush(file) != 0) {
+		return false;
+	}
+#ifdef WIN32
+	return Sync(_fileno(file));
+#else
+	return Sync(fileno(file));
+#endif
+}
+
+bool DurableFile::Write(const std::filesystem::path& path, std::string_view content) {
+	std::FILE* file = std::fopen(path.string().c_str(), "wb");
+	if (!file) {
+		return false;
+	}
+	bool ok = content.empty() || std::fwrite(content.data(), 1, content.size(), file) == content.size();
+	ok = ok && Flush(file);
+	return std::fclose(file) == 0 && ok;
+}
+
+bool DurableFile::SyncDirectory([[maybe_unused]] const std::filesystem::path& directory) {
+#ifdef WIN32
+	return true;
+#else
+	int handle = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (handle < 0) {
+		return false;
+	}
+	bool ok = ::fsync(handle) == 0;
+	::close(handle);
+	return ok;
+#endif
+}
+
+std::string DurableFile::UniqueName() {
+	static std::atomic<std::size_t> counter{ 0 };
+#ifdef WIN32
+	auto pid = _getpid();
+#else
+	auto pid = getpid();
+#endif
+	return std::to_string(std::chrono::system_clock::now().time_since_epoch().count()) + "." + std::to_string(pid) + "." +
+		std::to_string(counter++);
+}
@@ -1,10 +1,17 @@
 
 #include "FileSystemMailStorage.h"
+#include "MailboxExpunger.h"
+#include "MessageCache.h"
+#include "MailboxIndex.h"
+#include "MessageIngest.h"
+#include "PackedMailStorage.h"
+#include "WorkerPool.h"
 #include <numeric>
 #include <fstream>
 #include <sstream>
 
 std::filesystem::path FileSystemStorageFactory::defaultPath = "";
+io_engine_ptr FileSystemStorageFactory::ioEngine = StorageIOEngine::Create(StorageIOEngineType::Synchronous);
 
 #ifdef WIN32
 #include <ShlObj_core.h>
@@ -13,8 +20,70 @@ std::filesystem::path FileSystemStorageFactory::defaultPath = "";
 #include <unistd.h>
 #endif
 
-std::map<std::size_t, std::size_t> FileSystemMailStorage::getEmailsLengths(std::size_t mailNumberOffset) const {
-	std::map<std::size_t, std::size_t> lengths;
+namespace {
+	MailboxExpunger::RemovedCallback removedCallback(const std::filesystem::path& directory, const std::optional<ContentAddressedStore>& blobStore) {
+		return [directory, blobStore](const std::vector<std::filesystem::path>& removed) {
+			MailboxIndex::Remove(directory, removed);
+			if (blobStore) {
+				blobStore->collect(removed);
+			}
+		};
+	}
+
+	/// <summary>
+	/// Reads a message file by chunks, used for messages too large for MessageCache
+	/// </summary>
+	class FileMessageReader : public MessageReader
+	{
+	public:
+		explicit FileMessageReader(const std::filesystem::path& path) : stream(path, std::ios_base::in | std::ios_base::binary) {}
+
+		inline bool isOpen() const { return stream.is_open(); }
+
+		std::variant<std::size_t, MailboxOperationError> read(char* buffer, std::size_t size) override {
+			stream.read(buffer, static_cast<std::streamsize>(size));
+			if (stream.bad()) {
+				return MailboxOperationError::InternalError;
+			}
+			return static_cast<std::size_t>(stream.gcount());
+		}
+
+	private:
+		std::ifstream stream;
+	};
+
+	/// <summary>
+	/// Reads a message delivered by MessageIngest, the file is handed to the session to be sent by sendfile
+	/// </summary>
+	class WireFileMessageReader : public MessageReader
+	{
+	public:
+		WireFileMessageReader(const std::filesystem::path& path, std::uint64_t _length) : file(path, false), length(_length) {}
+
+		inline bool isOpen() const { return file.isOpen(); }
+
+		std::variant<std::size_t, MailboxOperationError> read(char* buffer, std::size_t size) override {
+			auto count = static_cast<std::size_t>(std::min<std::uint64_t>(size, length - position));
+			if (count > 0 && !file.readAt(buffer, count, position)) {
+				return MailboxOperationError::InternalError;
+			}
+			position += count;
+			return count;
+		}
+
+		std::optional<WireFile> wireFile() const override {
+			return WireFile{ file.nativeHandle(), 0, length };
+		}
+
+	private:
+		PackedFile file;
+		const std::uint64_t length;
+		std::uint64_t position{ 0 };
+	};
+}
+
+email_lengths FileSystemMailStorage::getEmailsLengths(std::size_t mailNumberOffset, std::pmr::memory_resource* resource) const {
+	email_lengths lengths(resource);
 	for (std::size_t i = 0; i < emails.size(); i++) {
 		if (!isMailMarkedAsDeleted(i)) {
 			lengths.emplace(i + mailNumberOffset, getEmailLength(i));
@@ -24,22 +93,61 @@ std::map<std::size_t, std::size_t> FileSystemMailStorage::getEmailsLengths(std::
 }
 
 std::size_t FileSystemMailStorage::getEmailLength(std::size_t emailNumber) const {
-	return std::filesystem::file_size(emails[emailNumber]);
+	return wireSizes[emailNumber];
 }
 
 std::variant<std::string, MailboxOperationError> FileSystemMailStorage::getEmail(std::size_t emailNumber) const {
 	if (isMailMarkedAsDeleted(emailNumber)) {
 		return MailboxOperationError::MailIsMarkedAsDeleted;
 	}
-	auto len = std::filesystem::file_size(emails[emailNumber]);
-	std::ifstream file{ emails[emailNumber] };
-	if (!file.is_open()) {
-		return MailboxOperationError::InternalError;
+	return ioEngine->readFile(emails[emailNumber], attributes[emailNumber].size);
+}
+
+std::variant<message_reader_ptr, MailboxOperationError> FileSystemMailStorage::openEmail(std::size_t emailNumber) const {
+	if (isMailMarkedAsDeleted(emailNumber)) {
+		return MailboxOperationError::MailIsMarkedAsDeleted;
+	}
+	auto [first, last] = readAhead.access(emailNumber, emails.size());
+	if (first < last) {
+		std::vector<std::filesystem::path> following;
+		for (auto i = first; i < last; i++) {
+			if (!isMailMarkedAsDeleted(i)) {
+				following.push_back(emails[i]);
+			}
+		}
+		//opening the files may block, so it is not done on the session's thread
+		WorkerPool::Shared().post([engine = ioEngine, following = std::move(following)]() { engine->prefetchFiles(following); });
 	}
-	std::ostringstream os;
-	os << file.rdbuf();
-	return os.str();
-	//return read_file(fis, len);
+
+	const auto& file = attributes[emailNumber];
+	if (MessageIngest::IsWireForm(emails[emailNumber])) {
+		//sendfile makes both reading and caching in user space unnecessary
+		auto reader = std::make_unique<WireFileMessageReader>(emails[emailNumber], file.size);
+		if (!reader->isOpen()) {
+			return MailboxOperationError::InternalError;
+		}
+		return message_reader_ptr(std::move(reader));
+	}
+	auto& cache = MessageCache::Shared();
+	if (!cache.admits(file.size)) {
+		auto reader = std::make_unique<FileMessageReader>(emails[emailNumber]);
+		if (!reader->isOpen()) {
+			return MailboxOperationError::InternalError;
+		}
+		return message_reader_ptr(std::move(reader));
+	}
+
+	MessageCache::Key key{ emails[emailNumber].string(), file.inode, file.mtime };
+	auto buffer = cache.find(key);
+	if (!buffer) {
+		auto result = ioEngine->readFile(emails[emailNumber], file.size);
+		if (std::holds_alternative<MailboxOperationError>(result)) {
+			return std::get<MailboxOperationError>(result);
+		}
+		buffer = std::make_shared<const std::string>(std::move(std::get<std::string>(result)));
+		cache.insert(key, buffer);
+	}
+	return message_reader_ptr(new BufferMessageReader(std::move(buffer)));
 }
 
 auto FileSystemMailStorage::read_file(std::ifstream& stream, std::size_t len) -> std::string {
@@ -58,36 +166,74 @@ auto FileSystemMailStorage::read_file(std::ifstream& stream, std::size_t len) ->
 
 FileSystemMailStorage::~FileSystemMailStorage() {
 	if (updateAtClose) {
-		std::for_each(emailsToBeDeleted.cbegin(), emailsToBeDeleted.cend(), [this](const std::size_t& number) {
-			std::filesystem::remove(emails[number]);
-			});
+		std::vector<std::filesystem::path> files;
+		if (deleteAll) {
+			files = emails;
+		}
+		else {
+			files.reserve(emailsToBeDeleted.size());
+			std::transform(emailsToBeDeleted.cbegin(), emailsToBeDeleted.cend(), std::back_inserter(files), [this](const std::size_t& number) {
+				return emails[number];
+				});
+		}
+		//only the journal is written here, files are removed in background
+		MailboxExpunger::Schedule(directory, files, ioEngine, removedCallback(directory, blobStore));
 	}
 }
 
-std::shared_ptr<FileSystemMailStorage> FileSystemStorageFactory::create(const MailStorageInfo& info, 
-	[[maybe_unused]] std::string_view name)  
-{
-	std::filesystem::path path;
+FileSystemStorageFactory::Settings FileSystemStorageFactory::resolve(const MailStorageInfo& info, std::string_view name) {
+	Settings settings;
 	for (unsigned int i = 0; i < info.count; i++) {
 		if (info[i].name == Option::name_type("path")) {
-			path = std::get<std::string>(info[i].value);
+			settings.path = std::get<std::string>(info[i].value);
+		}
+		else if (info[i].name == Option::name_type("blobs")) {
+			settings.blobs = std::get<std::string>(info[i].value);
 		}
 	}
 
-	if (path.empty()) {
-		path = defaultPath / name;
+	if (settings.path.empty()) {
+		settings.path = defaultPath / name;
+	}
+	if (info.storageType != StorageType::DeduplicatedMailStorage) {
+		settings.blobs.clear();
+	}
+	else if (settings.blobs.empty()) {
+		settings.blobs = ContentAddressedStore::DefaultRoot(settings.path);
 	}
+	return settings;
+}
 
-	if (!std::filesystem::exists(path)) {
-		if (!std::filesystem::create_directory(path)) {
-			throw std::exception{ "Failed to create mailbox directory" };
-		}
+std::shared_ptr<FileSystemMailStorage> FileSystemStorageFactory::create(const MailStorageInfo& info, 
+	[[maybe_unused]] std::string_view name)  
+{
+	auto settings = resolve(info, name);
+	const auto& path = settings.path;
+
+	std::optional<ContentAddressedStore> blobStore;
+	if (!settings.blobs.empty()) {
+		blobStore.emplace(settings.blobs);
 	}
 
+	//files expunged by a previous session may be still waiting for removal
+	auto expunged = MailboxExpunger::Recover(path, ioEngine, removedCallback(path, blobStore));
+
+	//the directory is listed only if something else than deliveries has changed it since the last login,
+	//a missing directory is created here
+	auto entries = MailboxIndex::Load(path, expunged, ioEngine);
 	std::vector<std::filesystem::path> emails;
-	std::copy_if(std::filesystem::directory_iterator(path), std::filesystem::directory_iterator{},
-		std::back_inserter(emails), [](const auto& path) { return std::filesystem::is_regular_file(path); });
-	return std::make_shared<FileSystemMailStorage>(emails);
+	std::vector<FileAttributes> attributes;
+	std::vector<std::size_t> wireSizes;
+	emails.reserve(entries.size());
+	attributes.reserve(entries.size());
+	wireSizes.reserve(entries.size());
+	for (auto& entry : entries) {
+		emails.push_back(std::move(entry.file));
+		attributes.push_back(entry.attributes);
+		wireSizes.push_back(entry.wireSize);
+	}
+	return std::make_shared<FileSystemMailStorage>(path, std::move(emails), std::move(attributes), std::move(wireSizes), ioEngine,
+		std::move(blobStore));
 }
 
 /*
@@ -0,0 +1,49 @@
+
+#include "LoginThrottle.h"
+
+#include <functional>
+#include <algorithm>
+
+namespace {
+	std::uint64_t keyOf(std::string_view name) {
+		return static_cast<std::uint64_t>(std::hash<std::string_view>{}(name));
+	}
+
+	const auto started = std::chrono::steady_clock::now();
+}
+
+std::uint32_t LoginThrottle::now() {
+	//seconds since the start of the process fit 32 bits for a century
+	return static_cast<std::uint32_t>(std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - started).count());
+}
+
+bool LoginThrottle::allowed(std::string_view name) const {
+	auto delay = delaySeconds.load();
+	if (delay <= 0) {
+		return true;
+	}
+	auto key = keyOf(name);
+	const auto& shard = shardOf(key);
+	std::lock_guard<std::mutex> lg{ shard.m_mutex };
+	auto it = shard.lastLogons.find(key);
+	return it == shard.lastLogons.end() || now() - it->second >= static_cast<std::uint64_t>(delay);
+}
+
+void LoginThrottle::record(std::string_view name) {
+	auto delay = delaySeconds.load();
+	if (delay <= 0) {
+		return;
+	}
+	auto key = keyOf(name);
+	auto& shard = shardOf(key);
+	auto time = now();
+	std::lock_guard<std::mutex> lg{ shard.m_mutex };
+	shard.lastLogons[key] = time;
+	if (shard.lastLogons.size() > shard.sweepAt) {
+		//consumers which may log on again do not need their entries
+		for (auto it = shard.lastLogons.begin(); it != shard.lastLogons.end();) {
+			it = time - it->second >= static_cast<std::uint64_t>(delay) ? shard.lastLogons.erase(it) : std::next(it);
+		}
+		shard.sweepAt = std::max(SweepSize, shard.lastLogons.size() * 2);
+	}
+}
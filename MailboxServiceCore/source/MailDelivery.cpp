@@ -0,0 +1,87 @@
+
+#include "MailDelivery.h"
+#include "MailboxServiceManager.h"
+#include "FileSystemMailStorage.h"
+#include "PackedMailStorage.h"
+#include "MaildirStorage.h"
+#include "ContentAddressedStore.h"
+#include "MessageIngest.h"
+
+#include <map>
+
+namespace {
+	struct Group {
+		std::vector<std::filesystem::path> mailboxes;
+		//numbers of the recipients owning the mailboxes
+		std::vector<std::size_t> recipients;
+	};
+
+	void setResults(std::vector<MailboxOperationError>& results, const Group& group,
+		const std::vector<std::variant<std::filesystem::path, MailboxOperationError>>& delivered)
+	{
+		for (std::size_t i = 0; i < delivered.size(); i++) {
+			results[group.recipients[i]] = std::holds_alternative<MailboxOperationError>(delivered[i]) ?
+				std::get<MailboxOperationError>(delivered[i]) : MailboxOperationError::NoError;
+		}
+	}
+
+	bool prepareDirectory(const std::filesystem::path& path) {
+		std::error_code ec;
+		std::filesystem::create_directories(path, ec);
+		return !ec;
+	}
+}
+
+bool MailDelivery::CanDeliver(std::string_view recipient) {
+	auto storages = MailboxServiceManager::GetMailStorages(recipient);
+	return !storages.empty() && checkIfStorageTypeValid(storages.front().storageType);
+}
+
+std::vector<MailboxOperationError> MailDelivery::Deliver(std::string_view message, const std::vector<std::string>& recipients) {
+	std::vector<MailboxOperationError> results(recipients.size(), MailboxOperationError::MailboxNotExist);
+	Group plain;
+	std::map<std::filesystem::path, Group> deduplicated;
+
+	for (std::size_t i = 0; i < recipients.size(); i++) {
+		auto storages = MailboxServiceManager::GetMailStorages(recipients[i]);
+		if (storages.empty()) {
+			continue;
+		}
+		//new mail goes to the first storage of the consumer
+		const auto& info = storages.front();
+		switch (info.storageType) {
+		case StorageType::FileSystemMailStorage:
+		case StorageType::DeduplicatedMailStorage: {
+			auto settings = FileSystemStorageFactory::resolve(info, recipients[i]);
+			if (!prepareDirectory(settings.path)) {
+				results[i] = MailboxOperationError::MailboxCreateError;
+				break;
+			}
+			auto& group = settings.blobs.empty() ? plain : deduplicated[settings.blobs];
+			group.mailboxes.push_back(std::move(settings.path));
+			group.recipients.push_back(i);
+			break;
+		}
+		case StorageType::PackedMailStorage: {
+			auto result = PackedStorageFactory::append(info, recipients[i], message);
+			results[i] = std::holds_alternative<MailboxOperationError>(result) ? std::get<MailboxOperationError>(result) : MailboxOperationError::NoError;
+			break;
+		}
+		case StorageType::MaildirMailStorage: {
+			auto result = MaildirStorageFactory::deliver(FileSystemStorageFactory::resolve(info, recipients[i]).path, message);
+			results[i] = std::holds_alternative<MailboxOperationError>(result) ? std::get<MailboxOperationError>(result) : MailboxOperationError::NoError;
+			break;
+		}
+		default:
+			break;
+		}
+	}
+
+	if (!plain.mailboxes.empty()) {
+		setResults(results, plain, MessageIngest::Deliver(plain.mailboxes, message));
+	}
+	for (const auto& [root, group] : deduplicated) {
+		setResults(results, group, ContentAddressedStore(root).deliver(message, group.mailboxes));
+	}
+	return results;
+}
@@ -1,6 +1,36 @@
 
 #include "Mailbox.h"
 #include "common_headers.h"
+#include "Metrics.h"
+
+namespace {
+	//time spent in storages by operation
+	struct StorageMetrics {
+		MetricsRegistry::Histogram lengths;
+		MetricsRegistry::Histogram read;
+		MetricsRegistry::Histogram open;
+		MetricsRegistry::Histogram remove;
+		MetricsRegistry::Histogram deleteMarked;
+		MetricsRegistry::Histogram reset;
+
+		StorageMetrics() {
+			auto& registry = MetricsRegistry::Shared();
+			constexpr std::string_view name = "mailbox_storage_latency_microseconds";
+			constexpr std::string_view help = "Time of mail storage operations";
+			lengths = registry.histogram(name, help, { { "operation", "lengths" } });
+			read = registry.histogram(name, help, { { "operation", "read" } });
+			open = registry.histogram(name, help, { { "operation", "open" } });
+			remove = registry.histogram(name, help, { { "operation", "delete" } });
+			deleteMarked = registry.histogram(name, help, { { "operation", "delete_marked" } });
+			reset = registry.histogram(name, help, { { "operation", "reset" } });
+		}
+	};
+
+	const StorageMetrics& storageMetrics() {
+		static const StorageMetrics instance;
+		return instance;
+	}
+}
 
 std::size_t Mailbox::getEmailsCount() const {
 	return std::accumulate(storages.cbegin(), storages.cend(), static_cast<std::size_t>(0), [](std::size_t sum, const auto& storage)
@@ -10,13 +40,14 @@ std::size_t Mailbox::getEmailsCount() const {
 	);
 }
 
-std::map<std::size_t, std::size_t> Mailbox::getEmailsLengths() const {
-	std::map<std::size_t, std::size_t> lengths;
+email_lengths Mailbox::getEmailsLengths(std::pmr::memory_resource* resource) const {
+	MetricsRegistry::Stopwatch stopwatch{ storageMetrics().lengths };
+	email_lengths lengths(resource);
 	auto it = std::inserter(lengths, lengths.begin());
 	std::size_t offset = 0;
-	std::for_each(storages.cbegin(), storages.cend(), [&lengths, &offset, &it](const auto& storage)
+	std::for_each(storages.cbegin(), storages.cend(), [&lengths, &offset, &it, resource](const auto& storage)
 		{
-			auto mp = storage->getEmailsLengths(offset);
+			auto mp = storage->getEmailsLengths(offset, resource);
 			std::copy(mp.cbegin(), mp.cend(), it);
 			offset += storage->getEmailsCount();
 		}
@@ -24,8 +55,8 @@ std::map<std::size_t, std::size_t> Mailbox::getEmailsLengths() const {
 	return lengths;
 }
 
-std::size_t Mailbox::getWholeMailboxSize() const {
-	auto mp = getEmailsLengths();
+std::size_t Mailbox::getWholeMailboxSize(std::pmr::memory_resource* resource) const {
+	auto mp = getEmailsLengths(resource);
 	return std::accumulate(mp.cbegin(), mp.cend(), static_cast<std::size_t>(0), [](auto sum, const auto& pair) { return sum + pair.second; });
 }
 
@@ -44,6 +75,7 @@ std::variant<std::size_t, MailboxOperationError> Mailbox::getEmailLength(std::si
 }
 
 std::variant<std::string, MailboxOperationError> Mailbox::getEmail(std::size_t emailNumber) const {
+	MetricsRegistry::Stopwatch stopwatch{ storageMetrics().read };
 	auto it = findStorage(emailNumber);
 
 	if (it == storages.cend()) {
@@ -53,7 +85,23 @@ std::variant<std::string, MailboxOperationError> Mailbox::getEmail(std::size_t e
 	return (*it)->getEmail(emailNumber);
 }
 
+std::variant<message_reader_ptr, MailboxOperationError> Mailbox::openEmail(std::size_t emailNumber) const {
+	MetricsRegistry::Stopwatch stopwatch{ storageMetrics().open };
+	auto it = findStorage(emailNumber);
+
+	if (it == storages.cend()) {
+		return MailboxOperationError::EmailNotFound;
+	}
+
+	if ((*it)->isMailMarkedAsDeleted(emailNumber)) {
+		return MailboxOperationError::MailIsMarkedAsDeleted;
+	}
+
+	return (*it)->openEmail(emailNumber);
+}
+
 MailboxOperationError Mailbox::deleteEmail(std::size_t emailNumber) {
+	MetricsRegistry::Stopwatch stopwatch{ storageMetrics().remove };
 	auto it = findStorage(emailNumber);
 
 	if (it == storages.cend()) {
@@ -64,10 +112,12 @@ MailboxOperationError Mailbox::deleteEmail(std::size_t emailNumber) {
 }
 
 void Mailbox::deleteEmails() {
+	MetricsRegistry::Stopwatch stopwatch{ storageMetrics().deleteMarked };
 	std::for_each(storages.cbegin(), storages.cend(), [](const auto& storage) { storage->deleteEmails(); });
 }
 
 void Mailbox::reset() {
+	MetricsRegistry::Stopwatch stopwatch{ storageMetrics().reset };
 	std::for_each(storages.cbegin(), storages.cend(), [](const auto& storage) { storage->reset(); });
 }
 
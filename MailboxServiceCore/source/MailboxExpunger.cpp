@@ -0,0 +1,195 @@
+
+#include "MailboxExpunger.h"
+#include "WorkerPool.h"
+#include "DurableFile.h"
+
+#include <map>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <cstdio>
+#include <algorithm>
+
+std::mutex MailboxExpunger::m_mutex;
+std::vector<MailboxExpunger::Job> MailboxExpunger::queue;
+std::map<std::filesystem::path, std::vector<std::filesystem::path>> MailboxExpunger::inProgress;
+std::set<std::filesystem::path> MailboxExpunger::recovered;
+bool MailboxExpunger::draining = false;
+
+namespace {
+	constexpr const char* JournalHeader = "expunge";
+	constexpr const char* JournalExtension = ".journal";
+}
+
+std::filesystem::path MailboxExpunger::writeJournal(const std::filesystem::path& mailboxDirectory, const std::vector<std::filesystem::path>& files) {
+	static std::atomic<std::size_t> counter{ 0 };
+	auto metadata = mailboxDirectory / MetadataDirectory;
+	std::error_code ec;
+	bool created = std::filesystem::create_directory(metadata, ec);
+	if (ec || (created && !DurableFile::SyncDirectory(mailboxDirectory))) {
+		return {};
+	}
+
+	auto id = std::to_string(std::chrono::system_clock::now().time_since_epoch().count()) + "-" + std::to_string(counter++);
+	auto tmp = metadata / ("expunge-" + id + ".tmp");
+	auto journal = metadata / ("expunge-" + id + JournalExtension);
+
+	std::FILE* file = std::fopen(tmp.string().c_str(), "wb");
+	if (!file) {
+		return {};
+	}
+	bool ok = std::fprintf(file, "%s\n", JournalHeader) > 0;
+	//paths are relative to the mailbox, messages may be kept in its subdirectories
+	std::for_each(files.cbegin(), files.cend(), [&ok, file, &mailboxDirectory](const auto& path) {
+		ok = ok && std::fprintf(file, "%s\n", path.lexically_relative(mailboxDirectory).string().c_str()) > 0;
+	});
+	ok = DurableFile::Flush(file) && ok;
+	std::fclose(file);
+
+	//rename makes the journal visible only when it is complete, the synced directory keeps it after a crash
+	if (ok) {
+		std::filesystem::rename(tmp, journal, ec);
+		ok = !ec && DurableFile::SyncDirectory(metadata);
+	}
+	if (!ok) {
+		std::filesystem::remove(tmp, ec);
+		std::filesystem::remove(journal, ec);
+		return {};
+	}
+	return journal;
+}
+
+std::vector<std::filesystem::path> MailboxExpunger::readJournal(const std::filesystem::path& journal) {
+	std::vector<std::filesystem::path> files;
+	std::ifstream stream{ journal };
+	std::string line;
+	if (!std::getline(stream, line) || line != JournalHeader) {
+		return files;
+	}
+	auto mailboxDirectory = journal.parent_path().parent_path();
+	while (std::getline(stream, line)) {
+		if (!line.empty()) {
+			files.push_back(mailboxDirectory / line);
+		}
+	}
+	return files;
+}
+
+bool MailboxExpunger::Schedule(const std::filesystem::path& mailboxDirectory, const std::vector<std::filesystem::path>& files, io_engine_ptr engine,
+	RemovedCallback onRemoved) 
+{
+	if (files.empty()) {
+		return true;
+	}
+	auto journal = writeJournal(mailboxDirectory, files);
+	if (journal.empty()) {
+		engine->unlinkFiles(files);
+		if (onRemoved) {
+			onRemoved(files);
+		}
+		return false;
+	}
+	enqueue(Job{ std::move(journal), files, std::move(engine), std::move(onRemoved) });
+	return true;
+}
+
+std::set<std::filesystem::path> MailboxExpunger::Recover(const std::filesystem::path& mailboxDirectory, io_engine_ptr engine,
+	RemovedCallback onRemoved) 
+{
+	std::set<std::filesystem::path> pending;
+	{
+		std::lock_guard<std::mutex> lg{ m_mutex };
+		if (recovered.find(mailboxDirectory) != recovered.cend()) {
+			for (const auto& [journal, files] : inProgress) {
+				if (journal.parent_path().parent_path() == mailboxDirectory) {
+					pending.insert(files.cbegin(), files.cend());
+				}
+			}
+			return pending;
+		}
+	}
+	auto metadata = mailboxDirectory / MetadataDirectory;
+	std::error_code ec;
+	std::filesystem::directory_iterator it(metadata, ec), end;
+	if (ec) {
+		//no metadata - nothing was ever expunged here
+		std::lock_guard<std::mutex> lg{ m_mutex };
+		recovered.insert(mailboxDirectory);
+		return pending;
+	}
+	for (; it != end; it.increment(ec)) {
+		const auto& journal = it->path();
+		if (journal.extension() != JournalExtension) {
+			continue;
+		}
+		auto files = readJournal(journal);
+		pending.insert(files.cbegin(), files.cend());
+		bool known;
+		{
+			std::lock_guard<std::mutex> lg{ m_mutex };
+			known = inProgress.find(journal) != inProgress.cend();
+		}
+		if (!known) {
+			enqueue(Job{ journal, std::move(files), engine, onRemoved });
+		}
+	}
+	std::lock_guard<std::mutex> lg{ m_mutex };
+	recovered.insert(mailboxDirectory);
+	return pending;
+}
+
+std::size_t MailboxExpunger::ReplayJournals(const std::filesystem::path& root, io_engine_ptr engine) {
+	std::size_t mailboxes = 0;
+	std::error_code ec;
+	std::filesystem::directory_iterator it(root, ec), end;
+	for (; !ec && it != end; it.increment(ec)) {
+		if (it->is_directory()) {
+			mailboxes += Recover(it->path(), engine).empty() ? 0 : 1;
+		}
+	}
+	return mailboxes;
+}
+
+void MailboxExpunger::enqueue(Job job) {
+	std::lock_guard<std::mutex> lg{ m_mutex };
+	inProgress.emplace(job.journal, job.files);
+	queue.push_back(std::move(job));
+	if (!draining) {
+		draining = true;
+		WorkerPool::Shared().post(&MailboxExpunger::drain);
+	}
+}
+
+void MailboxExpunger::drain() {
+	while (true) {
+		std::vector<Job> jobs;
+		{
+			std::lock_guard<std::mutex> lg{ m_mutex };
+			if (queue.empty()) {
+				draining = false;
+				return;
+			}
+			jobs.swap(queue);
+		}
+
+		//everything queued meanwhile is removed by one batch per engine
+		std::map<StorageIOEngine*, std::vector<std::filesystem::path>> batches;
+		std::for_each(jobs.cbegin(), jobs.cend(), [&batches](const auto& job) {
+			auto& batch = batches[job.engine.get()];
+			batch.insert(batch.end(), job.files.cbegin(), job.files.cend());
+		});
+		std::for_each(batches.cbegin(), batches.cend(), [](const auto& batch) {
+			batch.first->unlinkFiles(batch.second);
+		});
+
+		std::for_each(jobs.cbegin(), jobs.cend(), [](const auto& job) {
+			if (job.onRemoved) {
+				job.onRemoved(job.files);
+			}
+			std::error_code ec;
+			std::filesystem::remove(job.journal, ec);
+			std::lock_guard<std::mutex> lg{ m_mutex };
+			inProgress.erase(job.journal);
+		});
+	}
+}
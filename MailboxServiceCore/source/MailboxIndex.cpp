@@ -0,0 +1,488 @@
+
+#include "MailboxIndex.h"
+#include "WireEncoder.h"
+#include "MailboxExpunger.h"
+#include "MessageIngest.h"
+
+#include <unordered_map>
+#include <fstream>
+#include <sstream>
+#include <atomic>
+#include <string>
+#include <cstdio>
+#include <cinttypes>
+#include <stdexcept>
+#include <iterator>
+#include <algorithm>
+#include <chrono>
+
+#ifdef WIN32
+#include <io.h>
+#include <fcntl.h>
+#include <share.h>
+#include <sys/stat.h>
+#include <sys/locking.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#endif
+
+std::mutex MailboxIndex::m_mutex;
+std::map<std::string, std::weak_ptr<std::mutex>> MailboxIndex::directoryMutexes;
+MailboxIndex::snapshot_list MailboxIndex::snapshotOrder;
+std::unordered_map<std::string, MailboxIndex::snapshot_list::iterator> MailboxIndex::snapshots;
+
+namespace {
+	//header is of fixed width, so modification time of the directory and time of listing are updated in place
+	constexpr const char* IndexHeader = "mailbox-index 2 ";
+	constexpr const char* HeaderFormat = "mailbox-index 2 %020" PRId64 " %020" PRId64 "\n";
+	constexpr std::size_t MeasureChunk = 65536;
+	//file systems keeping nanoseconds stamp files by the kernel tick, others by seconds (two on FAT)
+	constexpr std::int64_t FineTimestampGranularity = 50000000;
+	constexpr std::int64_t CoarseTimestampGranularity = 2000000000;
+	constexpr const char* LockFileName = "index.lock";
+
+	struct Record {
+		std::string name;
+		FileAttributes attributes;
+		std::size_t wireSize;
+	};
+
+	struct IndexContent {
+		bool valid{ false };
+		std::int64_t directoryMtime{ 0 };
+		std::int64_t listedAt{ 0 };
+		std::vector<Record> records;
+	};
+
+	//current time by the clock of FileAttributes::mtime
+	std::int64_t fileClockNow() {
+#ifdef WIN32
+		auto now = std::filesystem::file_time_type::clock::now().time_since_epoch();
+#else
+		auto now = std::chrono::system_clock::now().time_since_epoch();
+#endif
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+	}
+
+	/// <summary>
+	/// Whether a directory listed at listedAt has a later modification time after any change.
+	/// A time without a fraction of a second is taken for one of a file system with coarse timestamps.
+	/// </summary>
+	bool settled(std::int64_t directoryMtime, std::int64_t listedAt) {
+		auto granularity = directoryMtime % 1000000000 != 0 ? FineTimestampGranularity : CoarseTimestampGranularity;
+		return listedAt - directoryMtime >= granularity;
+	}
+
+	/// <summary>
+	/// Compare names of regular files in the directory with the records and an extra file,
+	/// readdir reports file types, so no file is examined
+	/// </summary>
+	bool sameNames(const std::filesystem::path& directory, const std::vector<Record>& records, const std::string& extra = {}) {
+		std::vector<std::string> expected;
+		expected.reserve(records.size() + 1);
+		std::transform(records.cbegin(), records.cend(), std::back_inserter(expected), [](const auto& record) { return record.name; });
+		if (!extra.empty()) {
+			expected.push_back(extra);
+		}
+		std::vector<std::string> present;
+		present.reserve(expected.size());
+		std::error_code ec;
+		std::filesystem::directory_iterator it(directory, ec), end;
+		for (; !ec && it != end; it.increment(ec)) {
+			if (it->is_regular_file(ec)) {
+				present.push_back(it->path().filename().string());
+			}
+		}
+		if (ec) {
+			return false;
+		}
+		std::sort(expected.begin(), expected.end());
+		std::sort(present.begin(), present.end());
+		return expected == present;
+	}
+
+	std::filesystem::path indexPath(const std::filesystem::path& mailboxDirectory) {
+		return mailboxDirectory / MailboxExpunger::MetadataDirectory / MailboxIndex::FileName;
+	}
+
+	/// <summary>
+	/// Exclusive lock of the index among processes (the server and MailIngest), taken on a file beside it:
+	/// the index itself is replaced by rename, so it cannot hold the lock.
+	/// Not taken if the metadata directory does not exist yet, in that case there is no index to protect either.
+	/// </summary>
+	class IndexFileLock
+	{
+	public:
+		explicit IndexFileLock(const std::filesystem::path& mailboxDirectory) {
+			auto path = mailboxDirectory / MailboxExpunger::MetadataDirectory / LockFileName;
+#ifdef WIN32
+			if (_sopen_s(&handle, path.string().c_str(), _O_RDWR | _O_CREAT | _O_BINARY, _SH_DENYNO, _S_IREAD | _S_IWRITE) == 0) {
+				//locks the first octet, retries for 10 seconds
+				locked = _locking(handle, _LK_LOCK, 1) == 0;
+			}
+#else
+			handle = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+			if (handle >= 0) {
+				int res;
+				while ((res = ::flock(handle, LOCK_EX)) != 0 && errno == EINTR) {}
+				locked = res == 0;
+			}
+#endif
+		}
+
+		//noncopyable
+		IndexFileLock(const IndexFileLock&) = delete;
+		IndexFileLock& operator=(const IndexFileLock&) = delete;
+
+		~IndexFileLock() {
+			if (handle < 0) {
+				return;
+			}
+#ifdef WIN32
+			if (locked) {
+				_locking(handle, _LK_UNLCK, 1);
+			}
+			_close(handle);
+#else
+			//closing releases the lock
+			::close(handle);
+#endif
+		}
+
+		inline bool isLocked() const { return locked; }
+
+	private:
+		int handle{ -1 };
+		bool locked{ false };
+	};
+
+	std::vector<MailboxIndex::Entry> withoutExcluded(const std::vector<MailboxIndex::Entry>& entries, const std::set<std::filesystem::path>& excluded) {
+		std::vector<MailboxIndex::Entry> result;
+		result.reserve(entries.size());
+		std::copy_if(entries.cbegin(), entries.cend(), std::back_inserter(result), [&excluded](const auto& entry) {
+			return excluded.find(entry.file) == excluded.cend();
+		});
+		return result;
+	}
+
+	//stat of a single file or directory, the storage engine is not worth a batch here
+	io_engine_ptr statEngine() {
+		static io_engine_ptr engine = StorageIOEngine::Create(StorageIOEngineType::Synchronous);
+		return engine;
+	}
+
+	std::string formatRecord(const std::string& name, const FileAttributes& attributes, std::size_t wireSize) {
+		std::ostringstream line;
+		//<size> <mtime> <inode> <wire size> <file name>, the name is the rest of the line
+		line << attributes.size << " " << attributes.mtime << " " << attributes.inode << " " << wireSize << " " << name << "\n";
+		return line.str();
+	}
+
+	IndexContent readIndex(const std::filesystem::path& path) {
+		IndexContent content;
+		std::ifstream stream{ path };
+		std::string line;
+		if (!std::getline(stream, line) || line.compare(0, std::char_traits<char>::length(IndexHeader), IndexHeader) != 0) {
+			return content;
+		}
+		std::istringstream header{ line.substr(std::char_traits<char>::length(IndexHeader)) };
+		if (!(header >> content.directoryMtime >> content.listedAt)) {
+			return content;
+		}
+		while (std::getline(stream, line)) {
+			std::istringstream fields{ line };
+			Record record;
+			if (fields >> record.attributes.size >> record.attributes.mtime >> record.attributes.inode >> record.wireSize &&
+				fields.get() == ' ' && std::getline(fields, record.name))
+			{
+				content.records.push_back(std::move(record));
+			}
+		}
+		content.valid = true;
+		return content;
+	}
+
+	void writeIndex(const std::filesystem::path& path, std::int64_t directoryMtime, std::int64_t listedAt, const std::vector<MailboxIndex::Entry>& entries) {
+		static std::atomic<std::size_t> counter{ 0 };
+		std::error_code ec;
+		std::filesystem::create_directory(path.parent_path(), ec);
+		auto tmp = path;
+		tmp += "." + std::to_string(counter++) + ".tmp";
+		{
+			std::ofstream stream{ tmp, std::ios_base::out | std::ios_base::trunc | std::ios_base::binary };
+			char header[64];
+			std::snprintf(header, sizeof(header), HeaderFormat, directoryMtime, listedAt);
+			stream << header;
+			for (const auto& entry : entries) {
+				stream << formatRecord(entry.file.filename().string(), entry.attributes, entry.wireSize);
+			}
+			if (!stream.flush()) {
+				ec = std::make_error_code(std::errc::io_error);
+			}
+		}
+		//the index is only a cache, so a failed update is not an error
+		if (!ec) {
+			std::filesystem::rename(tmp, path, ec);
+		}
+		if (ec) {
+			std::filesystem::remove(tmp, ec);
+		}
+	}
+
+	/// <summary>
+	/// Append a record (none if empty) and then store the new modification time of the directory and time of listing,
+	/// if the process stops in between, the index just does not match the directory
+	/// </summary>
+	bool appendRecord(const std::filesystem::path& path, const std::string& record, std::int64_t directoryMtime, std::int64_t listedAt) {
+		std::FILE* file = std::fopen(path.string().c_str(), "r+b");
+		if (!file) {
+			return false;
+		}
+		char header[64];
+		auto headerSize = std::snprintf(header, sizeof(header), HeaderFormat, directoryMtime, listedAt);
+		bool ok = std::fseek(file, 0, SEEK_END) == 0 && std::fwrite(record.data(), 1, record.size(), file) == record.size() &&
+			std::fflush(file) == 0 && std::fseek(file, 0, SEEK_SET) == 0 &&
+			std::fwrite(header, 1, static_cast<std::size_t>(headerSize), file) == static_cast<std::size_t>(headerSize);
+		return std::fclose(file) == 0 && ok;
+	}
+}
+
+std::shared_ptr<std::mutex> MailboxIndex::getDirectoryMutex(const std::filesystem::path& directory) {
+	std::lock_guard<std::mutex> lg{ m_mutex };
+	auto& weak = directoryMutexes[directory.string()];
+	auto mutex = weak.lock();
+	if (!mutex) {
+		mutex = std::make_shared<std::mutex>();
+		weak = mutex;
+	}
+	return mutex;
+}
+
+MailboxIndex::snapshot_ptr MailboxIndex::findSnapshot(const std::filesystem::path& directory) {
+	std::lock_guard<std::mutex> lg{ m_mutex };
+	auto it = snapshots.find(directory.string());
+	if (it == snapshots.end()) {
+		return nullptr;
+	}
+	//move to the head of LRU list
+	snapshotOrder.splice(snapshotOrder.begin(), snapshotOrder, it->second);
+	return it->second->second;
+}
+
+void MailboxIndex::storeSnapshot(const std::filesystem::path& directory, snapshot_ptr snapshot) {
+	std::lock_guard<std::mutex> lg{ m_mutex };
+	auto key = directory.string();
+	auto it = snapshots.find(key);
+	if (it != snapshots.end()) {
+		snapshotOrder.erase(it->second);
+		snapshots.erase(it);
+	}
+	if (!snapshot) {
+		return;
+	}
+	snapshotOrder.emplace_front(std::move(key), std::move(snapshot));
+	snapshots.emplace(snapshotOrder.front().first, snapshotOrder.begin());
+	if (snapshots.size() > MaxSnapshots) {
+		//the least recently used mailbox only has to read its index file at the next login
+		snapshots.erase(snapshotOrder.back().first);
+		snapshotOrder.pop_back();
+	}
+}
+
+bool MailboxIndex::Measure(const std::filesystem::path& file, std::size_t& wireSize) {
+	std::ifstream stream{ file, std::ios_base::in | std::ios_base::binary };
+	if (!stream.is_open()) {
+		return false;
+	}
+	WireEncoder encoder;
+	std::string chunk(MeasureChunk, '\0');
+	wireSize = 0;
+	while (stream) {
+		stream.read(&chunk[0], static_cast<std::streamsize>(chunk.size()));
+		wireSize += encoder.measure(chunk.data(), static_cast<std::size_t>(stream.gcount()));
+	}
+	if (stream.bad()) {
+		return false;
+	}
+	wireSize += encoder.finishSize();
+	return true;
+}
+
+std::vector<MailboxIndex::Entry> MailboxIndex::Load(const std::filesystem::path& mailboxDirectory, const std::set<std::filesystem::path>& excluded,
+	io_engine_ptr engine)
+{
+	auto mutex = getDirectoryMutex(mailboxDirectory);
+	std::lock_guard<std::mutex> lg{ *mutex };
+
+	//taken before the stat, so a change made after it gets a later time
+	auto listedAt = fileClockNow();
+	auto directory = engine->statFiles({ mailboxDirectory }).front();
+	std::vector<Entry> entries;
+	if (!directory) {
+		if (!std::filesystem::create_directory(mailboxDirectory)) {
+			throw std::runtime_error{ "Failed to create mailbox directory" };
+		}
+		return entries;
+	}
+
+	auto snapshot = findSnapshot(mailboxDirectory);
+	if (snapshot && snapshot->directoryMtime == directory->mtime && settled(snapshot->directoryMtime, snapshot->listedAt)) {
+		//the common poll without new mail, nothing but the directory is touched
+		return withoutExcluded(snapshot->entries, excluded);
+	}
+
+	//another process may append to the index meanwhile, the lock is taken only where it is read
+	IndexFileLock fileLock{ mailboxDirectory };
+	auto path = indexPath(mailboxDirectory);
+	auto index = readIndex(path);
+	bool current = index.valid && directory->mtime == index.directoryMtime;
+	if (current && !settled(index.directoryMtime, index.listedAt)) {
+		//written within a tick of the last change, which may have hidden another one
+		current = sameNames(mailboxDirectory, index.records);
+		if (current) {
+			index.listedAt = listedAt;
+			appendRecord(path, {}, index.directoryMtime, index.listedAt);
+		}
+	}
+	if (current) {
+		//nothing has appeared or disappeared since the index was written
+		auto loaded = std::make_shared<Snapshot>(Snapshot{ index.directoryMtime, index.listedAt, {} });
+		loaded->entries.reserve(index.records.size());
+		for (auto& record : index.records) {
+			loaded->entries.push_back(Entry{ mailboxDirectory / record.name, record.attributes, record.wireSize });
+		}
+		entries = withoutExcluded(loaded->entries, excluded);
+		storeSnapshot(mailboxDirectory, std::move(loaded));
+		return entries;
+	}
+
+	//directory_entry keeps the file type reported by readdir, so no stat is made here.
+	//Files waiting for removal are indexed too, so the index names everything in the directory
+	std::vector<std::filesystem::path> files;
+	std::for_each(std::filesystem::directory_iterator(mailboxDirectory), std::filesystem::directory_iterator{}, [&files](const auto& entry) {
+		if (entry.is_regular_file()) {
+			files.push_back(entry.path());
+		}
+	});
+
+	std::unordered_map<std::string, const Record*> known;
+	std::for_each(index.records.cbegin(), index.records.cend(), [&known](const auto& record) { known.emplace(record.name, &record); });
+
+	auto stats = engine->statFiles(files);
+	entries.reserve(files.size());
+	//a file which could not be read is not indexed, so it is scanned again next time
+	bool complete = true;
+	for (std::size_t i = 0; i < files.size(); i++) {
+		//a file which has disappeared after listing is not a message anymore
+		if (!stats[i]) {
+			continue;
+		}
+		const auto& file = *stats[i];
+		std::size_t wireSize = file.size;
+		auto it = known.find(files[i].filename().string());
+		if (it != known.end() && it->second->attributes.size == file.size && it->second->attributes.mtime == file.mtime &&
+			it->second->attributes.inode == file.inode)
+		{
+			wireSize = it->second->wireSize;
+		}
+		else if (!MessageIngest::IsWireForm(files[i]) && !Measure(files[i], wireSize)) {
+			wireSize = file.size;
+			complete = false;
+		}
+		entries.push_back(Entry{ std::move(files[i]), file, wireSize });
+	}
+
+	//modification time taken before listing, so anything changed meanwhile causes one more listing
+	if (complete) {
+		writeIndex(path, directory->mtime, listedAt, entries);
+		storeSnapshot(mailboxDirectory, std::make_shared<Snapshot>(Snapshot{ directory->mtime, listedAt, entries }));
+	}
+	else {
+		std::error_code ec;
+		std::filesystem::remove(path, ec);
+		storeSnapshot(mailboxDirectory, nullptr);
+	}
+	return withoutExcluded(entries, excluded);
+}
+
+bool MailboxIndex::Publish(const std::filesystem::path& mailboxDirectory, const std::filesystem::path& file, std::size_t wireSize,
+	const std::function<bool()>& place)
+{
+	auto mutex = getDirectoryMutex(mailboxDirectory);
+	std::lock_guard<std::mutex> lg{ *mutex };
+	//deliveries of other processes (MailIngest, another server) update the same index
+	IndexFileLock fileLock{ mailboxDirectory };
+
+	auto path = indexPath(mailboxDirectory);
+	auto index = fileLock.isLocked() ? readIndex(path) : IndexContent{};
+	auto before = statEngine()->statFiles({ mailboxDirectory }).front();
+	bool current = index.valid && before && before->mtime == index.directoryMtime;
+	//taken before the message appears: the new modification time is not settled by it, so the next Load compares
+	//the names once before trusting it and finds anything put in meanwhile by other means (a Maildir rename, a copy)
+	auto listedAt = fileClockNow();
+
+	if (!place()) {
+		return false;
+	}
+	//the snapshot would not be trusted before that comparison either
+	storeSnapshot(mailboxDirectory, nullptr);
+	if (!index.valid) {
+		return true;
+	}
+	auto after = statEngine()->statFiles({ mailboxDirectory, file });
+	if (!after[1]) {
+		return true;
+	}
+	//a stale index keeps its header, the next Load lists the directory and takes the message's size from the record
+	bool updated = current && after[0];
+	if (!appendRecord(path, formatRecord(file.filename().string(), *after[1], wireSize), updated ? after[0]->mtime : index.directoryMtime,
+		updated ? listedAt : index.listedAt))
+	{
+		std::error_code ec;
+		std::filesystem::remove(path, ec);
+	}
+	return true;
+}
+
+void MailboxIndex::Remove(const std::filesystem::path& mailboxDirectory, const std::vector<std::filesystem::path>& removed) {
+	auto mutex = getDirectoryMutex(mailboxDirectory);
+	std::lock_guard<std::mutex> lg{ *mutex };
+	IndexFileLock fileLock{ mailboxDirectory };
+
+	storeSnapshot(mailboxDirectory, nullptr);
+	auto path = indexPath(mailboxDirectory);
+	auto index = fileLock.isLocked() ? readIndex(path) : IndexContent{};
+	if (!index.valid) {
+		return;
+	}
+	std::set<std::string> names;
+	std::for_each(removed.cbegin(), removed.cend(), [&names, &mailboxDirectory](const auto& file) {
+		if (file.parent_path() == mailboxDirectory) {
+			names.insert(file.filename().string());
+		}
+	});
+	auto remaining = std::remove_if(index.records.begin(), index.records.end(), [&names](const auto& record) {
+		return names.find(record.name) != names.cend();
+	});
+	index.records.erase(remaining, index.records.end());
+
+	auto listedAt = fileClockNow();
+	auto directory = statEngine()->statFiles({ mailboxDirectory }).front();
+	std::vector<Entry> entries;
+	entries.reserve(index.records.size());
+	for (const auto& record : index.records) {
+		entries.push_back(Entry{ mailboxDirectory / record.name, record.attributes, record.wireSize });
+	}
+	//the removals have changed the modification time, the index takes it over if the directory holds just the remaining messages,
+	//otherwise it keeps the old time and the next Load lists the directory, still without measuring the remaining messages again
+	if (directory && sameNames(mailboxDirectory, index.records)) {
+		writeIndex(path, directory->mtime, listedAt, entries);
+		storeSnapshot(mailboxDirectory, std::make_shared<Snapshot>(Snapshot{ directory->mtime, listedAt, std::move(entries) }));
+	}
+	else {
+		writeIndex(path, index.directoryMtime, index.listedAt, entries);
+	}
+}
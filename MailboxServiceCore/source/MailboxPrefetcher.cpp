@@ -0,0 +1,124 @@
+
+#include "MailboxPrefetcher.h"
+#include "WorkerPool.h"
+#include "FileSystemMailStorage.h"
+#include "PackedMailStorage.h"
+#include "MaildirStorage.h"
+#include "MailboxIndex.h"
+
+#include <algorithm>
+
+std::atomic<bool> MailboxPrefetcher::enabled{ false };
+std::mutex MailboxPrefetcher::m_mutex;
+std::set<std::string> MailboxPrefetcher::inFlight;
+
+namespace {
+	//messages are numbered from the first, clients usually retrieve them in this order
+	std::vector<std::filesystem::path> leadingFiles(const std::vector<std::filesystem::path>& files, const std::vector<std::uint64_t>& sizes) {
+		std::vector<std::filesystem::path> result;
+		std::uint64_t total = 0;
+		for (std::size_t i = 0; i < files.size() && result.size() < MailboxPrefetcher::MaxPrefetchedMessages; i++) {
+			if (total + sizes[i] > MailboxPrefetcher::MaxPrefetchedBytes && !result.empty()) {
+				break;
+			}
+			total += sizes[i];
+			result.push_back(files[i]);
+		}
+		return result;
+	}
+
+	void listRegularFiles(const std::filesystem::path& directory, std::vector<std::filesystem::path>& files) {
+		std::error_code ec;
+		std::filesystem::directory_iterator it(directory, ec), end;
+		for (; !ec && it != end; it.increment(ec)) {
+			if (it->is_regular_file()) {
+				files.push_back(it->path());
+			}
+		}
+	}
+}
+
+void MailboxPrefetcher::Schedule(std::string_view mailboxName, std::vector<MailStorageInfo> storages) {
+	if (!enabled || storages.empty()) {
+		return;
+	}
+	std::string name(mailboxName);
+	{
+		std::lock_guard<std::mutex> lg{ m_mutex };
+		if (!inFlight.insert(name).second) {
+			return;
+		}
+	}
+	WorkerPool::Shared().post([name, storages = std::move(storages)]() {
+		for (const auto& storage : storages) {
+			try {
+				warm(name, storage);
+			}
+			catch (...) {
+				//only a hint, the logon examines the storage anyway
+			}
+		}
+		std::lock_guard<std::mutex> lg{ m_mutex };
+		inFlight.erase(name);
+	});
+}
+
+void MailboxPrefetcher::warm(const std::string& mailboxName, const MailStorageInfo& storage) {
+	auto engine = FileSystemStorageFactory::getIOEngine();
+	if (!engine) {
+		return;
+	}
+	std::error_code ec;
+	switch (storage.storageType) {
+	case StorageType::FileSystemMailStorage:
+	case StorageType::DeduplicatedMailStorage: {
+		auto path = FileSystemStorageFactory::resolve(storage, mailboxName).path;
+		//the logon has not happened yet, so nothing is created here
+		if (!std::filesystem::is_directory(path, ec)) {
+			return;
+		}
+		//files waiting for removal are left in a stale index, the logon excludes them after recovering the journals
+		auto entries = MailboxIndex::Load(path, {}, engine);
+		std::vector<std::filesystem::path> files;
+		std::vector<std::uint64_t> sizes;
+		files.reserve(entries.size());
+		sizes.reserve(entries.size());
+		for (auto& entry : entries) {
+			files.push_back(std::move(entry.file));
+			sizes.push_back(entry.attributes.size);
+		}
+		engine->prefetchFiles(leadingFiles(files, sizes));
+		break;
+	}
+	case StorageType::MaildirMailStorage: {
+		auto path = FileSystemStorageFactory::resolve(storage, mailboxName).path;
+		//messages are moved from new/ to cur/ by the logon only
+		std::vector<std::filesystem::path> files;
+		listRegularFiles(path / "cur", files);
+		listRegularFiles(path / "new", files);
+		std::sort(files.begin(), files.end(), [](const auto& left, const auto& right) { return left.filename() < right.filename(); });
+		std::vector<std::uint64_t> sizes;
+		sizes.reserve(files.size());
+		std::for_each(files.cbegin(), files.cend(), [&sizes](const auto& file) {
+			//messages without the size in the name are not counted against the limit
+			auto size = MaildirStorageFactory::ParseName(file.filename().string()).size;
+			sizes.push_back(size ? *size : 0);
+		});
+		engine->prefetchFiles(leadingFiles(files, sizes));
+		break;
+	}
+	case StorageType::PackedMailStorage: {
+		auto path = PackedStorageFactory::resolve(storage, mailboxName).path;
+		auto index = path / PackedMailStorage::IndexFileName;
+		engine->prefetchFiles({ index });
+		//the index and the segment are all the files of a packed mailbox, the oldest messages are at the beginning of the segment
+		std::vector<std::filesystem::path> segments;
+		listRegularFiles(path, segments);
+		segments.erase(std::remove(segments.begin(), segments.end(), index), segments.end());
+		engine->prefetchFiles(segments, MaxPrefetchedBytes);
+		break;
+	}
+	default:
+		break;
+	}
+}
@@ -1,10 +1,87 @@
 
 #include "MailboxServiceManager.h"
 #include "common_headers.h"
+#include "Metrics.h"
 
 std::unique_ptr<AuthorizationManager> MailboxServiceManager::AuthorizationManager;
 std::mutex MailboxServiceManager::m_mutex;
 std::set<std::string> MailboxServiceManager::activeMailboxes;
+std::multimap<std::string, std::function<void()>, std::less<>> MailboxServiceManager::unlockTasks;
+LoginThrottle MailboxServiceManager::loginThrottle;
+std::atomic<unsigned int> MailboxServiceManager::authThreads{ std::max(static_cast<unsigned int>(1), std::thread::hardware_concurrency() / 2) };
+
+namespace {
+	//logons by outcome, every attempt is counted once: logged on, refused by AuthError, by the login delay or by the mailbox
+	struct AuthMetrics {
+		MetricsRegistry::Counter loggedOn;
+		MetricsRegistry::Counter noSuchConsumer;
+		MetricsRegistry::Counter invalidPassword;
+		MetricsRegistry::Counter noStorage;
+		MetricsRegistry::Counter delayed;
+		MetricsRegistry::Counter busy;
+		MetricsRegistry::Counter failed;
+
+		AuthMetrics() {
+			auto& registry = MetricsRegistry::Shared();
+			constexpr std::string_view name = "mailbox_logons_total";
+			constexpr std::string_view help = "Logons by outcome";
+			loggedOn = registry.counter(name, help, { { "outcome", "logged_on" } });
+			noSuchConsumer = registry.counter(name, help, { { "outcome", "no_such_consumer" } });
+			invalidPassword = registry.counter(name, help, { { "outcome", "invalid_password" } });
+			noStorage = registry.counter(name, help, { { "outcome", "no_storage" } });
+			delayed = registry.counter(name, help, { { "outcome", "login_delayed" } });
+			busy = registry.counter(name, help, { { "outcome", "mailbox_busy" } });
+			failed = registry.counter(name, help, { { "outcome", "storage_failure" } });
+		}
+
+		void count(const MailboxServiceManager::LogonResult& result) const {
+			if (std::holds_alternative<mailbox_ptr>(result)) {
+				loggedOn.add();
+			}
+			else if (auto err = std::get_if<AuthError>(&result)) {
+				count(*err);
+			}
+			else {
+				switch (std::get<MailboxOperationError>(result)) {
+				case MailboxOperationError::LoginDelayed:
+					delayed.add();
+					break;
+				case MailboxOperationError::MailboxIsBusy:
+					busy.add();
+					break;
+				default:
+					failed.add();
+					break;
+				}
+			}
+		}
+
+		void count(AuthError err) const {
+			switch (err) {
+			case AuthError::NoSuchConsumer:
+				noSuchConsumer.add();
+				break;
+			case AuthError::InvalidPassword:
+				invalidPassword.add();
+				break;
+			case AuthError::ConsumerHasNoAssociatedMailStorage:
+				noStorage.add();
+				break;
+			}
+		}
+	};
+
+	const AuthMetrics& authMetrics() {
+		static const AuthMetrics instance;
+		return instance;
+	}
+
+	//the outcome is counted where the logon ends
+	MailboxServiceManager::LogonResult counted(MailboxServiceManager::LogonResult result) {
+		authMetrics().count(result);
+		return result;
+	}
+}
 
 bool MailboxServiceManager::LockMailbox(std::string_view _name) {
 	std::lock_guard<std::mutex> _lock{ m_mutex };
@@ -20,52 +97,112 @@ bool MailboxServiceManager::LockMailbox(std::string_view _name) {
 }
 
 void MailboxServiceManager::UnlockMailbox(std::string_view name) {
-	std::lock_guard<std::mutex> _lock{ m_mutex };
-	activeMailboxes.erase(name.data());
+	std::vector<std::function<void()>> tasks;
+	{
+		std::lock_guard<std::mutex> _lock{ m_mutex };
+		activeMailboxes.erase(std::string(name));
+		auto [first, last] = unlockTasks.equal_range(name);
+		std::transform(first, last, std::back_inserter(tasks), [](auto& task) { return std::move(task.second); });
+		unlockTasks.erase(first, last);
+	}
+	std::for_each(tasks.begin(), tasks.end(), [](auto& task) { WorkerPool::Shared().post(std::move(task)); });
+}
+
+void MailboxServiceManager::PostWhenUnlocked(std::string_view name, std::function<void()> task) {
+	{
+		std::lock_guard<std::mutex> _lock{ m_mutex };
+		if (activeMailboxes.find(std::string(name)) != activeMailboxes.end()) {
+			unlockTasks.emplace(std::string(name), std::move(task));
+			return;
+		}
+	}
+	WorkerPool::Shared().post(std::move(task));
 }
 
 
 #include "MailboxLock.h"
 #include "FileSystemMailStorage.h"
+#include "PackedMailStorage.h"
+#include "MaildirStorage.h"
 
-std::variant<mailbox_ptr, MailboxOperationError, AuthError> MailboxServiceManager::VerifyCredentialsAndConnect(
+MailboxServiceManager::LogonResult MailboxServiceManager::VerifyCredentialsAndConnect(
 	std::string_view mailboxName,
 	std::string_view password)
+{
+	//verified before the lock, a slow verifier does not keep the mailbox locked
+	if (auto err = Authenticate(mailboxName, password)) {
+		return counted(*err);
+	}
+	//checked only for verified consumers, otherwise the refusal tells anyone that the account logged in recently (RFC 2449 8.1.1)
+	if (!loginThrottle.allowed(mailboxName)) {
+		return counted(MailboxOperationError::LoginDelayed);
+	}
+	return counted(Connect(mailboxName));
+}
+
+void MailboxServiceManager::VerifyCredentialsAndConnectAsync(std::string mailboxName, std::string password, std::function<void(LogonResult)> handler) {
+	AuthPool().post([mailboxName = std::move(mailboxName), password = std::move(password), handler = std::move(handler)]() {
+		if (auto err = Authenticate(mailboxName, password)) {
+			handler(counted(*err));
+			return;
+		}
+		if (!loginThrottle.allowed(mailboxName)) {
+			handler(counted(MailboxOperationError::LoginDelayed));
+			return;
+		}
+		WorkerPool::Shared().post([mailboxName, handler]() { handler(counted(Connect(mailboxName))); });
+	});
+}
+
+std::optional<AuthError> MailboxServiceManager::Authenticate(std::string_view mailboxName, std::string_view password) {
+	return AuthorizationManager->authenticate(mailboxName, password);
+}
+
+WorkerPool& MailboxServiceManager::AuthPool() {
+	static WorkerPool pool{ authThreads.load() };
+	return pool;
+}
+
+MailboxServiceManager::LogonResult MailboxServiceManager::Connect(std::string_view mailboxName)
 {
 	MailboxLock lock{ mailboxName };
 	if (lock()) {
-		auto result = AuthorizationManager->logon(mailboxName, password);
-		if (std::holds_alternative<std::vector<MailStorageInfo>>(result)) {
-			auto vec = std::get<std::vector<MailStorageInfo>>(result);
-			if (vec.empty()) {
-				return AuthError::ConsumerHasNoAssociatedMailStorage;
-			}
-			std::vector<storage_ptr> storages;
-			std::for_each(vec.cbegin(), vec.cend(), [&storages, &mailboxName](const auto& storageDescription)
-				{
-					try {
-						switch (storageDescription.storageType) {
-						case StorageType::FileSystemMailStorage: {
-							storages.push_back(FileSystemStorageFactory::create(storageDescription, mailboxName));
-							break;
-						}
-						default:
-							break;
-						}
+		auto vec = AuthorizationManager->storagesOf(mailboxName);
+		if (vec.empty()) {
+			return AuthError::ConsumerHasNoAssociatedMailStorage;
+		}
+		std::vector<storage_ptr> storages;
+		std::for_each(vec.cbegin(), vec.cend(), [&storages, &mailboxName](const auto& storageDescription)
+			{
+				try {
+					switch (storageDescription.storageType) {
+					case StorageType::FileSystemMailStorage:
+					case StorageType::DeduplicatedMailStorage: {
+						storages.push_back(FileSystemStorageFactory::create(storageDescription, mailboxName));
+						break;
+					}
+					case StorageType::PackedMailStorage: {
+						storages.push_back(PackedStorageFactory::create(storageDescription, mailboxName));
+						break;
+					}
+					case StorageType::MaildirMailStorage: {
+						storages.push_back(MaildirStorageFactory::create(storageDescription, mailboxName));
+						break;
 					}
-					catch (...) {
-						//TODO: 
+					default:
+						break;
 					}
 				}
-			);
-			if (storages.empty()) {
-				return MailboxOperationError::UserStoragesInstantinationFailure;
+				catch (...) {
+					//TODO: 
+				}
 			}
-			return mailbox_ptr(new Mailbox(mailboxName, std::move(storages), std::move(lock)));
-		}
-		else {
-			return std::get<AuthError>(result);
+		);
+		if (storages.empty()) {
+			return MailboxOperationError::UserStoragesInstantinationFailure;
 		}
+		loginThrottle.record(mailboxName);
+		return mailbox_ptr(new Mailbox(mailboxName, std::move(storages), std::move(lock)));
 	}
 	else {
 		return MailboxOperationError::MailboxIsBusy;
@@ -0,0 +1,265 @@
+
+#include "MaildirStorage.h"
+#include "MailboxExpunger.h"
+#include "MailboxIndex.h"
+#include "WireEncoder.h"
+#include "DurableFile.h"
+
+#include <atomic>
+#include <chrono>
+#include <charconv>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+
+#ifdef WIN32
+#include <io.h>
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+	constexpr const char* NewDirectory = "new";
+	constexpr const char* CurDirectory = "cur";
+	constexpr const char* TmpDirectory = "tmp";
+
+	std::string hostName() {
+		std::string host;
+#ifdef WIN32
+		if (auto name = std::getenv("COMPUTERNAME")) {
+			host = name;
+		}
+#else
+		char name[256] = {};
+		if (gethostname(name, sizeof(name) - 1) == 0) {
+			host = name;
+		}
+#endif
+		if (host.empty()) {
+			host = "localhost";
+		}
+		//characters with special meaning in Maildir names
+		std::replace(host.begin(), host.end(), '/', '_');
+		std::replace(host.begin(), host.end(), MaildirStorageFactory::InfoSeparator, '_');
+		std::replace(host.begin(), host.end(), ',', '_');
+		return host;
+	}
+
+	struct CachedSizes {
+		std::size_t size;
+		std::size_t wireSize;
+	};
+
+	//lines "<size> <wire size> <file name>", names are unique and Maildir messages are never modified
+	std::unordered_map<std::string, CachedSizes> readSizes(const std::filesystem::path& file) {
+		std::unordered_map<std::string, CachedSizes> sizes;
+		std::ifstream stream{ file, std::ios_base::in | std::ios_base::binary };
+		std::string line;
+		while (std::getline(stream, line)) {
+			std::istringstream fields{ line };
+			CachedSizes entry;
+			std::string name;
+			if (fields >> entry.size >> entry.wireSize && fields.get() == ' ' && std::getline(fields, name) && !name.empty()) {
+				sizes.emplace(std::move(name), entry);
+			}
+		}
+		return sizes;
+	}
+
+	//the cache is rewritten as a whole, so entries of messages removed since are dropped
+	void writeSizes(const std::filesystem::path& file, const std::vector<std::filesystem::path>& files,
+		const std::vector<FileAttributes>& attributes, const std::vector<std::size_t>& wireSizes) {
+		std::string content;
+		for (std::size_t i = 0; i < files.size(); i++) {
+			content.append(std::to_string(attributes[i].size)).append(" ").append(std::to_string(wireSizes[i])).append(" ")
+				.append(files[i].filename().string()).append("\n");
+		}
+		std::error_code ec;
+		std::filesystem::create_directories(file.parent_path(), ec);
+		auto tmp = file;
+		tmp += ".tmp";
+		if (DurableFile::Write(tmp, content)) {
+			std::filesystem::rename(tmp, file, ec);
+		}
+		if (ec || std::filesystem::exists(tmp, ec)) {
+			std::filesystem::remove(tmp, ec);
+		}
+	}
+}
+
+MaildirStorageFactory::NameSizes MaildirStorageFactory::ParseName(std::string_view filename) {
+	NameSizes sizes;
+	auto base = filename.substr(0, filename.find(InfoSeparator));
+	auto position = base.find(',');
+	while (position != std::string_view::npos) {
+		auto next = base.find(',', position + 1);
+		auto field = base.substr(position + 1, next == std::string_view::npos ? std::string_view::npos : next - position - 1);
+		if (field.size() > 2 && field[1] == '=' && (field[0] == 'S' || field[0] == 'W')) {
+			std::size_t value;
+			auto result = std::from_chars(field.data() + 2, field.data() + field.size(), value);
+			if (result.ec == std::errc() && result.ptr == field.data() + field.size()) {
+				(field[0] == 'S' ? sizes.size : sizes.wireSize) = value;
+			}
+		}
+		position = next;
+	}
+	return sizes;
+}
+
+bool MaildirStorageFactory::prepare(const std::filesystem::path& directory) {
+	std::error_code ec;
+	for (auto subdirectory : { NewDirectory, CurDirectory, TmpDirectory }) {
+		std::filesystem::create_directories(directory / subdirectory, ec);
+		if (ec) {
+			return false;
+		}
+	}
+	return true;
+}
+
+std::string MaildirStorageFactory::uniqueName() {
+	static std::atomic<std::size_t> counter{ 0 };
+	static const std::string host = hostName();
+#ifdef WIN32
+	auto pid = _getpid();
+#else
+	auto pid = getpid();
+#endif
+	auto now = std::chrono::system_clock::now().time_since_epoch();
+	auto seconds = std::chrono::duration_cast<std::chrono::seconds>(now);
+	auto microseconds = std::chrono::duration_cast<std::chrono::microseconds>(now - seconds);
+	return std::to_string(seconds.count()) + ".M" + std::to_string(microseconds.count()) + "P" + std::to_string(pid) +
+		"Q" + std::to_string(counter++) + "." + host;
+}
+
+std::shared_ptr<FileSystemMailStorage> MaildirStorageFactory::create(const MailStorageInfo& info, std::string_view name) {
+	auto path = FileSystemStorageFactory::resolve(info, name).path;
+	if (!prepare(path)) {
+		throw std::runtime_error{ "Failed to create mailbox directory" };
+	}
+	auto engine = FileSystemStorageFactory::getIOEngine();
+	auto expunged = MailboxExpunger::Recover(path, engine);
+
+	std::vector<std::filesystem::path> files;
+	//messages seen for the first time are moved to cur/ with empty flags
+	std::error_code ec;
+	std::filesystem::directory_iterator fresh(path / NewDirectory, ec), end;
+	for (; !ec && fresh != end; fresh.increment(ec)) {
+		if (!fresh->is_regular_file()) {
+			continue;
+		}
+		auto target = path / CurDirectory / (fresh->path().filename().string() + InfoSeparator + "2,");
+		std::error_code moveError;
+		std::filesystem::rename(fresh->path(), target, moveError);
+		if (moveError) {
+			//another process holds the maildir, the message is served from new/ this time
+			files.push_back(fresh->path());
+		}
+	}
+
+	//directory_entry keeps the file type reported by readdir, so no stat is made here
+	std::filesystem::directory_iterator seen(path / CurDirectory, ec);
+	for (; !ec && seen != end; seen.increment(ec)) {
+		if (seen->is_regular_file() && expunged.find(seen->path()) == expunged.cend()) {
+			files.push_back(seen->path());
+		}
+	}
+	//unique names begin with the delivery time, so messages are numbered in order of arrival
+	std::sort(files.begin(), files.end(), [](const auto& left, const auto& right) { return left.filename() < right.filename(); });
+
+	std::vector<FileAttributes> attributes(files.size());
+	std::vector<std::optional<std::size_t>> wireSizes(files.size());
+	//files delivered by MDAs which do not put the sizes into the name are measured once and remembered
+	auto sizesFile = path / MailboxExpunger::MetadataDirectory / SizesFileName;
+	auto cached = readSizes(sizesFile);
+	bool cacheChanged = false;
+	std::vector<bool> named(files.size());
+	std::vector<std::filesystem::path> unsized;
+	std::vector<std::size_t> unsizedNumbers;
+	for (std::size_t i = 0; i < files.size(); i++) {
+		auto filename = files[i].filename().string();
+		auto sizes = ParseName(filename);
+		named[i] = sizes.wireSize.has_value();
+		if (!named[i]) {
+			auto entry = cached.find(filename);
+			if (entry != cached.cend()) {
+				sizes.size = entry->second.size;
+				sizes.wireSize = entry->second.wireSize;
+			}
+			else {
+				cacheChanged = true;
+			}
+		}
+		wireSizes[i] = sizes.wireSize;
+		if (sizes.size) {
+			//Maildir messages are never modified, so the name identifies the content
+			attributes[i].size = *sizes.size;
+		}
+		else {
+			unsized.push_back(files[i]);
+			unsizedNumbers.push_back(i);
+		}
+	}
+	auto stats = engine->statFiles(unsized);
+	for (std::size_t i = 0; i < unsized.size(); i++) {
+		if (stats[i]) {
+			attributes[unsizedNumbers[i]] = *stats[i];
+		}
+	}
+
+	std::vector<std::size_t> resolvedWireSizes;
+	resolvedWireSizes.reserve(files.size());
+	std::vector<std::filesystem::path> measuredFiles;
+	std::vector<FileAttributes> measuredAttributes;
+	std::vector<std::size_t> measuredWireSizes;
+	for (std::size_t i = 0; i < files.size(); i++) {
+		std::size_t wireSize = attributes[i].size;
+		if (wireSizes[i]) {
+			wireSize = *wireSizes[i];
+		}
+		else if (!MailboxIndex::Measure(files[i], wireSize)) {
+			//not remembered, the file is measured again next time
+			resolvedWireSizes.push_back(attributes[i].size);
+			continue;
+		}
+		resolvedWireSizes.push_back(wireSize);
+		if (!named[i]) {
+			measuredFiles.push_back(files[i]);
+			measuredAttributes.push_back(attributes[i]);
+			measuredWireSizes.push_back(wireSize);
+		}
+	}
+	if (cacheChanged || measuredFiles.size() != cached.size()) {
+		writeSizes(sizesFile, measuredFiles, measuredAttributes, measuredWireSizes);
+	}
+	return std::make_shared<FileSystemMailStorage>(path, std::move(files), std::move(attributes), std::move(resolvedWireSizes), engine);
+}
+
+std::variant<std::filesystem::path, MailboxOperationError> MaildirStorageFactory::deliver(const std::filesystem::path& directory, std::string_view message) {
+	if (!prepare(directory)) {
+		return MailboxOperationError::MailboxCreateError;
+	}
+	auto filename = uniqueName() + ",S=" + std::to_string(message.size()) + ",W=" + std::to_string(WireEncoder::WireSize(message));
+	auto tmp = directory / TmpDirectory / filename;
+	auto target = directory / NewDirectory / filename;
+	std::error_code ec;
+	if (!DurableFile::Write(tmp, message)) {
+		std::filesystem::remove(tmp, ec);
+		return MailboxOperationError::InternalError;
+	}
+	std::filesystem::rename(tmp, target, ec);
+	if (ec) {
+		std::filesystem::remove(tmp, ec);
+		return MailboxOperationError::InternalError;
+	}
+	//the message is acknowledged only when its name survives a crash
+	if (!DurableFile::SyncDirectory(directory / NewDirectory)) {
+		return MailboxOperationError::InternalError;
+	}
+	return target;
+}
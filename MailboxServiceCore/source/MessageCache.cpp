@@ -0,0 +1,65 @@
+
+#include "MessageCache.h"
+
+std::size_t MessageCache::sharedCapacity = MessageCache::DefaultCapacity;
+std::size_t MessageCache::sharedMaxMessageSize = MessageCache::DefaultMaxMessageSize;
+
+MessageCache::MessageCache(std::size_t capacity, std::size_t maxMessageSize) :
+	shardCapacity(capacity / ShardsCount), maxMessageSize(maxMessageSize)
+{
+}
+
+message_buffer MessageCache::find(const Key& key) {
+	auto& shard = shardFor(key);
+	std::lock_guard<std::mutex> lg{ shard.m_mutex };
+	auto it = shard.index.find(key);
+	if (it == shard.index.end()) {
+		misses++;
+		return nullptr;
+	}
+	//move to the head of LRU list
+	shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+	hits++;
+	return it->second->second;
+}
+
+bool MessageCache::insert(const Key& key, message_buffer buffer) {
+	if (!buffer || !admits(buffer->size())) {
+		bypassed++;
+		return false;
+	}
+	auto& shard = shardFor(key);
+	std::lock_guard<std::mutex> lg{ shard.m_mutex };
+	if (shard.index.find(key) != shard.index.end()) {
+		//another session has just loaded the same message
+		return true;
+	}
+	while (!shard.entries.empty() && shard.size + buffer->size() > shardCapacity) {
+		auto& victim = shard.entries.back();
+		shard.size -= victim.second->size();
+		size -= victim.second->size();
+		shard.index.erase(victim.first);
+		shard.entries.pop_back();
+		evictions++;
+	}
+	shard.size += buffer->size();
+	size += buffer->size();
+	shard.entries.emplace_front(key, std::move(buffer));
+	shard.index.emplace(key, shard.entries.begin());
+	insertions++;
+	return true;
+}
+
+MessageCache::Statistics MessageCache::statistics() const {
+	return Statistics{ hits.load(), misses.load(), insertions.load(), evictions.load(), bypassed.load(), size.load() };
+}
+
+MessageCache& MessageCache::Shared() {
+	static MessageCache cache{ sharedCapacity, sharedMaxMessageSize };
+	return cache;
+}
+
+void MessageCache::Configure(std::size_t capacity, std::size_t maxMessageSize) {
+	sharedCapacity = capacity;
+	sharedMaxMessageSize = maxMessageSize;
+}
@@ -0,0 +1,82 @@
+
+#include "MessageIngest.h"
+#include "WireEncoder.h"
+#include "MailboxExpunger.h"
+#include "FileSystemMailStorage.h"
+#include "MailboxIndex.h"
+#include "DurableFile.h"
+
+bool MessageIngest::IsWireForm(const std::filesystem::path& file) {
+	return file.extension() == WireSuffix;
+}
+
+std::variant<std::filesystem::path, MailboxOperationError> MessageIngest::Deliver(const std::filesystem::path& mailboxDirectory, std::string_view message) {
+	return std::move(Deliver(std::vector<std::filesystem::path>{ mailboxDirectory }, message).front());
+}
+
+std::vector<std::variant<std::filesystem::path, MailboxOperationError>> MessageIngest::Deliver(
+	const std::vector<std::filesystem::path>& mailboxDirectories, std::string_view message)
+{
+	std::string wire;
+	WireEncoder encoder;
+	encoder.encode(message.data(), message.size(), wire);
+	encoder.finish(wire);
+
+	std::vector<std::variant<std::filesystem::path, MailboxOperationError>> results;
+	results.reserve(mailboxDirectories.size());
+	//file already delivered to one of the mailboxes, the others get links to it
+	std::filesystem::path stored;
+	for (const auto& mailboxDirectory : mailboxDirectories) {
+		//temporary file is kept in the metadata directory, so it is never listed as a message
+		auto metadata = mailboxDirectory / MailboxExpunger::MetadataDirectory;
+		std::error_code ec;
+		std::filesystem::create_directories(metadata, ec);
+		if (ec) {
+			results.push_back(MailboxOperationError::MailboxNotExist);
+			continue;
+		}
+		auto name = DurableFile::UniqueName();
+		auto tmp = metadata / (name + ".tmp");
+		auto target = mailboxDirectory / (name + WireSuffix);
+		bool linked = false;
+		if (!stored.empty()) {
+			std::filesystem::create_hard_link(stored, tmp, ec);
+			linked = !ec;
+		}
+		if (!linked && !DurableFile::Write(tmp, wire)) {
+			std::filesystem::remove(tmp, ec);
+			results.push_back(MailboxOperationError::InternalError);
+			continue;
+		}
+		bool placed = MailboxIndex::Publish(mailboxDirectory, target, wire.size(), [&tmp, &target]() {
+			std::error_code ec;
+			std::filesystem::rename(tmp, target, ec);
+			return !ec;
+		});
+		if (!placed) {
+			std::filesystem::remove(tmp, ec);
+			results.push_back(MailboxOperationError::InternalError);
+			continue;
+		}
+		//the message is acknowledged only when its name survives a crash
+		if (!DurableFile::SyncDirectory(mailboxDirectory)) {
+			results.push_back(MailboxOperationError::InternalError);
+			continue;
+		}
+		if (stored.empty()) {
+			stored = target;
+		}
+		results.push_back(std::move(target));
+	}
+	return results;
+}
+
+std::variant<std::filesystem::path, MailboxOperationError> MessageIngest::Deliver(const MailStorageInfo& info, std::string_view name,
+	std::string_view message)
+{
+	//packed and deduplicated mailboxes have their own delivery paths
+	if (info.storageType != StorageType::FileSystemMailStorage) {
+		return MailboxOperationError::InternalError;
+	}
+	return Deliver(FileSystemStorageFactory::resolve(info, name).path, message);
+}
@@ -0,0 +1,65 @@
+#include "Metrics.h"
+
+#include <algorithm>
+
+MetricsRegistry& MetricsRegistry::Shared() {
+	//never destroyed, threads of static pools finish after the static destructors have run
+	static MetricsRegistry* registry = new MetricsRegistry();
+	return *registry;
+}
+
+MetricsRegistry::Counter MetricsRegistry::counter(std::string_view name, std::string_view help, MetricLabels labels) {
+	return Counter(add(name, help, MetricType::Counter, std::move(labels)));
+}
+
+MetricsRegistry::Gauge MetricsRegistry::gauge(std::string_view name, std::string_view help, MetricLabels labels) {
+	return Gauge(add(name, help, MetricType::Gauge, std::move(labels)));
+}
+
+MetricsRegistry::Histogram MetricsRegistry::histogram(std::string_view name, std::string_view help, MetricLabels labels) {
+	return Histogram(add(name, help, MetricType::Histogram, std::move(labels)));
+}
+
+std::size_t MetricsRegistry::add(std::string_view name, std::string_view help, MetricType type, MetricLabels labels) {
+	std::lock_guard<std::mutex> lg{ m_mutex };
+	auto it = std::find_if(metrics.cbegin(), metrics.cend(), [&](const auto& metric) {
+		return metric.name == name && metric.labels == labels && metric.type == type;
+	});
+	if (it != metrics.cend()) {
+		return it->slot;
+	}
+	auto size = type == MetricType::Histogram ? HistogramSlots : 1;
+	if (nextSlot + size > MaxSlots) {
+		return 0;
+	}
+	metrics.push_back(MetricDescriptor{ std::string(name), std::string(help), type, std::move(labels), nextSlot });
+	nextSlot += size;
+	return metrics.back().slot;
+}
+
+MetricsRegistry::Snapshot MetricsRegistry::snapshot() const {
+	Snapshot result;
+	std::lock_guard<std::mutex> lg{ m_mutex };
+	result.metrics = metrics;
+	result.values.assign(finished.cbegin(), finished.cbegin() + nextSlot);
+	std::for_each(blocks.cbegin(), blocks.cend(), [&result](const auto& block) {
+		for (std::size_t i = 0; i < result.values.size(); i++) {
+			result.values[i] += (*block)[i].load();
+		}
+	});
+	return result;
+}
+
+MetricsRegistry::Block* MetricsRegistry::attach() {
+	std::lock_guard<std::mutex> lg{ m_mutex };
+	blocks.push_back(std::make_unique<Block>());
+	return blocks.back().get();
+}
+
+void MetricsRegistry::detach(Block* block) {
+	std::lock_guard<std::mutex> lg{ m_mutex };
+	for (std::size_t i = 0; i < MaxSlots; i++) {
+		finished[i] += (*block)[i].load();
+	}
+	blocks.remove_if([block](const auto& ptr) { return ptr.get() == block; });
+}
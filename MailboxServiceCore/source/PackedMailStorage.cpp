@@ -0,0 +1,591 @@
+
+#include "PackedMailStorage.h"
+#include "MailboxServiceManager.h"
+#include "FileSystemMailStorage.h"
+#include "WorkerPool.h"
+#include "WireEncoder.h"
+#include "DurableFile.h"
+
+#include <numeric>
+#include <cstddef>
+#include <stdexcept>
+#include <array>
+
+#ifdef MAILBOX_HAS_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef WIN32
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+std::mutex PackedStorageFactory::m_mutex;
+std::map<std::string, std::weak_ptr<std::mutex>> PackedStorageFactory::directoryMutexes;
+
+bool PackedFile::open(const std::filesystem::path& path, bool writable) {
+	close();
+#ifdef WIN32
+	handle = _wopen(path.c_str(), (writable ? _O_RDWR | _O_CREAT : _O_RDONLY) | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+	handle = ::open(path.c_str(), (writable ? O_RDWR | O_CREAT : O_RDONLY) | O_CLOEXEC, 0600);
+#endif
+	return handle >= 0;
+}
+
+bool PackedFile::readAt(void* data, std::size_t size, std::uint64_t offset) const {
+	auto dest = static_cast<char*>(data);
+	while (size > 0) {
+#ifdef WIN32
+		if (_lseeki64(handle, static_cast<__int64>(offset), SEEK_SET) < 0) {
+			return false;
+		}
+		auto res = _read(handle, dest, static_cast<unsigned int>(size));
+#else
+		auto res = ::pread(handle, dest, size, static_cast<off_t>(offset));
+#endif
+		if (res <= 0) {
+			return false;
+		}
+		dest += res;
+		size -= static_cast<std::size_t>(res);
+		offset += static_cast<std::uint64_t>(res);
+	}
+	return true;
+}
+
+bool PackedFile::writeAt(const void* data, std::size_t size, std::uint64_t offset) {
+	auto src = static_cast<const char*>(data);
+	while (size > 0) {
+#ifdef WIN32
+		if (_lseeki64(handle, static_cast<__int64>(offset), SEEK_SET) < 0) {
+			return false;
+		}
+		auto res = _write(handle, src, static_cast<unsigned int>(size));
+#else
+		auto res = ::pwrite(handle, src, size, static_cast<off_t>(offset));
+#endif
+		if (res <= 0) {
+			return false;
+		}
+		src += res;
+		size -= static_cast<std::size_t>(res);
+		offset += static_cast<std::uint64_t>(res);
+	}
+	return true;
+}
+
+std::uint64_t PackedFile::size() const {
+#ifdef WIN32
+	struct _stat64 st;
+	if (_fstat64(handle, &st) != 0) {
+		return 0;
+	}
+#else
+	struct stat st;
+	if (::fstat(handle, &st) != 0) {
+		return 0;
+	}
+#endif
+	return static_cast<std::uint64_t>(st.st_size);
+}
+
+void PackedFile::prefetch([[maybe_unused]] std::uint64_t offset, [[maybe_unused]] std::uint64_t length) const {
+#if !defined(WIN32) && defined(POSIX_FADV_WILLNEED)
+	::posix_fadvise(handle, static_cast<off_t>(offset), static_cast<off_t>(length), POSIX_FADV_WILLNEED);
+#endif
+}
+
+bool PackedFile::sync() {
+	return DurableFile::Sync(handle);
+}
+
+void PackedFile::close() {
+	if (handle >= 0) {
+#ifdef WIN32
+		_close(handle);
+#else
+		::close(handle);
+#endif
+		handle = -1;
+	}
+}
+
+namespace {
+	constexpr std::uint64_t recordOffset(std::uint64_t position) {
+		return sizeof(PackedIndexHeader) + position * sizeof(PackedIndexRecord);
+	}
+
+	bool readHeader(const PackedFile& index, PackedIndexHeader& header) {
+		if (index.size() < sizeof(PackedIndexHeader)) {
+			return false;
+		}
+		return index.readAt(&header, sizeof(header), 0) &&
+			header.magic == PackedIndexHeader::Magic && header.version == PackedIndexHeader::CurrentVersion;
+	}
+
+	/// <summary>
+	/// Open index of the mailbox creating an empty one if necessary
+	/// </summary>
+	bool openIndex(const std::filesystem::path& directory, PackedFile& index, PackedIndexHeader& header, bool writable) {
+		auto path = directory / PackedMailStorage::IndexFileName;
+		if (!std::filesystem::exists(path)) {
+			PackedFile created{ path, true };
+			PackedIndexHeader empty;
+			if (!created.isOpen() || !created.writeAt(&empty, sizeof(empty), 0) || !created.sync()) {
+				return false;
+			}
+		}
+		return index.open(path, writable) && readHeader(index, header);
+	}
+
+	std::vector<PackedIndexRecord> readRecords(const PackedFile& index) {
+		auto size = index.size();
+		//a torn record at the end of the index is ignored
+		auto count = size > sizeof(PackedIndexHeader) ? (size - sizeof(PackedIndexHeader)) / sizeof(PackedIndexRecord) : 0;
+		std::vector<PackedIndexRecord> records(static_cast<std::size_t>(count));
+		if (count > 0 && !index.readAt(records.data(), records.size() * sizeof(PackedIndexRecord), recordOffset(0))) {
+			records.clear();
+		}
+		return records;
+	}
+}
+
+namespace {
+	constexpr std::size_t SegmentReadChunk = 65536;
+
+	/// <summary>
+	/// Reads a message stored as is directly from the segment
+	/// </summary>
+	class SegmentMessageReader : public MessageReader
+	{
+	public:
+		SegmentMessageReader(const PackedFile& segment, const PackedIndexRecord& record) :
+			segment(segment), offset(record.offset), remaining(record.storedLength) {}
+
+		std::variant<std::size_t, MailboxOperationError> read(char* buffer, std::size_t size) override {
+			auto count = static_cast<std::size_t>(std::min<std::uint64_t>(size, remaining));
+			if (count > 0 && !segment.readAt(buffer, count, offset)) {
+				return MailboxOperationError::InternalError;
+			}
+			offset += count;
+			remaining -= count;
+			return count;
+		}
+
+	private:
+		const PackedFile& segment;
+		std::uint64_t offset;
+		std::uint64_t remaining;
+	};
+
+#ifdef MAILBOX_HAS_ZLIB
+	/// <summary>
+	/// Inflates a compressed message reading the segment by chunks,
+	/// so only a chunk of compressed data and the caller's buffer are in memory
+	/// </summary>
+	class InflatingMessageReader : public MessageReader
+	{
+	public:
+		InflatingMessageReader(const PackedFile& segment, const PackedIndexRecord& record) :
+			segment(segment), offset(record.offset), remaining(record.storedLength)
+		{
+			stream.zalloc = Z_NULL;
+			stream.zfree = Z_NULL;
+			stream.opaque = Z_NULL;
+			stream.next_in = Z_NULL;
+			stream.avail_in = 0;
+			initialized = inflateInit(&stream) == Z_OK;
+		}
+
+		std::variant<std::size_t, MailboxOperationError> read(char* buffer, std::size_t size) override {
+			if (!initialized) {
+				return MailboxOperationError::InternalError;
+			}
+			stream.next_out = reinterpret_cast<Bytef*>(buffer);
+			stream.avail_out = static_cast<uInt>(size);
+			while (!finished && stream.avail_out > 0) {
+				if (stream.avail_in == 0) {
+					if (remaining == 0) {
+						//stream is truncated
+						return MailboxOperationError::InternalError;
+					}
+					auto count = static_cast<std::size_t>(std::min<std::uint64_t>(input.size(), remaining));
+					if (!segment.readAt(input.data(), count, offset)) {
+						return MailboxOperationError::InternalError;
+					}
+					offset += count;
+					remaining -= count;
+					stream.next_in = reinterpret_cast<Bytef*>(input.data());
+					stream.avail_in = static_cast<uInt>(count);
+				}
+				auto res = inflate(&stream, Z_NO_FLUSH);
+				if (res == Z_STREAM_END) {
+					finished = true;
+				}
+				else if (res != Z_OK) {
+					return MailboxOperationError::InternalError;
+				}
+			}
+			return size - stream.avail_out;
+		}
+
+		~InflatingMessageReader() override {
+			if (initialized) {
+				inflateEnd(&stream);
+			}
+		}
+
+	private:
+		const PackedFile& segment;
+		std::uint64_t offset;
+		std::uint64_t remaining;
+		z_stream stream;
+		std::array<char, SegmentReadChunk> input;
+		bool initialized{ false };
+		bool finished{ false };
+	};
+
+	bool deflateMessage(std::string_view message, std::string& compressed) {
+		auto bound = compressBound(static_cast<uLong>(message.size()));
+		compressed.resize(bound);
+		auto res = compress2(reinterpret_cast<Bytef*>(&compressed[0]), &bound,
+			reinterpret_cast<const Bytef*>(message.data()), static_cast<uLong>(message.size()), Z_DEFAULT_COMPRESSION);
+		if (res != Z_OK) {
+			return false;
+		}
+		compressed.resize(bound);
+		return true;
+	}
+#endif
+}
+
+void PackedIndexRecord::setWireSize(std::string_view message) {
+	auto extra = WireEncoder::WireSize(message) - message.size();
+	//a message with more than 4G line breaks is reported by its raw size
+	if (extra <= UINT32_MAX) {
+		wireExtra = static_cast<std::uint32_t>(extra);
+		flags |= PackedRecordFlags::WireSized;
+	}
+}
+
+std::filesystem::path PackedMailStorage::SegmentPath(const std::filesystem::path& directory, std::uint64_t generation) {
+	return directory / ("mailbox." + std::to_string(generation) + ".seg");
+}
+
+email_lengths PackedMailStorage::getEmailsLengths(std::size_t mailNumberOffset, std::pmr::memory_resource* resource) const {
+	email_lengths lengths(resource);
+	for (std::size_t i = 0; i < records.size(); i++) {
+		if (!isMailMarkedAsDeleted(i)) {
+			lengths.emplace(i + mailNumberOffset, getEmailLength(i));
+		}
+	}
+	return lengths;
+}
+
+std::size_t PackedMailStorage::getEmailLength(std::size_t emailNumber) const {
+	return static_cast<std::size_t>(records[emailNumber].wireLength());
+}
+
+std::variant<std::string, MailboxOperationError> PackedMailStorage::getEmail(std::size_t emailNumber) const {
+	if (isMailMarkedAsDeleted(emailNumber)) {
+		return MailboxOperationError::MailIsMarkedAsDeleted;
+	}
+	const auto& record = records[emailNumber];
+	if (record.isCompressed()) {
+		auto result = openEmail(emailNumber);
+		if (std::holds_alternative<MailboxOperationError>(result)) {
+			return std::get<MailboxOperationError>(result);
+		}
+		auto& reader = std::get<message_reader_ptr>(result);
+		std::string content(static_cast<std::size_t>(record.length), '\0');
+		std::size_t position = 0;
+		while (position < content.size()) {
+			auto read = reader->read(&content[position], content.size() - position);
+			if (std::holds_alternative<MailboxOperationError>(read) || std::get<std::size_t>(read) == 0) {
+				return MailboxOperationError::InternalError;
+			}
+			position += std::get<std::size_t>(read);
+		}
+		return content;
+	}
+	std::string content(static_cast<std::size_t>(record.storedLength), '\0');
+	if (!content.empty() && !segment.readAt(&content[0], content.size(), record.offset)) {
+		return MailboxOperationError::InternalError;
+	}
+	return content;
+}
+
+std::variant<message_reader_ptr, MailboxOperationError> PackedMailStorage::openEmail(std::size_t emailNumber) const {
+	if (isMailMarkedAsDeleted(emailNumber)) {
+		return MailboxOperationError::MailIsMarkedAsDeleted;
+	}
+	auto [first, last] = readAhead.access(emailNumber, records.size());
+	for (auto i = first; i < last; i++) {
+		//only queues reads of the segment, nothing is opened
+		if (!isMailMarkedAsDeleted(i) && records[i].storedLength > 0) {
+			segment.prefetch(records[i].offset, records[i].storedLength);
+		}
+	}
+
+	const auto& record = records[emailNumber];
+	if (record.isCompressed()) {
+#ifdef MAILBOX_HAS_ZLIB
+		return message_reader_ptr(new InflatingMessageReader(segment, record));
+#else
+		return MailboxOperationError::InternalError;
+#endif
+	}
+	return message_reader_ptr(new SegmentMessageReader(segment, record));
+}
+
+PackedMailStorage::~PackedMailStorage() {
+	if (!updateAtClose || (!deleteAll && emailsToBeDeleted.empty())) {
+		return;
+	}
+	std::vector<std::size_t> deleted;
+	if (deleteAll) {
+		deleted.resize(records.size());
+		std::iota(deleted.begin(), deleted.end(), static_cast<std::size_t>(0));
+	}
+	else {
+		deleted = emailsToBeDeleted;
+	}
+
+	PackedFile index{ directory / IndexFileName, true };
+	if (!index.isOpen()) {
+		return;
+	}
+	auto dead = deadBytes;
+	constexpr std::uint32_t tombstone = PackedRecordFlags::Tombstone;
+	std::for_each(deleted.cbegin(), deleted.cend(), [&](const std::size_t& number) {
+		auto flags = records[number].flags | tombstone;
+		if (index.writeAt(&flags, sizeof(flags), recordOffset(positions[number]) + offsetof(PackedIndexRecord, flags))) {
+			dead += records[number].storedLength;
+		}
+	});
+	index.sync();
+
+	if (compactionThreshold > 0) {
+		auto total = segment.size();
+		if (total > 0 && dead * 100 >= total * compactionThreshold) {
+			PackedStorageFactory::scheduleCompaction(directory, mailboxName);
+		}
+	}
+}
+
+std::shared_ptr<std::mutex> PackedStorageFactory::getDirectoryMutex(const std::filesystem::path& directory) {
+	std::lock_guard<std::mutex> lg{ m_mutex };
+	auto& weak = directoryMutexes[directory.string()];
+	auto mutex = weak.lock();
+	if (!mutex) {
+		mutex = std::make_shared<std::mutex>();
+		weak = mutex;
+	}
+	return mutex;
+}
+
+PackedStorageFactory::Settings PackedStorageFactory::resolve(const MailStorageInfo& info, std::string_view name) {
+	Settings settings;
+	for (unsigned int i = 0; i < info.count; i++) {
+		if (info[i].name == Option::name_type("path")) {
+			settings.path = std::get<std::string>(info[i].value);
+		}
+		else if (info[i].name == Option::name_type("compaction")) {
+			settings.compactionThreshold = std::get<unsigned int>(info[i].value);
+		}
+		else if (info[i].name == Option::name_type("compression")) {
+			settings.compression = static_cast<PackedCompression>(std::get<unsigned int>(info[i].value));
+		}
+	}
+
+	if (settings.path.empty()) {
+		settings.path = FileSystemStorageFactory::getDefaultPath() / name;
+	}
+	return settings;
+}
+
+std::shared_ptr<PackedMailStorage> PackedStorageFactory::create(const MailStorageInfo& info, std::string_view name) {
+	auto settings = resolve(info, name);
+	const auto& path = settings.path;
+
+	if (!std::filesystem::exists(path)) {
+		if (!std::filesystem::create_directory(path)) {
+			throw std::runtime_error{ "Failed to create mailbox directory" };
+		}
+	}
+
+	PackedFile index;
+	PackedIndexHeader header;
+	{
+		auto mutex = getDirectoryMutex(path);
+		std::lock_guard<std::mutex> lg{ *mutex };
+		if (!openIndex(path, index, header, false)) {
+			throw std::runtime_error{ "Failed to open mailbox index" };
+		}
+	}
+
+	PackedFile segment{ PackedMailStorage::SegmentPath(path, header.generation), false };
+	auto all = readRecords(index);
+
+	std::vector<PackedIndexRecord> records;
+	std::vector<std::uint64_t> positions;
+	std::uint64_t deadBytes = 0;
+	records.reserve(all.size());
+	positions.reserve(all.size());
+	for (std::size_t i = 0; i < all.size(); i++) {
+		if (all[i].isTombstone()) {
+			deadBytes += all[i].storedLength;
+		}
+		else {
+			records.push_back(all[i]);
+			positions.push_back(i);
+		}
+	}
+
+	if (!records.empty() && !segment.isOpen()) {
+		throw std::runtime_error{ "Failed to open mailbox segment" };
+	}
+
+	return std::make_shared<PackedMailStorage>(path, name, std::move(segment), std::move(records), std::move(positions),
+		deadBytes, settings.compactionThreshold);
+}
+
+std::variant<std::uint64_t, MailboxOperationError> PackedStorageFactory::append(const MailStorageInfo& info, std::string_view name, std::string_view message) {
+	auto settings = resolve(info, name);
+	std::error_code ec;
+	std::filesystem::create_directory(settings.path, ec);
+	return append(settings.path, message, settings.compression);
+}
+
+std::variant<std::uint64_t, MailboxOperationError> PackedStorageFactory::append(const std::filesystem::path& directory, std::string_view message,
+	[[maybe_unused]] PackedCompression compression) 
+{
+	PackedIndexRecord record;
+	record.length = message.size();
+	record.setWireSize(message);
+	std::string_view stored = message;
+#ifdef MAILBOX_HAS_ZLIB
+	//compressed outside of the lock, only octets which are really saved are kept
+	std::string compressed;
+	if (compression == PackedCompression::Deflate && deflateMessage(message, compressed) && compressed.size() < message.size()) {
+		record.flags |= PackedRecordFlags::Compressed;
+		stored = compressed;
+	}
+#endif
+	record.storedLength = stored.size();
+
+	auto mutex = getDirectoryMutex(directory);
+	std::lock_guard<std::mutex> lg{ *mutex };
+
+	PackedFile index;
+	PackedIndexHeader header;
+	if (!openIndex(directory, index, header, true)) {
+		return MailboxOperationError::InternalError;
+	}
+	PackedFile segment{ PackedMailStorage::SegmentPath(directory, header.generation), true };
+	if (!segment.isOpen()) {
+		return MailboxOperationError::InternalError;
+	}
+
+	record.offset = segment.size();
+	record.uid = header.nextUid++;
+
+	//message goes to the segment first, the index record makes it visible
+	if (!segment.writeAt(stored.data(), stored.size(), record.offset) || !segment.sync()) {
+		return MailboxOperationError::InternalError;
+	}
+	auto indexSize = index.size();
+	auto position = (indexSize - sizeof(PackedIndexHeader)) / sizeof(PackedIndexRecord);
+	if (!index.writeAt(&header, sizeof(header), 0) ||
+		!index.writeAt(&record, sizeof(record), recordOffset(position)) || !index.sync()) {
+		return MailboxOperationError::InternalError;
+	}
+	return record.uid;
+}
+
+bool PackedStorageFactory::compact(const std::filesystem::path& directory) {
+	auto mutex = getDirectoryMutex(directory);
+	std::lock_guard<std::mutex> lg{ *mutex };
+
+	PackedFile index;
+	PackedIndexHeader header;
+	if (!openIndex(directory, index, header, false)) {
+		return false;
+	}
+	auto records = readRecords(index);
+	PackedFile oldSegment{ PackedMailStorage::SegmentPath(directory, header.generation), false };
+
+	PackedIndexHeader newHeader = header;
+	newHeader.generation = header.generation + 1;
+	auto newSegmentPath = PackedMailStorage::SegmentPath(directory, newHeader.generation);
+	auto newIndexPath = directory / (std::string(PackedMailStorage::IndexFileName) + ".tmp");
+	std::error_code ec;
+	std::filesystem::remove(newSegmentPath, ec);
+	std::filesystem::remove(newIndexPath, ec);
+
+	PackedFile newSegment{ newSegmentPath, true };
+	PackedFile newIndex{ newIndexPath, true };
+	if (!newSegment.isOpen() || !newIndex.isOpen() || !newIndex.writeAt(&newHeader, sizeof(newHeader), 0)) {
+		return false;
+	}
+
+	std::uint64_t offset = 0;
+	std::uint64_t position = 0;
+	std::string buffer;
+	for (const auto& record : records) {
+		if (record.isTombstone()) {
+			continue;
+		}
+		buffer.resize(static_cast<std::size_t>(record.storedLength));
+		if (!buffer.empty() && (!oldSegment.readAt(&buffer[0], buffer.size(), record.offset) ||
+			!newSegment.writeAt(buffer.data(), buffer.size(), offset))) {
+			return false;
+		}
+		auto moved = record;
+		moved.offset = offset;
+		if (!moved.isWireSized() && !moved.isCompressed()) {
+			//records appended by older versions get their wire size when they are rewritten
+			moved.setWireSize(buffer);
+		}
+		if (!newIndex.writeAt(&moved, sizeof(moved), recordOffset(position++))) {
+			return false;
+		}
+		offset += record.storedLength;
+	}
+	if (!newSegment.sync() || !newIndex.sync()) {
+		return false;
+	}
+	newIndex.close();
+	index.close();
+
+	//replacing the index switches readers to the new generation at once
+	std::filesystem::rename(newIndexPath, directory / PackedMailStorage::IndexFileName, ec);
+	if (ec) {
+		std::filesystem::remove(newSegmentPath, ec);
+		return false;
+	}
+	oldSegment.close();
+	std::filesystem::remove(PackedMailStorage::SegmentPath(directory, header.generation), ec);
+	return true;
+}
+
+void PackedStorageFactory::scheduleCompaction(const std::filesystem::path& directory, std::string_view mailboxName) {
+	//the session which requested compaction releases the mailbox right after its storages,
+	//no worker waits for that: the task is posted by the unlock
+	MailboxServiceManager::PostWhenUnlocked(mailboxName, [directory, name = std::string(mailboxName)]() {
+		if (MailboxServiceManager::LockMailbox(name)) {
+			compact(directory);
+			MailboxServiceManager::UnlockMailbox(name);
+		}
+		else {
+			//a new session took the mailbox first
+			scheduleCompaction(directory, name);
+		}
+	});
+}
@@ -0,0 +1,217 @@
+
+#include "PasswordVerifier.h"
+
+#include <array>
+#include <random>
+#include <charconv>
+#include <algorithm>
+#include <functional>
+
+#ifdef MAILBOX_HAS_OPENSSL
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include <openssl/crypto.h>
+
+namespace {
+	constexpr std::string_view HexDigits = "0123456789abcdef";
+
+	std::string toHex(const unsigned char* data, std::size_t size) {
+		std::string result;
+		result.reserve(size * 2);
+		std::for_each(data, data + size, [&result](unsigned char c) {
+			result.push_back(HexDigits[c >> 4]);
+			result.push_back(HexDigits[c & 0x0F]);
+		});
+		return result;
+	}
+
+	bool fromHex(std::string_view hex, std::string& result) {
+		if (hex.size() % 2) {
+			return false;
+		}
+		result.clear();
+		for (std::size_t i = 0; i < hex.size(); i += 2) {
+			unsigned int value = 0;
+			auto [ptr, ec] = std::from_chars(hex.data() + i, hex.data() + i + 2, value, 16);
+			if (ec != std::errc() || ptr != hex.data() + i + 2) {
+				return false;
+			}
+			result.push_back(static_cast<char>(value));
+		}
+		return true;
+	}
+
+	//splits off the part before the next '$'
+	std::string_view nextField(std::string_view& rest) {
+		auto pos = rest.find('$');
+		auto field = rest.substr(0, pos);
+		rest = pos == std::string_view::npos ? std::string_view() : rest.substr(pos + 1);
+		return field;
+	}
+}
+#endif
+
+namespace {
+	//overwrite a copy of a password, the compiler may not drop it as a dead store
+	void wipe(std::string& data) {
+#ifdef MAILBOX_HAS_OPENSSL
+		OPENSSL_cleanse(data.data(), data.size());
+#else
+		volatile char* p = data.data();
+		for (std::size_t i = 0; i < data.size(); i++) {
+			p[i] = '\0';
+		}
+#endif
+	}
+}
+
+bool Pbkdf2PasswordVerifier::verify(std::string_view password, std::string_view credential) const {
+	if (credential.substr(0, Prefix.size()) != Prefix) {
+		return password == credential;
+	}
+#ifdef MAILBOX_HAS_OPENSSL
+	auto rest = credential.substr(Prefix.size());
+	auto iterationsField = nextField(rest);
+	auto saltField = nextField(rest);
+	auto keyField = rest;
+	unsigned int iterations = 0;
+	auto [ptr, ec] = std::from_chars(iterationsField.data(), iterationsField.data() + iterationsField.size(), iterations);
+	std::string salt, key;
+	if (ec != std::errc() || ptr != iterationsField.data() + iterationsField.size() || iterations == 0
+		|| !fromHex(saltField, salt) || !fromHex(keyField, key) || key.empty()) {
+		//a malformed credential matches no password
+		return false;
+	}
+	std::string derived(key.size(), '\0');
+	if (PKCS5_PBKDF2_HMAC(password.data(), static_cast<int>(password.size()),
+		reinterpret_cast<const unsigned char*>(salt.data()), static_cast<int>(salt.size()), static_cast<int>(iterations),
+		EVP_sha256(), static_cast<int>(derived.size()), reinterpret_cast<unsigned char*>(derived.data())) != 1) {
+		return false;
+	}
+	//the time of the comparison tells nothing about the key
+	return CRYPTO_memcmp(derived.data(), key.data(), key.size()) == 0;
+#else
+	return false;
+#endif
+}
+
+std::string Pbkdf2PasswordVerifier::MakeCredential(std::string_view password, unsigned int iterations) {
+#ifdef MAILBOX_HAS_OPENSSL
+	std::array<unsigned char, SaltLength> salt;
+	std::array<unsigned char, KeyLength> key;
+	if (RAND_bytes(salt.data(), static_cast<int>(salt.size())) != 1
+		|| PKCS5_PBKDF2_HMAC(password.data(), static_cast<int>(password.size()), salt.data(), static_cast<int>(salt.size()),
+			static_cast<int>(iterations), EVP_sha256(), static_cast<int>(key.size()), key.data()) != 1) {
+		return std::string();
+	}
+	std::string credential(Prefix);
+	credential.append(std::to_string(iterations)).append("$")
+		.append(toHex(salt.data(), salt.size())).append("$")
+		.append(toHex(key.data(), key.size()));
+	return credential;
+#else
+	return std::string();
+#endif
+}
+
+bool Pbkdf2PasswordVerifier::IsSupported() {
+#ifdef MAILBOX_HAS_OPENSSL
+	return true;
+#else
+	return false;
+#endif
+}
+
+VerificationCache::VerificationCache(std::chrono::seconds _ttl) : ttl(_ttl) {
+	salt.resize(DigestLength);
+#ifdef MAILBOX_HAS_OPENSSL
+	if (RAND_bytes(reinterpret_cast<unsigned char*>(salt.data()), static_cast<int>(salt.size())) == 1) {
+		return;
+	}
+#endif
+	std::random_device rd;
+	std::uniform_int_distribution<int> dist(0, 255);
+	std::generate(salt.begin(), salt.end(), [&]() { return static_cast<char>(dist(rd)); });
+}
+
+void VerificationCache::setTtl(std::chrono::seconds _ttl) {
+	std::lock_guard<std::mutex> lg{ m_mutex };
+	ttl = _ttl;
+	if (ttl <= clock::duration::zero()) {
+		entries.clear();
+	}
+}
+
+std::uint64_t VerificationCache::keyOf(std::string_view name) const {
+	return static_cast<std::uint64_t>(std::hash<std::string_view>{}(name));
+}
+
+bool VerificationCache::digestOf(std::string_view name, std::string_view password, std::string_view credential, Digest& digest) const {
+	//lengths keep the boundaries of the parts, so different triples do not make the same string
+	std::string data;
+	//reserved at once, no copy of the password is left behind by a reallocation
+	data.reserve(salt.size() + name.size() + password.size() + credential.size() + 64);
+	for (auto part : { name, password, credential }) {
+		data.append(std::to_string(part.size())).append(":").append(part);
+	}
+#ifdef MAILBOX_HAS_OPENSSL
+	unsigned int length = 0;
+	auto computed = HMAC(EVP_sha256(), salt.data(), static_cast<int>(salt.size()), reinterpret_cast<const unsigned char*>(data.data()), data.size(),
+		digest.data(), &length) != nullptr && length == digest.size();
+#else
+	auto computed = true;
+	//without OpenSSL credentials are plain passwords, cheap to check again, the digest only has to tell triples apart
+	data.insert(0, salt);
+	for (std::size_t i = 0; i < digest.size(); i += sizeof(std::uint64_t)) {
+		data[0] = static_cast<char>(data[0] + 1);
+		auto part = static_cast<std::uint64_t>(std::hash<std::string_view>{}(data));
+		for (std::size_t j = 0; j < sizeof(part); j++) {
+			digest[i + j] = static_cast<unsigned char>(part >> (j * 8));
+		}
+	}
+#endif
+	wipe(data);
+	return computed;
+}
+
+bool VerificationCache::equal(const Digest& first, const Digest& second) {
+#ifdef MAILBOX_HAS_OPENSSL
+	return CRYPTO_memcmp(first.data(), second.data(), first.size()) == 0;
+#else
+	unsigned char difference = 0;
+	for (std::size_t i = 0; i < first.size(); i++) {
+		difference |= first[i] ^ second[i];
+	}
+	return difference == 0;
+#endif
+}
+
+bool VerificationCache::contains(std::string_view name, std::string_view password, std::string_view credential) const {
+	Digest digest;
+	if (!digestOf(name, password, credential, digest)) {
+		return false;
+	}
+	std::lock_guard<std::mutex> lg{ m_mutex };
+	auto it = entries.find(keyOf(name));
+	return it != entries.end() && equal(it->second.digest, digest) && it->second.expires > clock::now();
+}
+
+void VerificationCache::insert(std::string_view name, std::string_view password, std::string_view credential) {
+	Digest digest;
+	if (!digestOf(name, password, credential, digest)) {
+		return;
+	}
+	auto now = clock::now();
+	std::lock_guard<std::mutex> lg{ m_mutex };
+	if (ttl <= clock::duration::zero()) {
+		return;
+	}
+	entries[keyOf(name)] = Entry{ digest, now + ttl };
+	if (entries.size() > sweepAt) {
+		for (auto it = entries.begin(); it != entries.end();) {
+			it = it->second.expires <= now ? entries.erase(it) : std::next(it);
+		}
+		sweepAt = std::max(SweepSize, entries.size() * 2);
+	}
+}
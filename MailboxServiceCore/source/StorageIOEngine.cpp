@@ -0,0 +1,389 @@
+
+#include "StorageIOEngine.h"
+#include "WorkerPool.h"
+
+#include <fstream>
+#include <algorithm>
+#include <future>
+#include <mutex>
+
+#ifndef WIN32
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef MAILBOX_HAS_IO_URING
+#include <liburing.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+void StorageIOEngine::prefetchFiles([[maybe_unused]] const std::vector<std::filesystem::path>& files, [[maybe_unused]] std::uint64_t length) {
+#if !defined(WIN32) && defined(POSIX_FADV_WILLNEED)
+	std::for_each(files.cbegin(), files.cend(), [length](const auto& file) {
+		int handle = ::open(file.c_str(), O_RDONLY);
+		if (handle >= 0) {
+			::posix_fadvise(handle, 0, static_cast<off_t>(length), POSIX_FADV_WILLNEED);
+			::close(handle);
+		}
+	});
+#endif
+}
+
+/// <summary>
+/// Plain blocking implementation, one syscall per file
+/// </summary>
+class SynchronousStorageIOEngine : public StorageIOEngine
+{
+public:
+	std::vector<std::optional<FileAttributes>> statFiles(const std::vector<std::filesystem::path>& files) override {
+		std::vector<std::optional<FileAttributes>> attributes;
+		attributes.reserve(files.size());
+		std::transform(files.cbegin(), files.cend(), std::back_inserter(attributes), [](const auto& file) {
+			return statFile(file);
+		});
+		return attributes;
+	}
+
+	std::variant<std::string, MailboxOperationError> readFile(const std::filesystem::path& file, std::size_t sizeHint) override {
+		constexpr auto read_size = std::size_t{ 65536 };
+		std::ifstream stream{ file, std::ios_base::in | std::ios_base::binary };
+		if (!stream.is_open()) {
+			return MailboxOperationError::InternalError;
+		}
+		std::string out;
+		out.reserve(sizeHint);
+		auto buf = std::string(read_size, '\0');
+		while (stream.read(&buf[0], read_size)) {
+			out.append(buf, 0, stream.gcount());
+		}
+		if (stream.bad()) {
+			return MailboxOperationError::InternalError;
+		}
+		out.append(buf, 0, stream.gcount());
+		return out;
+	}
+
+	std::size_t unlinkFiles(const std::vector<std::filesystem::path>& files) override {
+		return std::count_if(files.cbegin(), files.cend(), [](const auto& file) {
+			std::error_code ec;
+			return std::filesystem::remove(file, ec);
+		});
+	}
+
+	StorageIOEngineType type() const override { return StorageIOEngineType::Synchronous; }
+
+private:
+	static std::optional<FileAttributes> statFile(const std::filesystem::path& file) {
+		FileAttributes attributes;
+#ifdef WIN32
+		std::error_code ec;
+		attributes.size = static_cast<std::size_t>(std::filesystem::file_size(file, ec));
+		if (ec) {
+			return std::nullopt;
+		}
+		auto mtime = std::filesystem::last_write_time(file, ec);
+		attributes.mtime = std::chrono::duration_cast<std::chrono::nanoseconds>(mtime.time_since_epoch()).count();
+#else
+		struct stat st;
+		if (::stat(file.c_str(), &st) != 0) {
+			return std::nullopt;
+		}
+		attributes.size = static_cast<std::size_t>(st.st_size);
+		attributes.mtime = static_cast<std::int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+		attributes.inode = static_cast<std::uint64_t>(st.st_ino);
+#endif
+		return attributes;
+	}
+};
+
+/// <summary>
+/// Splits batches into chunks and runs them in parallel on its own pool
+/// </summary>
+class ThreadPoolStorageIOEngine : public StorageIOEngine
+{
+public:
+	constexpr static std::size_t ChunkSize = 128;
+
+	explicit ThreadPoolStorageIOEngine(unsigned int threadsCount) : pool(threadsCount) {}
+
+	std::vector<std::optional<FileAttributes>> statFiles(const std::vector<std::filesystem::path>& files) override {
+		std::vector<std::optional<FileAttributes>> attributes(files.size());
+		forEachChunk(files, [this, &files, &attributes](std::size_t first, std::size_t last) {
+			std::vector<std::filesystem::path> chunk(files.cbegin() + first, files.cbegin() + last);
+			auto chunkAttributes = sync.statFiles(chunk);
+			std::move(chunkAttributes.begin(), chunkAttributes.end(), attributes.begin() + first);
+			return chunkAttributes.size();
+		});
+		return attributes;
+	}
+
+	std::variant<std::string, MailboxOperationError> readFile(const std::filesystem::path& file, std::size_t sizeHint) override {
+		//the caller waits for the content anyway, so there is nothing to gain from switching threads
+		return sync.readFile(file, sizeHint);
+	}
+
+	std::size_t unlinkFiles(const std::vector<std::filesystem::path>& files) override {
+		return forEachChunk(files, [this, &files](std::size_t first, std::size_t last) {
+			std::vector<std::filesystem::path> chunk(files.cbegin() + first, files.cbegin() + last);
+			return sync.unlinkFiles(chunk);
+		});
+	}
+
+	StorageIOEngineType type() const override { return StorageIOEngineType::ThreadPool; }
+
+private:
+	template<typename Func>
+	std::size_t forEachChunk(const std::vector<std::filesystem::path>& files, Func func) {
+		if (files.size() <= ChunkSize) {
+			return func(0, files.size());
+		}
+		std::vector<std::future<std::size_t>> futures;
+		for (std::size_t first = 0; first < files.size(); first += ChunkSize) {
+			auto last = std::min(first + ChunkSize, files.size());
+			futures.push_back(pool.submit([&func, first, last]() { return func(first, last); }));
+		}
+		std::size_t total = 0;
+		std::for_each(futures.begin(), futures.end(), [&total](auto& future) { total += future.get(); });
+		return total;
+	}
+
+	SynchronousStorageIOEngine sync;
+	WorkerPool pool;
+};
+
+#ifdef MAILBOX_HAS_IO_URING
+
+/// <summary>
+/// Submits a whole batch to io_uring at once: LIST costs a single submission of statx requests
+/// and UPDATE a single submission of unlinkat requests (per QueueDepth files).
+/// Reading a message is one submission too: open, read and close are linked through a fixed file slot of the ring.
+/// Rings are not thread-safe, so every caller takes a ring from a small free-list.
+/// </summary>
+class UringStorageIOEngine : public StorageIOEngine
+{
+	struct Ring {
+		io_uring ring;
+		bool initialized{ false };
+		//a registered file table holding FileSlot, for linked open-read-close
+		bool fixedFile{ false };
+		~Ring() {
+			if (initialized) {
+				io_uring_queue_exit(&ring);
+			}
+		}
+	};
+
+	class RingHolder {
+	public:
+		RingHolder(UringStorageIOEngine& engine) : engine(engine), ring(engine.acquire()) {}
+		~RingHolder() { engine.release(std::move(ring)); }
+		inline io_uring* get() { return ring ? &ring->ring : nullptr; }
+		inline bool fixedFile() const { return ring && ring->fixedFile; }
+	private:
+		UringStorageIOEngine& engine;
+		std::unique_ptr<Ring> ring;
+	};
+
+public:
+	constexpr static unsigned int QueueDepth = 256;
+	constexpr static std::size_t ReadChunk = 65536;
+	constexpr static unsigned int FileSlot = 0;
+
+	static std::shared_ptr<UringStorageIOEngine> TryCreate() {
+		auto engine = std::make_shared<UringStorageIOEngine>();
+		auto ring = engine->createRing();
+		if (!ring) {
+			return nullptr;
+		}
+		auto probe = io_uring_get_probe_ring(&ring->ring);
+		if (!probe) {
+			return nullptr;
+		}
+		bool supported = io_uring_opcode_supported(probe, IORING_OP_STATX) &&
+			io_uring_opcode_supported(probe, IORING_OP_UNLINKAT) &&
+			io_uring_opcode_supported(probe, IORING_OP_OPENAT) &&
+			io_uring_opcode_supported(probe, IORING_OP_READ) &&
+			io_uring_opcode_supported(probe, IORING_OP_CLOSE);
+		io_uring_free_probe(probe);
+		if (!supported) {
+			return nullptr;
+		}
+		engine->release(std::move(ring));
+		return engine;
+	}
+
+	std::vector<std::optional<FileAttributes>> statFiles(const std::vector<std::filesystem::path>& files) override {
+		std::vector<std::optional<FileAttributes>> attributes(files.size());
+		std::vector<struct statx> buffers(std::min<std::size_t>(files.size(), QueueDepth));
+		RingHolder ring{ *this };
+		if (!ring.get()) {
+			return fallback.statFiles(files);
+		}
+		forEachBatch(ring.get(), files.size(), [&](io_uring_sqe* sqe, std::size_t i, std::size_t slot) {
+			io_uring_prep_statx(sqe, AT_FDCWD, files[i].c_str(), AT_STATX_SYNC_AS_STAT, STATX_SIZE | STATX_MTIME | STATX_INO, &buffers[slot]);
+		}, [&](std::size_t i, std::size_t slot, int res) {
+			if (res == 0) {
+				const auto& stx = buffers[slot];
+				FileAttributes result;
+				result.size = static_cast<std::size_t>(stx.stx_size);
+				result.mtime = static_cast<std::int64_t>(stx.stx_mtime.tv_sec) * 1000000000 + stx.stx_mtime.tv_nsec;
+				result.inode = static_cast<std::uint64_t>(stx.stx_ino);
+				attributes[i] = result;
+			}
+		});
+		return attributes;
+	}
+
+	std::variant<std::string, MailboxOperationError> readFile(const std::filesystem::path& file, std::size_t sizeHint) override {
+		RingHolder ring{ *this };
+		if (!ring.get() || !ring.fixedFile()) {
+			return fallback.readFile(file, sizeHint);
+		}
+		//one octet over the expected size tells whether the file is larger than expected
+		auto expected = sizeHint != 0 ? sizeHint : ReadChunk - 1;
+		std::string out(expected + 1, '\0');
+
+		auto sqe = io_uring_get_sqe(ring.get());
+		//no O_CLOEXEC: a direct descriptor is never inherited and the kernel rejects the flag for it
+		io_uring_prep_openat_direct(sqe, AT_FDCWD, file.c_str(), O_RDONLY, 0, FileSlot);
+		//a failed open cancels the rest of the chain
+		sqe->flags |= IOSQE_IO_LINK;
+		io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(0));
+		sqe = io_uring_get_sqe(ring.get());
+		io_uring_prep_read(sqe, FileSlot, &out[0], static_cast<unsigned int>(out.size()), 0);
+		//the read is expected to be short, which would break a soft link before the close
+		sqe->flags |= IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+		io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(1));
+		sqe = io_uring_get_sqe(ring.get());
+		io_uring_prep_close_direct(sqe, FileSlot);
+		io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(2));
+		io_uring_submit_and_wait(ring.get(), 3);
+
+		int results[3] = { -ECANCELED, -ECANCELED, -ECANCELED };
+		for (int done = 0; done < 3; done++) {
+			io_uring_cqe* cqe = nullptr;
+			if (io_uring_wait_cqe(ring.get(), &cqe) < 0) {
+				break;
+			}
+			results[reinterpret_cast<std::size_t>(io_uring_cqe_get_data(cqe))] = cqe->res;
+			io_uring_cqe_seen(ring.get(), cqe);
+		}
+		//a slot left open by a failed close is replaced by the next open
+		if (results[0] < 0 || results[1] < 0) {
+			return MailboxOperationError::InternalError;
+		}
+		auto length = static_cast<std::size_t>(results[1]);
+		if (length > expected) {
+			//rare: the file has grown since it was examined, or its size was not known and it is large
+			return fallback.readFile(file, length);
+		}
+		out.resize(length);
+		return out;
+	}
+
+	std::size_t unlinkFiles(const std::vector<std::filesystem::path>& files) override {
+		RingHolder ring{ *this };
+		if (!ring.get()) {
+			return fallback.unlinkFiles(files);
+		}
+		std::size_t removed = 0;
+		forEachBatch(ring.get(), files.size(), [&](io_uring_sqe* sqe, std::size_t i, std::size_t) {
+			io_uring_prep_unlinkat(sqe, AT_FDCWD, files[i].c_str(), 0);
+		}, [&removed](std::size_t, std::size_t, int res) {
+			if (res == 0) {
+				removed++;
+			}
+		});
+		return removed;
+	}
+
+	StorageIOEngineType type() const override { return StorageIOEngineType::IoUring; }
+
+private:
+	std::unique_ptr<Ring> createRing() {
+		auto ring = std::make_unique<Ring>();
+		if (io_uring_queue_init(QueueDepth, &ring->ring, 0) < 0) {
+			return nullptr;
+		}
+		ring->initialized = true;
+		//sparse file tables came with Linux 5.19, after direct open and close (5.15), so this also probes for them
+		ring->fixedFile = io_uring_register_files_sparse(&ring->ring, FileSlot + 1) == 0;
+		return ring;
+	}
+
+	std::unique_ptr<Ring> acquire() {
+		{
+			std::lock_guard<std::mutex> lg{ m_mutex };
+			if (!rings.empty()) {
+				auto ring = std::move(rings.back());
+				rings.pop_back();
+				return ring;
+			}
+		}
+		return createRing();
+	}
+
+	void release(std::unique_ptr<Ring> ring) {
+		if (!ring) {
+			return;
+		}
+		std::lock_guard<std::mutex> lg{ m_mutex };
+		rings.push_back(std::move(ring));
+	}
+
+	/// <summary>
+	/// Submit count requests in batches of QueueDepth, prepare gets the request index and a slot in the batch
+	/// </summary>
+	template<typename Prepare, typename Complete>
+	static void forEachBatch(io_uring* ring, std::size_t count, Prepare prepare, Complete complete) {
+		for (std::size_t first = 0; first < count; first += QueueDepth) {
+			auto last = std::min<std::size_t>(first + QueueDepth, count);
+			for (auto i = first; i < last; i++) {
+				auto sqe = io_uring_get_sqe(ring);
+				prepare(sqe, i, i - first);
+				io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(i));
+			}
+			io_uring_submit_and_wait(ring, static_cast<unsigned int>(last - first));
+			for (auto done = first; done < last; done++) {
+				io_uring_cqe* cqe = nullptr;
+				if (io_uring_wait_cqe(ring, &cqe) < 0) {
+					break;
+				}
+				auto i = reinterpret_cast<std::size_t>(io_uring_cqe_get_data(cqe));
+				complete(i, i - first, cqe->res);
+				io_uring_cqe_seen(ring, cqe);
+			}
+		}
+	}
+
+	SynchronousStorageIOEngine fallback;
+	std::vector<std::unique_ptr<Ring>> rings;
+	std::mutex m_mutex;
+};
+
+#endif
+
+std::shared_ptr<StorageIOEngine> StorageIOEngine::Create(StorageIOEngineType type, unsigned int threadsCount) {
+	if (threadsCount == 0) {
+		threadsCount = std::max(static_cast<unsigned int>(2), std::thread::hardware_concurrency());
+	}
+	switch (type)
+	{
+	case StorageIOEngineType::IoUring: {
+#ifdef MAILBOX_HAS_IO_URING
+		if (auto engine = UringStorageIOEngine::TryCreate()) {
+			return engine;
+		}
+#endif
+		//kernel does not support required operations, use threads instead
+		return std::make_shared<ThreadPoolStorageIOEngine>(threadsCount);
+	}
+	case StorageIOEngineType::ThreadPool:
+		return std::make_shared<ThreadPoolStorageIOEngine>(threadsCount);
+	default:
+		return std::make_shared<SynchronousStorageIOEngine>();
+	}
+}
@@ -0,0 +1,157 @@
+
+#include "WireEncoder.h"
+
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define WIRE_ENCODER_AVX2
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define WIRE_ENCODER_SSE2
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace {
+	inline unsigned int lowestBit(std::uint32_t mask) {
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward(&index, mask);
+		return static_cast<unsigned int>(index);
+#else
+		return static_cast<unsigned int>(__builtin_ctz(mask));
+#endif
+	}
+
+	/// <summary>
+	/// Find the first LF, 32 or 16 octets are compared at once where the vector extensions are available
+	/// </summary>
+	/// <returns>Pointer to LF or end</returns>
+	const char* findLineFeed(const char* p, const char* end) {
+#ifdef WIRE_ENCODER_AVX2
+		const __m256i lf32 = _mm256_set1_epi8('\n');
+		for (; end - p >= 32; p += 32) {
+			auto block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+			auto mask = static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, lf32)));
+			if (mask != 0) {
+				return p + lowestBit(mask);
+			}
+		}
+#endif
+#ifdef WIRE_ENCODER_SSE2
+		const __m128i lf16 = _mm_set1_epi8('\n');
+		for (; end - p >= 16; p += 16) {
+			auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+			auto mask = static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, lf16)));
+			if (mask != 0) {
+				return p + lowestBit(mask);
+			}
+		}
+#endif
+		auto found = static_cast<const char*>(std::memchr(p, '\n', static_cast<std::size_t>(end - p)));
+		return found ? found : end;
+	}
+
+	struct StringSink {
+		std::string& out;
+
+		inline void append(const char* data, std::size_t size) { out.append(data, size); }
+		inline void push(char c) { out.push_back(c); }
+	};
+
+	struct CountingSink {
+		std::size_t count{ 0 };
+
+		inline void append(const char*, std::size_t size) { count += size; }
+		inline void push(char) { count++; }
+	};
+}
+
+template<typename Sink>
+void WireEncoder::process(const char* data, std::size_t size, Sink& sink) {
+	const char* p = data;
+	const char* end = data + size;
+	while (p < end) {
+		if (lineStart) {
+			if (*p == '.') {
+				sink.push('.');
+			}
+			lineStart = false;
+		}
+		auto lf = findLineFeed(p, end);
+		if (lf == end) {
+			//the line continues in the next part
+			sink.append(p, static_cast<std::size_t>(end - p));
+			afterCR = end[-1] == '\r';
+			return;
+		}
+		bool crlf = lf > p ? lf[-1] == '\r' : afterCR;
+		sink.append(p, static_cast<std::size_t>(lf - p));
+		if (!crlf) {
+			sink.push('\r');
+		}
+		sink.push('\n');
+		p = lf + 1;
+		lineStart = true;
+		afterCR = false;
+	}
+}
+
+void WireEncoder::encode(const char* data, std::size_t size, std::string& out) {
+	//most messages are already in CRLF form, so the output is usually of the same size
+	out.reserve(out.size() + size + size / 64 + 2);
+	StringSink sink{ out };
+	process(data, size, sink);
+}
+
+std::size_t WireEncoder::measure(const char* data, std::size_t size) {
+	CountingSink sink;
+	process(data, size, sink);
+	return sink.count;
+}
+
+void WireEncoder::finish(std::string& out) {
+	if (!lineStart) {
+		out.append("\r\n");
+	}
+	lineStart = true;
+	afterCR = false;
+}
+
+std::size_t WireEncoder::WireSize(std::string_view message) {
+	WireEncoder encoder;
+	auto size = encoder.measure(message.data(), message.size());
+	return size + encoder.finishSize();
+}
+
+std::variant<std::size_t, MailboxOperationError> WireMessageReader::read(char* buffer, std::size_t size) {
+	while (pendingPosition == pending.size()) {
+		if (finished) {
+			return static_cast<std::size_t>(0);
+		}
+		pending.clear();
+		pendingPosition = 0;
+		//every octet takes two octets at most, so a part usually fits to the caller's buffer at once
+		chunk.resize(std::max<std::size_t>(size / 2, 1));
+		auto result = source->read(&chunk[0], chunk.size());
+		if (std::holds_alternative<MailboxOperationError>(result)) {
+			return std::get<MailboxOperationError>(result);
+		}
+		auto count = std::get<std::size_t>(result);
+		if (count == 0) {
+			encoder.finish(pending);
+			finished = true;
+		}
+		else {
+			encoder.encode(chunk.data(), count, pending);
+		}
+	}
+	auto count = pending.copy(buffer, size, pendingPosition);
+	pendingPosition += count;
+	return count;
+}
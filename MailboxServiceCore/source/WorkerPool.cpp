@@ -0,0 +1,55 @@
+
+#include "WorkerPool.h"
+#include <algorithm>
+
+WorkerPool::WorkerPool(unsigned int threadsCount) {
+	threadsCount = std::max(static_cast<unsigned int>(1), threadsCount);
+	threads.reserve(threadsCount);
+	for (unsigned int i = 0; i < threadsCount; i++) {
+		threads.emplace_back([this]() { run(); });
+	}
+}
+
+void WorkerPool::post(std::function<void()> task) {
+	{
+		std::lock_guard<std::mutex> lg{ m_mutex };
+		tasks.push_back(std::move(task));
+	}
+	cv.notify_one();
+}
+
+void WorkerPool::run() {
+	while (true) {
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock{ m_mutex };
+			cv.wait(lock, [this]() { return stopped || !tasks.empty(); });
+			if (tasks.empty()) {
+				//stopped and nothing left to do
+				return;
+			}
+			task = std::move(tasks.front());
+			tasks.pop_front();
+		}
+		try {
+			task();
+		}
+		catch (...) {
+			//a failed background task must not take the whole pool down
+		}
+	}
+}
+
+WorkerPool& WorkerPool::Shared() {
+	static WorkerPool pool{ std::max(static_cast<unsigned int>(2), std::thread::hardware_concurrency()) };
+	return pool;
+}
+
+WorkerPool::~WorkerPool() {
+	{
+		std::lock_guard<std::mutex> lg{ m_mutex };
+		stopped = true;
+	}
+	cv.notify_all();
+	std::for_each(threads.begin(), threads.end(), [](auto& thread) { thread.join(); });
+}
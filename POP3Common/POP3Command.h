@@ -3,12 +3,18 @@
 #include "POP3CommandType.h"
 #include <optional>
 #include <variant>
-#include <boost/algorithm/string.hpp>
-#include <boost/lexical_cast.hpp>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <memory_resource>
+#include <algorithm>
+#include <charconv>
+#include <cctype>
 
 struct POP3Command {
 	POP3CommandType cmdType;
-	std::variant<std::monostate, unsigned int, std::string> parameter;
+	//string parameters are allocated by the resource given to parsePOP3Command
+	std::variant<std::monostate, unsigned int, std::pmr::string> parameter;
 
 	POP3Command() : cmdType{ POP3CommandType::NOOP } {
 
@@ -33,86 +39,90 @@ enum class ParsingError {
 	MailNumberRequired
 };
 
-inline std::ostream& operator<<(std::ostream& out, const ParsingError& err) {
-	std::string message;
+/// <summary>
+/// Text of the error sent to the client
+/// </summary>
+inline std::string_view errorMessage(ParsingError err) {
 	switch (err)
 	{
 	case ParsingError::EmptyString:
-		message = "empty line has been sent";
-		break;
+		return "empty line has been sent";
 	case ParsingError::InvalidFormat:
-		message = "command line has invalid format";
-		break;
+		return "command line has invalid format";
 	case ParsingError::UnknownCommand:
-		message = "unknown command";
-		break;
+		return "unknown command";
 	case ParsingError::InvalidUintParameter:
-		message = "expected integer parameter, but received something else";
-		break;
+		return "expected integer parameter, but received something else";
 	case ParsingError::UserNameRequired:
-		message = "user name required";
-		break;
+		return "user name required";
 	case ParsingError::PasswordRequired:
-		message = "password required";
-		break;
+		return "password required";
 	case ParsingError::MailNumberRequired:
-		message = "in RETR command mail number required";
-		break;
+		return "in RETR command mail number required";
 	default:
-		break;
+		return "";
 	}
-	out << message;
+}
+
+inline std::ostream& operator<<(std::ostream& out, const ParsingError& err) {
+	out << errorMessage(err);
 	return out;
 }
 
-inline std::variant<POP3Command, ParsingError> parsePOP3Command(const std::string& cmdLine) {
-	using namespace boost;
-	using namespace boost::algorithm;
+/// <summary>
+/// Parse a command line. Nothing is allocated but from the resource, so a session parses its commands
+/// in an arena which is released after every response.
+/// </summary>
+inline std::variant<POP3Command, ParsingError> parsePOP3Command(std::string_view cmdLine,
+	std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+{
 	if (cmdLine.empty()) {
 		return ParsingError::EmptyString;
 	}
 	constexpr std::size_t reserve_enough = 4;
-	std::vector<std::string> vv;
-	vv.reserve(reserve_enough);
-	split(vv, cmdLine, boost::is_space());
-	std::vector<std::string> v;
-	v.reserve(vv.size());
-	std::copy_if(vv.cbegin(), vv.cend(), std::back_inserter(v), [](const auto& s) { return !s.empty(); });
-	POP3Command cmd;
-	try {
-		cmd.cmdType = lexical_cast<POP3CommandType>(v[0]);
+	std::pmr::vector<std::string_view> v(resource);
+	v.reserve(reserve_enough);
+	std::size_t position = 0;
+	while (position < cmdLine.size()) {
+		auto begin = std::find_if_not(cmdLine.cbegin() + position, cmdLine.cend(), [](char c) { return std::isspace(static_cast<unsigned char>(c)); });
+		auto end = std::find_if(begin, cmdLine.cend(), [](char c) { return std::isspace(static_cast<unsigned char>(c)); });
+		if (begin != end) {
+			v.emplace_back(&*begin, static_cast<std::size_t>(end - begin));
+		}
+		position = static_cast<std::size_t>(end - cmdLine.cbegin());
 	}
-	catch (...) {
-		return ParsingError::UnknownCommand;
+	if (v.empty()) {
+		return ParsingError::EmptyString;
 	}
 
+	POP3Command cmd;
+	cmd.cmdType = toPOP3CommandType(v[0]);
 	if (cmd.cmdType == POP3CommandType::UNKNOWN) {
 		return ParsingError::UnknownCommand;
 	}
 
 	if (v.size() > 1) {
 		if (POP3Command::supportsUintParameter(cmd.cmdType)) {
-			try {
-				unsigned int param = lexical_cast<unsigned int>(v[1]);
-				cmd.parameter = param;
-			}
-			catch (bad_lexical_cast) {
+			unsigned int param;
+			auto result = std::from_chars(v[1].data(), v[1].data() + v[1].size(), param);
+			if (result.ec != std::errc() || result.ptr != v[1].data() + v[1].size()) {
 				return ParsingError::InvalidUintParameter;
 			}
+			cmd.parameter = param;
 		}
 		else if (POP3Command::supportStringParameter(cmd.cmdType)) {
-			cmd.parameter = v[1];
+			cmd.parameter.emplace<std::pmr::string>(v[1], resource);
 		}
 		/*else {
 			return ParsingError::InvalidFormat;
 		}*/
 	}
 
-	if (cmd.cmdType == POP3CommandType::USER && !std::holds_alternative<std::string>(cmd.parameter)) {
+	if (cmd.cmdType == POP3CommandType::USER && !std::holds_alternative<std::pmr::string>(cmd.parameter)) {
 		return ParsingError::UserNameRequired;
 	}
 
-	if (cmd.cmdType == POP3CommandType::PASS && !std::holds_alternative<std::string>(cmd.parameter)) {
+	if (cmd.cmdType == POP3CommandType::PASS && !std::holds_alternative<std::pmr::string>(cmd.parameter)) {
 		return ParsingError::PasswordRequired;
 	}
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <iostream>
+#include <string_view>
 
 enum class POP3CommandType {
 	UNKNOWN,
@@ -12,7 +13,8 @@ enum class POP3CommandType {
 	DELE,
 	NOOP,
 	RSET,
-	QUIT
+	QUIT,
+	CAPA
 };
 
 inline std::ostream& operator<<(std::ostream& out, const POP3CommandType& val) {
@@ -45,36 +47,43 @@ inline std::ostream& operator<<(std::ostream& out, const POP3CommandType& val) {
 	case POP3CommandType::QUIT:
 		out << "QUIT";
 		break;
+	case POP3CommandType::CAPA:
+		out << "CAPA";
+		break;
 	default:
 		break;
 	}
 	return out;
 }
 
-inline std::istream& operator>>(std::istream& in, POP3CommandType& val) {
-	std::string stringWCommand;
-	in >> stringWCommand;
+inline POP3CommandType toPOP3CommandType(std::string_view stringWCommand) {
 	if (stringWCommand == "USER")
-		val = POP3CommandType::USER;
+		return POP3CommandType::USER;
 	else if (stringWCommand == "PASS")
-		val = POP3CommandType::PASS;
+		return POP3CommandType::PASS;
 	else if (stringWCommand == "STAT")
-		val = POP3CommandType::STAT;
+		return POP3CommandType::STAT;
 	else if (stringWCommand == "LIST")
-		val = POP3CommandType::LIST;
+		return POP3CommandType::LIST;
 	else if (stringWCommand == "RETR")
-		val = POP3CommandType::RETR;
+		return POP3CommandType::RETR;
 	else if (stringWCommand == "DELE")
-		val = POP3CommandType::DELE;
+		return POP3CommandType::DELE;
 	else if (stringWCommand == "RSET")
-		val = POP3CommandType::RSET;
+		return POP3CommandType::RSET;
 	else if (stringWCommand == "NOOP")
-		val = POP3CommandType::NOOP;
+		return POP3CommandType::NOOP;
 	else if (stringWCommand == "QUIT")
-		val = POP3CommandType::QUIT;
-	else {
-		//Perhaps wrong command
-		val = POP3CommandType::UNKNOWN;
-	}
+		return POP3CommandType::QUIT;
+	else if (stringWCommand == "CAPA")
+		return POP3CommandType::CAPA;
+	//Perhaps wrong command
+	return POP3CommandType::UNKNOWN;
+}
+
+inline std::istream& operator>>(std::istream& in, POP3CommandType& val) {
+	std::string stringWCommand;
+	in >> stringWCommand;
+	val = toPOP3CommandType(stringWCommand);
 	return in;
 }
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <memory>
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include <boost/asio.hpp>
+
+#include "AdmissionController.h"
+#include "SessionExecutor.h"
+
+/// <summary>
+/// Session of the local admin listener: a minimal HTTP/1.1 server answering one GET or HEAD per connection.
+/// /metrics is the MetricsRegistry in the Prometheus text format, /sessions lists open POP3 sessions as JSON,
+/// /healthz answers while the io threads do. Responses are built on the shared worker pool, not on the io threads.
+/// </summary>
+class AdminSession : public std::enable_shared_from_this<AdminSession>
+{
+public:
+	constexpr static boost::asio::chrono::seconds Timeout = boost::asio::chrono::seconds(30);
+	//request line and headers, the body of a request is never read
+	constexpr static std::size_t MaxRequestLength = 8192;
+	//sent to connections over the limits of the server
+	constexpr static std::string_view BusyResponse = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+	explicit AdminSession(session_socket socket, session_timer timer, AdmissionController::Ticket ticket) : admission(std::move(ticket)),
+		socket(std::move(socket)), timer(std::move(timer)), sessionId{ counter++ }
+	{
+		//nothing
+	}
+
+	static std::shared_ptr<AdminSession> CreateSession(session_socket socket, session_timer timer, AdmissionController::Ticket ticket);
+
+	void read() {
+		boost::asio::async_read_until(socket, boost::asio::dynamic_buffer(request, MaxRequestLength), "\r\n\r\n",
+			[self = shared_from_this()](boost::system::error_code ec, std::size_t) {
+			self->handleRead(ec);
+		});
+	}
+
+	void write() {
+		boost::asio::async_write(socket, boost::asio::buffer(response), [self = shared_from_this()](boost::system::error_code, std::size_t) {
+			//one request per connection
+			boost::system::error_code ignored;
+			self->socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored);
+			self->deleteFromSessions();
+		});
+	}
+
+	inline void startTimer() {
+		timer.async_wait([self = shared_from_this()](boost::system::error_code ec) {
+			if (!ec) {
+				//a request is not expected to take a whole timeout
+				self->socket.cancel();
+			}
+		});
+	}
+
+	~AdminSession() {}
+
+	/// <summary>
+	/// Cancel all sessions, may be called from any thread
+	/// </summary>
+	static void cancelAll();
+
+private:
+	void handleRead(boost::system::error_code ec);
+	//build the response of a path on the worker pool and write it on the strand of the session
+	void respond(std::string path, bool withBody);
+	void setResponse(std::string_view status, std::string_view contentType, const std::string& body, bool withBody);
+
+	//static
+	static std::list<std::shared_ptr<AdminSession>> sessions;
+	static std::mutex m_mutex;
+
+	void deleteFromSessions();
+
+	//place of the session among the limits of the server
+	AdmissionController::Ticket admission;
+	session_socket socket;
+	session_timer timer;
+	std::string request;
+	std::string response;
+	static std::atomic<std::size_t> counter;
+	std::size_t sessionId;
+};
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+enum class LMTPSessionState
+{
+	Greeting,
+	Ready,
+	MailFrom,
+	Data,
+	Delivering
+};
+
+/// <summary>
+/// Commands of the local delivery protocol (RFC 2033) apart from the connection: every command line
+/// gets its response here, the session reads the message once the state is Data and delivers it to recipients().
+/// </summary>
+class LMTPProtocol
+{
+public:
+	//check whether there is a mailbox which can receive messages
+	using RecipientCheck = bool (*)(std::string_view recipient);
+
+	constexpr static std::size_t MaxRecipients = 1000;
+
+	explicit LMTPProtocol(RecipientCheck _canDeliver) : canDeliver(_canDeliver) {}
+
+	/// <summary>
+	/// Greeting of the server, the server speaks first
+	/// </summary>
+	std::string_view greet();
+
+	/// <summary>
+	/// Handle a command line
+	/// </summary>
+	/// <param name="line">Command line without CRLF</param>
+	/// <returns>Response to the command</returns>
+	std::string_view handleCommand(std::string_view line);
+
+	/// <summary>
+	/// The message has been received, recipients() are kept until the transaction is reset
+	/// </summary>
+	inline void messageReceived() { state = LMTPSessionState::Delivering; }
+
+	/// <summary>
+	/// Forget recipients of the transaction, the next one starts with MAIL
+	/// </summary>
+	void resetTransaction();
+
+	inline LMTPSessionState getState() const { return state; }
+	inline const std::vector<std::string>& getRecipients() const { return recipients; }
+	inline bool isQuitReceived() const { return quitReceived; }
+
+	/// <summary>
+	/// Get the mailbox name from a path like "TO:&lt;user@domain&gt;"
+	/// </summary>
+	static std::string MailboxOf(std::string_view argument);
+
+	/// <summary>
+	/// Remove dot-stuffing of the received message
+	/// </summary>
+	/// <param name="data">Message without the terminating ".CRLF"</param>
+	static std::string Unstuff(std::string_view data);
+
+private:
+	RecipientCheck canDeliver;
+	LMTPSessionState state{ LMTPSessionState::Greeting };
+	std::vector<std::string> recipients;
+	bool quitReceived{ false };
+};
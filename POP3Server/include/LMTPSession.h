@@ -0,0 +1,130 @@
+#pragma once
+
+#include <memory>
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <utility>
+
+#include <boost/asio.hpp>
+
+#include "AdmissionController.h"
+#include "SessionExecutor.h"
+#include "LMTPProtocol.h"
+#include "MailDelivery.h"
+
+/// <summary>
+/// Session of the local delivery listener (RFC 2033). Messages are delivered through MailDelivery,
+/// which puts a message into all recipients' mailboxes at once and keeps their indexes current,
+/// so POP3 logins do not need to list the mailbox directories.
+/// </summary>
+class LMTPSession : public std::enable_shared_from_this<LMTPSession>
+{
+public:
+	constexpr static boost::asio::chrono::minutes Timeout = boost::asio::chrono::minutes(5);
+	//larger messages are rejected
+	constexpr static std::size_t MaxMessageSize = 64 * 1024 * 1024;
+	//limit of commands received at once by pipelining
+	constexpr static std::size_t MaxCommandsLength = 65536;
+	//sent to connections over the limits of the server
+	constexpr static std::string_view BusyResponse = "421 4.3.2 too many connections, try again later\r\n";
+
+	explicit LMTPSession(session_socket socket, session_timer timer, AdmissionController::Ticket ticket) : protocol(MailDelivery::CanDeliver),
+		admission(std::move(ticket)), socket(std::move(socket)), timer(std::move(timer)), sessionId{ counter++ }, lastActivityTime(boost::asio::chrono::steady_clock::now())
+	{
+		//nothing
+	}
+
+	static std::shared_ptr<LMTPSession> CreateSession(session_socket socket, session_timer timer, AdmissionController::Ticket ticket);
+
+	void read() {
+		if (protocol.getState() == LMTPSessionState::Greeting) {
+			response = protocol.greet();
+			write();
+			return;
+		}
+		if (protocol.getState() == LMTPSessionState::Data) {
+			//the terminator is searched with the preceding line break, so an empty message is found as well
+			request.insert(0, "\r\n");
+			boost::asio::async_read_until(socket, boost::asio::dynamic_buffer(request, MaxMessageSize + 2), "\r\n.\r\n",
+				[self = shared_from_this()](boost::system::error_code ec, std::size_t length) {
+				self->handleRead(ec, length);
+			});
+			return;
+		}
+		boost::asio::async_read_until(socket, boost::asio::dynamic_buffer(request, MaxCommandsLength), "\r\n",
+			[self = shared_from_this()](boost::system::error_code ec, std::size_t length) {
+			self->handleRead(ec, length);
+		});
+	}
+
+	void write() {
+		boost::asio::async_write(socket, boost::asio::buffer(response), [self = shared_from_this()](boost::system::error_code ec,
+			std::size_t) {
+			if (ec || self->protocol.isQuitReceived() || self->closeAfterWrite) {
+				self->deleteFromSessions();
+				return;
+			}
+			self->read();
+		});
+	}
+
+	inline void startTimer() {
+		timer.async_wait([self = shared_from_this()](boost::system::error_code ec){
+			if (!ec) {
+				//time expired
+				if ((boost::asio::chrono::steady_clock::now() - self->lastActivityTime) > Timeout) {
+					//client does not reponse too long
+					self->socket.cancel();
+				}
+				else {
+					self->timer.expires_after(Timeout);
+					self->startTimer();
+				}
+			}
+			else if (ec == boost::asio::error::operation_aborted) {
+				//operation was canceled, do nothing
+			}
+			else {
+				self->startTimer();
+			}
+		});
+	}
+
+	~LMTPSession() {}
+
+	/// <summary>
+	/// Cancel all sessions, may be called from any thread
+	/// </summary>
+	static void cancelAll();
+
+private:
+	void handleRead(boost::system::error_code ec, std::size_t length);
+	void handleMessage(std::size_t length);
+
+	inline void prolongateLifeTime() {
+		lastActivityTime = boost::asio::chrono::steady_clock::now();
+	}
+
+	//static
+	static std::list<std::shared_ptr<LMTPSession>> sessions;
+	static std::mutex m_mutex;
+
+	void deleteFromSessions();
+
+	LMTPProtocol protocol;
+	//place of the session among the limits of the server
+	AdmissionController::Ticket admission;
+	session_socket socket;
+	session_timer timer;
+	std::string request;
+	std::string response;
+	//the connection is closed after an error response
+	bool closeAfterWrite{ false };
+	static std::atomic<std::size_t> counter;
+	std::size_t sessionId;
+	boost::asio::chrono::steady_clock::time_point lastActivityTime;
+};
@@ -2,12 +2,35 @@
 
 #include <memory>
 #include <atomic>
+#include <array>
+#include <algorithm>
+#include <list>
+#include <vector>
+#include <chrono>
+#include <mutex>
+#include <cstddef>
+#include <memory_resource>
+#include <utility>
 
 #include <boost/asio.hpp>
-#include <boost/lexical_cast.hpp>
+
+//sessions may run as coroutines when the compiler supports them (POP3_COROUTINE_SESSIONS build option)
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+#define POP3_SESSION_HAS_COROUTINES
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <boost/asio/redirect_error.hpp>
+#endif
 
 
 #include "POP3Command.h"
+#include "AdmissionController.h"
+#include "SessionExecutor.h"
+#include "BufferPool.h"
+#include "TokenBucket.h"
+#include "AuthFailureLimiter.h"
 #include "Enums.h"
 #include "Mailbox.h"
 
@@ -28,88 +51,191 @@ enum class POP3SessionError {
 	OtherMailboxBeingUsed,
 	AlreadyLogged,
 	NoSuchMessage,
-	MessageAlreadyDeleted
+	MessageAlreadyDeleted,
+	LoginDelayed,
+	TooManyFailures
 };
 
-inline std::ostream& operator<<(std::ostream& out, const POP3SessionError& err) {
-	std::string message;
+/// <summary>
+/// Text of the error sent to the client, with the response code of RFC 2449 if there is one
+/// </summary>
+inline std::string_view errorMessage(POP3SessionError err) {
 	switch (err)
 	{
-	case POP3SessionError::ProhibitedForAnonymous: 
-		message = "you must authorized before calling this command";
-		break;
+	case POP3SessionError::ProhibitedForAnonymous:
+		return "you must authorized before calling this command";
 	case POP3SessionError::NotRegistered:
-		message = "sorry, no mailbox for such user here";
-		break;
+		return "sorry, no mailbox for such user here";
 	case POP3SessionError::MailboxIsBusy:
-		message = "mailbox is busy at the moment, please try again later";
-		break;
+		return "mailbox is busy at the moment, please try again later";
 	case POP3SessionError::InternalError:
-		message = "some internal error occured, please try again later";
-		break;
+		return "some internal error occured, please try again later";
 	case POP3SessionError::OtherMailboxBeingUsed:
-		message = "you have already logged using other name, please quit from mailbox and then try again";
-		break;
+		return "you have already logged using other name, please quit from mailbox and then try again";
 	case POP3SessionError::AlreadyLogged:
-		message = "maildrop already locked";
-		break;
+		return "maildrop already locked";
 	case POP3SessionError::NoSuchMessage:
-		message = "no such message";
-		break;
+		return "no such message";
 	case POP3SessionError::MessageAlreadyDeleted:
-		message = "no such message";
-		break;
+		return "no such message";
+	case POP3SessionError::LoginDelayed:
+		//response code of RFC 2449
+		return "[LOGIN-DELAY] minimum time between logins has not passed";
+	case POP3SessionError::TooManyFailures:
+		return "[SYS/TEMP] too many failed logins, please try again later";
 	default:
-		break;
+		return "";
 	}
-	out << message;
+}
+
+inline std::ostream& operator<<(std::ostream& out, const POP3SessionError& err) {
+	out << errorMessage(err);
 	return out;
 }
 
+/// <summary>
+/// What the admin listener shows about a session, only fields which do not change after the session is created
+/// </summary>
+struct POP3SessionInfo
+{
+	std::size_t id;
+	boost::asio::ip::address peer;
+	std::chrono::steady_clock::duration connected;
+};
+
 class POP3Session : public std::enable_shared_from_this<POP3Session>
 {
 public:
 	constexpr static boost::asio::chrono::minutes Timeout = boost::asio::chrono::minutes(1);
+	//size of parts in which a message is sent by RETR
+	constexpr static std::size_t RetrChunkSize = 65536;
+	//inline part of the arena, enough for a command cycle of a mailbox with a few dozens of messages
+	constexpr static std::size_t ArenaSize = 4096;
+	//longest command line with CRLF (RFC 2449), longer lines are not buffered
+	constexpr static std::size_t MaxCommandLength = 255;
+	//larger response buffers are freed after the response is sent
+	constexpr static std::size_t RetainedBufferCapacity = 1024;
+	//RETR chunks kept by the pool for the next sessions
+	constexpr static std::size_t RetainedChunks = 64;
+	//sent to connections over the limits of the server (RFC 2449 response code)
+	constexpr static std::string_view BusyResponse = "-ERR [IN-USE] too many connections, please try again later\r\n";
 
-	explicit POP3Session(boost::asio::ip::tcp::socket socket, boost::asio::steady_timer timer) : sessionId{ counter++ },
-		socket(std::move(socket)), timer(std::move(timer)),
+	explicit POP3Session(session_socket socket, session_timer timer, AdmissionController::Ticket ticket) : sessionId{ counter++ },
+		admission(std::move(ticket)), socket(std::move(socket)), timer(std::move(timer)), pacer(this->socket.get_executor()),
+		bandwidth(static_cast<double>(bandwidthLimit), static_cast<double>(retrQuantum)),
 		mailbox{}, lastActivityTime(boost::asio::chrono::steady_clock::now())
 	{
-		//nothing
+		boost::system::error_code ec;
+		peer = this->socket.remote_endpoint(ec).address();
 	}
 
-	static std::shared_ptr<POP3Session> CreateSession(boost::asio::ip::tcp::socket socket, boost::asio::steady_timer timer);
+	static std::shared_ptr<POP3Session> CreateSession(session_socket socket, session_timer timer, AdmissionController::Ticket ticket);
+
+	/// <summary>
+	/// Pacing of messages sent by RETR, applies to sessions created after the call.
+	/// A session sends at most a quantum at once and then lets the other sessions run.
+	/// </summary>
+	/// <param name="quantum">Octets sent at once, at most RetrChunkSize</param>
+	/// <param name="bytesPerSecond">Bandwidth of a session, zero does not limit it</param>
+	static void SetRetrPacing(std::size_t quantum, std::size_t bytesPerSecond) {
+		retrQuantum = std::clamp<std::size_t>(quantum, 1, RetrChunkSize);
+		bandwidthLimit = bytesPerSecond;
+	}
+
+	/// <summary>
+	/// Run sessions as coroutines: one frame per connection runs the whole command loop,
+	/// logons are performed on the storage pool while the io thread serves other sessions
+	/// </summary>
+	/// <returns>false if coroutines are not supported by this build</returns>
+	static bool EnableCoroutines(bool value) {
+#ifdef POP3_SESSION_HAS_COROUTINES
+		useCoroutines = value;
+		return true;
+#else
+		return !value;
+#endif
+	}
 
 	void read() {
-		boost::asio::async_read_until(socket, boost::asio::dynamic_buffer(request), "\r\n", 
+#ifdef POP3_SESSION_HAS_COROUTINES
+		if (useCoroutines) {
+			//called once by the server, the coroutine reads by itself afterwards
+			boost::asio::co_spawn(socket.get_executor(), run(), boost::asio::detached);
+			return;
+		}
+#endif
+		boost::asio::async_read_until(socket, boost::asio::dynamic_buffer(request, MaxCommandLength), "\r\n", 
 			[self = shared_from_this()](boost::system::error_code ec,
 			std::size_t length){
+			if (ec == boost::asio::error::not_found) {
+				//no CRLF within the limit
+				self->rejectLongCommand();
+				return;
+			}
 			if (ec) {
 				self->deleteFromSessions();
 				//TODO: -   
 				return;
 			}
 			self->prolongateLifeTime();
+			self->requestLength = length;
 			self->readImpl();
 		});
 	}
 
+	void writeAfter(std::chrono::milliseconds delay) {
+		//the refusal is held back on the timer, the io thread serves other sessions meanwhile
+		pacer.expires_after(delay);
+		pacer.async_wait([self = shared_from_this()](boost::system::error_code ec) {
+			if (ec) {
+				//the session is cancelled
+				self->deleteFromSessions();
+				return;
+			}
+			self->write();
+		});
+	}
+
 	void write() {
-		boost::asio::async_write(socket, boost::asio::buffer(response), [self = shared_from_this()](boost::system::error_code ec,
+		finishCommand();
+		//a cached message is sent right from the shared buffer between the status line and the terminator
+		std::size_t messagePart = 0;
+		auto buffers = responseBuffers(messagePart);
+		boost::asio::async_write(socket, buffers, [self = shared_from_this(), messagePart](boost::system::error_code ec,
 			std::size_t length){
 			if (ec) {
+				self->messageBuffer.reset();
 				self->deleteFromSessions();
 				//TODO: -   
 				return;
 			}
-			if (self->quitCommandReceived) {
-				if (self->mailbox) {
+			self->countSent(length);
+			if (self->messageBuffer) {
+				self->messageSent += messagePart;
+				if (self->messageSent < self->messageBuffer->size()) {
+					self->response.clear();
+					self->paceNextChunk(length);
+					return;
+				}
+				self->messageBuffer.reset();
+			}
+			if (self->messageReader) {
+				//RETR is in progress
+				self->paceNextChunk(length);
+				return;
+			}
+			if (self->quitCommandReceived || self->closeAfterResponse) {
+				if (self->quitCommandReceived && self->mailbox) {
 					self->mailbox->setUpdate();
 				}
 				self->deleteFromSessions();
 			}
 			else {
-				self->request.clear();
+				//nothing allocated while handling the command is alive anymore
+				self->arena.release();
+				self->trimBuffers();
+				//commands pipelined after this one stay in the buffer
+				self->request.erase(0, self->requestLength);
 				self->read();
 			}
 		});
@@ -137,13 +263,23 @@ public:
 		});
 	}
 
-	~POP3Session() {}
+	~POP3Session();
 
 	/// <summary>
-	/// Cancel all sessions
+	/// Cancel all sessions, may be called from any thread
 	/// </summary>
 	static void cancelAll();
 	static void cancelParticular(std::size_t id);
+	//may be called from any thread
+	static std::vector<POP3SessionInfo> listSessions();
+
+	/// <summary>
+	/// Memory held by the session: the object and its buffers, without the mailbox.
+	/// Must be called on the session's strand.
+	/// </summary>
+	std::size_t memoryUsage() const {
+		return sizeof(POP3Session) + request.capacity() + response.capacity() + (retrChunk ? chunkPool.getBlockSize() : 0);
+	}
 
 private:
 	
@@ -152,12 +288,41 @@ private:
 	void setErrorResponse(Err err);
 	
 	void readImpl();
+	void handleRequest(const std::variant<POP3Command, ParsingError>& parsed);
+	void handleLogon(std::variant<mailbox_ptr, MailboxOperationError, AuthError> result);
+	//metrics: a command is counted when it is parsed and timed until its response is sent
+	void startCommand(const std::variant<POP3Command, ParsingError>& parsed);
+	void finishCommand();
+	void countSent(std::size_t length);
+	//refuse PASS without looking the consumer up while the name or the address is backed off
+	bool refuseLogon();
+	//verify the password and connect to the mailbox off the io thread, then write the response
+	void logon(std::string pass);
+#ifdef POP3_SESSION_HAS_COROUTINES
+	boost::asio::awaitable<void> run();
+	boost::asio::awaitable<void> writeResponse();
+	boost::asio::awaitable<void> pace(std::size_t sent);
+	static inline bool useCoroutines{ false };
+#endif
 
 	void putMailboxInfoToReponse();
 	void setSimpleOkResponse(std::string_view = "");
+	void putCapabilitiesToResponse();
 	void handleList(const POP3Command& cmd);
 	void handleDelete(const POP3Command& cmd);
 	void handleRetr(const POP3Command& cmd);
+	void writeNextChunk();
+	//buffers of the next write: the response and a part of the message being sent by RETR
+	std::array<boost::asio::const_buffer, 3> responseBuffers(std::size_t& messagePart) const;
+	//the next part of a message is sent when the other sessions had their turn and the bandwidth allows
+	void paceNextChunk(std::size_t sent);
+	//read the next part of the message into a chunk taken from the pool, false if the message could not be read
+	bool readNextChunk();
+	void rejectLongCommand();
+	void trimBuffers();
+#ifdef __linux__
+	void sendFileChunk(const MessageReader::WireFile& file);
+#endif
 	void handleAnonymousCommand(const POP3Command& cmd);
 	void handleAuthorizedUserCommand(const POP3Command& cmd);
 
@@ -168,20 +333,59 @@ private:
 	//static
 	static std::list<std::shared_ptr<POP3Session>> sessions;
 	static std::mutex m_mutex;
+	static BufferPool chunkPool;
+	static inline std::size_t retrQuantum{ RetrChunkSize };
+	static inline std::size_t bandwidthLimit{ 0 };
 
 
 	void deleteFromSessions();
+	static void cancel(const std::shared_ptr<POP3Session>& session);
 
 	POP3SessionState state{POP3SessionState::Authorization};
-	boost::asio::ip::tcp::socket socket;
-	boost::asio::steady_timer timer;
+	//place of the session among the limits of the server
+	AdmissionController::Ticket admission;
+	session_socket socket;
+	//failed logons are counted by the address of the peer
+	boost::asio::ip::address peer;
+	session_timer timer;
+	//waits out the bandwidth of the session between parts of a message
+	session_timer pacer;
+	TokenBucket bandwidth;
+	//request is bounded by MaxCommandLength, response keeps up to RetainedBufferCapacity between commands
 	std::string request;
+	//length of the command being handled, with CRLF
+	std::size_t requestLength{ 0 };
 	std::string response;
+	//part of the message being sent by RETR, owned only while the message is sent
+	BufferPool::Buffer retrChunk;
+	std::size_t retrChunkLength{ 0 };
+	//temporaries of a command cycle (parsed command, LIST maps) are allocated here and released after the response
+	std::array<std::byte, ArenaSize> arenaBuffer;
+	//keeps blocks of larger cycles for the next ones
+	std::pmr::unsynchronized_pool_resource arenaUpstream{ std::pmr::pool_options{ 0, 1024 * 1024 } };
+	std::pmr::monotonic_buffer_resource arena{ arenaBuffer.data(), arenaBuffer.size(), &arenaUpstream };
 	std::string userName;
 	std::string password;
+	//a refused logon is answered after the backoff
+	std::chrono::milliseconds responseDelay{ 0 };
+	//the response to PASS is written by the completion of the logon
+	bool logonPending{ false };
+	POP3CommandType timedCommand{ POP3CommandType::UNKNOWN };
+	bool commandTimed{ false };
+	std::chrono::steady_clock::time_point commandStarted;
 	bool quitCommandReceived{ false };
+	//the connection is closed after the response, the mailbox is not updated
+	bool closeAfterResponse{ false };
 	mailbox_ptr mailbox;
+	//reader of the message being sent by RETR, declared after mailbox to be destroyed before it
+	message_reader_ptr messageReader;
+	//octets of a wire form file passed to sendfile or of messageBuffer written
+	std::uint64_t messageSent{ 0 };
+	//message from MessageCache being sent by RETR without copying
+	message_buffer messageBuffer;
+	std::string_view messageTrailer;
 	static std::atomic<std::size_t> counter;
 	std::size_t sessionId;
 	boost::asio::chrono::steady_clock::time_point lastActivityTime;
+	const boost::asio::chrono::steady_clock::time_point created{ boost::asio::chrono::steady_clock::now() };
 };
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <string>
+
+#include "Metrics.h"
+
+/// <summary>
+/// Prometheus text format (version 0.0.4) of a snapshot of the metrics. Histograms are reported by powers of two,
+/// the finer buckets of the registry would make hundreds of series per histogram.
+/// </summary>
+std::string formatPrometheus(const MetricsRegistry::Snapshot& snapshot);
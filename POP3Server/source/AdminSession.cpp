@@ -0,0 +1,125 @@
+#include "AdminSession.h"
+#include "POP3Session.h"
+#include "Metrics.h"
+#include "PrometheusFormat.h"
+#include "WorkerPool.h"
+
+#include <assert.h>
+#include <algorithm>
+#include <string_view>
+
+std::atomic<std::size_t> AdminSession::counter = 0;
+std::list<std::shared_ptr<AdminSession>> AdminSession::sessions;
+std::mutex AdminSession::m_mutex;
+
+namespace {
+	std::string formatSessions(const std::vector<POP3SessionInfo>& sessions) {
+		std::string out = "{\"count\":";
+		out.append(std::to_string(sessions.size())).append(",\"sessions\":[");
+		bool first = true;
+		std::for_each(sessions.cbegin(), sessions.cend(), [&out, &first](const auto& session) {
+			out.append(first ? "{\"id\":" : ",{\"id\":").append(std::to_string(session.id));
+			out.append(",\"peer\":\"").append(session.peer.to_string());
+			out.append("\",\"connected_seconds\":");
+			out.append(std::to_string(std::chrono::duration_cast<std::chrono::seconds>(session.connected).count())).append("}");
+			first = false;
+		});
+		out.append("]}\n");
+		return out;
+	}
+}
+
+std::shared_ptr<AdminSession> AdminSession::CreateSession(session_socket socket, session_timer timer, AdmissionController::Ticket ticket) {
+
+	auto session = std::make_shared<AdminSession>(std::move(socket), std::move(timer), std::move(ticket));
+
+	{
+		std::lock_guard<std::mutex> lg{ m_mutex };
+		sessions.push_front(session);
+	}
+
+	return session;
+}
+
+void AdminSession::deleteFromSessions() {
+	std::lock_guard<std::mutex> lg{ m_mutex };
+	auto it = std::find_if(sessions.cbegin(), sessions.cend(), [this](const auto& session) {
+		return session->sessionId == sessionId;
+		});
+	assert(it != sessions.cend());
+	if (it != sessions.cend()) {
+		(*it)->timer.cancel();
+		sessions.erase(it);
+	}
+}
+
+void AdminSession::cancelAll() {
+	std::lock_guard<std::mutex> lg{ m_mutex };
+	std::for_each(sessions.cbegin(), sessions.cend(), [](const auto& session) {
+		//sockets and timers are touched only by the strand of their session
+		boost::asio::post(session->socket.get_executor(), [session]() {
+			session->socket.cancel();
+			session->timer.cancel();
+		});
+	});
+}
+
+void AdminSession::handleRead(boost::system::error_code ec) {
+	if (ec) {
+		if (ec == boost::asio::error::not_found) {
+			setResponse("431 Request Header Fields Too Large", "text/plain", "request is too long\n", true);
+			write();
+			return;
+		}
+		deleteFromSessions();
+		return;
+	}
+	//request line: method, target and version
+	std::string_view line(request.data(), request.find("\r\n"));
+	auto methodEnd = line.find(' ');
+	auto targetEnd = methodEnd == std::string_view::npos ? std::string_view::npos : line.find(' ', methodEnd + 1);
+	if (targetEnd == std::string_view::npos) {
+		setResponse("400 Bad Request", "text/plain", "malformed request line\n", true);
+		write();
+		return;
+	}
+	auto method = line.substr(0, methodEnd);
+	auto target = line.substr(methodEnd + 1, targetEnd - methodEnd - 1);
+	if (method != "GET" && method != "HEAD") {
+		setResponse("405 Method Not Allowed", "text/plain", "only GET and HEAD are allowed\n", true);
+		write();
+		return;
+	}
+	respond(std::string(target.substr(0, target.find('?'))), method == "GET");
+}
+
+void AdminSession::respond(std::string path, bool withBody) {
+	//merging the blocks of all threads and formatting is left to the worker pool
+	WorkerPool::Shared().post([self = shared_from_this(), path = std::move(path), withBody]() mutable {
+		if (path == "/metrics") {
+			self->setResponse("200 OK", "text/plain; version=0.0.4; charset=utf-8", formatPrometheus(MetricsRegistry::Shared().snapshot()), withBody);
+		}
+		else if (path == "/sessions") {
+			self->setResponse("200 OK", "application/json", formatSessions(POP3Session::listSessions()), withBody);
+		}
+		else if (path == "/healthz") {
+			self->setResponse("200 OK", "text/plain", "ok\n", withBody);
+		}
+		else {
+			self->setResponse("404 Not Found", "text/plain", "not found\n", withBody);
+		}
+		//the response was built here, the strand takes it over by the post, together with the last reference
+		auto executor = self->socket.get_executor();
+		boost::asio::post(executor, [self = std::move(self)]() { self->write(); });
+	});
+}
+
+void AdminSession::setResponse(std::string_view status, std::string_view contentType, const std::string& body, bool withBody) {
+	response.assign("HTTP/1.1 ").append(status).append("\r\n");
+	response.append("Content-Type: ").append(contentType).append("\r\n");
+	response.append("Content-Length: ").append(std::to_string(body.size())).append("\r\n");
+	response.append("Cache-Control: no-store\r\nConnection: close\r\n\r\n");
+	if (withBody) {
+		response.append(body);
+	}
+}
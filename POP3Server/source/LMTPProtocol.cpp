@@ -0,0 +1,90 @@
+#include "LMTPProtocol.h"
+
+#include <boost/algorithm/string.hpp>
+
+std::string_view LMTPProtocol::greet() {
+	state = LMTPSessionState::Ready;
+	return "220 localhost LMTP server ready\r\n";
+}
+
+void LMTPProtocol::resetTransaction() {
+	recipients.clear();
+	state = LMTPSessionState::Ready;
+}
+
+std::string_view LMTPProtocol::handleCommand(std::string_view line) {
+	auto verbEnd = line.find_first_of(" :");
+	auto verb = line.substr(0, verbEnd);
+	auto argument = verbEnd == std::string_view::npos ? std::string_view() : line.substr(verbEnd);
+
+	if (boost::algorithm::iequals(verb, "LHLO")) {
+		resetTransaction();
+		return "250-localhost\r\n250-PIPELINING\r\n250-ENHANCEDSTATUSCODES\r\n250 8BITMIME\r\n";
+	}
+	if (boost::algorithm::iequals(verb, "MAIL")) {
+		if (state != LMTPSessionState::Ready) {
+			return "503 5.5.1 Nested MAIL command\r\n";
+		}
+		state = LMTPSessionState::MailFrom;
+		return "250 2.1.0 OK\r\n";
+	}
+	if (boost::algorithm::iequals(verb, "RCPT")) {
+		if (state != LMTPSessionState::MailFrom) {
+			return "503 5.5.1 Need MAIL command\r\n";
+		}
+		if (recipients.size() >= MaxRecipients) {
+			return "452 4.5.3 Too many recipients\r\n";
+		}
+		auto mailbox = MailboxOf(argument);
+		if (mailbox.empty() || !canDeliver(mailbox)) {
+			return "550 5.1.1 No such user here\r\n";
+		}
+		recipients.push_back(std::move(mailbox));
+		return "250 2.1.5 OK\r\n";
+	}
+	if (boost::algorithm::iequals(verb, "DATA")) {
+		if (state != LMTPSessionState::MailFrom || recipients.empty()) {
+			return "503 5.5.1 No valid recipients\r\n";
+		}
+		state = LMTPSessionState::Data;
+		return "354 Start mail input; end with <CRLF>.<CRLF>\r\n";
+	}
+	if (boost::algorithm::iequals(verb, "RSET")) {
+		resetTransaction();
+		return "250 2.0.0 OK\r\n";
+	}
+	if (boost::algorithm::iequals(verb, "NOOP")) {
+		return "250 2.0.0 OK\r\n";
+	}
+	if (boost::algorithm::iequals(verb, "QUIT")) {
+		quitReceived = true;
+		return "221 2.0.0 LMTP server closing connection\r\n";
+	}
+	return "500 5.5.2 Unknown command\r\n";
+}
+
+std::string LMTPProtocol::MailboxOf(std::string_view argument) {
+	auto open = argument.find('<');
+	auto close = argument.find('>', open);
+	if (open == std::string_view::npos || close == std::string_view::npos) {
+		return std::string();
+	}
+	auto address = argument.substr(open + 1, close - open - 1);
+	return std::string(address.substr(0, address.find('@')));
+}
+
+std::string LMTPProtocol::Unstuff(std::string_view data) {
+	std::string message;
+	message.reserve(data.size());
+	std::size_t start = 0;
+	while (start < data.size()) {
+		auto end = data.find("\r\n", start);
+		end = end == std::string_view::npos ? data.size() : end + 2;
+		if (data[start] == '.') {
+			start++;
+		}
+		message.append(data.substr(start, end - start));
+		start = end;
+	}
+	return message;
+}
@@ -0,0 +1,90 @@
+#include "LMTPSession.h"
+#include "WorkerPool.h"
+
+#include <assert.h>
+#include <algorithm>
+
+std::atomic<std::size_t> LMTPSession::counter = 0;
+std::list<std::shared_ptr<LMTPSession>> LMTPSession::sessions;
+std::mutex LMTPSession::m_mutex;
+
+std::shared_ptr<LMTPSession> LMTPSession::CreateSession(session_socket socket, session_timer timer, AdmissionController::Ticket ticket) {
+
+	auto session = std::make_shared<LMTPSession>(std::move(socket), std::move(timer), std::move(ticket));
+
+	{
+		std::lock_guard<std::mutex> lg{ m_mutex };
+		sessions.push_front(session);
+	}
+
+	return session;
+}
+
+void LMTPSession::deleteFromSessions() {
+	std::lock_guard<std::mutex> lg{ m_mutex };
+	auto it = std::find_if(sessions.cbegin(), sessions.cend(), [this](const auto& session) {
+		return session->sessionId == sessionId;
+		});
+	assert(it != sessions.cend());
+	if (it != sessions.cend()) {
+		(*it)->timer.cancel();
+		sessions.erase(it);
+	}
+}
+
+void LMTPSession::cancelAll() {
+	std::lock_guard<std::mutex> lg{ m_mutex };
+	std::for_each(sessions.cbegin(), sessions.cend(), [](const auto& session) {
+		//sockets and timers are touched only by the strand of their session
+		boost::asio::post(session->socket.get_executor(), [session]() {
+			session->socket.cancel();
+			session->timer.cancel();
+		});
+	});
+}
+
+void LMTPSession::handleRead(boost::system::error_code ec, std::size_t length) {
+	if (ec) {
+		if (ec == boost::asio::error::not_found) {
+			//the limit of the buffer is reached
+			response = protocol.getState() == LMTPSessionState::Data ? "552 5.3.4 Message size exceeds fixed limit\r\n" : "500 5.5.2 Line too long\r\n";
+			closeAfterWrite = true;
+			write();
+			return;
+		}
+		deleteFromSessions();
+		return;
+	}
+	prolongateLifeTime();
+	if (protocol.getState() == LMTPSessionState::Data) {
+		handleMessage(length);
+		return;
+	}
+	response = protocol.handleCommand(std::string_view(request.data(), length - 2));
+	//commands sent by pipelining stay in the buffer
+	request.erase(0, length);
+	write();
+}
+
+void LMTPSession::handleMessage(std::size_t length) {
+	//request is CRLF, the message and ".CRLF"
+	auto message = LMTPProtocol::Unstuff(std::string_view(request.data() + 2, length - 5));
+	request.erase(0, length);
+	protocol.messageReceived();
+
+	//writing and syncing files is done outside of the network threads
+	WorkerPool::Shared().post([self = shared_from_this(), message = std::move(message)]() {
+		auto results = MailDelivery::Deliver(message, self->protocol.getRecipients());
+		//LMTP replies for every recipient separately
+		std::string response;
+		std::for_each(results.cbegin(), results.cend(), [&response](auto result) {
+			response.append(result == MailboxOperationError::NoError ? "250 2.0.0 Message delivered\r\n" :
+				"451 4.3.0 Delivery failed, try again later\r\n");
+		});
+		boost::asio::post(self->socket.get_executor(), [self, response = std::move(response)]() {
+			self->response = response;
+			self->protocol.resetTransaction();
+			self->write();
+		});
+	});
+}
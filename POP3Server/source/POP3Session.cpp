@@ -2,17 +2,77 @@
 #include "POP3Session.h"
 #include "POP3Status.h"
 #include "MailboxServiceManager.h"
+#include "WireEncoder.h"
+#include "Metrics.h"
 
 #include <assert.h>
 #include <variant>
+#include <sstream>
+#include <charconv>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#include <cerrno>
+#endif
 
 std::atomic<std::size_t> POP3Session::counter = 0;
 std::list<std::shared_ptr<POP3Session>> POP3Session::sessions;
 std::mutex POP3Session::m_mutex;
+BufferPool POP3Session::chunkPool{ POP3Session::RetrChunkSize, POP3Session::RetainedChunks };
+
+namespace {
+	std::string_view statusText(POP3Status status) {
+		return status == POP3Status::OK ? "+OK" : "-ERR";
+	}
+
+	//appends without a stream, so building a response does not allocate once the string has grown
+	void appendNumber(std::string& out, std::size_t value) {
+		char digits[24];
+		auto result = std::to_chars(std::begin(digits), std::end(digits), value);
+		out.append(digits, static_cast<std::size_t>(result.ptr - digits));
+	}
+
+	constexpr std::size_t CommandTypes = static_cast<std::size_t>(POP3CommandType::CAPA) + 1;
+
+	//handles of the session metrics, registered with the first session
+	struct SessionMetrics {
+		MetricsRegistry::Counter opened;
+		MetricsRegistry::Counter closed;
+		MetricsRegistry::Gauge active;
+		MetricsRegistry::Counter received;
+		MetricsRegistry::Counter sent;
+		std::array<MetricsRegistry::Counter, CommandTypes> commands;
+		std::array<MetricsRegistry::Histogram, CommandTypes> latency;
+
+		SessionMetrics() {
+			auto& registry = MetricsRegistry::Shared();
+			opened = registry.counter("pop3_sessions_opened_total", "POP3 sessions opened");
+			closed = registry.counter("pop3_sessions_closed_total", "POP3 sessions closed");
+			active = registry.gauge("pop3_sessions_active", "POP3 sessions open now");
+			received = registry.counter("pop3_received_bytes_total", "Octets of POP3 command lines received");
+			sent = registry.counter("pop3_sent_bytes_total", "Octets of POP3 responses and messages sent");
+			for (std::size_t i = 0; i < CommandTypes; i++) {
+				std::ostringstream name;
+				name << static_cast<POP3CommandType>(i);
+				MetricLabels labels{ { "command", i == 0 ? std::string("UNKNOWN") : name.str() } };
+				commands[i] = registry.counter("pop3_commands_total", "POP3 commands by type, UNKNOWN counts lines which could not be parsed", labels);
+				latency[i] = registry.histogram("pop3_command_latency_microseconds", "Time from receiving a POP3 command to sending its response", labels);
+			}
+		}
+	};
 
-std::shared_ptr<POP3Session> POP3Session::CreateSession(boost::asio::ip::tcp::socket socket, boost::asio::steady_timer timer) {
+	const SessionMetrics& metrics() {
+		static const SessionMetrics instance;
+		return instance;
+	}
+}
+
+std::shared_ptr<POP3Session> POP3Session::CreateSession(session_socket socket, session_timer timer, AdmissionController::Ticket ticket) {
 
-	auto session = std::make_shared<POP3Session>(std::move(socket), std::move(timer));
+	auto session = std::make_shared<POP3Session>(std::move(socket), std::move(timer), std::move(ticket));
+	metrics().opened.add();
+	metrics().active.add(1);
 
 	{
 		std::lock_guard<std::mutex> lg{ m_mutex };
@@ -22,66 +82,128 @@ std::shared_ptr<POP3Session> POP3Session::CreateSession(boost::asio::ip::tcp::so
 	return session;
 }
 
+POP3Session::~POP3Session() {
+	metrics().closed.add();
+	metrics().active.add(-1);
+}
+
+void POP3Session::startCommand(const std::variant<POP3Command, ParsingError>& parsed) {
+	auto command = std::get_if<POP3Command>(&parsed);
+	timedCommand = command ? command->cmdType : POP3CommandType::UNKNOWN;
+	commandStarted = std::chrono::steady_clock::now();
+	commandTimed = true;
+	metrics().received.add(requestLength);
+	metrics().commands[static_cast<std::size_t>(timedCommand)].add();
+}
+
+void POP3Session::finishCommand() {
+	if (commandTimed) {
+		commandTimed = false;
+		metrics().latency[static_cast<std::size_t>(timedCommand)].record(std::chrono::steady_clock::now() - commandStarted);
+	}
+}
+
+void POP3Session::countSent(std::size_t length) {
+	metrics().sent.add(length);
+}
+
 void POP3Session::deleteFromSessions() {
 	std::lock_guard<std::mutex> lg{ m_mutex };
 	auto it = std::find_if(sessions.cbegin(), sessions.cend(), [this](const auto& session) {
 		return session->sessionId == sessionId;
 		});
 	assert(it != sessions.cend());
-	sessions.erase(it);
+	if (it != sessions.cend()) {
+		//the waits hold the session, it must not outlive its connection until they expire
+		(*it)->timer.cancel();
+		(*it)->pacer.cancel();
+		sessions.erase(it);
+	}
 }
 
-void POP3Session::cancelAll() {
-	std::lock_guard<std::mutex> lg{ m_mutex };
-	std::for_each(sessions.cbegin(), sessions.cend(), [](const auto& session) {
+void POP3Session::cancel(const std::shared_ptr<POP3Session>& session) {
+	//sockets and timers are touched only by the strand of their session
+	boost::asio::post(session->socket.get_executor(), [session]() {
 		session->socket.cancel();
 		session->timer.cancel();
+		session->pacer.cancel();
 	});
 }
 
+void POP3Session::cancelAll() {
+	std::lock_guard<std::mutex> lg{ m_mutex };
+	std::for_each(sessions.cbegin(), sessions.cend(), &POP3Session::cancel);
+}
+
+std::vector<POP3SessionInfo> POP3Session::listSessions() {
+	auto now = std::chrono::steady_clock::now();
+	std::lock_guard<std::mutex> lg{ m_mutex };
+	std::vector<POP3SessionInfo> result;
+	result.reserve(sessions.size());
+	std::transform(sessions.cbegin(), sessions.cend(), std::back_inserter(result), [now](const auto& session) {
+		return POP3SessionInfo{ session->sessionId, session->peer, now - session->created };
+	});
+	return result;
+}
+
 void POP3Session::cancelParticular(std::size_t id)
 {
 	std::lock_guard<std::mutex> lg{ m_mutex };
 	auto it = std::find_if(sessions.cbegin(), sessions.cend(), [&id](const auto& session) {
 		return session->sessionId == id;
 	});
-	assert(it != sessions.cend());
+	//the session leaves the list by itself when its cancelled operations complete
 	if (it != sessions.cend()) {
-		sessions.erase(it);
+		cancel(*it);
 	}
-	(*it)->socket.cancel();
-	(*it)->timer.cancel();
 }
 
 template<typename Err>
 void POP3Session::setErrorResponse(Err err) {
-	response = boost::lexical_cast<std::string>(POP3Status::ERR);
-	response.append(" ");
-	response.append(boost::lexical_cast<std::string>(err));
-	response.append("\r\n");
+	//the texts are constant and the response keeps its capacity, so an error does not allocate
+	response.assign(statusText(POP3Status::ERR)).append(" ").append(errorMessage(err)).append("\r\n");
 }
 
 void POP3Session::putMailboxInfoToReponse() {
-	std::ostringstream ss;
-	ss << boost::lexical_cast<std::string>(POP3Status::OK) << " " << userName << "'s maildrop has " <<
-		mailbox->getEmailsCount() << " messages (" << mailbox->getWholeMailboxSize() << " octets)\r\n";
-	response = ss.str();
+	response.assign(statusText(POP3Status::OK)).append(" ").append(userName).append("'s maildrop has ");
+	appendNumber(response, mailbox->getEmailsCount());
+	response.append(" messages (");
+	appendNumber(response, mailbox->getWholeMailboxSize(&arena));
+	response.append(" octets)\r\n");
+}
+
+void POP3Session::putCapabilitiesToResponse() {
+	//RFC 2449, commands may be pipelined since only the handled line is taken from the request buffer
+	response.assign(statusText(POP3Status::OK)).append(" capability list follows\r\nUSER\r\nPIPELINING\r\nRESP-CODES\r\n");
+	auto delay = MailboxServiceManager::GetLoginDelay();
+	if (delay.count() > 0) {
+		response.append("LOGIN-DELAY ");
+		appendNumber(response, static_cast<std::size_t>(delay.count()));
+		response.append("\r\n");
+	}
+	response.append(".\r\n");
 }
 
 void POP3Session::setSimpleOkResponse(std::string_view mesg) {
-	response = boost::lexical_cast<std::string>(POP3Status::OK) + (mesg.empty() ? "" : " ") + mesg.data() + "\r\n";
+	response.assign(statusText(POP3Status::OK));
+	if (!mesg.empty()) {
+		response.append(" ").append(mesg);
+	}
+	response.append("\r\n");
 }
 
 void POP3Session::handleAnonymousCommand(const POP3Command& cmd) {
 	switch (cmd.cmdType)
 	{
 	case POP3CommandType::USER: {
-		auto username = std::get<std::string>(cmd.parameter);
+		std::string_view username = std::get<std::pmr::string>(cmd.parameter);
 		if (!MailboxServiceManager::VerifyName(username)) {
 			setErrorResponse(POP3SessionError::NotRegistered);
 		}
 		else {
-			userName = username;
+			userName.assign(username);
+			//the mailbox is examined while the client sends its password
+			MailboxServiceManager::PrefetchMailbox(username);
 			std::string mesg = "user ";
 			mesg.append(username);
 			mesg.append(" exists");
@@ -90,25 +212,10 @@ void POP3Session::handleAnonymousCommand(const POP3Command& cmd) {
 		break;
 	}
 	case POP3CommandType::PASS: {
-		auto pass = std::get<std::string>(cmd.parameter);
-		auto result = MailboxServiceManager::VerifyCredentialsAndConnect(userName, pass);
-		if (std::holds_alternative<mailbox_ptr>(result)) {
-			mailbox = std::move(std::get<mailbox_ptr>(result));
-			state = POP3SessionState::Transaction;
-			putMailboxInfoToReponse();
-		}
-		else if (std::holds_alternative<AuthError>(result)) {
-			setErrorResponse(std::get<AuthError>(result));
-		}
-		else {
-			auto err = std::get<MailboxOperationError>(result);
-			if (err == MailboxOperationError::MailboxIsBusy) {
-				setErrorResponse(POP3SessionError::MailboxIsBusy);
-			}
-			else {
-				setErrorResponse(POP3SessionError::InternalError);
-			}
+		if (refuseLogon()) {
+			break;
 		}
+		logon(std::string(std::get<std::pmr::string>(cmd.parameter)));
 		break;
 	}
 	case POP3CommandType::NOOP: {
@@ -120,6 +227,10 @@ void POP3Session::handleAnonymousCommand(const POP3Command& cmd) {
 		setSimpleOkResponse();
 		break;
 	}
+	case POP3CommandType::CAPA: {
+		putCapabilitiesToResponse();
+		break;
+	}
 	default:
 		//Not allowed for anonymous
 		setErrorResponse(POP3SessionError::ProhibitedForAnonymous);
@@ -127,6 +238,56 @@ void POP3Session::handleAnonymousCommand(const POP3Command& cmd) {
 	}
 }
 
+void POP3Session::handleLogon(std::variant<mailbox_ptr, MailboxOperationError, AuthError> result) {
+	if (std::holds_alternative<mailbox_ptr>(result)) {
+		mailbox = std::move(std::get<mailbox_ptr>(result));
+		state = POP3SessionState::Transaction;
+		putMailboxInfoToReponse();
+	}
+	else if (std::holds_alternative<AuthError>(result)) {
+		auto err = std::get<AuthError>(result);
+		if (err == AuthError::NoSuchConsumer || err == AuthError::InvalidPassword) {
+			AuthFailureLimiter::Shared().failure(userName, peer);
+		}
+		setErrorResponse(err);
+	}
+	else {
+		auto err = std::get<MailboxOperationError>(result);
+		if (err == MailboxOperationError::MailboxIsBusy) {
+			setErrorResponse(POP3SessionError::MailboxIsBusy);
+		}
+		else if (err == MailboxOperationError::LoginDelayed) {
+			setErrorResponse(POP3SessionError::LoginDelayed);
+		}
+		else {
+			setErrorResponse(POP3SessionError::InternalError);
+		}
+	}
+}
+
+void POP3Session::logon(std::string pass) {
+	//the response is written when the logon completes, the io thread serves other sessions meanwhile
+	logonPending = true;
+	MailboxServiceManager::VerifyCredentialsAndConnectAsync(userName, std::move(pass), [self = shared_from_this()](MailboxServiceManager::LogonResult result) {
+		auto value = std::make_shared<MailboxServiceManager::LogonResult>(std::move(result));
+		boost::asio::post(self->socket.get_executor(), [self, value]() {
+			self->logonPending = false;
+			self->handleLogon(std::move(*value));
+			self->write();
+		});
+	});
+}
+
+bool POP3Session::refuseLogon() {
+	auto backoff = AuthFailureLimiter::Shared().backoff(userName, peer);
+	if (backoff == std::chrono::milliseconds::zero()) {
+		return false;
+	}
+	setErrorResponse(POP3SessionError::TooManyFailures);
+	responseDelay = backoff;
+	return true;
+}
+
 void POP3Session::handleList(const POP3Command& cmd) {
 	if (std::holds_alternative<unsigned int>(cmd.parameter)) {
 		auto number = std::get<unsigned int>(cmd.parameter);
@@ -135,25 +296,30 @@ void POP3Session::handleList(const POP3Command& cmd) {
 			setErrorResponse(POP3SessionError::NoSuchMessage);
 		}
 		else {
-			std::ostringstream ss;
-			ss << boost::lexical_cast<std::string>(POP3Status::OK) << " " <<
-				number << " " << std::get<std::size_t>(result) << "\r\n";
-			response = ss.str();
+			response.assign(statusText(POP3Status::OK)).append(" ");
+			appendNumber(response, number);
+			response.append(" ");
+			appendNumber(response, std::get<std::size_t>(result));
+			response.append("\r\n");
 		}
 	}
 	else {
-		auto lengths = mailbox->getEmailsLengths();
-		std::ostringstream ss;
-		ss << boost::lexical_cast<std::string>(POP3Status::OK) << " " << mailbox->getEmailsCount() << " messages (" << 
-			mailbox->getWholeMailboxSize() << " octets)\r\n";
+		auto lengths = mailbox->getEmailsLengths(&arena);
+		response.assign(statusText(POP3Status::OK)).append(" ");
+		appendNumber(response, mailbox->getEmailsCount());
+		response.append(" messages (");
+		appendNumber(response, mailbox->getWholeMailboxSize(&arena));
+		response.append(" octets)\r\n");
 		if (!lengths.empty()) {
-			std::for_each(lengths.cbegin(), lengths.cend(), [&ss](const auto& p)
+			std::for_each(lengths.cbegin(), lengths.cend(), [this](const auto& p)
 				{
-					ss << p.first << " " << p.second << "\r\n";
+					appendNumber(response, p.first);
+					response.append(" ");
+					appendNumber(response, p.second);
+					response.append("\r\n");
 				});
-			ss << ".\r\n";
+			response.append(".\r\n");
 		}
-		response = ss.str();
 	}
 }
 
@@ -185,22 +351,165 @@ void POP3Session::handleRetr(const POP3Command& cmd) {
 		setErrorResponse(POP3SessionError::NoSuchMessage);
 		return;
 	}
-	std::ostringstream ss;
-	ss << boost::lexical_cast<std::string>(POP3Status::OK) << " " << std::get<std::size_t>(result) << " octets\r\n";
-	auto result1 = mailbox->getEmail(number);
-	if (std::holds_alternative<MailboxOperationError>(result1)) {
+	auto reader = mailbox->openEmail(number);
+	if (std::holds_alternative<MailboxOperationError>(reader)) {
 		setErrorResponse(POP3SessionError::NoSuchMessage);
+		return;
+	}
+	response.assign(statusText(POP3Status::OK)).append(" ");
+	appendNumber(response, std::get<std::size_t>(result));
+	response.append(" octets\r\n");
+	messageSent = 0;
+	auto& messageReaderPtr = std::get<message_reader_ptr>(reader);
+	auto buffer = messageReaderPtr->contiguous();
+	if (buffer && buffer->size() == std::get<std::size_t>(result)) {
+		//encoding never shrinks a message, so a buffer of the wire size is already in the wire form
+		messageTrailer = ".\r\n";
+		messageBuffer = std::move(buffer);
+		return;
+	}
+	//the message itself is sent by chunks after the status line, dot-stuffed unless the storage keeps it in the wire form
+	if (messageReaderPtr->wireFile()) {
+		messageReader = std::move(messageReaderPtr);
 	}
 	else {
-		auto content = std::get<std::string>(result1);
-		if (!boost::ends_with(content, "\r\n")) {
-			content.append("\r\n");
+		messageReader = std::make_unique<WireMessageReader>(std::move(messageReaderPtr));
+	}
+}
+
+std::array<boost::asio::const_buffer, 3> POP3Session::responseBuffers(std::size_t& messagePart) const {
+	std::array<boost::asio::const_buffer, 3> buffers{ boost::asio::buffer(response) };
+	messagePart = 0;
+	if (messageBuffer) {
+		//a cached message is sent right from the shared buffer between the status line and the terminator, a quantum at a time
+		auto remaining = static_cast<std::size_t>(messageBuffer->size() - messageSent);
+		messagePart = std::min(remaining, retrQuantum);
+		buffers[1] = boost::asio::buffer(messageBuffer->data() + messageSent, messagePart);
+		if (messagePart == remaining) {
+			buffers[2] = boost::asio::buffer(messageTrailer.data(), messageTrailer.size());
 		}
-		ss << std::move(content) << ".\r\n";
-		response = ss.str();
 	}
+	else if (retrChunk) {
+		buffers[1] = boost::asio::buffer(retrChunk.get(), retrChunkLength);
+	}
+	return buffers;
+}
+
+void POP3Session::paceNextChunk(std::size_t sent) {
+	//sending is activity as well, a paced message must not be cut by the timeout
+	prolongateLifeTime();
+	auto delay = bandwidth.charge(static_cast<double>(sent));
+	if (delay == TokenBucket::clock::duration::zero()) {
+		//handlers of other sessions queued meanwhile run before the next part
+		boost::asio::post(socket.get_executor(), [self = shared_from_this()]() {
+			self->writeNextChunk();
+		});
+		return;
+	}
+	pacer.expires_after(delay);
+	pacer.async_wait([self = shared_from_this()](boost::system::error_code ec) {
+		if (ec) {
+			//the session is cancelled
+			self->messageReader.reset();
+			self->messageBuffer.reset();
+			self->deleteFromSessions();
+			return;
+		}
+		self->writeNextChunk();
+	});
+}
+
+void POP3Session::writeNextChunk() {
+	if (messageBuffer) {
+		write();
+		return;
+	}
+#ifdef __linux__
+	if (auto file = messageReader->wireFile()) {
+		sendFileChunk(*file);
+		return;
+	}
+#endif
+	if (!readNextChunk()) {
+		//status line has already been sent, so the failure can be reported only by dropping the connection
+		messageReader.reset();
+		deleteFromSessions();
+		return;
+	}
+	write();
 }
 
+bool POP3Session::readNextChunk() {
+	if (!retrChunk) {
+		retrChunk = chunkPool.acquire();
+	}
+	auto result = messageReader->read(retrChunk.get(), retrQuantum);
+	if (std::holds_alternative<MailboxOperationError>(result)) {
+		retrChunk.reset();
+		retrChunkLength = 0;
+		return false;
+	}
+	retrChunkLength = std::get<std::size_t>(result);
+	response.clear();
+	if (retrChunkLength == 0) {
+		//wire form always ends with CRLF
+		messageReader.reset();
+		retrChunk.reset();
+		response.assign(".\r\n");
+	}
+	return true;
+}
+
+void POP3Session::rejectLongCommand() {
+	//the rest of the line cannot be told from the next command, so the connection is closed
+	response.assign(statusText(POP3Status::ERR)).append(" command line is too long\r\n");
+	closeAfterResponse = true;
+	write();
+}
+
+void POP3Session::trimBuffers() {
+	//a large LIST or a RETR served from memory grows the response, its temporaries grow the arena
+	if (response.capacity() > RetainedBufferCapacity) {
+		std::string().swap(response);
+		arenaUpstream.release();
+	}
+}
+
+#ifdef __linux__
+void POP3Session::sendFileChunk(const MessageReader::WireFile& file) {
+	if (messageSent < file.length) {
+		if (!socket.native_non_blocking()) {
+			socket.native_non_blocking(true);
+		}
+		off_t offset = static_cast<off_t>(file.offset + messageSent);
+		auto count = static_cast<std::size_t>(std::min<std::uint64_t>(file.length - messageSent, retrQuantum));
+		auto sent = ::sendfile(socket.native_handle(), file.handle, &offset, count);
+		if (sent > 0 || (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))) {
+			auto passed = sent > 0 ? static_cast<std::size_t>(sent) : 0;
+			messageSent += passed;
+			countSent(passed);
+			//one chunk at a time, other sessions are served while the socket is drained
+			socket.async_wait(boost::asio::ip::tcp::socket::wait_write, [self = shared_from_this(), passed](boost::system::error_code ec) {
+				if (ec) {
+					self->messageReader.reset();
+					self->deleteFromSessions();
+					return;
+				}
+				self->paceNextChunk(passed);
+			});
+			return;
+		}
+		//file is truncated or the connection is broken, the client can learn about it only by dropping the connection
+		messageReader.reset();
+		deleteFromSessions();
+		return;
+	}
+	messageReader.reset();
+	response = ".\r\n";
+	write();
+}
+#endif
+
 void POP3Session::handleAuthorizedUserCommand(const POP3Command& cmd) {
 	switch (cmd.cmdType)
 	{
@@ -217,10 +526,8 @@ void POP3Session::handleAuthorizedUserCommand(const POP3Command& cmd) {
 		break;
 	}
 	case POP3CommandType::USER: {
-		if (userName == std::get<std::string>(cmd.parameter)) {
-			std::ostringstream ss;
-			ss << boost::lexical_cast<std::string>(POP3Status::OK) << " " << userName << "\r\n";
-			response = ss.str();
+		if (userName == std::string_view(std::get<std::pmr::string>(cmd.parameter))) {
+			response.assign(statusText(POP3Status::OK)).append(" ").append(userName).append("\r\n");
 		}
 		else {
 			setErrorResponse(POP3SessionError::OtherMailboxBeingUsed);
@@ -249,20 +556,22 @@ void POP3Session::handleAuthorizedUserCommand(const POP3Command& cmd) {
 		putMailboxInfoToReponse();
 		break;
 	}
+	case POP3CommandType::CAPA: {
+		putCapabilitiesToResponse();
+		break;
+	}
 	default:
 		break;
 	}
 }
 
-void POP3Session::readImpl() {
-	auto result = parsePOP3Command(request);
+void POP3Session::handleRequest(const std::variant<POP3Command, ParsingError>& parsed) {
 	response.clear();
-
-	if (std::holds_alternative<ParsingError>(result)) {
-		setErrorResponse(std::get<ParsingError>(result));
+	if (std::holds_alternative<ParsingError>(parsed)) {
+		setErrorResponse(std::get<ParsingError>(parsed));
 	}
 	else {
-		auto command = std::get<POP3Command>(result);
+		const auto& command = std::get<POP3Command>(parsed);
 		if (state == POP3SessionState::Authorization) {
 			handleAnonymousCommand(command);
 		}
@@ -270,6 +579,169 @@ void POP3Session::readImpl() {
 			handleAuthorizedUserCommand(command);
 		}
 	}
+}
 
+void POP3Session::readImpl() {
+	auto parsed = parsePOP3Command(std::string_view(request).substr(0, requestLength), &arena);
+	startCommand(parsed);
+	handleRequest(parsed);
+	if (logonPending) {
+		return;
+	}
+	if (responseDelay != std::chrono::milliseconds::zero()) {
+		writeAfter(std::exchange(responseDelay, std::chrono::milliseconds::zero()));
+		return;
+	}
 	write();
-}
\ No newline at end of file
+}
+
+#ifdef POP3_SESSION_HAS_COROUTINES
+namespace {
+	/// <summary>
+	/// Log on through the pools of MailboxServiceManager and resume on the calling executor
+	/// </summary>
+	boost::asio::awaitable<MailboxServiceManager::LogonResult> asyncLogon(std::string name, std::string password) {
+		using result_type = MailboxServiceManager::LogonResult;
+		co_return co_await boost::asio::async_initiate<decltype(boost::asio::use_awaitable), void(result_type)>(
+			[&name, &password](auto handler) {
+				//the strand of the session
+				auto executor = boost::asio::get_associated_executor(handler);
+				//the manager takes copyable handlers, the handler of an awaitable is move-only
+				auto shared = std::make_shared<decltype(handler)>(std::move(handler));
+				MailboxServiceManager::VerifyCredentialsAndConnectAsync(std::move(name), std::move(password), [shared, executor](result_type result) {
+					auto value = std::make_shared<result_type>(std::move(result));
+					boost::asio::post(executor, [shared, value]() { (*shared)(std::move(*value)); });
+				});
+			}, boost::asio::use_awaitable);
+	}
+}
+
+boost::asio::awaitable<void> POP3Session::run() {
+	//the frame keeps the session alive while the connection lasts
+	auto self = shared_from_this();
+	try {
+		while (true) {
+			boost::system::error_code ec;
+			requestLength = co_await boost::asio::async_read_until(socket, boost::asio::dynamic_buffer(request, MaxCommandLength), "\r\n",
+				boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+			if (ec == boost::asio::error::not_found) {
+				//the rest of the line cannot be told from the next command, so the connection is closed
+				response.assign(statusText(POP3Status::ERR)).append(" command line is too long\r\n");
+				co_await writeResponse();
+				break;
+			}
+			if (ec) {
+				throw boost::system::system_error(ec);
+			}
+			prolongateLifeTime();
+			auto parsed = parsePOP3Command(std::string_view(request).substr(0, requestLength), &arena);
+			startCommand(parsed);
+			auto command = std::get_if<POP3Command>(&parsed);
+			if (command && state == POP3SessionState::Authorization && command->cmdType == POP3CommandType::PASS) {
+				response.clear();
+				if (!refuseLogon()) {
+					//the password is verified and storages are instantiated on the pools, not on the io thread
+					//named, temporaries living across co_await are mishandled by some compilers
+					std::string pass(std::get<std::pmr::string>(command->parameter));
+					auto result = co_await asyncLogon(userName, std::move(pass));
+					handleLogon(std::move(result));
+				}
+			}
+			else {
+				handleRequest(parsed);
+			}
+			if (responseDelay != std::chrono::milliseconds::zero()) {
+				//the refusal is held back on the timer, the io thread serves other sessions meanwhile
+				pacer.expires_after(std::exchange(responseDelay, std::chrono::milliseconds::zero()));
+				co_await pacer.async_wait(boost::asio::use_awaitable);
+			}
+			co_await writeResponse();
+			if (quitCommandReceived) {
+				if (mailbox) {
+					mailbox->setUpdate();
+				}
+				break;
+			}
+			arena.release();
+			trimBuffers();
+			//commands pipelined after this one stay in the buffer
+			request.erase(0, requestLength);
+		}
+	}
+	catch (const std::exception&) {
+		//connection is broken or the session was cancelled
+		messageReader.reset();
+	}
+	deleteFromSessions();
+}
+
+boost::asio::awaitable<void> POP3Session::writeResponse() {
+	finishCommand();
+	std::size_t messagePart = 0;
+	auto sent = co_await boost::asio::async_write(socket, responseBuffers(messagePart), boost::asio::use_awaitable);
+	countSent(sent);
+	//a cached message is sent a quantum at a time
+	while (messageBuffer) {
+		messageSent += messagePart;
+		if (messageSent == messageBuffer->size()) {
+			messageBuffer.reset();
+			break;
+		}
+		response.clear();
+		co_await pace(sent);
+		sent = co_await boost::asio::async_write(socket, responseBuffers(messagePart), boost::asio::use_awaitable);
+		countSent(sent);
+	}
+
+	//RETR is in progress
+	while (messageReader) {
+		co_await pace(sent);
+#ifdef __linux__
+		if (auto file = messageReader->wireFile()) {
+			if (messageSent < file->length) {
+				if (!socket.native_non_blocking()) {
+					socket.native_non_blocking(true);
+				}
+				off_t offset = static_cast<off_t>(file->offset + messageSent);
+				auto count = static_cast<std::size_t>(std::min<std::uint64_t>(file->length - messageSent, retrQuantum));
+				auto passed = ::sendfile(socket.native_handle(), file->handle, &offset, count);
+				if (passed <= 0 && !(passed < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))) {
+					//file is truncated or the connection is broken, the client can learn about it only by dropping the connection
+					throw std::runtime_error{ "sendfile failed" };
+				}
+				sent = passed > 0 ? static_cast<std::size_t>(passed) : 0;
+				messageSent += sent;
+				countSent(sent);
+				//one chunk at a time, other sessions are served while the socket is drained
+				co_await socket.async_wait(boost::asio::ip::tcp::socket::wait_write, boost::asio::use_awaitable);
+				continue;
+			}
+			messageReader.reset();
+			response = ".\r\n";
+			countSent(co_await boost::asio::async_write(socket, boost::asio::buffer(response), boost::asio::use_awaitable));
+			break;
+		}
+#endif
+		if (!readNextChunk()) {
+			//status line has already been sent, so the failure can be reported only by dropping the connection
+			throw std::runtime_error{ "message could not be read" };
+		}
+		sent = co_await boost::asio::async_write(socket, responseBuffers(messagePart), boost::asio::use_awaitable);
+		countSent(sent);
+	}
+}
+
+boost::asio::awaitable<void> POP3Session::pace(std::size_t sent) {
+	//sending is activity as well, a paced message must not be cut by the timeout
+	prolongateLifeTime();
+	auto delay = bandwidth.charge(static_cast<double>(sent));
+	if (delay == TokenBucket::clock::duration::zero()) {
+		//handlers of other sessions queued meanwhile run before the next part
+		co_await boost::asio::post(socket.get_executor(), boost::asio::use_awaitable);
+	}
+	else {
+		pacer.expires_after(delay);
+		co_await pacer.async_wait(boost::asio::use_awaitable);
+	}
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,108 @@
+#include "PrometheusFormat.h"
+
+#include <algorithm>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+	//label values may hold anything, the text format escapes backslashes, quotes and line breaks
+	void appendEscaped(std::string& out, std::string_view value) {
+		for (auto c : value) {
+			switch (c) {
+			case '\\':
+				out.append("\\\\");
+				break;
+			case '"':
+				out.append("\\\"");
+				break;
+			case '\n':
+				out.append("\\n");
+				break;
+			default:
+				out.push_back(c);
+			}
+		}
+	}
+
+	void appendLabels(std::string& out, const MetricLabels& labels, std::string_view le = {}) {
+		if (labels.empty() && le.empty()) {
+			return;
+		}
+		out.push_back('{');
+		bool first = true;
+		for (const auto& [name, value] : labels) {
+			if (!first) {
+				out.push_back(',');
+			}
+			first = false;
+			out.append(name).append("=\"");
+			appendEscaped(out, value);
+			out.push_back('"');
+		}
+		if (!le.empty()) {
+			out.append(first ? "le=\"" : ",le=\"").append(le).push_back('"');
+		}
+		out.push_back('}');
+	}
+
+	std::string_view typeName(MetricType type) {
+		switch (type) {
+		case MetricType::Counter:
+			return "counter";
+		case MetricType::Gauge:
+			return "gauge";
+		default:
+			return "histogram";
+		}
+	}
+}
+
+std::string formatPrometheus(const MetricsRegistry::Snapshot& snapshot) {
+	//metrics of one name make one family, written where the name first appears
+	std::vector<const MetricDescriptor*> ordered;
+	std::unordered_map<std::string_view, std::size_t> families;
+	std::for_each(snapshot.metrics.cbegin(), snapshot.metrics.cend(), [&](const auto& metric) {
+		families.emplace(metric.name, families.size());
+		ordered.push_back(&metric);
+	});
+	std::stable_sort(ordered.begin(), ordered.end(), [&families](const auto* a, const auto* b) {
+		return families.at(a->name) < families.at(b->name);
+	});
+
+	std::string out;
+	std::string_view family;
+	for (const auto* metric : ordered) {
+		if (metric->name != family) {
+			family = metric->name;
+			out.append("# HELP ").append(metric->name).append(" ").append(metric->help).append("\n");
+			out.append("# TYPE ").append(metric->name).append(" ").append(typeName(metric->type)).append("\n");
+		}
+		if (metric->type != MetricType::Histogram) {
+			out.append(metric->name);
+			appendLabels(out, metric->labels);
+			out.append(" ").append(std::to_string(snapshot.values[metric->slot])).append("\n");
+			continue;
+		}
+		std::int64_t cumulative = 0;
+		for (std::size_t i = 0; i < MetricsRegistry::HistogramBuckets - 1; i++) {
+			cumulative += snapshot.values[metric->slot + i];
+			if (i % MetricsRegistry::SubBuckets == MetricsRegistry::SubBuckets - 1) {
+				out.append(metric->name).append("_bucket");
+				appendLabels(out, metric->labels, std::to_string(MetricsRegistry::BucketUpperBound(i)));
+				out.append(" ").append(std::to_string(cumulative)).append("\n");
+			}
+		}
+		auto count = snapshot.values[metric->slot + MetricsRegistry::HistogramBuckets];
+		out.append(metric->name).append("_bucket");
+		appendLabels(out, metric->labels, "+Inf");
+		out.append(" ").append(std::to_string(count)).append("\n");
+		out.append(metric->name).append("_sum");
+		appendLabels(out, metric->labels);
+		out.append(" ").append(std::to_string(snapshot.values[metric->slot + MetricsRegistry::HistogramBuckets + 1])).append("\n");
+		out.append(metric->name).append("_count");
+		appendLabels(out, metric->labels);
+		out.append(" ").append(std::to_string(count)).append("\n");
+	}
+	return out;
+}
@@ -3,12 +3,19 @@
 #include "AuthorizationManager.h"
 #include "MailboxServiceManager.h"
 #include "POP3Session.h"
+#include "LMTPSession.h"
+#include "AdminSession.h"
 #include "Server.h"
 #include "ConsumerInfo.h"
+#include "FileSystemMailStorage.h"
+#include "MailboxExpunger.h"
+#include "MailboxPrefetcher.h"
 
 #include <boost/lexical_cast.hpp>
 
 typedef Server<POP3Session> POP3Server;
+typedef Server<LMTPSession> LMTPServer;
+typedef Server<AdminSession> AdminServer;
 
 void dummy_generate_consumers(std::unique_ptr<HashedFileSystemConsumerInfoStorage>& storage, unsigned int count = 10) {
 	std::filesystem::path p = "D:\\mailboxes";
@@ -35,6 +42,31 @@ int main()
 		new SingleConsumerInfoStorageAuthorizationManager<BothNumericConsumerInfo>(std::move(stor))
 	};
 	MailboxServiceManager::SetAuthorizationManager(std::move(AuthorizationManager));
+	FileSystemStorageFactory::setIOEngine(StorageIOEngine::Create(StorageIOEngineType::IoUring));
+	//finish expunges interrupted by a crash, mailboxes outside of the default path are recovered at their first login
+	MailboxExpunger::ReplayJournals(FileSystemStorageFactory::getDefaultPath(), FileSystemStorageFactory::getIOEngine());
+	//sessions are coroutines in C++20 builds, callback chains otherwise
+	POP3Session::EnableCoroutines(true);
+	//messages are sent by 16 KiB, so short commands of other sessions do not wait behind a large RETR
+	POP3Session::SetRetrPacing(16 * 1024, 0);
+	//clients polling more often than once a minute are told to come back later (CAPA shows them the delay)
+	MailboxServiceManager::SetLoginDelay(std::chrono::seconds(60));
+	//passwords are verified by two threads, a logon storm queues there and leaves the io and storage threads alone
+	MailboxServiceManager::SetAuthThreads(2);
+	//mailboxes are warmed between USER and PASS
+	MailboxPrefetcher::Enable(true);
+	//connections over the limits are turned away before a session is created
+	AdmissionLimits limits;
+	limits.maxSessions = 10000;
+	limits.maxSessionsPerAddress = 20;
+	limits.acceptsPerSecond = 500;
+	limits.acceptBurst = 100;
+	limits.memoryBudget = std::size_t{ 1024 } * 1024 * 1024;
+	POP3Server::SetAdmissionLimits(limits);
+	//local delivery, mail put into mailboxes by other means is found by directory listing at login
+	ConsoleServerController<POP3Server>::Attach<LMTPServer>("127.0.0.1", 24);
+	//metrics for Prometheus, open sessions and a health check, on the loopback only
+	ConsoleServerController<POP3Server>::Attach<AdminServer>("127.0.0.1", 9110);
 	ConsoleServerController<POP3Server>::Run();
 	return 0;
 }
\ No newline at end of file
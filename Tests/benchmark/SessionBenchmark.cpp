@@ -0,0 +1,181 @@
+//Memory held by a POP3 session and latency of its commands, for callback and coroutine sessions.
+//Run by hand, ctest does not run it: MailBenchmarks [sessions] [round trips]
+
+#include "AllocationCounter.h"
+#include "POP3TestServer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace {
+	constexpr std::size_t MessagesInMailbox = 200;
+	constexpr std::size_t LargeMessageSize = 256 * 1024;
+
+	/// <summary>
+	/// Connections of the memory measurement share one context and one buffer,
+	/// so they allocate nothing after their sockets are opened
+	/// </summary>
+	class Connections
+	{
+	public:
+		Connections(std::size_t count) {
+			received.reserve(POP3TestClient::BufferSize);
+			sockets.reserve(count);
+			for (std::size_t i = 0; i < count; i++) {
+				sockets.emplace_back(context).open(boost::asio::ip::tcp::v4());
+			}
+		}
+
+		void connect(unsigned short port) {
+			for (auto& socket : sockets) {
+				socket.connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), port));
+			}
+		}
+
+		/// <summary>
+		/// Send the command on every connection and read the responses
+		/// </summary>
+		/// <param name="line">Command, "%u" is replaced by the number of the connection</param>
+		void command(const char* line, bool multiline = false) {
+			char buffer[64];
+			for (std::size_t i = 0; i < sockets.size(); i++) {
+				auto length = std::snprintf(buffer, sizeof(buffer), line, static_cast<unsigned int>(i));
+				buffer[length++] = '\r';
+				buffer[length++] = '\n';
+				boost::asio::write(sockets[i], boost::asio::buffer(buffer, length));
+				received.clear();
+				auto consumed = boost::asio::read_until(sockets[i], boost::asio::dynamic_buffer(received, POP3TestClient::BufferSize), "\r\n");
+				if (multiline && received.compare(0, 3, "+OK") == 0) {
+					boost::asio::read_until(sockets[i], boost::asio::dynamic_buffer(received, POP3TestClient::BufferSize), "\r\n.\r\n");
+				}
+				if (received.compare(0, 3, "+OK") != 0) {
+					std::fprintf(stderr, "%s: %.*s", line, static_cast<int>(consumed), received.data());
+					std::exit(EXIT_FAILURE);
+				}
+			}
+		}
+
+		void close() {
+			for (auto& socket : sockets) {
+				socket.close();
+			}
+		}
+
+	private:
+		boost::asio::io_context context;
+		std::vector<boost::asio::ip::tcp::socket> sockets;
+		std::string received;
+	};
+
+	std::vector<std::string> mailboxMessages() {
+		std::vector<std::string> messages(MessagesInMailbox, "Subject: small\r\n\r\nbody\r\n");
+		std::string line = "Subject: large\r\n\r\n";
+		while (line.size() < LargeMessageSize) {
+			line.append("0123456789012345678901234567890123456789012345678901234567890123456789\r\n");
+		}
+		messages[0] = std::move(line);
+		return messages;
+	}
+
+	void waitForSessions(std::size_t count) {
+		for (int i = 0; i < 500 && POP3Session::listSessions().size() != count; i++) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+	}
+
+	double perSession(std::size_t before, std::size_t after, std::size_t sessions) {
+		return (static_cast<double>(after) - static_cast<double>(before)) / static_cast<double>(sessions);
+	}
+
+	void measureMemory(std::size_t sessions) {
+		POP3TestServer server;
+		auto messages = mailboxMessages();
+		for (std::size_t i = 0; i <= sessions; i++) {
+			server.addMailbox("user" + std::to_string(i), "password", messages);
+		}
+		//the pools of the manager and the caches of the server are created by the first session
+		{
+			POP3TestClient warmup(server.port());
+			warmup.command("USER user" + std::to_string(sessions));
+			warmup.command("PASS password");
+			warmup.command("RETR 0", true);
+			warmup.command("QUIT");
+		}
+		waitForSessions(0);
+
+		Connections connections(sessions);
+		auto idle = AllocationCounter::LiveBytes();
+		connections.connect(server.port());
+		connections.command("NOOP");
+		auto connected = AllocationCounter::LiveBytes();
+		connections.command("USER user%u");
+		connections.command("PASS password");
+		auto loggedOn = AllocationCounter::LiveBytes();
+		//a LIST of the whole mailbox grows the response past the retained capacity
+		connections.command("LIST", true);
+		connections.command("RETR 0", true);
+		auto served = AllocationCounter::LiveBytes();
+		connections.command("QUIT");
+		connections.close();
+		waitForSessions(0);
+		auto closed = AllocationCounter::LiveBytes();
+
+		std::printf("  memory per session, %zu sessions:\n", sessions);
+		std::printf("    connected        %10.0f B\n", perSession(idle, connected, sessions));
+		std::printf("    logged on        %10.0f B\n", perSession(idle, loggedOn, sessions));
+		std::printf("    after LIST, RETR %10.0f B\n", perSession(idle, served, sessions));
+		//snapshots of the mailbox indexes stay cached after the sessions are gone
+		std::printf("    after QUIT       %10.0f B (cached mailbox indexes)\n", perSession(idle, closed, sessions));
+	}
+
+	void measureLatency(std::size_t roundTrips) {
+		POP3TestServer server;
+		server.addMailbox("user", "password", mailboxMessages());
+		POP3TestClient client(server.port());
+		client.command("USER user");
+		client.command("PASS password");
+
+		std::vector<double> latencies;
+		latencies.reserve(roundTrips);
+		for (const char* command : { "NOOP", "STAT", "LIST 1" }) {
+			for (std::size_t i = 0; i < roundTrips / 10; i++) {
+				client.command(command);
+			}
+			latencies.clear();
+			for (std::size_t i = 0; i < roundTrips; i++) {
+				auto start = std::chrono::steady_clock::now();
+				client.command(command);
+				latencies.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+			}
+			std::sort(latencies.begin(), latencies.end());
+			double total = 0;
+			for (auto latency : latencies) {
+				total += latency;
+			}
+			std::printf("  %-6s mean %6.1f us, p50 %6.1f us, p99 %6.1f us\n", command,
+				total / latencies.size(), latencies[latencies.size() / 2], latencies[latencies.size() * 99 / 100]);
+		}
+		client.command("QUIT");
+	}
+}
+
+int main(int argc, char** argv) {
+	std::size_t sessions = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 32;
+	std::size_t roundTrips = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 20000;
+
+	for (bool coroutines : { false, true }) {
+		std::printf("%s sessions\n", coroutines ? "coroutine" : "callback");
+		if (!POP3Session::EnableCoroutines(coroutines)) {
+			std::printf("  not supported by this build, configure with POP3_COROUTINE_SESSIONS\n");
+			continue;
+		}
+		measureMemory(sessions);
+		measureLatency(roundTrips);
+	}
+	POP3Session::EnableCoroutines(false);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+
+/// <summary>
+/// Counts allocations made through the global operator new, which the tests replace.
+/// The counters are shared by all threads, so a test compares them around code no other thread runs meanwhile.
+/// </summary>
+class AllocationCounter
+{
+public:
+	AllocationCounter() = delete;
+
+	/// <summary>
+	/// Number of allocations since the start of the process
+	/// </summary>
+	static std::size_t Allocations();
+
+	/// <summary>
+	/// Octets requested by the allocations since the start of the process
+	/// </summary>
+	static std::size_t Bytes();
+
+	/// <summary>
+	/// Octets held by the allocations which are not freed yet
+	/// </summary>
+	static std::size_t LiveBytes();
+};
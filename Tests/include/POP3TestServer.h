@@ -0,0 +1,186 @@
+#pragma once
+
+#include "AuthorizationManager.h"
+#include "MailboxServiceManager.h"
+#include "POP3Session.h"
+#include "Server.h"
+#include "TestDirectory.h"
+
+#include <array>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+/// <summary>
+/// Consumers of a test, their mailboxes are plain directories. A consumer without a directory has no storages.
+/// </summary>
+class TestAuthorizationManager : public AuthorizationManager
+{
+public:
+	void addConsumer(std::string name, std::string password, std::filesystem::path mailbox) {
+		consumers[std::move(name)] = Consumer{ std::move(password), std::move(mailbox) };
+	}
+
+	bool verifyName(std::string_view name) const override {
+		return consumers.find(name) != consumers.end();
+	}
+
+protected:
+	bool verifyCredentials(std::string_view name, std::string_view password) const override {
+		auto it = consumers.find(name);
+		return it != consumers.end() && checkPassword(name, password, it->second.password);
+	}
+
+	std::vector<MailStorageInfo> getMailStoragesAssociatedWithConsumer(std::string_view name) const override {
+		auto it = consumers.find(name);
+		if (it == consumers.end() || it->second.mailbox.empty()) {
+			return std::vector<MailStorageInfo>();
+		}
+		MailStorageInfo info(StorageType::FileSystemMailStorage);
+		info.addOption("path", it->second.mailbox.string());
+		return { info };
+	}
+
+private:
+	struct Consumer {
+		std::string password;
+		std::filesystem::path mailbox;
+	};
+	std::map<std::string, Consumer, std::less<>> consumers;
+};
+
+/// <summary>
+/// POP3 server on a loopback port, run by its own threads. Consumers and their mailboxes are removed with it.
+/// </summary>
+class POP3TestServer
+{
+public:
+	explicit POP3TestServer(unsigned int threadsCount = 1, const AdmissionLimits& limits = {}) {
+		auto authorization = std::make_unique<TestAuthorizationManager>();
+		consumers = authorization.get();
+		MailboxServiceManager::SetAuthorizationManager(std::move(authorization));
+
+		boost::asio::ip::tcp::acceptor acceptor(context, boost::asio::ip::tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 0));
+		portNumber = acceptor.local_endpoint().port();
+		Server<POP3Session>::SetAdmissionLimits(limits);
+		server = std::make_unique<Server<POP3Session>>(context, std::move(acceptor));
+		server->serve();
+		for (unsigned int i = 0; i < threadsCount; i++) {
+			threads.emplace_back([this]() { context.run(); });
+		}
+	}
+
+	~POP3TestServer() {
+		server->cancel();
+		//sessions leave the list when their cancelled operations complete
+		for (int i = 0; i < 500 && !POP3Session::listSessions().empty(); i++) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+		context.stop();
+		for (auto& thread : threads) {
+			thread.join();
+		}
+	}
+
+	POP3TestServer(const POP3TestServer&) = delete;
+	POP3TestServer& operator=(const POP3TestServer&) = delete;
+
+	/// <summary>
+	/// Create a consumer whose mailbox holds the messages
+	/// </summary>
+	void addMailbox(const std::string& name, const std::string& password, const std::vector<std::string>& messages) {
+		auto mailbox = directory.get() / name;
+		std::filesystem::create_directories(mailbox);
+		for (std::size_t i = 0; i < messages.size(); i++) {
+			directory.write(std::filesystem::path(name) / (std::to_string(i + 1) + ".eml"), messages[i]);
+		}
+		consumers->addConsumer(name, password, mailbox);
+	}
+
+	inline unsigned short port() const { return portNumber; }
+
+private:
+	TestDirectory directory;
+	boost::asio::io_context context;
+	TestAuthorizationManager* consumers;
+	unsigned short portNumber;
+	std::unique_ptr<Server<POP3Session>> server;
+	std::vector<std::thread> threads;
+};
+
+/// <summary>
+/// Blocking client of POP3TestServer. Once its buffer is large enough it does not allocate,
+/// so allocations of the server can be counted while it talks to it.
+/// </summary>
+class POP3TestClient
+{
+public:
+	constexpr static std::size_t BufferSize = 1024 * 1024;
+
+	explicit POP3TestClient(unsigned short port) : socket(context) {
+		received.reserve(BufferSize);
+		//the server does not greet, the client speaks first
+		socket.connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), port));
+		//pipelined commands are sent at once, not held back until the previous ones are acknowledged
+		socket.set_option(boost::asio::ip::tcp::no_delay(true));
+	}
+
+	/// <summary>
+	/// Send a command line and read the response
+	/// </summary>
+	/// <param name="line">Command without CRLF</param>
+	/// <param name="multiline">A positive response is read up to the terminating line</param>
+	/// <returns>Response, valid until the next command</returns>
+	std::string_view command(std::string_view line, bool multiline = false) {
+		send(line);
+		return readResponse(multiline);
+	}
+
+	/// <summary>
+	/// Send a command line without waiting for the response
+	/// </summary>
+	void send(std::string_view line) {
+		std::array<boost::asio::const_buffer, 2> buffers{ boost::asio::buffer(line.data(), line.size()), boost::asio::buffer("\r\n", 2) };
+		boost::asio::write(socket, buffers);
+	}
+
+	/// <summary>
+	/// Read the next response
+	/// </summary>
+	std::string_view readResponse(bool multiline) {
+		received.erase(0, consumed);
+		boost::system::error_code ec;
+		consumed = boost::asio::read_until(socket, boost::asio::dynamic_buffer(received, BufferSize), "\r\n", ec);
+		if (ec) {
+			consumed = 0;
+			return std::string_view();
+		}
+		if (multiline && received.compare(0, 3, "+OK") == 0) {
+			consumed = boost::asio::read_until(socket, boost::asio::dynamic_buffer(received, BufferSize), "\r\n.\r\n", ec);
+			if (ec) {
+				consumed = 0;
+				return std::string_view();
+			}
+		}
+		return std::string_view(received).substr(0, consumed);
+	}
+
+	/// <summary>
+	/// Check whether the server has closed the connection
+	/// </summary>
+	bool closed() {
+		boost::system::error_code ec;
+		char octet;
+		socket.read_some(boost::asio::buffer(&octet, 1), ec);
+		return ec == boost::asio::error::eof || ec == boost::asio::error::connection_reset;
+	}
+
+private:
+	boost::asio::io_context context;
+	boost::asio::ip::tcp::socket socket;
+	std::string received;
+	std::size_t consumed{ 0 };
+};
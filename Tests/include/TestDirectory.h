@@ -0,0 +1,44 @@
+#pragma once
+
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <string_view>
+
+/// <summary>
+/// Directory created under the temporary path for one test and removed with its content afterwards
+/// </summary>
+class TestDirectory
+{
+public:
+	TestDirectory() {
+		std::random_device random;
+		path = std::filesystem::temp_directory_path() / ("mail-test-" + std::to_string(random()) + std::to_string(random()));
+		std::filesystem::create_directories(path);
+	}
+
+	~TestDirectory() {
+		std::error_code ec;
+		std::filesystem::remove_all(path, ec);
+	}
+
+	TestDirectory(const TestDirectory&) = delete;
+	TestDirectory& operator=(const TestDirectory&) = delete;
+
+	/// <summary>
+	/// Create a file with the given content, directories on the way are created as well
+	/// </summary>
+	std::filesystem::path write(const std::filesystem::path& name, std::string_view content) const {
+		auto file = path / name;
+		std::filesystem::create_directories(file.parent_path());
+		std::ofstream stream(file, std::ios::binary | std::ios::trunc);
+		stream.write(content.data(), static_cast<std::streamsize>(content.size()));
+		return file;
+	}
+
+	inline const std::filesystem::path& get() const { return path; }
+
+private:
+	std::filesystem::path path;
+};
@@ -0,0 +1,96 @@
+#include "AdmissionController.h"
+#include "POP3TestServer.h"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <vector>
+
+namespace {
+	const auto First = boost::asio::ip::make_address("192.0.2.1");
+	const auto Second = boost::asio::ip::make_address("192.0.2.2");
+}
+
+TEST(AdmissionController, AdmitsWithoutLimits) {
+	AdmissionController admission;
+	std::vector<AdmissionController::Ticket> tickets;
+	for (int i = 0; i < 100; i++) {
+		tickets.push_back(admission.admit(First));
+		EXPECT_TRUE(tickets.back());
+	}
+	EXPECT_EQ(admission.activeSessions(), 100u);
+	EXPECT_EQ(admission.acceptDelay(), std::chrono::steady_clock::duration::zero());
+}
+
+TEST(AdmissionController, LimitsSessions) {
+	AdmissionLimits limits;
+	limits.maxSessions = 2;
+	AdmissionController admission(limits);
+	auto first = admission.admit(First);
+	auto second = admission.admit(Second);
+	EXPECT_TRUE(first);
+	EXPECT_TRUE(second);
+	EXPECT_FALSE(admission.admit(First));
+	//the place is given back with the ticket
+	first = AdmissionController::Ticket();
+	EXPECT_EQ(admission.activeSessions(), 1u);
+	EXPECT_TRUE(admission.admit(Second));
+}
+
+TEST(AdmissionController, LimitsSessionsPerAddress) {
+	AdmissionLimits limits;
+	limits.maxSessionsPerAddress = 1;
+	AdmissionController admission(limits);
+	auto first = admission.admit(First);
+	EXPECT_TRUE(first);
+	EXPECT_FALSE(admission.admit(First));
+	auto second = admission.admit(Second);
+	EXPECT_TRUE(second);
+	auto moved = std::move(first);
+	EXPECT_FALSE(admission.admit(First));
+	moved = AdmissionController::Ticket();
+	EXPECT_TRUE(admission.admit(First));
+}
+
+TEST(AdmissionController, LimitsAcceptRate) {
+	AdmissionLimits limits;
+	limits.acceptsPerSecond = 1;
+	limits.acceptBurst = 2;
+	AdmissionController admission(limits);
+	EXPECT_EQ(admission.acceptDelay(), std::chrono::steady_clock::duration::zero());
+	EXPECT_EQ(admission.acceptDelay(), std::chrono::steady_clock::duration::zero());
+	EXPECT_EQ(admission.acceptDelay(), std::chrono::steady_clock::duration::zero());
+	EXPECT_GT(admission.acceptDelay(), std::chrono::milliseconds(500));
+}
+
+TEST(AdmissionController, PausesOverMemoryBudget) {
+	if (AdmissionController::residentMemory() == 0) {
+		GTEST_SKIP() << "resident memory is unknown on this platform";
+	}
+	AdmissionLimits limits;
+	limits.memoryBudget = 1;
+	AdmissionController admission(limits);
+	EXPECT_EQ(admission.acceptDelay(), AdmissionController::MemoryPause);
+}
+
+TEST(AdmissionController, TicketOutlivesController) {
+	auto admission = std::make_unique<AdmissionController>();
+	auto ticket = admission->admit(First);
+	admission.reset();
+	ticket = AdmissionController::Ticket();
+	EXPECT_FALSE(ticket);
+}
+
+TEST(AdmissionController, ServerRejectsConnectionOverLimit) {
+	AdmissionLimits limits;
+	limits.maxSessionsPerAddress = 1;
+	POP3TestServer server(1, limits);
+	server.addMailbox("admitted", "secret", {});
+	POP3TestClient admitted(server.port());
+	EXPECT_EQ(admitted.command("USER admitted").substr(0, 3), "+OK");
+
+	POP3TestClient rejected(server.port());
+	EXPECT_EQ(rejected.readResponse(false), POP3Session::BusyResponse);
+	EXPECT_TRUE(rejected.closed());
+	EXPECT_EQ(admitted.command("NOOP").substr(0, 3), "+OK");
+}
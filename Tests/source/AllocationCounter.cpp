@@ -0,0 +1,93 @@
+#include "AllocationCounter.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+namespace {
+	std::atomic<std::size_t> allocations{ 0 };
+	std::atomic<std::size_t> bytes{ 0 };
+	std::atomic<std::size_t> liveBytes{ 0 };
+
+	//the size of a block is kept in front of it, so its release can be counted
+	constexpr std::size_t HeaderSize = alignof(std::max_align_t);
+
+	void* allocate(std::size_t size) noexcept {
+		allocations.fetch_add(1, std::memory_order_relaxed);
+		bytes.fetch_add(size, std::memory_order_relaxed);
+		liveBytes.fetch_add(size, std::memory_order_relaxed);
+		auto block = static_cast<unsigned char*>(std::malloc(HeaderSize + size));
+		if (!block) {
+			return nullptr;
+		}
+		*reinterpret_cast<std::size_t*>(block) = size;
+		return block + HeaderSize;
+	}
+
+	void release(void* p) noexcept {
+		if (!p) {
+			return;
+		}
+		auto block = static_cast<unsigned char*>(p) - HeaderSize;
+		liveBytes.fetch_sub(*reinterpret_cast<std::size_t*>(block), std::memory_order_relaxed);
+		std::free(block);
+	}
+}
+
+std::size_t AllocationCounter::Allocations() {
+	return allocations.load(std::memory_order_relaxed);
+}
+
+std::size_t AllocationCounter::Bytes() {
+	return bytes.load(std::memory_order_relaxed);
+}
+
+std::size_t AllocationCounter::LiveBytes() {
+	return liveBytes.load(std::memory_order_relaxed);
+}
+
+//over-aligned allocations are left to the library, nothing in the tested code makes them
+
+void* operator new(std::size_t size) {
+	if (auto p = allocate(size)) {
+		return p;
+	}
+	throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+	return ::operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+	return allocate(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+	return allocate(size);
+}
+
+void operator delete(void* p) noexcept {
+	release(p);
+}
+
+void operator delete[](void* p) noexcept {
+	release(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+	release(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+	release(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+	release(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+	release(p);
+}
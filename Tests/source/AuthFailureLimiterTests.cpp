@@ -0,0 +1,84 @@
+#include "AuthFailureLimiter.h"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+
+namespace {
+	const auto First = boost::asio::ip::make_address("192.0.2.1");
+	const auto Second = boost::asio::ip::make_address("2001:db8::2");
+
+	class AuthFailureLimiterTest : public ::testing::Test {
+	protected:
+		void fail(std::string_view name, const boost::asio::ip::address& address, int times) {
+			for (int i = 0; i < times; i++) {
+				limiter->failure(name, address);
+			}
+		}
+
+		//the tables are too large for the stack
+		std::unique_ptr<AuthFailureLimiter> limiter = std::make_unique<AuthFailureLimiter>();
+	};
+}
+
+TEST_F(AuthFailureLimiterTest, AllowsFreeFailures) {
+	fail("guessed", First, static_cast<int>(AuthFailureLimiter::FreeFailures));
+	EXPECT_EQ(limiter->backoff("guessed", First), std::chrono::milliseconds::zero());
+}
+
+TEST_F(AuthFailureLimiterTest, DoublesBackoff) {
+	fail("guessed", First, static_cast<int>(AuthFailureLimiter::FreeFailures) + 1);
+	auto first = limiter->backoff("guessed", First);
+	EXPECT_GE(first, AuthFailureLimiter::BaseBackoff - std::chrono::milliseconds(5));
+	EXPECT_LE(first, AuthFailureLimiter::BaseBackoff);
+	fail("guessed", First, 1);
+	auto second = limiter->backoff("guessed", First);
+	//counters leak while the test runs, a few milliseconds are lost to it
+	EXPECT_GE(second, 2 * AuthFailureLimiter::BaseBackoff - std::chrono::milliseconds(5));
+	EXPECT_LE(second, 2 * AuthFailureLimiter::BaseBackoff);
+	fail("guessed", First, 100);
+	EXPECT_EQ(limiter->backoff("guessed", First), AuthFailureLimiter::MaxBackoff);
+}
+
+TEST_F(AuthFailureLimiterTest, OtherAddressesDoNotLockOutConsumer) {
+	fail("victim", First, 50);
+	EXPECT_GT(limiter->backoff("victim", First), std::chrono::milliseconds::zero());
+	EXPECT_EQ(limiter->backoff("victim", Second), std::chrono::milliseconds::zero());
+}
+
+TEST_F(AuthFailureLimiterTest, LimitsAddressTryingManyNames) {
+	const auto names = static_cast<int>(AuthFailureLimiter::FreeAddressFailures);
+	for (int i = 0; i < names; i++) {
+		fail("name" + std::to_string(i), First, 1);
+	}
+	EXPECT_EQ(limiter->backoff("fresh", First), std::chrono::milliseconds::zero());
+	fail("name" + std::to_string(names), First, 1);
+	//every name from the address is refused, other addresses are not
+	EXPECT_GT(limiter->backoff("fresh", First), std::chrono::milliseconds::zero());
+	EXPECT_EQ(limiter->backoff("fresh", Second), std::chrono::milliseconds::zero());
+}
+
+TEST_F(AuthFailureLimiterTest, CollisionsOnlyRaiseEstimates) {
+	//far more keys than a row has cells, the estimate of an untouched pair stays within the allowance
+	for (int i = 0; i < static_cast<int>(AuthFailureLimiter::Width) * 2; i++) {
+		fail("noise" + std::to_string(i), Second, 1);
+	}
+	fail("counted", First, static_cast<int>(AuthFailureLimiter::FreeFailures) + 1);
+	EXPECT_GT(limiter->backoff("counted", First), std::chrono::milliseconds::zero());
+	EXPECT_EQ(limiter->backoff("untouched", First), std::chrono::milliseconds::zero());
+}
+
+TEST_F(AuthFailureLimiterTest, CountsIPv6ClientByPrefix) {
+	//a host rotating its interface identifier stays one client, the next /64 is another one
+	fail("victim", boost::asio::ip::make_address("2001:db8:0:1::1"), 50);
+	EXPECT_GT(limiter->backoff("victim", boost::asio::ip::make_address("2001:db8:0:1:abcd::7")), std::chrono::milliseconds::zero());
+	EXPECT_EQ(limiter->backoff("victim", boost::asio::ip::make_address("2001:db8:0:2::1")), std::chrono::milliseconds::zero());
+}
+
+TEST_F(AuthFailureLimiterTest, CountsMappedAddressAsIPv4) {
+	fail("victim", boost::asio::ip::make_address("::ffff:192.0.2.1"), 50);
+	EXPECT_GT(limiter->backoff("victim", First), std::chrono::milliseconds::zero());
+	//all IPv4-mapped addresses share a /64, yet they are distinct clients
+	EXPECT_EQ(limiter->backoff("victim", boost::asio::ip::make_address("::ffff:192.0.2.2")), std::chrono::milliseconds::zero());
+}
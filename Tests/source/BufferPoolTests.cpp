@@ -0,0 +1,32 @@
+#include "BufferPool.h"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+TEST(BufferPool, ReusesReturnedBlock) {
+	BufferPool pool(4096, 2);
+	EXPECT_EQ(pool.getBlockSize(), 4096u);
+	char* first = nullptr;
+	{
+		auto buffer = pool.acquire();
+		ASSERT_TRUE(buffer);
+		first = buffer.get();
+		EXPECT_EQ(pool.retained(), 0u);
+	}
+	EXPECT_EQ(pool.retained(), 1u);
+	auto buffer = pool.acquire();
+	EXPECT_EQ(buffer.get(), first);
+	EXPECT_EQ(pool.retained(), 0u);
+}
+
+TEST(BufferPool, RetainsAtMostMaxBlocks) {
+	BufferPool pool(1024, 2);
+	std::vector<BufferPool::Buffer> buffers;
+	for (int i = 0; i < 5; i++) {
+		buffers.push_back(pool.acquire());
+	}
+	buffers.clear();
+	//the rest are freed, idle sessions do not pin them
+	EXPECT_EQ(pool.retained(), 2u);
+}
@@ -0,0 +1,115 @@
+#include "ContentAddressedStore.h"
+#include "MailboxExpunger.h"
+#include "MailboxIndex.h"
+#include "TestDirectory.h"
+
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <iterator>
+
+namespace {
+	struct ContentAddressedStoreTest : testing::Test {
+		TestDirectory root;
+		ContentAddressedStore store{ ContentAddressedStore::DefaultRoot(root.get() / "a") };
+
+		std::filesystem::path mailbox(const std::string& name) const {
+			auto directory = root.get() / name;
+			std::filesystem::create_directories(directory / MailboxExpunger::MetadataDirectory);
+			return directory;
+		}
+
+		std::size_t blobs() const {
+			std::size_t count = 0;
+			std::error_code ec;
+			for (std::filesystem::recursive_directory_iterator it(store.getRoot(), ec), end; !ec && it != end; it.increment(ec)) {
+				count += it->is_regular_file() ? 1 : 0;
+			}
+			return count;
+		}
+
+		static std::string read(const std::filesystem::path& file) {
+			std::ifstream stream{ file, std::ios_base::in | std::ios_base::binary };
+			return std::string{ std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>() };
+		}
+
+		static std::vector<std::filesystem::path> paths(const std::vector<std::variant<std::filesystem::path, MailboxOperationError>>& delivered) {
+			std::vector<std::filesystem::path> result;
+			for (const auto& item : delivered) {
+				EXPECT_TRUE(std::holds_alternative<std::filesystem::path>(item));
+				if (std::holds_alternative<std::filesystem::path>(item)) {
+					result.push_back(std::get<std::filesystem::path>(item));
+				}
+			}
+			return result;
+		}
+	};
+}
+
+TEST_F(ContentAddressedStoreTest, SharesOneBodyBetweenMailboxes) {
+	auto delivered = paths(store.deliver("Subject: one\r\n\r\nbody\r\n", { mailbox("a"), mailbox("b") }));
+	ASSERT_EQ(delivered.size(), 2u);
+	EXPECT_EQ(delivered[0].parent_path(), root.get() / "a");
+	EXPECT_EQ(delivered[1].parent_path(), root.get() / "b");
+	EXPECT_EQ(read(delivered[0]), "Subject: one\r\n\r\nbody\r\n");
+	//both mailboxes and the store refer to one inode
+	EXPECT_EQ(std::filesystem::hard_link_count(delivered[0]), 3u);
+	EXPECT_TRUE(std::filesystem::equivalent(delivered[0], delivered[1]));
+
+	//the same message delivered later finds its body, another one gets its own
+	auto again = paths(store.deliver("Subject: one\r\n\r\nbody\r\n", { mailbox("c") }));
+	ASSERT_EQ(again.size(), 1u);
+	EXPECT_TRUE(std::filesystem::equivalent(delivered[0], again[0]));
+	auto other = paths(store.deliver("Subject: two\r\n\r\nbody\r\n", { mailbox("a") }));
+	ASSERT_EQ(other.size(), 1u);
+	EXPECT_FALSE(std::filesystem::equivalent(delivered[0], other[0]));
+	EXPECT_EQ(blobs(), 2u);
+}
+
+TEST_F(ContentAddressedStoreTest, ReportsEveryMailboxSeparately) {
+	//the second recipient's mailbox is missing, the others keep their copy and are told so
+	auto delivered = store.deliver("Subject: one\r\n\r\nbody\r\n", { mailbox("a"), root.get() / "missing", mailbox("c") });
+	ASSERT_EQ(delivered.size(), 3u);
+	EXPECT_TRUE(std::holds_alternative<std::filesystem::path>(delivered[0]));
+	EXPECT_TRUE(std::holds_alternative<MailboxOperationError>(delivered[1]));
+	EXPECT_TRUE(std::holds_alternative<std::filesystem::path>(delivered[2]));
+	EXPECT_EQ(std::filesystem::hard_link_count(std::get<std::filesystem::path>(delivered[2])), 3u);
+}
+
+TEST_F(ContentAddressedStoreTest, KeepsMailboxIndexCurrent) {
+	auto box = mailbox("a");
+	MailboxIndex::Load(box, {}, StorageIOEngine::Create(StorageIOEngineType::Synchronous));
+	auto delivered = paths(store.deliver("Subject: one\n\nbody\n", { box }));
+	ASSERT_EQ(delivered.size(), 1u);
+	auto entries = MailboxIndex::Load(box, {}, StorageIOEngine::Create(StorageIOEngineType::Synchronous));
+	ASSERT_EQ(entries.size(), 1u);
+	EXPECT_EQ(entries[0].file, delivered[0]);
+	//three carriage returns added on the wire
+	EXPECT_EQ(entries[0].wireSize, 19u + 3);
+}
+
+TEST_F(ContentAddressedStoreTest, CollectsUnreferencedBodies) {
+	auto first = paths(store.deliver("first\r\n", { mailbox("a"), mailbox("b") }));
+	auto second = paths(store.deliver("second\r\n", { mailbox("a") }));
+	ASSERT_EQ(first.size(), 2u);
+	ASSERT_EQ(second.size(), 1u);
+
+	//a body stays while a mailbox still refers to it
+	std::filesystem::remove(first[0]);
+	EXPECT_EQ(store.collect({ first[0] }), 0u);
+	EXPECT_EQ(blobs(), 2u);
+	std::filesystem::remove(first[1]);
+	EXPECT_EQ(store.collect({ first[1] }), 1u);
+	EXPECT_EQ(blobs(), 1u);
+
+	//files removed without telling the store are found by the full scan
+	std::filesystem::remove(second[0]);
+	EXPECT_EQ(store.collectGarbage(), 1u);
+	EXPECT_EQ(blobs(), 0u);
+
+	//a collected body is stored again by the next delivery
+	auto again = paths(store.deliver("first\r\n", { mailbox("a") }));
+	ASSERT_EQ(again.size(), 1u);
+	EXPECT_EQ(read(again[0]), "first\r\n");
+	EXPECT_EQ(std::filesystem::hard_link_count(again[0]), 2u);
+}
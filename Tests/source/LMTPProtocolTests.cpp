@@ -0,0 +1,103 @@
+#include "LMTPProtocol.h"
+
+#include <gtest/gtest.h>
+
+namespace {
+	bool knownRecipient(std::string_view recipient) {
+		return recipient == "alice" || recipient == "bob";
+	}
+
+	struct LMTPProtocolTest : testing::Test {
+		LMTPProtocol protocol{ knownRecipient };
+
+		void SetUp() override {
+			protocol.greet();
+		}
+
+		//status code of the response
+		std::string_view send(std::string_view line) {
+			return protocol.handleCommand(line).substr(0, 3);
+		}
+	};
+}
+
+TEST_F(LMTPProtocolTest, GreetsBeforeCommands) {
+	LMTPProtocol fresh{ knownRecipient };
+	EXPECT_EQ(fresh.getState(), LMTPSessionState::Greeting);
+	EXPECT_EQ(fresh.greet().substr(0, 4), "220 ");
+	EXPECT_EQ(fresh.getState(), LMTPSessionState::Ready);
+}
+
+TEST_F(LMTPProtocolTest, RunsTransaction) {
+	EXPECT_EQ(protocol.handleCommand("LHLO client"), "250-localhost\r\n250-PIPELINING\r\n250-ENHANCEDSTATUSCODES\r\n250 8BITMIME\r\n");
+	EXPECT_EQ(send("MAIL FROM:<sender@remote>"), "250");
+	EXPECT_EQ(protocol.getState(), LMTPSessionState::MailFrom);
+	EXPECT_EQ(send("RCPT TO:<alice@localhost>"), "250");
+	EXPECT_EQ(send("RCPT TO:<carol@localhost>"), "550");
+	EXPECT_EQ(send("RCPT TO:<bob>"), "250");
+	EXPECT_EQ(send("DATA"), "354");
+	EXPECT_EQ(protocol.getState(), LMTPSessionState::Data);
+	EXPECT_EQ(protocol.getRecipients(), (std::vector<std::string>{ "alice", "bob" }));
+
+	protocol.messageReceived();
+	EXPECT_EQ(protocol.getState(), LMTPSessionState::Delivering);
+	protocol.resetTransaction();
+	EXPECT_EQ(protocol.getState(), LMTPSessionState::Ready);
+	EXPECT_TRUE(protocol.getRecipients().empty());
+}
+
+TEST_F(LMTPProtocolTest, AcceptsVerbsInAnyCase) {
+	EXPECT_EQ(send("mail from:<>"), "250");
+	EXPECT_EQ(send("Rcpt To:<alice@localhost>"), "250");
+	EXPECT_EQ(send("noop"), "250");
+}
+
+TEST_F(LMTPProtocolTest, EnforcesCommandOrder) {
+	EXPECT_EQ(send("RCPT TO:<alice@localhost>"), "503");
+	EXPECT_EQ(send("DATA"), "503");
+	EXPECT_EQ(send("MAIL FROM:<>"), "250");
+	EXPECT_EQ(send("MAIL FROM:<>"), "503");
+	//DATA needs at least one accepted recipient
+	EXPECT_EQ(send("RCPT TO:<carol@localhost>"), "550");
+	EXPECT_EQ(send("DATA"), "503");
+	EXPECT_EQ(send("RSET"), "250");
+	EXPECT_EQ(protocol.getState(), LMTPSessionState::Ready);
+	EXPECT_EQ(send("MAIL FROM:<>"), "250");
+}
+
+TEST_F(LMTPProtocolTest, RejectsBadRecipientsAndCommands) {
+	EXPECT_EQ(send("MAIL FROM:<>"), "250");
+	EXPECT_EQ(send("RCPT TO:alice"), "550");
+	EXPECT_EQ(send("RCPT TO:<@localhost>"), "550");
+	EXPECT_EQ(send("VRFY alice"), "500");
+	EXPECT_EQ(send(""), "500");
+	EXPECT_EQ(protocol.getState(), LMTPSessionState::MailFrom);
+}
+
+TEST_F(LMTPProtocolTest, LimitsRecipients) {
+	EXPECT_EQ(send("MAIL FROM:<>"), "250");
+	for (std::size_t i = 0; i < LMTPProtocol::MaxRecipients; i++) {
+		ASSERT_EQ(send("RCPT TO:<alice@localhost>"), "250");
+	}
+	EXPECT_EQ(send("RCPT TO:<bob@localhost>"), "452");
+	EXPECT_EQ(protocol.getRecipients().size(), LMTPProtocol::MaxRecipients);
+}
+
+TEST_F(LMTPProtocolTest, Quits) {
+	EXPECT_FALSE(protocol.isQuitReceived());
+	EXPECT_EQ(send("QUIT"), "221");
+	EXPECT_TRUE(protocol.isQuitReceived());
+}
+
+TEST(LMTPProtocol, GetsMailboxOfPath) {
+	EXPECT_EQ(LMTPProtocol::MailboxOf(":<alice@localhost>"), "alice");
+	EXPECT_EQ(LMTPProtocol::MailboxOf(" TO:<bob> NOTIFY=NEVER"), "bob");
+	EXPECT_EQ(LMTPProtocol::MailboxOf(":alice@localhost"), "");
+	EXPECT_EQ(LMTPProtocol::MailboxOf(":<alice@localhost"), "");
+}
+
+TEST(LMTPProtocol, UnstuffsMessage) {
+	EXPECT_EQ(LMTPProtocol::Unstuff("a\r\n..b\r\n.\r\nc.\r\n"), "a\r\n.b\r\n\r\nc.\r\n");
+	EXPECT_EQ(LMTPProtocol::Unstuff("..last line"), ".last line");
+	EXPECT_EQ(LMTPProtocol::Unstuff(""), "");
+}
@@ -0,0 +1,36 @@
+#include "LoginThrottle.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+TEST(LoginThrottle, AllowsAnyTimeWithoutDelay) {
+	LoginThrottle throttle;
+	throttle.record("poller");
+	EXPECT_TRUE(throttle.allowed("poller"));
+}
+
+TEST(LoginThrottle, RefusesLogonWithinDelay) {
+	LoginThrottle throttle(std::chrono::seconds(60));
+	EXPECT_EQ(throttle.getDelay(), std::chrono::seconds(60));
+	EXPECT_TRUE(throttle.allowed("poller"));
+	throttle.record("poller");
+	EXPECT_FALSE(throttle.allowed("poller"));
+	//other consumers are not affected
+	EXPECT_TRUE(throttle.allowed("other"));
+	//the delay may be lifted at run time
+	throttle.setDelay(std::chrono::seconds::zero());
+	EXPECT_TRUE(throttle.allowed("poller"));
+}
+
+TEST(LoginThrottle, SweepKeepsRecentLogons) {
+	LoginThrottle throttle(std::chrono::seconds(60));
+	//every shard grows past its sweep size, the entries are recent and survive it
+	const auto count = LoginThrottle::Shards * LoginThrottle::SweepSize * 2;
+	for (std::size_t i = 0; i < count; i++) {
+		throttle.record("consumer" + std::to_string(i));
+	}
+	for (std::size_t i = 0; i < count; i += 97) {
+		EXPECT_FALSE(throttle.allowed("consumer" + std::to_string(i))) << i;
+	}
+}
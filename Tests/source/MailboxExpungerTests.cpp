@@ -0,0 +1,101 @@
+#include "MailboxExpunger.h"
+#include "TestDirectory.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <future>
+#include <thread>
+
+namespace {
+	struct MailboxExpungerTest : testing::Test {
+		TestDirectory root;
+		io_engine_ptr engine = StorageIOEngine::Create(StorageIOEngineType::Synchronous);
+
+		std::filesystem::path metadata(const std::string& mailbox) const {
+			return root.get() / mailbox / MailboxExpunger::MetadataDirectory;
+		}
+
+		std::size_t journals(const std::string& mailbox) const {
+			std::size_t count = 0;
+			std::error_code ec;
+			for (std::filesystem::directory_iterator it(metadata(mailbox), ec), end; !ec && it != end; it.increment(ec)) {
+				count += it->path().extension() == ".journal" ? 1 : 0;
+			}
+			return count;
+		}
+
+		//the callback runs before the journal is removed, wait for the removal too
+		void waitForJournals(const std::string& mailbox) const {
+			for (int i = 0; i < 200 && journals(mailbox) != 0; i++) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(5));
+			}
+		}
+	};
+}
+
+TEST_F(MailboxExpungerTest, RemovesScheduledFilesAndJournal) {
+	std::vector<std::filesystem::path> files{ root.write("box/1", "one"), root.write("box/sub/2", "two") };
+	auto kept = root.write("box/3", "three");
+	std::promise<std::vector<std::filesystem::path>> removed;
+
+	ASSERT_TRUE(MailboxExpunger::Schedule(root.get() / "box", files, engine, [&removed](const auto& files) {
+		removed.set_value(files);
+	}));
+	auto future = removed.get_future();
+	ASSERT_EQ(future.wait_for(std::chrono::seconds(5)), std::future_status::ready);
+	EXPECT_EQ(future.get(), files);
+	EXPECT_FALSE(std::filesystem::exists(files[0]));
+	EXPECT_FALSE(std::filesystem::exists(files[1]));
+	EXPECT_TRUE(std::filesystem::exists(kept));
+	waitForJournals("box");
+	EXPECT_EQ(journals("box"), 0u);
+}
+
+TEST_F(MailboxExpungerTest, RecoversJournalOfPreviousRun) {
+	auto first = root.write("box/1", "one");
+	auto second = root.write("box/sub/2", "two");
+	auto kept = root.write("box/3", "three");
+	root.write("box/.pop3/expunge-1.journal", "expunge\n1\nsub/2\n");
+	std::promise<void> removed;
+
+	auto pending = MailboxExpunger::Recover(root.get() / "box", engine, [&removed](const auto&) {
+		removed.set_value();
+	});
+	EXPECT_EQ(pending, (std::set<std::filesystem::path>{ first, second }));
+	ASSERT_EQ(removed.get_future().wait_for(std::chrono::seconds(5)), std::future_status::ready);
+	EXPECT_FALSE(std::filesystem::exists(first));
+	EXPECT_FALSE(std::filesystem::exists(second));
+	EXPECT_TRUE(std::filesystem::exists(kept));
+	waitForJournals("box");
+	EXPECT_EQ(journals("box"), 0u);
+
+	//the directory is examined once, later calls know the pending files without reading it
+	EXPECT_TRUE(MailboxExpunger::Recover(root.get() / "box", engine).empty());
+}
+
+TEST_F(MailboxExpungerTest, IgnoresOtherFilesInMetadata) {
+	auto message = root.write("box/1", "one");
+	root.write("box/.pop3/expunge-1.tmp", "expunge\n1\n");
+	root.write("box/.pop3/expunge-2.journal", "not a journal\n1\n");
+
+	EXPECT_TRUE(MailboxExpunger::Recover(root.get() / "box", engine).empty());
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	EXPECT_TRUE(std::filesystem::exists(message));
+}
+
+TEST_F(MailboxExpungerTest, ReplaysJournalsOfAllMailboxes) {
+	auto first = root.write("a/1", "one");
+	auto second = root.write("b/1", "one");
+	root.write("c/1", "one");
+	root.write("a/.pop3/expunge-1.journal", "expunge\n1\n");
+	root.write("b/.pop3/expunge-1.journal", "expunge\n1\n");
+
+	EXPECT_EQ(MailboxExpunger::ReplayJournals(root.get(), engine), 2u);
+	waitForJournals("a");
+	waitForJournals("b");
+	EXPECT_EQ(journals("a") + journals("b"), 0u);
+	EXPECT_FALSE(std::filesystem::exists(first));
+	EXPECT_FALSE(std::filesystem::exists(second));
+	EXPECT_TRUE(std::filesystem::exists(root.get() / "c" / "1"));
+}
@@ -0,0 +1,131 @@
+#include "MailboxIndex.h"
+#include "MailboxExpunger.h"
+#include "TestDirectory.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+
+namespace {
+	struct MailboxIndexTest : testing::Test {
+		TestDirectory mailbox;
+		io_engine_ptr engine = StorageIOEngine::Create(StorageIOEngineType::Synchronous);
+
+		MailboxIndexTest() {
+			//metadata directory of a mailbox used before, creating it would change the mailbox directory after the first load
+			std::filesystem::create_directory(mailbox.get() / MailboxExpunger::MetadataDirectory);
+		}
+
+		//names and wire sizes of the messages, ordered by name
+		std::vector<std::pair<std::string, std::size_t>> load(const std::set<std::filesystem::path>& excluded = {}) {
+			std::vector<std::pair<std::string, std::size_t>> messages;
+			for (auto& entry : MailboxIndex::Load(mailbox.get(), excluded, engine)) {
+				messages.emplace_back(entry.file.filename().string(), entry.wireSize);
+			}
+			std::sort(messages.begin(), messages.end());
+			return messages;
+		}
+
+		//deliver a message the way MessageIngest does: written aside, renamed into the mailbox
+		bool publish(const std::string& name, std::string_view content, std::size_t wireSize) {
+			auto temporary = mailbox.write(std::filesystem::path(MailboxExpunger::MetadataDirectory) / ("tmp-" + name), content);
+			auto file = mailbox.get() / name;
+			return MailboxIndex::Publish(mailbox.get(), file, wireSize, [&]() {
+				std::error_code ec;
+				std::filesystem::rename(temporary, file, ec);
+				return !ec;
+			});
+		}
+
+		std::filesystem::path indexFile() const {
+			return mailbox.get() / MailboxExpunger::MetadataDirectory / MailboxIndex::FileName;
+		}
+	};
+
+	using Messages = std::vector<std::pair<std::string, std::size_t>>;
+}
+
+TEST_F(MailboxIndexTest, ListsMessagesWithWireSizes) {
+	mailbox.write("a.eml", "x\n.y");
+	mailbox.write("b.wire", "abc\r\n");
+	EXPECT_EQ(load(), (Messages{ { "a.eml", 8 }, { "b.wire", 5 } }));
+	EXPECT_TRUE(std::filesystem::exists(indexFile()));
+	//the second load is served from memory or the index
+	EXPECT_EQ(load(), (Messages{ { "a.eml", 8 }, { "b.wire", 5 } }));
+}
+
+TEST_F(MailboxIndexTest, LeavesOutExcludedFiles) {
+	mailbox.write("a.eml", "a\r\n");
+	auto removed = mailbox.write("b.eml", "b\r\n");
+	EXPECT_EQ(load({ removed }), (Messages{ { "a.eml", 3 } }));
+	EXPECT_EQ(load(), (Messages{ { "a.eml", 3 }, { "b.eml", 3 } }));
+}
+
+TEST_F(MailboxIndexTest, PublishAddsRecordToIndex) {
+	mailbox.write("a.eml", "a\r\n");
+	load();
+	//the size passed by the delivery is taken as it is, so it shows the message was not scanned
+	ASSERT_TRUE(publish("c.eml", "c\n", 42));
+	EXPECT_EQ(load(), (Messages{ { "a.eml", 3 }, { "c.eml", 42 } }));
+}
+
+TEST_F(MailboxIndexTest, FindsMessageAddedWithinSameTick) {
+	mailbox.write("a.eml", "a\r\n");
+	load();
+	//a change within the timestamp granularity leaves the modification time as it was
+	auto mtime = std::filesystem::last_write_time(mailbox.get());
+	mailbox.write("b.eml", "bb\r\n");
+	std::filesystem::last_write_time(mailbox.get(), mtime);
+	EXPECT_EQ(load(), (Messages{ { "a.eml", 3 }, { "b.eml", 4 } }));
+}
+
+TEST_F(MailboxIndexTest, PublishLeavesStaleIndexToListing) {
+	mailbox.write("a.eml", "a\r\n");
+	load();
+	mailbox.write("b.eml", "b\r\n");
+	ASSERT_TRUE(publish("c.eml", "c\n", 42));
+	//listed again, the published message keeps the size of its record
+	EXPECT_EQ(load(), (Messages{ { "a.eml", 3 }, { "b.eml", 3 }, { "c.eml", 42 } }));
+}
+
+TEST_F(MailboxIndexTest, FindsMessageAddedWithinSameTickAsPublish) {
+	mailbox.write("a.eml", "a\r\n");
+	load();
+	auto mtime = std::filesystem::last_write_time(mailbox.get());
+	mailbox.write("b.eml", "b\r\n");
+	std::filesystem::last_write_time(mailbox.get(), mtime);
+	ASSERT_TRUE(publish("c.eml", "c\n", 42));
+	//the new modification time would hide the message put in by other means, the next load compares the names
+	EXPECT_EQ(load(), (Messages{ { "a.eml", 3 }, { "b.eml", 3 }, { "c.eml", 42 } }));
+}
+
+TEST_F(MailboxIndexTest, RemoveKeepsRemainingRecords) {
+	mailbox.write("a.eml", "a\r\n");
+	auto removed = mailbox.write("b.eml", "b\r\n");
+	load();
+	ASSERT_TRUE(publish("c.eml", "c\n", 42));
+	std::filesystem::remove(removed);
+	MailboxIndex::Remove(mailbox.get(), { removed });
+	//the published size shows the remaining messages are not measured again
+	EXPECT_EQ(load(), (Messages{ { "a.eml", 3 }, { "c.eml", 42 } }));
+	EXPECT_EQ(load(), (Messages{ { "a.eml", 3 }, { "c.eml", 42 } }));
+}
+
+TEST_F(MailboxIndexTest, RemoveLeavesOtherChangesToListing) {
+	mailbox.write("a.eml", "a\r\n");
+	auto removed = mailbox.write("b.eml", "b\r\n");
+	load();
+	ASSERT_TRUE(publish("c.eml", "c\n", 42));
+	mailbox.write("d.eml", "d\n");
+	std::filesystem::remove(removed);
+	MailboxIndex::Remove(mailbox.get(), { removed });
+	EXPECT_EQ(load(), (Messages{ { "a.eml", 3 }, { "c.eml", 42 }, { "d.eml", 3 } }));
+}
+
+TEST(MailboxIndex, MeasuresWireSize) {
+	TestDirectory directory;
+	std::size_t wireSize = 0;
+	ASSERT_TRUE(MailboxIndex::Measure(directory.write("m.eml", ".a\nb"), wireSize));
+	EXPECT_EQ(wireSize, 8u);
+	EXPECT_FALSE(MailboxIndex::Measure(directory.get() / "missing.eml", wireSize));
+}
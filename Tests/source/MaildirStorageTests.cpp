@@ -0,0 +1,102 @@
+#include "MaildirStorage.h"
+#include "MailboxExpunger.h"
+#include "TestDirectory.h"
+
+#include <gtest/gtest.h>
+
+namespace {
+	struct MaildirStorageTest : testing::Test {
+		TestDirectory mailbox;
+
+		std::shared_ptr<FileSystemMailStorage> open() const {
+			MailStorageInfo info(StorageType::MaildirMailStorage);
+			info.addOption("path", mailbox.get().string());
+			return MaildirStorageFactory::create(info, "user");
+		}
+
+		static std::string content(const FileSystemMailStorage& storage, std::size_t number) {
+			auto result = storage.getEmail(number);
+			return std::holds_alternative<std::string>(result) ? std::get<std::string>(result) : "<error>";
+		}
+
+		std::filesystem::path sizesFile() const {
+			return mailbox.get() / MailboxExpunger::MetadataDirectory / MaildirStorageFactory::SizesFileName;
+		}
+	};
+}
+
+TEST(MaildirStorage, ParsesSizesOfName) {
+	std::string flags = std::string(1, MaildirStorageFactory::InfoSeparator) + "2,S";
+	auto sizes = MaildirStorageFactory::ParseName("1700000000.M1P2Q3.host,S=120,W=124" + flags);
+	EXPECT_EQ(sizes.size, 120u);
+	EXPECT_EQ(sizes.wireSize, 124u);
+
+	//other MDAs put only the size or nothing at all
+	sizes = MaildirStorageFactory::ParseName("1700000000.M1P2Q3.host,S=120");
+	EXPECT_EQ(sizes.size, 120u);
+	EXPECT_FALSE(sizes.wireSize);
+	sizes = MaildirStorageFactory::ParseName("1700000000.M1P2Q3.host" + flags);
+	EXPECT_FALSE(sizes.size);
+	EXPECT_FALSE(sizes.wireSize);
+
+	//malformed values and fields in the flags are not sizes
+	sizes = MaildirStorageFactory::ParseName("1700000000.host,S=12x,W=,X=5" + std::string(1, MaildirStorageFactory::InfoSeparator) + "2,S=7");
+	EXPECT_FALSE(sizes.size);
+	EXPECT_FALSE(sizes.wireSize);
+}
+
+TEST_F(MaildirStorageTest, ListsDeliveredMessagesInOrder) {
+	auto first = MaildirStorageFactory::deliver(mailbox.get(), "Subject: one\r\n\r\nfirst\r\n");
+	auto second = MaildirStorageFactory::deliver(mailbox.get(), "Subject: two\n\nsecond\n");
+	ASSERT_TRUE(std::holds_alternative<std::filesystem::path>(first));
+	ASSERT_TRUE(std::holds_alternative<std::filesystem::path>(second));
+	EXPECT_EQ(std::get<std::filesystem::path>(first).parent_path().filename(), "new");
+
+	auto storage = open();
+	ASSERT_EQ(storage->getEmailsCount(), 2u);
+	EXPECT_EQ(content(*storage, 0), "Subject: one\r\n\r\nfirst\r\n");
+	EXPECT_EQ(content(*storage, 1), "Subject: two\n\nsecond\n");
+	EXPECT_EQ(storage->getEmailLength(0), 23u);
+	//three carriage returns added on the wire
+	EXPECT_EQ(storage->getEmailLength(1), 21u + 3);
+	//seen messages are moved to cur/
+	EXPECT_FALSE(std::filesystem::exists(std::get<std::filesystem::path>(first)));
+	EXPECT_TRUE(std::filesystem::is_empty(mailbox.get() / "new"));
+	//the names carry the sizes, nothing is measured or remembered
+	EXPECT_FALSE(std::filesystem::exists(sizesFile()));
+}
+
+TEST_F(MaildirStorageTest, RemembersSizesOfForeignMessages) {
+	std::string flags = std::string(1, MaildirStorageFactory::InfoSeparator) + "2,";
+	mailbox.write("new/1700000001.foreign", "Subject: one\n\nfirst\n");
+	mailbox.write("cur/1700000000.foreign" + flags, "Subject: zero\r\n\r\n");
+	{
+		auto storage = open();
+		ASSERT_EQ(storage->getEmailsCount(), 2u);
+		EXPECT_EQ(storage->getEmailLength(0), 17u);
+		EXPECT_EQ(storage->getEmailLength(1), 20u + 3);
+	}
+	ASSERT_TRUE(std::filesystem::exists(sizesFile()));
+
+	//the remembered sizes are used as they are, the files are not read again
+	std::filesystem::resize_file(mailbox.get() / "cur" / ("1700000001.foreign" + flags), 5);
+	{
+		auto storage = open();
+		ASSERT_EQ(storage->getEmailsCount(), 2u);
+		EXPECT_EQ(storage->getEmailLength(1), 20u + 3);
+	}
+
+	//removed messages are forgotten
+	std::filesystem::remove(mailbox.get() / "cur" / ("1700000001.foreign" + flags));
+	{
+		auto storage = open();
+		ASSERT_EQ(storage->getEmailsCount(), 1u);
+	}
+	std::ifstream stream{ sizesFile() };
+	std::string line;
+	std::size_t lines = 0;
+	while (std::getline(stream, line)) {
+		lines++;
+	}
+	EXPECT_EQ(lines, 1u);
+}
@@ -0,0 +1,73 @@
+#include "MessageCache.h"
+
+#include <gtest/gtest.h>
+
+namespace {
+	message_buffer bufferOf(std::size_t size, char fill = 'x') {
+		return std::make_shared<const std::string>(size, fill);
+	}
+
+	MessageCache::Key keyOf(std::uint64_t uid, std::int64_t mtime = 1) {
+		return MessageCache::Key{ "/mail/user", uid, mtime };
+	}
+}
+
+TEST(MessageCache, SharesCachedBuffers) {
+	MessageCache cache{ MessageCache::ShardsCount * 1000, 500 };
+	auto buffer = bufferOf(100);
+	EXPECT_EQ(cache.find(keyOf(1)), nullptr);
+	ASSERT_TRUE(cache.insert(keyOf(1), buffer));
+	//sessions get the same buffer, nothing is copied
+	EXPECT_EQ(cache.find(keyOf(1)), buffer);
+	EXPECT_EQ(cache.find(keyOf(1)), buffer);
+	//a file modified since it was cached is another message
+	EXPECT_EQ(cache.find(keyOf(1, 2)), nullptr);
+	EXPECT_EQ(cache.find(MessageCache::Key{ "/mail/other", 1, 1 }), nullptr);
+
+	//a message loaded by two sessions at once is kept once
+	EXPECT_TRUE(cache.insert(keyOf(1), bufferOf(100)));
+	EXPECT_EQ(cache.find(keyOf(1)), buffer);
+
+	auto statistics = cache.statistics();
+	EXPECT_EQ(statistics.hits, 3u);
+	EXPECT_EQ(statistics.misses, 3u);
+	EXPECT_EQ(statistics.insertions, 1u);
+	EXPECT_EQ(statistics.size, 100u);
+}
+
+TEST(MessageCache, BypassesLargeMessages) {
+	MessageCache cache{ MessageCache::ShardsCount * 1000, 500 };
+	EXPECT_TRUE(cache.admits(500));
+	EXPECT_FALSE(cache.admits(501));
+	EXPECT_FALSE(cache.insert(keyOf(1), bufferOf(501)));
+	EXPECT_FALSE(cache.insert(keyOf(2), nullptr));
+	EXPECT_EQ(cache.find(keyOf(1)), nullptr);
+
+	//a message larger than a shard would evict the whole shard, it is not admitted either
+	MessageCache small{ MessageCache::ShardsCount * 100, 500 };
+	EXPECT_FALSE(small.admits(101));
+	EXPECT_FALSE(small.insert(keyOf(1), bufferOf(101)));
+
+	EXPECT_EQ(cache.statistics().bypassed, 2u);
+	EXPECT_EQ(cache.statistics().size, 0u);
+	EXPECT_EQ(small.statistics().bypassed, 1u);
+}
+
+TEST(MessageCache, EvictsLeastRecentlyUsed) {
+	//every shard holds two messages
+	MessageCache cache{ MessageCache::ShardsCount * 100, 100 };
+	auto hot = bufferOf(40, 'h');
+	ASSERT_TRUE(cache.insert(keyOf(0), hot));
+	ASSERT_TRUE(cache.insert(keyOf(1), bufferOf(40)));
+	for (std::uint64_t uid = 2; uid < 400; uid++) {
+		ASSERT_TRUE(cache.insert(keyOf(uid), bufferOf(40)));
+		//the hot message is used between deliveries of the others, so it is never the oldest of its shard
+		ASSERT_EQ(cache.find(keyOf(0)), hot) << uid;
+	}
+	EXPECT_EQ(cache.find(keyOf(1)), nullptr);
+
+	auto statistics = cache.statistics();
+	EXPECT_LE(statistics.size, MessageCache::ShardsCount * 100);
+	EXPECT_EQ(statistics.size, (statistics.insertions - statistics.evictions) * 40);
+	EXPECT_GE(statistics.evictions, 400u - 2 * MessageCache::ShardsCount);
+}
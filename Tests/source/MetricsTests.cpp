@@ -0,0 +1,131 @@
+#include "Metrics.h"
+#include "POP3TestServer.h"
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <thread>
+
+namespace {
+	std::int64_t valueOf(const MetricsRegistry::Snapshot& snapshot, std::string_view name, const MetricLabels& labels = {}) {
+		for (const auto& metric : snapshot.metrics) {
+			if (metric.name == name && metric.labels == labels) {
+				return snapshot.values[metric.slot];
+			}
+		}
+		return -1;
+	}
+}
+
+TEST(MetricsRegistry, CountsSmallValuesExactly) {
+	for (std::uint64_t value = 0; value < MetricsRegistry::SubBuckets; value++) {
+		EXPECT_EQ(MetricsRegistry::BucketIndex(value), value);
+		EXPECT_EQ(MetricsRegistry::BucketUpperBound(value), value);
+	}
+}
+
+TEST(MetricsRegistry, BucketsCoverValues) {
+	std::size_t previous = 0;
+	for (std::uint64_t value = 1; value < (std::uint64_t{ 1 } << 20); value += 1 + value / 64) {
+		auto index = MetricsRegistry::BucketIndex(value);
+		ASSERT_LT(index, MetricsRegistry::HistogramBuckets) << value;
+		EXPECT_GE(index, previous) << value;
+		//the value lies within its bucket, and the bucket is at most a quarter wider than it
+		EXPECT_GE(MetricsRegistry::BucketUpperBound(index), value);
+		EXPECT_LT(MetricsRegistry::BucketUpperBound(index - 1), value);
+		EXPECT_LE(MetricsRegistry::BucketUpperBound(index), value + value / 4);
+		previous = index;
+	}
+}
+
+TEST(MetricsRegistry, BucketBoundsAreConsistent) {
+	for (std::size_t index = 0; index + 1 < MetricsRegistry::HistogramBuckets; index++) {
+		auto bound = MetricsRegistry::BucketUpperBound(index);
+		EXPECT_EQ(MetricsRegistry::BucketIndex(bound), index);
+		EXPECT_EQ(MetricsRegistry::BucketIndex(bound + 1), index + 1);
+	}
+}
+
+TEST(MetricsRegistry, LastBucketCountsLargerValues) {
+	const auto last = MetricsRegistry::HistogramBuckets - 1;
+	EXPECT_EQ(MetricsRegistry::BucketIndex(std::uint64_t{ 1 } << MetricsRegistry::MaxMagnitude), last);
+	EXPECT_EQ(MetricsRegistry::BucketIndex(~std::uint64_t{ 0 }), last);
+}
+
+TEST(MetricsRegistry, MergesThreads) {
+	auto& registry = MetricsRegistry::Shared();
+	auto counter = registry.counter("test_merged_total", "Counted by several threads", { { "kind", "test" } });
+	auto histogram = registry.histogram("test_merged_microseconds", "Recorded by several threads");
+	auto before = registry.snapshot();
+	auto counted = valueOf(before, "test_merged_total", { { "kind", "test" } });
+	ASSERT_GE(counted, 0);
+
+	counter.add(2);
+	histogram.record(std::uint64_t{ 10 });
+	//the block of a finished thread is folded into the total
+	std::thread([&]() {
+		counter.add(3);
+		histogram.record(std::uint64_t{ 1000 });
+	}).join();
+
+	auto after = registry.snapshot();
+	EXPECT_EQ(valueOf(after, "test_merged_total", { { "kind", "test" } }), counted + 5);
+	//a histogram takes its buckets, then the count and the sum
+	for (const auto& metric : after.metrics) {
+		if (metric.name == "test_merged_microseconds") {
+			EXPECT_EQ(after.values[metric.slot + MetricsRegistry::BucketIndex(10)] - before.values[metric.slot + MetricsRegistry::BucketIndex(10)], 1);
+			EXPECT_EQ(after.values[metric.slot + MetricsRegistry::HistogramBuckets], before.values[metric.slot + MetricsRegistry::HistogramBuckets] + 2);
+			EXPECT_EQ(after.values[metric.slot + MetricsRegistry::HistogramBuckets + 1], before.values[metric.slot + MetricsRegistry::HistogramBuckets + 1] + 1010);
+		}
+	}
+	//registered again, the same metric is returned
+	registry.counter("test_merged_total", "Counted by several threads", { { "kind", "test" } }).add();
+	EXPECT_EQ(valueOf(registry.snapshot(), "test_merged_total", { { "kind", "test" } }), counted + 6);
+}
+
+TEST(MetricsRegistry, CountsOneOutcomePerLogon) {
+	TestDirectory directory;
+	std::filesystem::create_directories(directory.get() / "present");
+	auto authorization = std::make_unique<TestAuthorizationManager>();
+	authorization->addConsumer("present", "secret", directory.get() / "present");
+	authorization->addConsumer("homeless", "secret", std::filesystem::path());
+	MailboxServiceManager::SetAuthorizationManager(std::move(authorization));
+
+	const std::array<const char*, 5> outcomes{ "logged_on", "invalid_password", "no_such_consumer", "no_storage", "mailbox_busy" };
+	auto counts = [&outcomes]() {
+		auto snapshot = MetricsRegistry::Shared().snapshot();
+		std::map<std::string, std::int64_t> result;
+		for (auto outcome : outcomes) {
+			result[outcome] = std::max<std::int64_t>(0, valueOf(snapshot, "mailbox_logons_total", { { "outcome", outcome } }));
+		}
+		return result;
+	};
+	auto expectOnly = [&](const std::map<std::string, std::int64_t>& before, const char* outcome) {
+		auto after = counts();
+		for (auto other : outcomes) {
+			EXPECT_EQ(after[other] - before.at(other), other == std::string_view(outcome) ? 1 : 0) << outcome << ": " << other;
+		}
+	};
+
+	auto before = counts();
+	auto loggedOn = MailboxServiceManager::VerifyCredentialsAndConnect("present", "secret");
+	EXPECT_TRUE(std::holds_alternative<mailbox_ptr>(loggedOn));
+	expectOnly(before, "logged_on");
+
+	before = counts();
+	MailboxServiceManager::VerifyCredentialsAndConnect("present", "wrong");
+	expectOnly(before, "invalid_password");
+
+	before = counts();
+	MailboxServiceManager::VerifyCredentialsAndConnect("absent", "secret");
+	expectOnly(before, "no_such_consumer");
+
+	before = counts();
+	MailboxServiceManager::VerifyCredentialsAndConnect("homeless", "secret");
+	expectOnly(before, "no_storage");
+
+	//the first logon still holds the mailbox
+	before = counts();
+	MailboxServiceManager::VerifyCredentialsAndConnect("present", "secret");
+	expectOnly(before, "mailbox_busy");
+}
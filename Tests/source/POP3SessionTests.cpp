@@ -0,0 +1,217 @@
+#include "POP3TestServer.h"
+#include "AllocationCounter.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+TEST(POP3Session, ServesMailbox) {
+	POP3TestServer server;
+	server.addMailbox("serves", "secret", { "Subject: 1\n\n.dot\n" });
+	POP3TestClient client(server.port());
+	EXPECT_EQ(client.command("USER serves").substr(0, 3), "+OK");
+	EXPECT_EQ(client.command("PASS secret").substr(0, 3), "+OK");
+	EXPECT_EQ(client.command("STAT"), "+OK serves's maildrop has 1 messages (21 octets)\r\n");
+	EXPECT_EQ(client.command("LIST", true), "+OK 1 messages (21 octets)\r\n0 21\r\n.\r\n");
+	EXPECT_EQ(client.command("RETR 0", true), "+OK 21 octets\r\nSubject: 1\r\n\r\n..dot\r\n.\r\n");
+	EXPECT_EQ(client.command("LIST 1"), "-ERR no such message\r\n");
+	EXPECT_EQ(client.command("QUIT").substr(0, 3), "+OK");
+	EXPECT_TRUE(client.closed());
+}
+
+TEST(POP3Session, SteadyCommandLoopDoesNotAllocate) {
+	POP3TestServer server;
+	server.addMailbox("steady", "secret", { "Subject: 1\r\n\r\nfirst\r\n", "Subject: 2\r\n\r\nsecond\r\n", "Subject: 3\r\n\r\nthird\r\n" });
+	POP3TestClient client(server.port());
+	client.command("USER steady");
+	ASSERT_EQ(client.command("PASS secret").substr(0, 3), "+OK");
+
+	std::size_t errors = 0;
+	auto cycle = [&]() {
+		errors += client.command("STAT").substr(0, 3) != "+OK";
+		errors += client.command("LIST", true).substr(0, 3) != "+OK";
+		errors += client.command("LIST 2").substr(0, 3) != "+OK";
+		errors += client.command("NOOP").substr(0, 3) != "+OK";
+		errors += client.command("CAPA", true).substr(0, 3) != "+OK";
+		errors += client.command("LIST 9").substr(0, 4) != "-ERR";
+		errors += client.command("XYZZY").substr(0, 4) != "-ERR";
+		errors += client.command("RSET").substr(0, 3) != "+OK";
+	};
+	//the first cycles grow the buffers and pools of the session, the io thread and the metrics
+	for (int i = 0; i < 10; i++) {
+		cycle();
+	}
+	auto before = AllocationCounter::Allocations();
+	for (int i = 0; i < 100; i++) {
+		cycle();
+	}
+	auto allocations = AllocationCounter::Allocations() - before;
+	EXPECT_EQ(errors, 0u);
+	EXPECT_EQ(allocations, 0u) << "allocations in 800 commands";
+	client.command("QUIT");
+}
+
+TEST(POP3Session, PipelinedCommandsOnManyThreads) {
+	constexpr int Clients = 8;
+	constexpr int Rounds = 50;
+	POP3TestServer server(4);
+	for (int i = 0; i < Clients; i++) {
+		server.addMailbox("pipelined" + std::to_string(i), "secret", { "Subject: 1\r\n\r\nfirst\r\n", "Subject: 2\r\n\r\nsecond\r\n" });
+	}
+	std::vector<int> errors(Clients, 0);
+	std::vector<std::thread> threads;
+	for (int i = 0; i < Clients; i++) {
+		threads.emplace_back([&server, &errors, i]() {
+			POP3TestClient client(server.port());
+			auto name = "pipelined" + std::to_string(i);
+			auto stat = "+OK " + name + "'s maildrop";
+			client.command("USER " + name);
+			errors[i] += client.command("PASS secret").substr(0, 3) != "+OK";
+			for (int round = 0; round < Rounds; round++) {
+				//all commands are sent before the first response is read, the responses come in their order
+				client.send("STAT");
+				client.send("LIST 1");
+				client.send("LIST 5");
+				client.send("NOOP");
+				errors[i] += client.readResponse(false).substr(0, stat.size()) != stat;
+				errors[i] += client.readResponse(false).substr(0, 5) != "+OK 1";
+				errors[i] += client.readResponse(false).substr(0, 4) != "-ERR";
+				errors[i] += client.readResponse(false).substr(0, 3) != "+OK";
+			}
+		});
+	}
+	for (auto& thread : threads) {
+		thread.join();
+	}
+	for (int i = 0; i < Clients; i++) {
+		EXPECT_EQ(errors[i], 0) << "client " << i;
+	}
+}
+
+TEST(POP3Session, BoundsCommandLine) {
+	POP3TestServer server;
+	POP3TestClient client(server.port());
+	//the longest line, its CRLF included
+	auto longest = std::string("USER ") + std::string(POP3Session::MaxCommandLength - 7, 'x');
+	EXPECT_NE(client.command(longest), "-ERR command line is too long\r\n");
+	//the session goes on
+	EXPECT_EQ(client.command("QUIT").substr(0, 3), "+OK");
+
+	POP3TestClient longer(server.port());
+	//one octet over the bound, nothing more is buffered and the connection is closed
+	EXPECT_EQ(longer.command(longest + "x"), "-ERR command line is too long\r\n");
+	EXPECT_TRUE(longer.closed());
+}
+
+TEST(POP3Session, ReturnsLargeResponseBuffer) {
+	POP3TestServer server;
+	server.addMailbox("large", "secret", std::vector<std::string>(300, "Subject: 1\r\n\r\nbody\r\n"));
+	POP3TestClient client(server.port());
+	client.command("USER large");
+	ASSERT_EQ(client.command("PASS secret").substr(0, 3), "+OK");
+	client.command("LIST 1");
+	client.command("NOOP");
+
+	auto before = AllocationCounter::LiveBytes();
+	auto list = client.command("LIST", true);
+	EXPECT_GT(list.size(), POP3Session::RetainedBufferCapacity);
+	client.command("NOOP");
+	//the response of the LIST and its temporaries are freed, the idle session is back to its size
+	EXPECT_LE(AllocationCounter::LiveBytes(), before);
+	client.command("QUIT");
+}
+
+namespace {
+	//a session gives its place back when it is destroyed, so with one place per address the next client is admitted only then
+	bool admittedAgain(unsigned short port) {
+		for (int i = 0; i < 100; i++) {
+			POP3TestClient client(port);
+			if (client.command("NOOP") != POP3Session::BusyResponse) {
+				return true;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		}
+		return false;
+	}
+}
+
+TEST(POP3Session, DisconnectFreesSession) {
+	AdmissionLimits limits;
+	limits.maxSessionsPerAddress = 1;
+	POP3TestServer server(1, limits);
+	server.addMailbox("dropped", "secret", { "Subject: 1\r\n\r\nbody\r\n" });
+	{
+		POP3TestClient client(server.port());
+		client.command("USER dropped");
+		ASSERT_EQ(client.command("PASS secret").substr(0, 3), "+OK");
+	}
+	EXPECT_TRUE(admittedAgain(server.port()));
+}
+
+TEST(POP3Session, DisconnectDuringRetrFreesSession) {
+	AdmissionLimits limits;
+	limits.maxSessionsPerAddress = 1;
+	POP3TestServer server(1, limits);
+	server.addMailbox("dropped", "secret", { "Subject: 1\r\n\r\n" + std::string(256 * 1024, 'x') + "\r\n" });
+	POP3Session::SetRetrPacing(1024, 16 * 1024);
+	{
+		POP3TestClient client(server.port());
+		client.command("USER dropped");
+		ASSERT_EQ(client.command("PASS secret").substr(0, 3), "+OK");
+		//the message is paced out for seconds, the client leaves after its first part
+		EXPECT_EQ(client.command("RETR 0").substr(0, 3), "+OK");
+	}
+	EXPECT_TRUE(admittedAgain(server.port()));
+	POP3Session::SetRetrPacing(POP3Session::RetrChunkSize, 0);
+}
+
+TEST(POP3Session, ListsCapabilities) {
+	POP3TestServer server;
+	server.addMailbox("capable", "secret", {});
+	POP3TestClient client(server.port());
+	const auto capabilities = "+OK capability list follows\r\nUSER\r\nPIPELINING\r\nRESP-CODES\r\n.\r\n";
+	EXPECT_EQ(client.command("CAPA", true), capabilities);
+	client.command("USER capable");
+	ASSERT_EQ(client.command("PASS secret").substr(0, 3), "+OK");
+	EXPECT_EQ(client.command("CAPA", true), capabilities);
+	client.command("QUIT");
+}
+
+TEST(POP3Session, EnforcesLoginDelay) {
+	POP3TestServer server;
+	server.addMailbox("poller", "secret", {});
+	MailboxServiceManager::SetLoginDelay(std::chrono::seconds(60));
+	{
+		POP3TestClient client(server.port());
+		EXPECT_EQ(client.command("CAPA", true), "+OK capability list follows\r\nUSER\r\nPIPELINING\r\nRESP-CODES\r\nLOGIN-DELAY 60\r\n.\r\n");
+		client.command("USER poller");
+		EXPECT_EQ(client.command("PASS secret").substr(0, 3), "+OK");
+		EXPECT_EQ(client.command("QUIT").substr(0, 3), "+OK");
+		EXPECT_TRUE(client.closed());
+	}
+	POP3TestClient client(server.port());
+	client.command("USER poller");
+	EXPECT_EQ(client.command("PASS secret"), "-ERR [LOGIN-DELAY] minimum time between logins has not passed\r\n");
+	//a wrong password is refused as such, the delay is not revealed to whoever does not know the password
+	client.command("USER poller");
+	EXPECT_EQ(client.command("PASS wrong").find("LOGIN-DELAY"), std::string::npos);
+	MailboxServiceManager::SetLoginDelay(std::chrono::seconds::zero());
+}
+
+TEST(POP3Session, BacksOffFailedLogons) {
+	POP3TestServer server;
+	server.addMailbox("guessed", "secret", {});
+	POP3TestClient client(server.port());
+	client.command("USER guessed");
+	for (int i = 0; i <= static_cast<int>(AuthFailureLimiter::FreeFailures); i++) {
+		auto response = client.command("PASS wrong");
+		EXPECT_EQ(response.substr(0, 4), "-ERR") << i;
+		EXPECT_EQ(response.find("[SYS/TEMP]"), std::string_view::npos) << i;
+	}
+	//refused without being verified, after the backoff
+	auto start = std::chrono::steady_clock::now();
+	EXPECT_EQ(client.command("PASS secret"), "-ERR [SYS/TEMP] too many failed logins, please try again later\r\n");
+	EXPECT_GE(std::chrono::steady_clock::now() - start, AuthFailureLimiter::BaseBackoff - std::chrono::milliseconds(1));
+}
@@ -0,0 +1,191 @@
+#include "PackedMailStorage.h"
+#include "TestDirectory.h"
+
+#include <gtest/gtest.h>
+
+namespace {
+	struct PackedMailStorageTest : testing::Test {
+		TestDirectory mailbox;
+
+		//compaction is started by the tests, not by the closing storage
+		std::shared_ptr<PackedMailStorage> open() const {
+			MailStorageInfo info(StorageType::PackedMailStorage);
+			info.addOption("path", mailbox.get().string());
+			info.addOption("compaction", 0u);
+			return PackedStorageFactory::create(info, "user");
+		}
+
+		std::uint64_t append(std::string_view message, PackedCompression compression = PackedCompression::None) const {
+			auto result = PackedStorageFactory::append(mailbox.get(), message, compression);
+			EXPECT_TRUE(std::holds_alternative<std::uint64_t>(result));
+			return std::holds_alternative<std::uint64_t>(result) ? std::get<std::uint64_t>(result) : 0;
+		}
+
+		std::uint64_t segmentSize(std::uint64_t generation) const {
+			std::error_code ec;
+			auto size = std::filesystem::file_size(PackedMailStorage::SegmentPath(mailbox.get(), generation), ec);
+			return ec ? 0 : size;
+		}
+
+		static std::string content(const PackedMailStorage& storage, std::size_t number) {
+			auto result = storage.getEmail(number);
+			return std::holds_alternative<std::string>(result) ? std::get<std::string>(result) : "<error>";
+		}
+
+		//read through the reader by small chunks, the way RETR sends a message
+		static std::string readByChunks(const PackedMailStorage& storage, std::size_t number, std::size_t chunk = 1000) {
+			auto opened = storage.openEmail(number);
+			if (!std::holds_alternative<message_reader_ptr>(opened)) {
+				return "<error>";
+			}
+			auto& reader = std::get<message_reader_ptr>(opened);
+			std::string content;
+			std::string buffer(chunk, '\0');
+			while (true) {
+				auto read = reader->read(&buffer[0], buffer.size());
+				if (!std::holds_alternative<std::size_t>(read)) {
+					return "<error>";
+				}
+				if (std::get<std::size_t>(read) == 0) {
+					return content;
+				}
+				content.append(buffer, 0, std::get<std::size_t>(read));
+			}
+		}
+	};
+}
+
+TEST_F(PackedMailStorageTest, AppendsAndReadsMessages) {
+	EXPECT_EQ(append("Subject: one\r\n\r\nfirst\r\n"), 1u);
+	//bare line feeds and a leading dot grow the message on the wire
+	EXPECT_EQ(append("Subject: two\n\n.second\n"), 2u);
+	EXPECT_EQ(append(""), 3u);
+
+	auto storage = open();
+	ASSERT_EQ(storage->getEmailsCount(), 3u);
+	EXPECT_EQ(content(*storage, 0), "Subject: one\r\n\r\nfirst\r\n");
+	EXPECT_EQ(content(*storage, 1), "Subject: two\n\n.second\n");
+	EXPECT_EQ(content(*storage, 2), "");
+	EXPECT_EQ(readByChunks(*storage, 1, 5), "Subject: two\n\n.second\n");
+	EXPECT_EQ(storage->getEmailLength(0), 23u);
+	//three carriage returns and a stuffed dot
+	EXPECT_EQ(storage->getEmailLength(1), 22u + 3 + 1);
+	auto lengths = storage->getEmailsLengths(1);
+	EXPECT_EQ(lengths, (email_lengths{ { 1, 23 }, { 2, 26 }, { 3, 0 } }));
+}
+
+TEST_F(PackedMailStorageTest, MarksDeletedMessagesAsTombstones) {
+	append("first\r\n");
+	append("second\r\n");
+	append("third\r\n");
+	{
+		auto storage = open();
+		storage->deleteEmail(1);
+		//without UPDATE state nothing is deleted
+	}
+	ASSERT_EQ(open()->getEmailsCount(), 3u);
+	{
+		auto storage = open();
+		storage->deleteEmail(1);
+		storage->setUpdateFlag();
+	}
+	auto storage = open();
+	ASSERT_EQ(storage->getEmailsCount(), 2u);
+	EXPECT_EQ(content(*storage, 0), "first\r\n");
+	EXPECT_EQ(content(*storage, 1), "third\r\n");
+	//the space stays in the segment until compaction
+	EXPECT_EQ(segmentSize(0), 22u);
+	EXPECT_EQ(append("fourth\r\n"), 4u);
+}
+
+TEST_F(PackedMailStorageTest, CompactsTombstones) {
+	append("first\r\n");
+	append("second\r\n");
+	append("third\r\n");
+	{
+		auto storage = open();
+		storage->deleteEmail(0);
+		storage->deleteEmail(2);
+		storage->setUpdateFlag();
+	}
+	{
+		//a session which opened the mailbox before compaction keeps reading the old segment
+		auto before = open();
+		ASSERT_TRUE(PackedStorageFactory::compact(mailbox.get()));
+		EXPECT_EQ(content(*before, 0), "second\r\n");
+	}
+	EXPECT_FALSE(std::filesystem::exists(PackedMailStorage::SegmentPath(mailbox.get(), 0)));
+	EXPECT_EQ(segmentSize(1), 8u);
+
+	//uids go on after compaction
+	EXPECT_EQ(append("fourth\r\n"), 4u);
+	auto storage = open();
+	ASSERT_EQ(storage->getEmailsCount(), 2u);
+	EXPECT_EQ(content(*storage, 0), "second\r\n");
+	EXPECT_EQ(content(*storage, 1), "fourth\r\n");
+	EXPECT_EQ(storage->getEmailLength(0), 8u);
+}
+
+TEST_F(PackedMailStorageTest, IgnoresTornIndexRecord) {
+	append("first\r\n");
+	append("second\r\n");
+	//a crash while the third record was written
+	{
+		std::ofstream index(mailbox.get() / PackedMailStorage::IndexFileName, std::ios::binary | std::ios::app);
+		index.write("\x10\x00\x00\x00\x00\x00", 6);
+	}
+	auto storage = open();
+	ASSERT_EQ(storage->getEmailsCount(), 2u);
+	EXPECT_EQ(content(*storage, 1), "second\r\n");
+	//the next append writes its record over the torn one
+	EXPECT_EQ(append("third\r\n"), 3u);
+	storage = open();
+	ASSERT_EQ(storage->getEmailsCount(), 3u);
+	EXPECT_EQ(content(*storage, 2), "third\r\n");
+}
+
+TEST_F(PackedMailStorageTest, RejectsForeignIndex) {
+	mailbox.write(PackedMailStorage::IndexFileName, std::string(sizeof(PackedIndexHeader), 'x'));
+	EXPECT_THROW(open(), std::runtime_error);
+	EXPECT_TRUE(std::holds_alternative<MailboxOperationError>(PackedStorageFactory::append(mailbox.get(), "first\r\n")));
+}
+
+namespace {
+	std::string compressibleMessage() {
+		std::string message = "Subject: large\r\n\r\n";
+		for (int i = 0; message.size() < 300 * 1024; i++) {
+			message.append("line ").append(std::to_string(i % 100)).append(" of a message which compresses well\r\n");
+		}
+		return message;
+	}
+}
+
+TEST_F(PackedMailStorageTest, ReadsCompressedMessageByChunks) {
+	auto message = compressibleMessage();
+	append(message, PackedCompression::Deflate);
+	if (segmentSize(0) >= message.size()) {
+		GTEST_SKIP() << "the build has no zlib";
+	}
+	//a short message gains nothing by compression and is stored as is
+	append("short\r\n", PackedCompression::Deflate);
+	auto compressed = segmentSize(0) - 7;
+
+	{
+		auto storage = open();
+		ASSERT_EQ(storage->getEmailsCount(), 2u);
+		EXPECT_EQ(storage->getEmailLength(0), message.size());
+		EXPECT_EQ(readByChunks(*storage, 0), message);
+		//chunks smaller than a line and than the inflater's output
+		EXPECT_EQ(readByChunks(*storage, 0, 7), message);
+		EXPECT_EQ(content(*storage, 0), message);
+		EXPECT_EQ(content(*storage, 1), "short\r\n");
+		storage->deleteEmail(1);
+		storage->setUpdateFlag();
+	}
+	//compaction moves the compressed octets as they are
+	ASSERT_TRUE(PackedStorageFactory::compact(mailbox.get()));
+	EXPECT_EQ(segmentSize(1), compressed);
+	auto storage = open();
+	ASSERT_EQ(storage->getEmailsCount(), 1u);
+	EXPECT_EQ(readByChunks(*storage, 0, 4096), message);
+}
@@ -0,0 +1,78 @@
+#include "PasswordVerifier.h"
+
+#include <gtest/gtest.h>
+
+TEST(Pbkdf2PasswordVerifier, VerifiesDerivedCredential) {
+	if (!Pbkdf2PasswordVerifier::IsSupported()) {
+		GTEST_SKIP() << "the build has no PBKDF2";
+	}
+	Pbkdf2PasswordVerifier verifier;
+	auto credential = Pbkdf2PasswordVerifier::MakeCredential("secret", 1000);
+	ASSERT_EQ(credential.substr(0, Pbkdf2PasswordVerifier::Prefix.size()), Pbkdf2PasswordVerifier::Prefix);
+	EXPECT_TRUE(verifier.verify("secret", credential));
+	EXPECT_FALSE(verifier.verify("Secret", credential));
+	EXPECT_FALSE(verifier.verify("", credential));
+	//salts are random, a password makes different credentials
+	EXPECT_NE(Pbkdf2PasswordVerifier::MakeCredential("secret", 1000), credential);
+}
+
+TEST(Pbkdf2PasswordVerifier, ComparesPlainCredential) {
+	Pbkdf2PasswordVerifier verifier;
+	EXPECT_TRUE(verifier.verify("secret", "secret"));
+	EXPECT_FALSE(verifier.verify("secret", "other"));
+}
+
+TEST(Pbkdf2PasswordVerifier, RejectsMalformedCredential) {
+	Pbkdf2PasswordVerifier verifier;
+	for (auto credential : { "pbkdf2-sha256$", "pbkdf2-sha256$0$00$00", "pbkdf2-sha256$x$00$00", "pbkdf2-sha256$10$0g$00",
+		"pbkdf2-sha256$10$00$", "pbkdf2-sha256$10$00$abc" }) {
+		EXPECT_FALSE(verifier.verify("", credential)) << credential;
+		EXPECT_FALSE(verifier.verify(credential, credential)) << credential;
+	}
+}
+
+TEST(VerificationCache, FindsInsertedVerification) {
+	VerificationCache cache;
+	EXPECT_FALSE(cache.contains("name", "secret", "credential"));
+	cache.insert("name", "secret", "credential");
+	EXPECT_TRUE(cache.contains("name", "secret", "credential"));
+	//a wrong password, a changed credential or another consumer misses
+	EXPECT_FALSE(cache.contains("name", "Secret", "credential"));
+	EXPECT_FALSE(cache.contains("name", "secret", "changed"));
+	EXPECT_FALSE(cache.contains("other", "secret", "credential"));
+}
+
+TEST(VerificationCache, KeepsBoundariesOfParts) {
+	VerificationCache cache;
+	cache.insert("ab", "c", "d");
+	EXPECT_FALSE(cache.contains("ab", "", "cd"));
+	cache.insert("name", "pass", "word");
+	EXPECT_FALSE(cache.contains("name", "passw", "ord"));
+	EXPECT_FALSE(cache.contains("name", "pass", "word2"));
+}
+
+TEST(VerificationCache, KeepsLatestVerificationOfConsumer) {
+	VerificationCache cache;
+	cache.insert("name", "old", "credential");
+	cache.insert("name", "new", "credential");
+	EXPECT_TRUE(cache.contains("name", "new", "credential"));
+	EXPECT_FALSE(cache.contains("name", "old", "credential"));
+}
+
+TEST(VerificationCache, DisabledByZeroTtl) {
+	VerificationCache cache;
+	cache.insert("name", "secret", "credential");
+	cache.setTtl(std::chrono::seconds::zero());
+	EXPECT_FALSE(cache.contains("name", "secret", "credential"));
+	cache.insert("name", "secret", "credential");
+	EXPECT_FALSE(cache.contains("name", "secret", "credential"));
+}
+
+TEST(VerificationCache, SeparateCachesDoNotShareDigests) {
+	//keys are random per cache, a digest of one is worth nothing to the other
+	VerificationCache first;
+	VerificationCache second;
+	first.insert("name", "secret", "credential");
+	EXPECT_TRUE(first.contains("name", "secret", "credential"));
+	EXPECT_FALSE(second.contains("name", "secret", "credential"));
+}
@@ -0,0 +1,83 @@
+#include "PrometheusFormat.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+
+namespace {
+	std::size_t add(MetricsRegistry::Snapshot& snapshot, std::string name, MetricType type, MetricLabels labels = {}) {
+		auto slot = snapshot.values.size();
+		snapshot.values.resize(slot + (type == MetricType::Histogram ? MetricsRegistry::HistogramSlots : 1));
+		snapshot.metrics.push_back({ std::move(name), "help text", type, std::move(labels), slot });
+		return slot;
+	}
+
+	void record(MetricsRegistry::Snapshot& snapshot, std::size_t slot, std::uint64_t value) {
+		snapshot.values[slot + MetricsRegistry::BucketIndex(value)]++;
+		snapshot.values[slot + MetricsRegistry::HistogramBuckets]++;
+		snapshot.values[slot + MetricsRegistry::HistogramBuckets + 1] += static_cast<std::int64_t>(value);
+	}
+}
+
+TEST(PrometheusFormat, WritesCountersAndGauges) {
+	MetricsRegistry::Snapshot snapshot;
+	snapshot.values[add(snapshot, "pop3_sessions", MetricType::Gauge)] = -2;
+	snapshot.values[add(snapshot, "pop3_commands_total", MetricType::Counter, { { "command", "STAT" }, { "result", "ok" } })] = 5;
+
+	EXPECT_EQ(formatPrometheus(snapshot),
+		"# HELP pop3_sessions help text\n"
+		"# TYPE pop3_sessions gauge\n"
+		"pop3_sessions -2\n"
+		"# HELP pop3_commands_total help text\n"
+		"# TYPE pop3_commands_total counter\n"
+		"pop3_commands_total{command=\"STAT\",result=\"ok\"} 5\n");
+}
+
+TEST(PrometheusFormat, EscapesLabelValues) {
+	MetricsRegistry::Snapshot snapshot;
+	snapshot.values[add(snapshot, "errors_total", MetricType::Counter, { { "text", "a\\b \"c\"\nd" } })] = 1;
+
+	EXPECT_NE(formatPrometheus(snapshot).find("errors_total{text=\"a\\\\b \\\"c\\\"\\nd\"} 1\n"), std::string::npos);
+}
+
+TEST(PrometheusFormat, GroupsFamilies) {
+	MetricsRegistry::Snapshot snapshot;
+	snapshot.values[add(snapshot, "logons_total", MetricType::Counter, { { "outcome", "logged_on" } })] = 1;
+	snapshot.values[add(snapshot, "sessions", MetricType::Gauge)] = 2;
+	snapshot.values[add(snapshot, "logons_total", MetricType::Counter, { { "outcome", "invalid_password" } })] = 3;
+
+	EXPECT_EQ(formatPrometheus(snapshot),
+		"# HELP logons_total help text\n"
+		"# TYPE logons_total counter\n"
+		"logons_total{outcome=\"logged_on\"} 1\n"
+		"logons_total{outcome=\"invalid_password\"} 3\n"
+		"# HELP sessions help text\n"
+		"# TYPE sessions gauge\n"
+		"sessions 2\n");
+}
+
+TEST(PrometheusFormat, WritesCumulativeHistogramBuckets) {
+	MetricsRegistry::Snapshot snapshot;
+	auto slot = add(snapshot, "latency_us", MetricType::Histogram, { { "operation", "retr" } });
+	record(snapshot, slot, 1);
+	record(snapshot, slot, 10);
+	record(snapshot, slot, 10);
+	//beyond the largest bound, only +Inf counts it
+	record(snapshot, slot, std::uint64_t{ 1 } << 40);
+
+	auto text = formatPrometheus(snapshot);
+	EXPECT_EQ(text.find("# HELP latency_us help text\n# TYPE latency_us histogram\n"), 0u);
+	//buckets are reported by powers of two, each counting the values up to its bound
+	EXPECT_NE(text.find("latency_us_bucket{operation=\"retr\",le=\"3\"} 1\n"
+		"latency_us_bucket{operation=\"retr\",le=\"7\"} 1\n"
+		"latency_us_bucket{operation=\"retr\",le=\"15\"} 3\n"
+		"latency_us_bucket{operation=\"retr\",le=\"31\"} 3\n"), std::string::npos) << text;
+	auto bound = std::to_string(MetricsRegistry::BucketUpperBound(MetricsRegistry::HistogramBuckets - 1 - MetricsRegistry::SubBuckets));
+	EXPECT_NE(text.find("latency_us_bucket{operation=\"retr\",le=\"" + bound + "\"} 3\n"
+		"latency_us_bucket{operation=\"retr\",le=\"+Inf\"} 4\n"
+		"latency_us_sum{operation=\"retr\"} " + std::to_string((std::uint64_t{ 1 } << 40) + 21) + "\n"
+		"latency_us_count{operation=\"retr\"} 4\n"), std::string::npos) << text;
+	//one line per power of two, then +Inf, sum and count
+	EXPECT_EQ(static_cast<std::size_t>(std::count(text.cbegin(), text.cend(), '\n')),
+		2 + MetricsRegistry::HistogramBuckets / MetricsRegistry::SubBuckets - 1 + 3);
+}
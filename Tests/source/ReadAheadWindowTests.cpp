@@ -0,0 +1,38 @@
+#include "MailStorage.h"
+
+#include <gtest/gtest.h>
+
+using Range = std::pair<std::size_t, std::size_t>;
+
+TEST(ReadAheadWindow, WaitsForSequentialAccess) {
+	ReadAheadWindow window;
+	EXPECT_EQ(window.access(0, 10), Range(0, 0));
+	EXPECT_EQ(window.access(1, 10), Range(2, 2 + ReadAheadWindow::Depth));
+}
+
+TEST(ReadAheadWindow, RequestsEveryEmailOnce) {
+	ReadAheadWindow window;
+	window.access(0, 10);
+	EXPECT_EQ(window.access(1, 10), Range(2, 6));
+	EXPECT_EQ(window.access(2, 10), Range(6, 7));
+	EXPECT_EQ(window.access(3, 10), Range(7, 8));
+	EXPECT_EQ(window.access(4, 10), Range(8, 9));
+	EXPECT_EQ(window.access(5, 10), Range(9, 10));
+	EXPECT_EQ(window.access(6, 10), Range(0, 0));
+	EXPECT_EQ(window.access(9, 10), Range(0, 0));
+}
+
+TEST(ReadAheadWindow, IgnoresRandomAccess) {
+	ReadAheadWindow window;
+	for (std::size_t emailNumber : { 5, 2, 7, 7, 6, 4 }) {
+		EXPECT_EQ(window.access(emailNumber, 10), Range(0, 0)) << emailNumber;
+	}
+	//a new run is picked up after a jump
+	EXPECT_EQ(window.access(5, 10), Range(6, 10));
+}
+
+TEST(ReadAheadWindow, StopsAtLastEmail) {
+	ReadAheadWindow window;
+	window.access(0, 2);
+	EXPECT_EQ(window.access(1, 2), Range(0, 0));
+}
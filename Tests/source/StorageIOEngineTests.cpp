@@ -0,0 +1,83 @@
+#include "StorageIOEngine.h"
+#include "TestDirectory.h"
+
+#include <gtest/gtest.h>
+
+namespace {
+	std::string contentOf(std::size_t size) {
+		std::string content;
+		content.reserve(size);
+		for (std::size_t i = 0; i < size; i++) {
+			content.push_back(static_cast<char>('a' + i % 26));
+		}
+		return content;
+	}
+
+	//small and large files, with and without the size, and a size hint which is out of date
+	void expectReads(StorageIOEngine& engine) {
+		TestDirectory directory;
+		auto small = contentOf(100);
+		auto large = contentOf(300 * 1024);
+		auto smallFile = directory.write("small", small);
+		auto largeFile = directory.write("large", large);
+
+		auto read = engine.readFile(smallFile, small.size());
+		ASSERT_TRUE(std::holds_alternative<std::string>(read));
+		EXPECT_EQ(std::get<std::string>(read), small);
+		read = engine.readFile(smallFile);
+		ASSERT_TRUE(std::holds_alternative<std::string>(read));
+		EXPECT_EQ(std::get<std::string>(read), small);
+		read = engine.readFile(largeFile);
+		ASSERT_TRUE(std::holds_alternative<std::string>(read));
+		EXPECT_EQ(std::get<std::string>(read), large);
+		read = engine.readFile(largeFile, 1000);
+		ASSERT_TRUE(std::holds_alternative<std::string>(read));
+		EXPECT_EQ(std::get<std::string>(read), large);
+		//the ring is reused by the following reads, a slot left open would fail them
+		for (int i = 0; i < 10; i++) {
+			read = engine.readFile(smallFile, small.size());
+			ASSERT_TRUE(std::holds_alternative<std::string>(read));
+			EXPECT_EQ(std::get<std::string>(read), small);
+		}
+
+		EXPECT_TRUE(std::holds_alternative<MailboxOperationError>(engine.readFile(directory.get() / "missing")));
+		read = engine.readFile(smallFile, small.size());
+		ASSERT_TRUE(std::holds_alternative<std::string>(read));
+		EXPECT_EQ(std::get<std::string>(read), small);
+	}
+}
+
+TEST(StorageIOEngine, SynchronousReadsFiles) {
+	expectReads(*StorageIOEngine::Create(StorageIOEngineType::Synchronous));
+}
+
+TEST(StorageIOEngine, ThreadPoolReadsFiles) {
+	expectReads(*StorageIOEngine::Create(StorageIOEngineType::ThreadPool, 2));
+}
+
+TEST(StorageIOEngine, IoUringReadsFiles) {
+	auto engine = StorageIOEngine::Create(StorageIOEngineType::IoUring, 2);
+	if (engine->type() != StorageIOEngineType::IoUring) {
+		GTEST_SKIP() << "io_uring is not compiled in or not supported by the kernel";
+	}
+	expectReads(*engine);
+}
+
+TEST(StorageIOEngine, StatsAndUnlinksBatches) {
+	TestDirectory directory;
+	for (auto type : { StorageIOEngineType::Synchronous, StorageIOEngineType::ThreadPool, StorageIOEngineType::IoUring }) {
+		auto engine = StorageIOEngine::Create(type, 2);
+		std::vector<std::filesystem::path> files{ directory.write("a", "12345"), directory.get() / "missing", directory.write("b", "") };
+		auto attributes = engine->statFiles(files);
+		ASSERT_EQ(attributes.size(), 3u);
+		ASSERT_TRUE(attributes[0]);
+		EXPECT_EQ(attributes[0]->size, 5u);
+		EXPECT_FALSE(attributes[1]);
+		ASSERT_TRUE(attributes[2]);
+		EXPECT_EQ(attributes[2]->size, 0u);
+
+		EXPECT_EQ(engine->unlinkFiles(files), 2u);
+		EXPECT_FALSE(std::filesystem::exists(files[0]));
+		EXPECT_FALSE(std::filesystem::exists(files[2]));
+	}
+}
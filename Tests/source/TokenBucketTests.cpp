@@ -0,0 +1,52 @@
+#include "TokenBucket.h"
+
+#include <gtest/gtest.h>
+
+using namespace std::chrono_literals;
+
+TEST(TokenBucket, ZeroRateDoesNotLimit) {
+	TokenBucket bucket;
+	auto now = TokenBucket::clock::now();
+	EXPECT_FALSE(bucket.limited());
+	EXPECT_EQ(bucket.take(1000, now), TokenBucket::clock::duration::zero());
+	EXPECT_EQ(bucket.charge(1000000, now), TokenBucket::clock::duration::zero());
+}
+
+TEST(TokenBucket, TakesUpToBurstAtOnce) {
+	TokenBucket bucket(10, 3);
+	auto now = TokenBucket::clock::now();
+	EXPECT_TRUE(bucket.limited());
+	for (int i = 0; i < 3; i++) {
+		EXPECT_EQ(bucket.take(1, now), TokenBucket::clock::duration::zero()) << i;
+	}
+	//the fourth take runs into debt, the fifth waits until it is paid off
+	EXPECT_EQ(bucket.take(1, now), TokenBucket::clock::duration::zero());
+	auto wait = bucket.take(1, now);
+	EXPECT_GT(wait, 100ms);
+	EXPECT_LE(wait, 101ms);
+}
+
+TEST(TokenBucket, RefillsAtRate) {
+	TokenBucket bucket(100, 1);
+	auto start = TokenBucket::clock::now();
+	EXPECT_EQ(bucket.charge(11, start), std::chrono::duration_cast<TokenBucket::clock::duration>(100ms) + 1ms);
+	EXPECT_NE(bucket.take(1, start + 50ms), TokenBucket::clock::duration::zero());
+	EXPECT_EQ(bucket.take(1, start + 101ms), TokenBucket::clock::duration::zero());
+}
+
+TEST(TokenBucket, DoesNotSaveMoreThanBurst) {
+	TokenBucket bucket(1000, 5);
+	auto start = TokenBucket::clock::now();
+	//a long pause refills only the burst
+	EXPECT_EQ(bucket.charge(5, start + 1h), TokenBucket::clock::duration::zero());
+	EXPECT_GT(bucket.charge(1, start + 1h), TokenBucket::clock::duration::zero());
+}
+
+TEST(TokenBucket, IgnoresEarlierTime) {
+	TokenBucket bucket(10, 1);
+	auto now = TokenBucket::clock::now();
+	EXPECT_EQ(bucket.take(1, now), TokenBucket::clock::duration::zero());
+	//a caller which read the clock before the previous one does not find the bucket in debt
+	EXPECT_EQ(bucket.charge(0, now - 1s), TokenBucket::clock::duration::zero());
+	EXPECT_EQ(bucket.take(1, now + 100ms), TokenBucket::clock::duration::zero());
+}
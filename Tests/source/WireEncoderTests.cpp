@@ -0,0 +1,80 @@
+#include "WireEncoder.h"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+
+namespace {
+	std::string encodeByParts(std::string_view message, std::size_t partSize) {
+		WireEncoder encoder;
+		std::string out;
+		for (std::size_t position = 0; position < message.size(); position += partSize) {
+			auto part = message.substr(position, partSize);
+			encoder.encode(part.data(), part.size(), out);
+		}
+		encoder.finish(out);
+		return out;
+	}
+
+	std::string readAll(MessageReader& reader, std::size_t bufferSize) {
+		std::string out;
+		std::string buffer(bufferSize, '\0');
+		for (;;) {
+			auto result = reader.read(&buffer[0], buffer.size());
+			auto count = std::get<std::size_t>(result);
+			if (count == 0) {
+				return out;
+			}
+			out.append(buffer, 0, count);
+		}
+	}
+}
+
+TEST(WireEncoder, KeepsMessageInWireForm) {
+	EXPECT_EQ(encodeByParts("Subject: x\r\n\r\nbody\r\n", 1024), "Subject: x\r\n\r\nbody\r\n");
+}
+
+TEST(WireEncoder, ConvertsBareLineFeeds) {
+	EXPECT_EQ(encodeByParts("a\nb\r\nc\n", 1024), "a\r\nb\r\nc\r\n");
+}
+
+TEST(WireEncoder, StuffsLinesBeginningWithDot) {
+	EXPECT_EQ(encodeByParts(".a\r\n..b\r\nc.\r\n.\r\n", 1024), "..a\r\n...b\r\nc.\r\n..\r\n");
+}
+
+TEST(WireEncoder, EndsMessageWithLineBreak) {
+	EXPECT_EQ(encodeByParts("no line break", 1024), "no line break\r\n");
+	EXPECT_EQ(encodeByParts("", 1024), "");
+}
+
+TEST(WireEncoder, KeepsStateBetweenParts) {
+	std::string message = "a\r\n.b\nc\r\n\n.\r.d\r\n";
+	auto expected = encodeByParts(message, message.size());
+	EXPECT_EQ(expected, "a\r\n..b\r\nc\r\n\r\n..\r.d\r\n");
+	for (std::size_t partSize = 1; partSize < message.size(); partSize++) {
+		EXPECT_EQ(encodeByParts(message, partSize), expected) << "parts of " << partSize;
+	}
+}
+
+TEST(WireEncoder, FindsLineFeedsInLongLines) {
+	//long enough for the vectorized search to see every position of the line feed
+	for (std::size_t length = 0; length < 80; length++) {
+		std::string line(length, 'x');
+		EXPECT_EQ(encodeByParts(line + "\n." + line, 1024), line + "\r\n.." + line + "\r\n") << "line of " << length;
+	}
+}
+
+TEST(WireEncoder, MeasuresWireSize) {
+	for (std::string message : { "", "a", "a\nb", ".\n.\r\n", "x\r\n.y\nz" }) {
+		EXPECT_EQ(WireEncoder::WireSize(message), encodeByParts(message, 1024).size()) << message;
+	}
+}
+
+TEST(WireMessageReader, ReturnsWireFormBySmallBuffers) {
+	std::string message = ".a\nb\r\n" + std::string(1000, 'c') + "\n.";
+	auto expected = encodeByParts(message, message.size());
+	for (std::size_t bufferSize : { 1, 2, 7, 4096 }) {
+		WireMessageReader reader(std::make_unique<BufferMessageReader>(std::make_shared<const std::string>(message)));
+		EXPECT_EQ(readAll(reader, bufferSize), expected) << "buffer of " << bufferSize;
+	}
+}